@@ -0,0 +1,205 @@
+// Benchmark of SimpleSetup based scenes.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+// Renders a synthetic scene offscreen for a fixed number of frames
+// along a scripted camera path and writes the startup time and the
+// frame profiler statistics as CSV to stdout.
+//
+// usage: SetupHelpers_Benchmark [small|huge|textures|lights] [frames]
+//
+// Each run benchmarks a single scene, so runs do not share driver or
+// resource manager state.
+
+#include <Utils/SimpleSetup.h>
+#include <Utils/FrameProfiler.h>
+
+#include <Core/IListener.h>
+#include <Display/Camera.h>
+#include <Display/OffscreenEnvironment.h>
+#include <Geometry/Face.h>
+#include <Geometry/FaceSet.h>
+#include <Geometry/Material.h>
+#include <Math/Vector.h>
+#include <Resources/EmptyTextureResource.h>
+#include <Scene/DirectionalLightNode.h>
+#include <Scene/GeometryNode.h>
+#include <Scene/PointLightNode.h>
+#include <Scene/SceneNode.h>
+#include <Scene/TransformationNode.h>
+#include <Utils/Timer.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+using namespace OpenEngine;
+using namespace OpenEngine::Core;
+using namespace OpenEngine::Display;
+using namespace OpenEngine::Geometry;
+using namespace OpenEngine::Math;
+using namespace OpenEngine::Resources;
+using namespace OpenEngine::Scene;
+using namespace OpenEngine::Utils;
+
+// side length of the area the scenes are spread over
+static const float AREA = 200.0f;
+
+// Add a grid of n by n quads of the given size centered at origin.
+static void AddGrid(FaceSet* faces, unsigned int n, float size,
+                    MaterialPtr mat) {
+    float step = size / n;
+    float o = -size * 0.5f;
+    Vector<3,float> up(0,1,0);
+    for (unsigned int i = 0; i < n; ++i)
+        for (unsigned int j = 0; j < n; ++j) {
+            Vector<3,float> a(o + i*step,     0, o + j*step);
+            Vector<3,float> b(o + (i+1)*step, 0, o + j*step);
+            Vector<3,float> c(o + (i+1)*step, 0, o + (j+1)*step);
+            Vector<3,float> d(o + i*step,     0, o + (j+1)*step);
+            FacePtr f1(new Face(a, c, b, up, up, up));
+            FacePtr f2(new Face(a, d, c, up, up, up));
+            f1->mat = f2->mat = mat;
+            faces->Add(f1);
+            faces->Add(f2);
+        }
+}
+
+static MaterialPtr CreateMaterial(float r, float g, float b) {
+    MaterialPtr mat(new Material());
+    mat->diffuse = Vector<4,float>(r, g, b, 1.0f);
+    return mat;
+}
+
+static TransformationNode* Place(ISceneNode* root, float x, float z) {
+    TransformationNode* t = new TransformationNode();
+    t->SetPosition(Vector<3,float>(x, 0, z));
+    root->AddNode(t);
+    return t;
+}
+
+// 10000 small meshes of 2 faces each.
+static void BuildSmall(ISceneNode* root) {
+    MaterialPtr mat = CreateMaterial(0.8f, 0.8f, 0.8f);
+    const unsigned int n = 100;
+    for (unsigned int i = 0; i < n; ++i)
+        for (unsigned int j = 0; j < n; ++j) {
+            FaceSet* faces = new FaceSet();
+            AddGrid(faces, 1, 1.0f, mat);
+            Place(root, (i * AREA) / n - AREA*0.5f, (j * AREA) / n - AREA*0.5f)
+                ->AddNode(new GeometryNode(faces));
+        }
+}
+
+// 4 meshes of 125000 faces each.
+static void BuildHuge(ISceneNode* root) {
+    MaterialPtr mat = CreateMaterial(0.6f, 0.7f, 0.8f);
+    for (unsigned int i = 0; i < 4; ++i) {
+        FaceSet* faces = new FaceSet();
+        AddGrid(faces, 250, AREA * 0.5f, mat);
+        Place(root, (i % 2) * AREA*0.5f - AREA*0.25f, (i / 2) * AREA*0.5f - AREA*0.25f)
+            ->AddNode(new GeometryNode(faces));
+    }
+}
+
+// 1024 quads each with its own 128x128 texture.
+static void BuildTextures(ISceneNode* root) {
+    const unsigned int n = 32;
+    for (unsigned int i = 0; i < n; ++i)
+        for (unsigned int j = 0; j < n; ++j) {
+            MaterialPtr mat = CreateMaterial(1, 1, 1);
+            mat->texr = EmptyTextureResource::Create(128, 128, 32);
+            FaceSet* faces = new FaceSet();
+            AddGrid(faces, 1, AREA / n, mat);
+            Place(root, (i * AREA) / n - AREA*0.5f, (j * AREA) / n - AREA*0.5f)
+                ->AddNode(new GeometryNode(faces));
+        }
+}
+
+// A ground mesh lit by 64 point lights.
+static void BuildLights(ISceneNode* root) {
+    FaceSet* faces = new FaceSet();
+    AddGrid(faces, 100, AREA, CreateMaterial(0.8f, 0.8f, 0.8f));
+    root->AddNode(new GeometryNode(faces));
+    const unsigned int n = 8;
+    for (unsigned int i = 0; i < n; ++i)
+        for (unsigned int j = 0; j < n; ++j) {
+            TransformationNode* t =
+                Place(root, (i * AREA) / n - AREA*0.5f, (j * AREA) / n - AREA*0.5f);
+            t->Move(0, 5, 0);
+            t->AddNode(new PointLightNode());
+        }
+}
+
+// Moves the camera around the scene with a fixed step per frame so
+// every run renders the same frames.
+class CameraScript : public IListener<ProcessEventArg> {
+    Camera& camera;
+    unsigned int frame;
+public:
+    CameraScript(Camera& camera) : camera(camera), frame(0) {}
+    void Handle(ProcessEventArg arg) {
+        float a = frame++ * 0.01f;
+        camera.SetPosition(Vector<3,float>(std::cos(a) * AREA * 0.6f,
+                                           40.0f,
+                                           std::sin(a) * AREA * 0.6f));
+        camera.LookAt(Vector<3,float>(0, 0, 0));
+    }
+};
+
+// Records the time from program start until the first frame is done.
+class FirstFrame : public IListener<ProcessEventArg> {
+    Timer& timer;
+public:
+    unsigned int startup;
+    FirstFrame(Timer& timer) : timer(timer), startup(0) {}
+    void Handle(ProcessEventArg arg) {
+        if (startup == 0) startup = timer.GetElapsedTime().AsInt();
+    }
+};
+
+int main(int argc, char** argv) {
+    Timer timer;
+    timer.Start();
+
+    std::string name = (argc > 1) ? argv[1] : "small";
+    unsigned int frames = (argc > 2) ? std::atoi(argv[2]) : 300;
+
+    OffscreenEnvironment* env = new OffscreenEnvironment(1024, 768);
+    SimpleSetup setup("SetupHelpers benchmark", env);
+    setup.GetProfiler().Enable(true);
+
+    SceneNode* scene = new SceneNode();
+    scene->AddNode(new DirectionalLightNode());
+    if      (name == "small")    BuildSmall(scene);
+    else if (name == "huge")     BuildHuge(scene);
+    else if (name == "textures") BuildTextures(scene);
+    else if (name == "lights")   BuildLights(scene);
+    else {
+        std::cerr << "unknown scene: " << name << std::endl
+                  << "usage: " << argv[0]
+                  << " [small|huge|textures|lights] [frames]" << std::endl;
+        return 1;
+    }
+    setup.SetScene(*scene);
+
+    setup.GetEngine().ProcessEvent()
+        .Attach(*(new CameraScript(*setup.GetCamera())));
+    FirstFrame first(timer);
+    setup.GetEngine().ProcessEvent().Attach(first);
+    env->GetOffscreenFrame().StopAfter(frames, setup.GetEngine());
+
+    setup.GetEngine().Start();
+
+    std::cout << "scene," << name << std::endl
+              << "frames," << env->GetOffscreenFrame().GetFrameCount() << std::endl
+              << "startup_us," << first.startup << std::endl;
+    setup.GetProfiler().WriteCSV(std::cout);
+    return 0;
+}
@@ -0,0 +1,121 @@
+// Arena allocator.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Core/Arena.h>
+
+#include <cstddef>
+
+namespace OpenEngine {
+namespace Core {
+
+// allocations are aligned for any fundamental type, the blocks
+// themselves come from operator new which guarantees as much
+static const unsigned int ALIGNMENT = 16;
+
+/**
+ * Create an arena.
+ * No memory is allocated until the first allocation.
+ *
+ * @param blockSize Size of the blocks in bytes, larger allocations
+ *                  get a block of their own.
+ */
+Arena::Arena(unsigned int blockSize)
+    : blockSize(blockSize)
+    , current(0)
+    , finalizers(NULL) {}
+
+/**
+ * Destroy the arena.
+ * The objects of the arena are destroyed newest first.
+ */
+Arena::~Arena() {
+    Finalize();
+    for (unsigned int i = 0; i < blocks.size(); ++i)
+        delete[] blocks[i].data;
+}
+
+/**
+ * Allocate memory in the arena.
+ * The memory is valid until the arena is reset or destroyed.
+ *
+ * @param size Bytes to allocate.
+ * @return Memory aligned for any fundamental type.
+ */
+void* Arena::Allocate(unsigned int size) {
+    size = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    while (current < blocks.size() &&
+           blocks[current].used + size > blocks[current].size)
+        current++;
+    if (current == blocks.size())
+        AddBlock(size > blockSize ? size : blockSize);
+    Block& b = blocks[current];
+    void* p = b.data + b.used;
+    b.used += size;
+    return p;
+}
+
+/**
+ * Release all memory of the arena at once.
+ * The objects of the arena are destroyed newest first. If the
+ * allocations did not fit in one block the blocks are merged into
+ * one, so an arena reset with allocations of the same size, like
+ * once per frame, stops allocating after a few resets.
+ */
+void Arena::Reset() {
+    Finalize();
+    if (blocks.size() > 1) {
+        unsigned int size = GetCapacity();
+        for (unsigned int i = 0; i < blocks.size(); ++i)
+            delete[] blocks[i].data;
+        blocks.clear();
+        AddBlock(size);
+    }
+    for (unsigned int i = 0; i < blocks.size(); ++i)
+        blocks[i].used = 0;
+    current = 0;
+}
+
+/**
+ * Bytes allocated since the last reset, including alignment.
+ */
+unsigned int Arena::GetUsed() const {
+    unsigned int used = 0;
+    for (unsigned int i = 0; i < blocks.size(); ++i)
+        used += blocks[i].used;
+    return used;
+}
+
+/**
+ * Bytes held by the arena.
+ */
+unsigned int Arena::GetCapacity() const {
+    unsigned int size = 0;
+    for (unsigned int i = 0; i < blocks.size(); ++i)
+        size += blocks[i].size;
+    return size;
+}
+
+void Arena::Finalize() {
+    while (finalizers != NULL) {
+        Finalizer* f = finalizers;
+        finalizers = f->next;
+        f->destroy(f->object);
+    }
+}
+
+void Arena::AddBlock(unsigned int size) {
+    Block b;
+    b.data = new char[size];
+    b.size = size;
+    b.used = 0;
+    blocks.push_back(b);
+}
+
+} // NS Core
+} // NS OpenEngine
@@ -0,0 +1,107 @@
+// Arena allocator.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OE_ARENA_H_
+#define _OE_ARENA_H_
+
+#include <new>
+#include <vector>
+
+namespace OpenEngine {
+namespace Core {
+
+/**
+ * Arena allocator.
+ *
+ * Memory is handed out linearly from large blocks and is never freed
+ * one allocation at a time. Reset() releases everything at once,
+ * keeping the blocks for reuse, so an arena reset every frame gives
+ * transient per-frame data allocation free of the heap once it has
+ * grown to the size of a frame.
+ *
+ * Objects created with New() are placed in the arena and destroyed,
+ * newest first, when the arena is reset or destroyed. They must not
+ * be deleted. Objects created together are placed next to each other
+ * in memory.
+ *
+ * The arena is not thread safe.
+ *
+ * @code
+ * Arena arena;
+ * QuitHandler* quit = arena.New<QuitHandler>(engine);
+ * float* scratch = (float*)arena.Allocate(16 * sizeof(float));
+ * ...
+ * arena.Reset(); // destroys quit, releases scratch
+ * @endcode
+ */
+class Arena {
+public:
+    Arena(unsigned int blockSize = 64 * 1024);
+    virtual ~Arena();
+
+    void* Allocate(unsigned int size);
+    void Reset();
+
+    unsigned int GetUsed() const;
+    unsigned int GetCapacity() const;
+
+    template <class T> T* New() {
+        return Own(new (Allocate(sizeof(T))) T());
+    }
+    template <class T, class A> T* New(A& a) {
+        return Own(new (Allocate(sizeof(T))) T(a));
+    }
+    template <class T, class A, class B> T* New(A& a, B& b) {
+        return Own(new (Allocate(sizeof(T))) T(a, b));
+    }
+    template <class T, class A, class B, class C> T* New(A& a, B& b, C& c) {
+        return Own(new (Allocate(sizeof(T))) T(a, b, c));
+    }
+    template <class T, class A, class B, class C, class D>
+    T* New(A& a, B& b, C& c, D& d) {
+        return Own(new (Allocate(sizeof(T))) T(a, b, c, d));
+    }
+
+private:
+    struct Block {
+        char* data;
+        unsigned int size;
+        unsigned int used;
+    };
+    struct Finalizer {
+        void (*destroy)(void*);
+        void* object;
+        Finalizer* next;
+    };
+
+    unsigned int blockSize;
+    std::vector<Block> blocks;
+    unsigned int current;
+    Finalizer* finalizers;
+
+    template <class T> static void Destroy(void* object) {
+        static_cast<T*>(object)->~T();
+    }
+    template <class T> T* Own(T* object) {
+        Finalizer* f = new (Allocate(sizeof(Finalizer))) Finalizer();
+        f->destroy = &Destroy<T>;
+        f->object = object;
+        f->next = finalizers;
+        finalizers = f;
+        return object;
+    }
+
+    void Finalize();
+    void AddBlock(unsigned int size);
+};
+
+} // NS Core
+} // NS OpenEngine
+
+#endif // _OE_ARENA_H_
@@ -0,0 +1,97 @@
+// Parallel process modules with dependencies.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Core/ProcessGraph.h>
+
+#include <Core/Exceptions.h>
+
+namespace OpenEngine {
+namespace Core {
+
+class ProcessGraph::ModuleTask : public ITask {
+    ProcessGraph& graph;
+    unsigned int index;
+public:
+    ModuleTask(ProcessGraph& graph, unsigned int index)
+        : graph(graph), index(index) {}
+    void Run() {
+        graph.nodes[index].module->Handle(*graph.current);
+        graph.Done(index);
+    }
+};
+
+ProcessGraph::ProcessGraph(TaskScheduler& scheduler)
+    : scheduler(scheduler)
+    , current(NULL) {}
+
+ProcessGraph::~ProcessGraph() {
+    for (unsigned int i = 0; i < nodes.size(); ++i)
+        delete nodes[i].task;
+}
+
+/**
+ * Add a module to the graph.
+ *
+ * @param module Module to run on each process event.
+ * @return Index of the module, used to declare dependencies.
+ */
+unsigned int ProcessGraph::Add(IListener<ProcessEventArg>& module) {
+    Node node;
+    node.module = &module;
+    node.task = new ModuleTask(*this, nodes.size());
+    node.dependencies = 0;
+    node.remaining = 0;
+    nodes.push_back(node);
+    return nodes.size() - 1;
+}
+
+/**
+ * Make a module wait for another module.
+ *
+ * @param module Index of the waiting module.
+ * @param dependency Index of a module added before it.
+ */
+void ProcessGraph::AddDependency(unsigned int module, unsigned int dependency) {
+    if (module >= nodes.size() || dependency >= module)
+        throw Exception("ProcessGraph: a module may only depend on "
+                        "modules added before it.");
+    nodes[dependency].dependents.push_back(module);
+    nodes[module].dependencies++;
+}
+
+/**
+ * Run all modules and wait for them to finish.
+ */
+void ProcessGraph::Handle(ProcessEventArg arg) {
+    current = &arg;
+    lock.Lock();
+    for (unsigned int i = 0; i < nodes.size(); ++i)
+        nodes[i].remaining = nodes[i].dependencies;
+    lock.Unlock();
+    for (unsigned int i = 0; i < nodes.size(); ++i)
+        if (nodes[i].dependencies == 0)
+            scheduler.Submit(nodes[i].task, &group);
+    scheduler.Wait(group);
+    current = NULL;
+}
+
+void ProcessGraph::Done(unsigned int index) {
+    std::vector<unsigned int> ready;
+    lock.Lock();
+    std::vector<unsigned int>& dependents = nodes[index].dependents;
+    for (unsigned int i = 0; i < dependents.size(); ++i)
+        if (--nodes[dependents[i]].remaining == 0)
+            ready.push_back(dependents[i]);
+    lock.Unlock();
+    for (unsigned int i = 0; i < ready.size(); ++i)
+        scheduler.Submit(nodes[ready[i]].task, &group);
+}
+
+} // NS Core
+} // NS OpenEngine
@@ -0,0 +1,76 @@
+// Parallel process modules with dependencies.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OE_PROCESS_GRAPH_H_
+#define _OE_PROCESS_GRAPH_H_
+
+#include <Core/IEngine.h>
+#include <Core/IListener.h>
+#include <Core/Mutex.h>
+#include <Core/TaskScheduler.h>
+
+#include <vector>
+
+namespace OpenEngine {
+namespace Core {
+
+/**
+ * Parallel process modules with dependencies.
+ *
+ * Modules added to the graph are run on a task scheduler each time
+ * the graph handles a process event. A module starts when all the
+ * modules it depends on have finished, so modules without a path
+ * between them run in parallel. The graph returns when all modules
+ * are done.
+ *
+ * A module may only depend on modules added before it, which keeps
+ * the graph free of cycles.
+ *
+ * @code
+ * ProcessGraph& graph = setup.GetProcessGraph();
+ * unsigned int physics = graph.Add(physicsModule);
+ * unsigned int ai = graph.Add(aiModule);
+ * unsigned int anim = graph.Add(animationModule);
+ * graph.AddDependency(anim, physics);
+ * @endcode
+ */
+class ProcessGraph : public IListener<ProcessEventArg> {
+public:
+    ProcessGraph(TaskScheduler& scheduler);
+    virtual ~ProcessGraph();
+
+    unsigned int Add(IListener<ProcessEventArg>& module);
+    void AddDependency(unsigned int module, unsigned int dependency);
+
+    void Handle(ProcessEventArg arg);
+
+private:
+    class ModuleTask;
+
+    struct Node {
+        IListener<ProcessEventArg>* module;
+        ModuleTask* task;
+        std::vector<unsigned int> dependents;
+        unsigned int dependencies;
+        unsigned int remaining;   // guarded by the lock
+    };
+
+    TaskScheduler& scheduler;
+    std::vector<Node> nodes;
+    TaskGroup group;
+    Mutex lock;
+    ProcessEventArg* current;
+
+    void Done(unsigned int index);
+};
+
+} // NS Core
+} // NS OpenEngine
+
+#endif // _OE_PROCESS_GRAPH_H_
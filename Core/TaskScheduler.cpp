@@ -0,0 +1,236 @@
+// Work stealing task scheduler.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Core/TaskScheduler.h>
+
+#include <Core/Thread.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace OpenEngine {
+namespace Core {
+
+// idle workers sleep between these bounds, in microseconds
+static const unsigned int MIN_BACKOFF = 50;
+static const unsigned int MAX_BACKOFF = 2000;
+
+class TaskScheduler::Worker : public Thread {
+    TaskScheduler& owner;
+    unsigned int index;
+public:
+    Worker(TaskScheduler& owner, unsigned int index)
+        : owner(owner), index(index) {}
+    void Run() { owner.WorkerLoop(index); }
+};
+
+TaskGroup::TaskGroup() : pending(0) {}
+
+/**
+ * Number of tasks of the group not yet finished.
+ */
+unsigned int TaskGroup::GetPendingCount() {
+    lock.Lock();
+    unsigned int p = pending;
+    lock.Unlock();
+    return p;
+}
+
+/**
+ * Create a scheduler and start its workers.
+ *
+ * @param workers Number of worker threads, zero for one per
+ *                processor.
+ */
+TaskScheduler::TaskScheduler(unsigned int workers)
+    : running(true)
+    , next(0) {
+    if (workers == 0) workers = GetProcessorCount();
+    for (unsigned int i = 0; i < workers; ++i)
+        queues.push_back(new Queue());
+    for (unsigned int i = 0; i < workers; ++i) {
+        this->workers.push_back(new Worker(*this, i));
+        this->workers.back()->Start();
+    }
+}
+
+/**
+ * Destroy the scheduler.
+ * The workers finish all submitted tasks before they exit.
+ */
+TaskScheduler::~TaskScheduler() {
+    lock.Lock();
+    running = false;
+    lock.Unlock();
+    for (unsigned int i = 0; i < workers.size(); ++i) {
+        workers[i]->Wait();
+        delete workers[i];
+    }
+    for (unsigned int i = 0; i < queues.size(); ++i)
+        delete queues[i];
+}
+
+/**
+ * Submit a task.
+ * The task must stay alive until it has run.
+ *
+ * @param task Task to run.
+ * @param group Group to count the task in, may be NULL.
+ */
+void TaskScheduler::Submit(ITask* task, TaskGroup* group) {
+    if (group != NULL) {
+        group->lock.Lock();
+        group->pending++;
+        group->lock.Unlock();
+    }
+    Item item;
+    item.task = task;
+    item.group = group;
+    lock.Lock();
+    Queue* q = queues[next];
+    next = (next + 1) % queues.size();
+    lock.Unlock();
+    q->lock.Lock();
+    q->items.push_back(item);
+    q->lock.Unlock();
+}
+
+/**
+ * Wait for all tasks of a group.
+ * Pending tasks of the group are run on the calling thread while
+ * waiting, tasks of other groups are left to the workers.
+ *
+ * @param group Group to wait for.
+ */
+void TaskScheduler::Wait(TaskGroup& group) {
+    unsigned int backoff = MIN_BACKOFF;
+    while (group.GetPendingCount() > 0) {
+        Item item;
+        if (TakeGroup(group, item)) {
+            Execute(item);
+            backoff = MIN_BACKOFF;
+            continue;
+        }
+        Thread::Sleep(backoff);
+        if (backoff < MAX_BACKOFF) backoff *= 2;
+    }
+}
+
+/**
+ * Run a single pending task on the calling thread.
+ *
+ * @return True if a task was run.
+ */
+bool TaskScheduler::RunPending() {
+    Item item;
+    if (!Take(queues.size(), item)) return false;
+    Execute(item);
+    return true;
+}
+
+unsigned int TaskScheduler::GetWorkerCount() const {
+    return workers.size();
+}
+
+/**
+ * Number of processors available, at least one.
+ */
+unsigned int TaskScheduler::GetProcessorCount() {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    long n = info.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return (n < 1) ? 1 : n;
+}
+
+bool TaskScheduler::IsRunning() {
+    lock.Lock();
+    bool r = running;
+    lock.Unlock();
+    return r;
+}
+
+// Take the newest task of the own queue or steal the oldest task of
+// another queue. Threads outside the pool have no queue of their own.
+bool TaskScheduler::Take(unsigned int self, Item& item) {
+    if (self < queues.size()) {
+        Queue* q = queues[self];
+        q->lock.Lock();
+        if (!q->items.empty()) {
+            item = q->items.back();
+            q->items.pop_back();
+            q->lock.Unlock();
+            return true;
+        }
+        q->lock.Unlock();
+    }
+    for (unsigned int i = 1; i <= queues.size(); ++i) {
+        Queue* q = queues[(self + i) % queues.size()];
+        q->lock.Lock();
+        if (!q->items.empty()) {
+            item = q->items.front();
+            q->items.pop_front();
+            q->lock.Unlock();
+            return true;
+        }
+        q->lock.Unlock();
+    }
+    return false;
+}
+
+// Take the oldest pending task of a group from any queue.
+bool TaskScheduler::TakeGroup(TaskGroup& group, Item& item) {
+    for (unsigned int i = 0; i < queues.size(); ++i) {
+        Queue* q = queues[i];
+        q->lock.Lock();
+        for (std::deque<Item>::iterator itr = q->items.begin();
+             itr != q->items.end(); ++itr)
+            if (itr->group == &group) {
+                item = *itr;
+                q->items.erase(itr);
+                q->lock.Unlock();
+                return true;
+            }
+        q->lock.Unlock();
+    }
+    return false;
+}
+
+void TaskScheduler::Execute(Item& item) {
+    item.task->Run();
+    if (item.group != NULL) {
+        item.group->lock.Lock();
+        item.group->pending--;
+        item.group->lock.Unlock();
+    }
+}
+
+void TaskScheduler::WorkerLoop(unsigned int self) {
+    unsigned int backoff = MIN_BACKOFF;
+    for (;;) {
+        Item item;
+        if (Take(self, item)) {
+            Execute(item);
+            backoff = MIN_BACKOFF;
+            continue;
+        }
+        if (!IsRunning()) return;
+        Thread::Sleep(backoff);
+        if (backoff < MAX_BACKOFF) backoff *= 2;
+    }
+}
+
+} // NS Core
+} // NS OpenEngine
@@ -0,0 +1,110 @@
+// Work stealing task scheduler.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OE_TASK_SCHEDULER_H_
+#define _OE_TASK_SCHEDULER_H_
+
+#include <Core/Mutex.h>
+
+#include <deque>
+#include <vector>
+
+namespace OpenEngine {
+namespace Core {
+
+/**
+ * Unit of work run by the task scheduler.
+ * Tasks must not throw. A task may delete itself at the end of
+ * Run(), the scheduler does not touch it afterwards.
+ */
+class ITask {
+public:
+    virtual ~ITask() {}
+    virtual void Run() = 0;
+};
+
+/**
+ * Set of submitted tasks that can be waited for.
+ */
+class TaskGroup {
+public:
+    TaskGroup();
+    unsigned int GetPendingCount();
+private:
+    friend class TaskScheduler;
+    Mutex lock;
+    unsigned int pending;
+};
+
+/**
+ * Work stealing task scheduler.
+ *
+ * Runs tasks on a fixed pool of worker threads, by default one per
+ * processor. Every worker has its own queue. Submitted tasks are
+ * spread over the queues, a worker runs the newest task of its own
+ * queue first and steals the oldest task of another queue when its
+ * own is empty. Idle workers back off with increasing sleeps.
+ *
+ * Waiting for a task group runs pending tasks of the group on the
+ * waiting thread until the group is done, so a task may submit and
+ * wait for other tasks without dead locking the pool, and a waiting
+ * thread is not held up by long tasks of other groups.
+ *
+ * @code
+ * class Decode : public ITask { ... };
+ * TaskGroup group;
+ * for (unsigned int i = 0; i < n; ++i)
+ *     scheduler.Submit(&tasks[i], &group);
+ * scheduler.Wait(group);
+ * @endcode
+ */
+class TaskScheduler {
+public:
+    TaskScheduler(unsigned int workers = 0);
+    virtual ~TaskScheduler();
+
+    void Submit(ITask* task, TaskGroup* group = NULL);
+    void Wait(TaskGroup& group);
+    bool RunPending();
+
+    unsigned int GetWorkerCount() const;
+    static unsigned int GetProcessorCount();
+
+private:
+    class Worker;
+
+    struct Item {
+        ITask* task;
+        TaskGroup* group;
+    };
+
+    struct Queue {
+        Mutex lock;
+        std::deque<Item> items;
+    };
+
+    std::vector<Queue*> queues;
+    std::vector<Worker*> workers;
+
+    // guards the running flag and the queue to submit to
+    Mutex lock;
+    bool running;
+    unsigned int next;
+
+    bool IsRunning();
+    bool Take(unsigned int self, Item& item);
+    bool TakeGroup(TaskGroup& group, Item& item);
+    void Execute(Item& item);
+    void WorkerLoop(unsigned int self);
+};
+
+} // NS Core
+} // NS OpenEngine
+
+#endif // _OE_TASK_SCHEDULER_H_
@@ -0,0 +1,187 @@
+// Engine with separate simulation and render threads.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Core/ThreadedEngine.h>
+
+#include <Core/Thread.h>
+#include <Utils/Timer.h>
+
+namespace OpenEngine {
+namespace Core {
+
+using Utils::Timer;
+
+// maximum number of ticks run back to back when the simulation is
+// behind, the rest of the time is dropped
+static const unsigned int MAX_CATCHUP = 5;
+
+class ThreadedEngine::SimulationThread : public Thread {
+    ThreadedEngine& engine;
+public:
+    SimulationThread(ThreadedEngine& engine) : engine(engine) {}
+    void Run() { engine.Simulate(); }
+};
+
+/**
+ * Create a threaded engine.
+ *
+ * @param step Simulation time step in microseconds.
+ */
+ThreadedEngine::ThreadedEngine(unsigned int step)
+    : step(step == 0 ? 1 : step)
+    , running(false)
+    , ticks(0) {}
+
+ThreadedEngine::~ThreadedEngine() {}
+
+IEvent<InitializeEventArg>& ThreadedEngine::InitializeEvent() {
+    return initializeEvent;
+}
+
+/**
+ * Simulation event, notified once per time step on the simulation
+ * thread.
+ */
+IEvent<ProcessEventArg>& ThreadedEngine::ProcessEvent() {
+    return processEvent;
+}
+
+IEvent<DeinitializeEventArg>& ThreadedEngine::DeinitializeEvent() {
+    return deinitializeEvent;
+}
+
+/**
+ * Render event, notified once per frame on the thread running the
+ * engine.
+ */
+IEvent<ProcessEventArg>& ThreadedEngine::RenderEvent() {
+    return renderEvent;
+}
+
+/**
+ * Event notified on the simulation thread after each tick.
+ */
+IEvent<ProcessEventArg>& ThreadedEngine::PostTickEvent() {
+    return postTickEvent;
+}
+
+/**
+ * Run the engine until Stop() is called.
+ * Rendering runs on the calling thread.
+ */
+void ThreadedEngine::Start() {
+    lock.Lock();
+    running = true;
+    ticks = 0;
+    lock.Unlock();
+
+    initializeEvent.Notify(InitializeEventArg());
+
+    SimulationThread simulation(*this);
+    simulation.Start();
+
+    Timer timer;
+    timer.Start();
+    unsigned int approx = 0;
+    while (IsRunning()) {
+        sceneLock.Lock();
+        renderEvent.Notify(ProcessEventArg(Timer::GetTime(), approx));
+        sceneLock.Unlock();
+        // a thread waiting for the scene lock to change the graph
+        // usually takes it here, this is not guaranteed
+        Thread::Sleep(0);
+        approx = timer.GetElapsedTime().AsInt();
+        timer.Reset();
+        timer.Start();
+    }
+    simulation.Wait();
+
+    deinitializeEvent.Notify(DeinitializeEventArg());
+}
+
+/**
+ * Stop the engine.
+ * May be called from either thread, both loops finish their current
+ * iteration.
+ */
+void ThreadedEngine::Stop() {
+    lock.Lock();
+    running = false;
+    lock.Unlock();
+}
+
+bool ThreadedEngine::IsRunning() {
+    lock.Lock();
+    bool r = running;
+    lock.Unlock();
+    return r;
+}
+
+/**
+ * Set the simulation time step.
+ *
+ * @param usec Time step in microseconds.
+ */
+void ThreadedEngine::SetTimeStep(unsigned int usec) {
+    step = (usec == 0) ? 1 : usec;
+}
+
+unsigned int ThreadedEngine::GetTimeStep() const {
+    return step;
+}
+
+/**
+ * Number of simulation ticks since the engine was started.
+ */
+unsigned int ThreadedEngine::GetTickCount() {
+    lock.Lock();
+    unsigned int t = ticks;
+    lock.Unlock();
+    return t;
+}
+
+Mutex& ThreadedEngine::GetSceneLock() {
+    return sceneLock;
+}
+
+/**
+ * Get the lock held by render side code while it changes the scene
+ * graph, and by simulation code walking the graph outside the render
+ * event.
+ */
+Mutex& ThreadedEngine::GetStructureLock() {
+    return structureLock;
+}
+
+void ThreadedEngine::Simulate() {
+    Timer timer;
+    timer.Start();
+    unsigned int lag = 0;
+    while (IsRunning()) {
+        lag += timer.GetElapsedTime().AsInt();
+        timer.Reset();
+        timer.Start();
+        unsigned int count = 0;
+        while (lag >= step && count < MAX_CATCHUP) {
+            ProcessEventArg arg(Timer::GetTime(), step);
+            processEvent.Notify(arg);
+            postTickEvent.Notify(arg);
+            lock.Lock();
+            ticks++;
+            lock.Unlock();
+            lag -= step;
+            count++;
+        }
+        if (lag >= step) lag = 0;
+        else Thread::Sleep(step - lag);
+    }
+}
+
+} // NS Core
+} // NS OpenEngine
@@ -0,0 +1,97 @@
+// Engine with separate simulation and render threads.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OE_THREADED_ENGINE_H_
+#define _OE_THREADED_ENGINE_H_
+
+#include <Core/Event.h>
+#include <Core/IEngine.h>
+#include <Core/Mutex.h>
+
+namespace OpenEngine {
+namespace Core {
+
+/**
+ * Engine with separate simulation and render threads.
+ *
+ * The process event is notified on a simulation thread with a fixed
+ * time step, while the render event is notified as fast as possible
+ * on the thread calling Start(). Attach game logic to the process
+ * event and the environment (which drives the frame and renderer) to
+ * the render event. The post tick event is notified on the
+ * simulation thread after all process listeners, which is where the
+ * state shared with the renderer should be published, see
+ * Scene::TransformSnapshot.
+ *
+ * The initialize and deinitialize events are notified on the thread
+ * calling Start(), before the simulation thread starts and after it
+ * has stopped.
+ *
+ * The scene lock is held while the render event is notified.
+ * Simulation code must hold it while adding or removing scene nodes
+ * but not while changing transformations, so the simulation does not
+ * wait for the renderer in the common case.
+ *
+ * Render side code changing the scene graph, such as streaming in a
+ * model, holds the structure lock while it does. Simulation code
+ * walking the graph after each tick, as the transformation snapshot
+ * does, holds the structure lock instead of the scene lock, so it
+ * only waits for such changes and not for a whole frame.
+ *
+ * When a tick takes longer than the time step the simulation catches
+ * up with at most a few ticks in a row and then drops the remaining
+ * time, so a slow tick never stalls the render thread.
+ */
+class ThreadedEngine : public IEngine {
+public:
+    ThreadedEngine(unsigned int step = 10000);
+    virtual ~ThreadedEngine();
+
+    IEvent<InitializeEventArg>& InitializeEvent();
+    IEvent<ProcessEventArg>& ProcessEvent();
+    IEvent<DeinitializeEventArg>& DeinitializeEvent();
+    IEvent<ProcessEventArg>& RenderEvent();
+    IEvent<ProcessEventArg>& PostTickEvent();
+
+    void Start();
+    void Stop();
+    bool IsRunning();
+
+    void SetTimeStep(unsigned int usec);
+    unsigned int GetTimeStep() const;
+    unsigned int GetTickCount();
+
+    Mutex& GetSceneLock();
+    Mutex& GetStructureLock();
+
+private:
+    class SimulationThread;
+
+    Event<InitializeEventArg> initializeEvent;
+    Event<ProcessEventArg> processEvent;
+    Event<DeinitializeEventArg> deinitializeEvent;
+    Event<ProcessEventArg> renderEvent;
+    Event<ProcessEventArg> postTickEvent;
+
+    unsigned int step;
+    Mutex sceneLock;
+    Mutex structureLock;
+
+    // guards the running flag and the tick count
+    Mutex lock;
+    bool running;
+    unsigned int ticks;
+
+    void Simulate();
+};
+
+} // NS Core
+} // NS OpenEngine
+
+#endif // _OE_THREADED_ENGINE_H_
@@ -0,0 +1,170 @@
+// Timestamped input queue with a latest state.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Devices/InputQueue.h>
+
+#include <time.h>
+
+namespace OpenEngine {
+namespace Devices {
+
+/**
+ * Create a queue.
+ *
+ * @param mouse Mouse to poll before each frame, NULL for none.
+ * @param capacity Events kept until popped, rounded up to a power of
+ *                 two.
+ */
+InputQueue::InputQueue(IMouse* mouse, unsigned int capacity)
+    : mouse(mouse)
+    , head(0)
+    , tail(0)
+    , drops(0)
+    , sequence(0) {
+    unsigned int size = 1;
+    while (size < capacity) size <<= 1;
+    ring.resize(size);
+}
+
+InputQueue::~InputQueue() {}
+
+/**
+ * Take the oldest event of the queue.
+ * Must only be called by one thread at a time.
+ *
+ * @param event Set to the event.
+ * @return False if the queue is empty.
+ */
+bool InputQueue::Pop(InputEvent& event) {
+    unsigned int t = tail;
+    if (t == head) return false;
+    // read the event only after seeing the head that published it
+    __sync_synchronize();
+    event = ring[t & (ring.size() - 1)];
+    __sync_synchronize();
+    tail = t + 1;
+    return true;
+}
+
+/**
+ * Get a consistent copy of the latest state, from any thread.
+ */
+InputState InputQueue::GetState() const {
+    InputState copy;
+    for (;;) {
+        unsigned int s = sequence;
+        if (s & 1) continue;
+        __sync_synchronize();
+        copy = state;
+        __sync_synchronize();
+        if (sequence == s) return copy;
+    }
+}
+
+/**
+ * Number of events dropped because the queue was full.
+ */
+unsigned int InputQueue::GetDropCount() const {
+    return drops;
+}
+
+/**
+ * Current time of the clock stamping the events, in microseconds.
+ */
+unsigned long long InputQueue::GetTime() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+void InputQueue::Handle(KeyboardEventArg arg) {
+    InputEvent e;
+    e.key = arg;
+    Push(e, InputEvent::KEY);
+}
+
+void InputQueue::Handle(MouseMovedEventArg arg) {
+    InputEvent e;
+    e.moved = arg;
+    Push(e, InputEvent::MOUSE_MOVED);
+}
+
+void InputQueue::Handle(MouseButtonEventArg arg) {
+    InputEvent e;
+    e.button = arg;
+    Push(e, InputEvent::MOUSE_BUTTON);
+}
+
+void InputQueue::Handle(JoystickButtonEventArg arg) {
+    InputEvent e;
+    e.joyButton = arg;
+    Push(e, InputEvent::JOYSTICK_BUTTON);
+}
+
+void InputQueue::Handle(JoystickAxisEventArg arg) {
+    InputEvent e;
+    e.joyAxis = arg;
+    Push(e, InputEvent::JOYSTICK_AXIS);
+}
+
+/**
+ * Poll the mouse right before the frame is rendered.
+ */
+void InputQueue::Handle(Renderers::RenderingEventArg arg) {
+    if (mouse == NULL) return;
+    MouseState m = mouse->GetState();
+    BeginWrite();
+    state.mouse = m;
+    state.time = GetTime();
+    EndWrite();
+}
+
+// Stamp an event, update the state with it and publish it to the
+// consumer.
+void InputQueue::Push(InputEvent& event, InputEvent::Type type) {
+    event.type = type;
+    event.time = GetTime();
+
+    BeginWrite();
+    state.time = event.time;
+    if (type == InputEvent::KEY) {
+        unsigned int k = event.key.sym;
+        if (k < InputState::KEY_WORDS * 32) {
+            unsigned int bit = 1u << (k % 32);
+            if (event.key.type == EVENT_PRESS) state.keys[k / 32] |= bit;
+            else state.keys[k / 32] &= ~bit;
+        }
+    } else if ((type == InputEvent::MOUSE_MOVED ||
+                type == InputEvent::MOUSE_BUTTON) && mouse != NULL)
+        state.mouse = mouse->GetState();
+    EndWrite();
+
+    unsigned int h = head;
+    if (h - tail == ring.size()) {
+        drops++;
+        return;
+    }
+    ring[h & (ring.size() - 1)] = event;
+    // publish the head only after the event is written
+    __sync_synchronize();
+    head = h + 1;
+}
+
+void InputQueue::BeginWrite() {
+    sequence = sequence + 1;
+    __sync_synchronize();
+}
+
+void InputQueue::EndWrite() {
+    __sync_synchronize();
+    sequence = sequence + 1;
+}
+
+} // NS Devices
+} // NS OpenEngine
@@ -0,0 +1,122 @@
+// Timestamped input queue with a latest state.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OE_INPUT_QUEUE_H_
+#define _OE_INPUT_QUEUE_H_
+
+#include <Core/IListener.h>
+#include <Devices/IJoystick.h>
+#include <Devices/IKeyboard.h>
+#include <Devices/IMouse.h>
+#include <Renderers/IRenderer.h>
+
+#include <vector>
+
+namespace OpenEngine {
+namespace Devices {
+
+/**
+ * Input event with the time it arrived.
+ * Only the argument of the type of the event is set.
+ */
+struct InputEvent {
+    enum Type { KEY, MOUSE_MOVED, MOUSE_BUTTON,
+                JOYSTICK_BUTTON, JOYSTICK_AXIS };
+    Type type;
+    // microseconds on a monotonic clock, see InputQueue::GetTime()
+    unsigned long long time;
+    KeyboardEventArg key;
+    MouseMovedEventArg moved;
+    MouseButtonEventArg button;
+    JoystickButtonEventArg joyButton;
+    JoystickAxisEventArg joyAxis;
+};
+
+/**
+ * Latest state of the input devices.
+ */
+struct InputState {
+    static const unsigned int KEY_WORDS = 16;
+    MouseState mouse;
+    // bit per key symbol of the keys held down
+    unsigned int keys[KEY_WORDS];
+    // time of the latest event or mouse poll, zero for none
+    unsigned long long time;
+    InputState() : time(0) {
+        for (unsigned int i = 0; i < KEY_WORDS; ++i) keys[i] = 0;
+    }
+    bool IsKeyDown(Key sym) const {
+        unsigned int k = sym;
+        return k < KEY_WORDS * 32 && (keys[k / 32] >> (k % 32)) & 1;
+    }
+};
+
+/**
+ * Timestamped input queue with a latest state.
+ *
+ * Attached to the events of the input devices the queue stamps every
+ * event with a monotonic clock in microseconds when it arrives and
+ * stores it in a fixed ring, without locks, for one consuming thread
+ * to drain with Pop(), for instance the simulation thread of a
+ * threaded engine, independent of the frame it arrived in.
+ *
+ * The latest state, the mouse and the keys held down, can be read by
+ * any thread with GetState(), also without locks. Attached to the
+ * renderer pre-process event the mouse state is polled from the
+ * device again right before the frame is rendered, so a view
+ * following the mouse does not wait for the next round of events.
+ *
+ * Events arriving while the ring is full are dropped and counted.
+ * The events and the mouse poll must come from one thread, as they
+ * do from the environment and the renderer.
+ */
+class InputQueue
+    : public Core::IListener<KeyboardEventArg>
+    , public Core::IListener<MouseMovedEventArg>
+    , public Core::IListener<MouseButtonEventArg>
+    , public Core::IListener<JoystickButtonEventArg>
+    , public Core::IListener<JoystickAxisEventArg>
+    , public Core::IListener<Renderers::RenderingEventArg> {
+public:
+    InputQueue(IMouse* mouse = NULL, unsigned int capacity = 1024);
+    virtual ~InputQueue();
+
+    bool Pop(InputEvent& event);
+    InputState GetState() const;
+    unsigned int GetDropCount() const;
+
+    static unsigned long long GetTime();
+
+    void Handle(KeyboardEventArg arg);
+    void Handle(MouseMovedEventArg arg);
+    void Handle(MouseButtonEventArg arg);
+    void Handle(JoystickButtonEventArg arg);
+    void Handle(JoystickAxisEventArg arg);
+    void Handle(Renderers::RenderingEventArg arg);
+
+private:
+    IMouse* mouse;
+    std::vector<InputEvent> ring;
+    // written by the producer and the consumer only
+    volatile unsigned int head, tail;
+    unsigned int drops;
+
+    // sequence lock of the state, odd while it is written
+    volatile unsigned int sequence;
+    InputState state;
+
+    void Push(InputEvent& event, InputEvent::Type type);
+    void BeginWrite();
+    void EndWrite();
+};
+
+} // NS Devices
+} // NS OpenEngine
+
+#endif // _OE_INPUT_QUEUE_H_
@@ -0,0 +1,316 @@
+// HUD surfaces packed into one texture.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Display/HUDAtlas.h>
+
+#include <Display/IRenderCanvas.h>
+#include <Logging/Logger.h>
+#include <Meta/OpenGL.h>
+#include <Renderers/OpenGL/UploadRing.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace OpenEngine {
+namespace Display {
+
+using namespace Resources;
+using Renderers::RenderingEventArg;
+using Renderers::OpenGL::UploadRing;
+
+// side length of the tiles compared to find the changed pixels
+static const unsigned int TILE = 32;
+
+/**
+ * Create an atlas.
+ * The texture is created on the first frame.
+ *
+ * @param size Side length of the atlas texture.
+ */
+HUDAtlas::HUDAtlas(unsigned int size)
+    : size(size)
+    , texture(0)
+    , ring(NULL)
+    , shelfX(0)
+    , shelfY(0)
+    , shelfHeight(0)
+    , uploaded(0) {}
+
+/**
+ * Destroy the atlas.
+ * The texture is left for the context to clean up since we can not
+ * know if the context still exists.
+ */
+HUDAtlas::~HUDAtlas() {
+    for (std::vector<Surface*>::iterator itr = surfaces.begin();
+         itr != surfaces.end(); ++itr) {
+        ITexture2DPtr texr = (*itr)->texr.lock();
+        if (texr) texr->ChangedEvent().Detach(*this);
+        delete *itr;
+    }
+}
+
+/**
+ * Add a surface to the HUD.
+ * The surface is loaded if it is not already, and is uploaded on the
+ * next frame and whenever it changes.
+ *
+ * @param texr Surface texture.
+ * @param h Horizontal side of the canvas to place the surface at.
+ * @param v Vertical side of the canvas to place the surface at.
+ * @return False if the surface does not fit in the atlas.
+ */
+bool HUDAtlas::Add(ITexture2DPtr texr, HorizontalAlign h, VerticalAlign v) {
+    for (std::vector<Surface*>::iterator itr = surfaces.begin();
+         itr != surfaces.end(); ++itr)
+        if ((*itr)->key == texr.get() && (*itr)->texr.lock() == texr)
+            return true;
+    if (texr->GetData() == NULL) texr->Load();
+    Surface* s = new Surface();
+    s->texr = texr;
+    s->key = texr.get();
+    s->h = h;
+    s->v = v;
+    s->placed = false;
+    s->dirty = true;
+    if (!Place(*s, texr->GetWidth(), texr->GetHeight())) {
+        logger.warning << "HUDAtlas: no room for a surface of "
+                       << texr->GetWidth() << "x" << texr->GetHeight()
+                       << logger.end;
+        delete s;
+        return false;
+    }
+    texr->ChangedEvent().Attach(*this);
+    surfaces.push_back(s);
+    return true;
+}
+
+/**
+ * Remove a surface from the HUD.
+ */
+void HUDAtlas::Remove(ITexture2DPtr texr) {
+    for (std::vector<Surface*>::iterator itr = surfaces.begin();
+         itr != surfaces.end(); ++itr)
+        if ((*itr)->key == texr.get()) {
+            texr->ChangedEvent().Detach(*this);
+            delete *itr;
+            surfaces.erase(itr);
+            return;
+        }
+}
+
+/**
+ * Upload the changed pixels through an upload ring instead of from
+ * client memory.
+ */
+void HUDAtlas::SetUploadRing(UploadRing* ring) {
+    this->ring = ring;
+}
+
+/**
+ * Bytes of pixels uploaded in the last frame.
+ */
+unsigned int HUDAtlas::GetUploadedBytes() const {
+    return uploaded;
+}
+
+/**
+ * Upload the changed surfaces and draw the HUD.
+ */
+void HUDAtlas::Handle(RenderingEventArg arg) {
+    if (texture == 0) Initialize();
+    uploaded = 0;
+    quads.clear();
+    float width = arg.canvas.GetWidth();
+    float height = arg.canvas.GetHeight();
+    float inv = 1.0f / size;
+    // stacking offset of each corner
+    float stack[4] = { 0, 0, 0, 0 };
+    for (std::vector<Surface*>::iterator itr = surfaces.begin();
+         itr != surfaces.end(); ) {
+        Surface& s = **itr;
+        ITexture2DPtr texr = s.texr.lock();
+        if (!texr) {
+            delete *itr;
+            itr = surfaces.erase(itr);
+            continue;
+        }
+        ++itr;
+        if (s.dirty) {
+            s.dirty = false;
+            Update(s, *texr);
+        }
+        if (!s.placed) continue;
+
+        float& offset = stack[s.h * 2 + s.v];
+        float x0 = (s.h == LEFT) ? 0 : width - s.width;
+        float y0 = (s.v == TOP) ? offset : height - offset - s.height;
+        float x1 = x0 + s.width, y1 = y0 + s.height;
+        offset += s.height;
+        float u0 = s.x * inv, v0 = s.y * inv;
+        float u1 = (s.x + s.width) * inv, v1 = (s.y + s.height) * inv;
+        const float quad[16] = { x0, y0, u0, v0,  x1, y0, u1, v0,
+                                 x1, y1, u1, v1,  x0, y1, u0, v1 };
+        quads.insert(quads.end(), quad, quad + 16);
+    }
+    if (quads.empty()) return;
+
+    glPushAttrib(GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT |
+                 GL_TEXTURE_BIT | GL_CURRENT_BIT);
+    glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadIdentity();
+    glOrtho(0, width, height, 0, -1, 1);
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_LIGHTING);
+    glDisable(GL_CULL_FACE);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glEnable(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glColor4f(1, 1, 1, 1);
+    if (GLEW_VERSION_2_0) glUseProgram(0);
+    if (GLEW_ARB_vertex_buffer_object)
+        glBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
+
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glVertexPointer(2, GL_FLOAT, 4 * sizeof(float), &quads[0]);
+    glTexCoordPointer(2, GL_FLOAT, 4 * sizeof(float), &quads[2]);
+    glDrawArrays(GL_QUADS, 0, quads.size() / 4);
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glPopMatrix();
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+    glPopClientAttrib();
+    glPopAttrib();
+}
+
+/**
+ * Mark a surface for update in the next frame.
+ */
+void HUDAtlas::Handle(Texture2DChangedEventArg arg) {
+    for (std::vector<Surface*>::iterator itr = surfaces.begin();
+         itr != surfaces.end(); ++itr)
+        if ((*itr)->key == arg.resource.get()) (*itr)->dirty = true;
+}
+
+void HUDAtlas::Initialize() {
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    // only the rectangles of the surfaces are ever sampled
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size, size, 0,
+                 GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+// Find room for a surface on the shelves of the atlas, leaving a
+// pixel between surfaces.
+bool HUDAtlas::Place(Surface& s, unsigned int width, unsigned int height) {
+    if (shelfX + width > size) {
+        shelfY += shelfHeight;
+        shelfX = shelfHeight = 0;
+    }
+    if (width > size || shelfY + height > size) return false;
+    s.x = shelfX;
+    s.y = shelfY;
+    s.width = width;
+    s.height = height;
+    s.placed = true;
+    s.shadow.clear();
+    shelfX += width + 1;
+    shelfHeight = std::max(shelfHeight, height + 1);
+    return true;
+}
+
+// Upload the tiles of a surface that changed since the last upload,
+// merged into one rectangle per row of tiles. A surface changing
+// its size is placed again and uploaded as a whole.
+void HUDAtlas::Update(Surface& s, ITexture2D& texr) {
+    const unsigned char* p = (const unsigned char*)texr.GetData();
+    unsigned int format;
+    if (p == NULL || !UploadRing::GetPixelFormat(texr, format)) return;
+    unsigned int channels = texr.GetDepth() / 8;
+    unsigned int w = texr.GetWidth(), h = texr.GetHeight();
+    if ((w != s.width || h != s.height) && !Place(s, w, h)) {
+        logger.warning << "HUDAtlas: no room for a surface of "
+                       << w << "x" << h << logger.end;
+        s.placed = false;
+        return;
+    }
+    unsigned int stride = w * channels;
+    if (s.shadow.size() != stride * h) {
+        UploadRect(s, p, format, channels, 0, 0, w, h);
+        s.shadow.assign(p, p + stride * h);
+        return;
+    }
+    for (unsigned int ty = 0; ty < h; ty += TILE) {
+        unsigned int th = std::min(TILE, h - ty);
+        unsigned int first = w, last = 0;
+        for (unsigned int tx = 0; tx < w; tx += TILE) {
+            unsigned int tw = std::min(TILE, w - tx);
+            bool changed = false;
+            for (unsigned int r = 0; r < th && !changed; ++r) {
+                unsigned int offset = (ty + r) * stride + tx * channels;
+                changed = memcmp(p + offset, &s.shadow[offset], tw * channels) != 0;
+            }
+            if (!changed) continue;
+            first = std::min(first, tx);
+            last = tx + tw;
+        }
+        if (first >= last) continue;
+        UploadRect(s, p, format, channels, first, ty, last - first, th);
+        for (unsigned int r = ty; r < ty + th; ++r) {
+            unsigned int offset = r * stride + first * channels;
+            memcpy(&s.shadow[offset], p + offset, (last - first) * channels);
+        }
+    }
+}
+
+void HUDAtlas::UploadRect(Surface& s, const unsigned char* pixels,
+                          unsigned int format, unsigned int channels,
+                          unsigned int x, unsigned int y,
+                          unsigned int width, unsigned int height) {
+    unsigned int stride = s.width * channels;
+    unsigned int row = width * channels;
+    packed.resize(row * height);
+    for (unsigned int r = 0; r < height; ++r)
+        memcpy(&packed[r * row], pixels + (y + r) * stride + x * channels, row);
+
+    const GLvoid* data = &packed[0];
+    unsigned int offset;
+    bool pbo = ring != NULL && GLEW_ARB_pixel_buffer_object &&
+        ring->Write(&packed[0], packed.size(), offset);
+    if (pbo) {
+        glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, ring->GetBuffer());
+        data = (const GLvoid*)(unsigned long)offset;
+    }
+    glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, s.x + x, s.y + y, width, height,
+                    format, GL_UNSIGNED_BYTE, data);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glPopClientAttrib();
+    if (pbo) glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
+    uploaded += packed.size();
+}
+
+} // NS Display
+} // NS OpenEngine
@@ -0,0 +1,100 @@
+// HUD surfaces packed into one texture.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OE_HUD_ATLAS_H_
+#define _OE_HUD_ATLAS_H_
+
+#include <Core/IListener.h>
+#include <Renderers/IRenderer.h>
+#include <Resources/ITexture2D.h>
+
+#include <boost/weak_ptr.hpp>
+#include <vector>
+
+namespace OpenEngine {
+    namespace Renderers {
+        namespace OpenGL {
+            class UploadRing;
+        }
+    }
+namespace Display {
+
+/**
+ * HUD surfaces packed into one texture.
+ *
+ * The surfaces, typically Cairo resources redrawing themselves, are
+ * packed into a shared atlas texture and the whole HUD is drawn with
+ * a single draw call. When a surface changes its pixels are compared
+ * with a copy of the previous pixels in tiles, and only the rows of
+ * changed tiles are uploaded, so a counter changing a few digits
+ * uploads a few hundred bytes instead of the whole surface.
+ *
+ * Surfaces are placed in a corner of the canvas and surfaces sharing
+ * a corner are stacked away from it, in the order they were added.
+ * The space of a removed surface is not reused.
+ *
+ * Attach the atlas to the renderer post-process event so it is drawn
+ * on top of the scene.
+ */
+class HUDAtlas
+    : public Core::IListener<Renderers::RenderingEventArg>
+    , public Core::IListener<Resources::Texture2DChangedEventArg> {
+public:
+    enum HorizontalAlign { LEFT, RIGHT };
+    enum VerticalAlign { TOP, BOTTOM };
+
+    HUDAtlas(unsigned int size = 1024);
+    virtual ~HUDAtlas();
+
+    bool Add(Resources::ITexture2DPtr texr,
+             HorizontalAlign h, VerticalAlign v);
+    void Remove(Resources::ITexture2DPtr texr);
+
+    void SetUploadRing(Renderers::OpenGL::UploadRing* ring);
+    unsigned int GetUploadedBytes() const;
+
+    void Handle(Renderers::RenderingEventArg arg);
+    void Handle(Resources::Texture2DChangedEventArg arg);
+
+private:
+    struct Surface {
+        boost::weak_ptr<Resources::ITexture2D> texr;
+        Resources::ITexture2D* key;
+        HorizontalAlign h;
+        VerticalAlign v;
+        unsigned int x, y, width, height;
+        bool placed;
+        bool dirty;
+        // pixels as last uploaded, compared to find changed tiles
+        std::vector<unsigned char> shadow;
+    };
+
+    unsigned int size;
+    unsigned int texture;
+    Renderers::OpenGL::UploadRing* ring;
+    std::vector<Surface*> surfaces;
+    // shelf packing state
+    unsigned int shelfX, shelfY, shelfHeight;
+    std::vector<unsigned char> packed;
+    std::vector<float> quads;
+    unsigned int uploaded;
+
+    void Initialize();
+    bool Place(Surface& s, unsigned int width, unsigned int height);
+    void Update(Surface& s, Resources::ITexture2D& texr);
+    void UploadRect(Surface& s, const unsigned char* pixels,
+                    unsigned int format, unsigned int channels,
+                    unsigned int x, unsigned int y,
+                    unsigned int width, unsigned int height);
+};
+
+} // NS Display
+} // NS OpenEngine
+
+#endif // _OE_HUD_ATLAS_H_
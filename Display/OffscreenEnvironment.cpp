@@ -0,0 +1,338 @@
+// Offscreen rendering environment.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Display/OffscreenEnvironment.h>
+
+#include <Core/Exceptions.h>
+#include <Devices/IJoystick.h>
+#include <Devices/IKeyboard.h>
+#include <Devices/IMouse.h>
+#include <Display/IRenderCanvas.h>
+#include <Logging/Logger.h>
+#include <Meta/OpenGL.h>
+
+#ifdef OE_HAVE_EGL
+#include <EGL/egl.h>
+#endif
+
+namespace OpenEngine {
+namespace Display {
+
+using namespace Core;
+using namespace Devices;
+
+// Input devices of an environment without input.
+
+class NullMouse : public IMouse {
+    Event<MouseMovedEventArg> moved;
+    Event<MouseButtonEventArg> button;
+public:
+    IEvent<MouseMovedEventArg>& MouseMovedEvent() { return moved; }
+    IEvent<MouseButtonEventArg>& MouseButtonEvent() { return button; }
+    void HideCursor() {}
+    void ShowCursor() {}
+    void SetCursor(int x, int y) {}
+    MouseState GetState() { return MouseState(); }
+};
+
+class NullKeyboard : public IKeyboard {
+    Event<KeyboardEventArg> key;
+public:
+    IEvent<KeyboardEventArg>& KeyEvent() { return key; }
+};
+
+class NullJoystick : public IJoystick {
+    Event<JoystickButtonEventArg> button;
+    Event<JoystickAxisEventArg> axis;
+public:
+    IEvent<JoystickButtonEventArg>& JoystickButtonEvent() { return button; }
+    IEvent<JoystickAxisEventArg>& JoystickAxisEvent() { return axis; }
+};
+
+/**
+ * Create an offscreen frame.
+ * The rendering context is created on initialization.
+ *
+ * @param width Frame width in pixels.
+ * @param height Frame height in pixels.
+ */
+OffscreenFrame::OffscreenFrame(unsigned int width, unsigned int height)
+    : width(width)
+    , height(height)
+    , canvas(NULL)
+    , init(false)
+    , readback(false)
+    , frames(0)
+    , delivered(0)
+    , limit(0)
+    , engine(NULL)
+    , display(NULL)
+    , surface(NULL)
+    , context(NULL)
+    , usePBO(false)
+    , pixels(NULL) {}
+
+OffscreenFrame::~OffscreenFrame() {
+    DestroyContext();
+    delete[] pixels;
+}
+
+bool OffscreenFrame::IsFocused() const { return true; }
+unsigned int OffscreenFrame::GetWidth() const { return width; }
+unsigned int OffscreenFrame::GetHeight() const { return height; }
+unsigned int OffscreenFrame::GetDepth() const { return 32; }
+FrameOption OffscreenFrame::GetOptions() const { return FrameOption(); }
+bool OffscreenFrame::GetOption(const FrameOption option) const { return false; }
+
+void OffscreenFrame::SetWidth(const unsigned int width) {
+    if (init) throw Exception("Offscreen frame can not be resized.");
+    this->width = width;
+}
+
+void OffscreenFrame::SetHeight(const unsigned int height) {
+    if (init) throw Exception("Offscreen frame can not be resized.");
+    this->height = height;
+}
+
+void OffscreenFrame::SetDepth(const unsigned int depth) {}
+void OffscreenFrame::SetOptions(const FrameOption options) {}
+void OffscreenFrame::ToggleOption(const FrameOption option) {}
+
+void OffscreenFrame::SetCanvas(IRenderCanvas* canvas) {
+    this->canvas = canvas;
+}
+
+IRenderCanvas* OffscreenFrame::GetCanvas() {
+    return canvas;
+}
+
+/**
+ * Enable reading back every frame.
+ * The frames are delivered by the frame ready event.
+ */
+void OffscreenFrame::SetReadback(bool enable) {
+    readback = enable;
+}
+
+IEvent<OffscreenFrameEventArg>& OffscreenFrame::FrameReadyEvent() {
+    return frameReady;
+}
+
+/**
+ * Stop the engine after a number of frames.
+ * Frames still waiting in the readback ring are delivered when the
+ * frame is deinitialized.
+ *
+ * @param frames Number of frames to render.
+ * @param engine Engine to stop.
+ */
+void OffscreenFrame::StopAfter(unsigned int frames, IEngine& engine) {
+    limit = frames;
+    this->engine = &engine;
+}
+
+/**
+ * Number of frames rendered so far.
+ */
+unsigned int OffscreenFrame::GetFrameCount() const {
+    return frames;
+}
+
+void OffscreenFrame::Handle(Core::InitializeEventArg arg) {
+    CreateContext();
+    init = true;
+    if (canvas == NULL) return;
+    canvas->SetWidth(width);
+    canvas->SetHeight(height);
+    canvas->Handle(Display::InitializeEventArg(*canvas));
+
+    usePBO = GLEW_ARB_pixel_buffer_object;
+    if (usePBO) {
+        glGenBuffers(BUFFERS, pbos);
+        for (unsigned int i = 0; i < BUFFERS; ++i) {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, pbos[i]);
+            glBufferData(GL_PIXEL_PACK_BUFFER_ARB, width * height * 4,
+                         NULL, GL_STREAM_READ);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, 0);
+    } else
+        pixels = new unsigned char[width * height * 4];
+}
+
+void OffscreenFrame::Handle(Core::ProcessEventArg arg) {
+    if (canvas == NULL) return;
+    canvas->Handle(Display::ProcessEventArg(*canvas, arg.start, arg.approx));
+    if (readback) Readback();
+    else delivered = ++frames;
+    if (limit != 0 && frames >= limit && engine != NULL)
+        engine->Stop();
+}
+
+void OffscreenFrame::Handle(Core::DeinitializeEventArg arg) {
+    if (canvas != NULL) {
+        // deliver the frames still in the readback ring
+        while (usePBO && delivered < frames) {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, pbos[delivered % BUFFERS]);
+            const unsigned char* data = (const unsigned char*)
+                glMapBuffer(GL_PIXEL_PACK_BUFFER_ARB, GL_READ_ONLY);
+            if (data != NULL) {
+                frameReady.Notify(OffscreenFrameEventArg(*this, delivered,
+                                                         width, height, data));
+                glUnmapBuffer(GL_PIXEL_PACK_BUFFER_ARB);
+            }
+            delivered++;
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, 0);
+        canvas->Handle(Display::DeinitializeEventArg(*canvas));
+        if (usePBO) glDeleteBuffers(BUFFERS, pbos);
+    }
+    DestroyContext();
+    init = false;
+}
+
+void OffscreenFrame::Readback() {
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    if (!usePBO) {
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+        frameReady.Notify(OffscreenFrameEventArg(*this, frames,
+                                                 width, height, pixels));
+        delivered = ++frames;
+        return;
+    }
+    // start reading the current frame, this returns immediately
+    glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, pbos[frames % BUFFERS]);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    frames++;
+    // deliver the oldest frame before its buffer is reused, it was
+    // issued BUFFERS - 1 frames ago so it is most likely done.
+    if (frames - delivered == BUFFERS) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, pbos[delivered % BUFFERS]);
+        const unsigned char* data = (const unsigned char*)
+            glMapBuffer(GL_PIXEL_PACK_BUFFER_ARB, GL_READ_ONLY);
+        if (data != NULL) {
+            frameReady.Notify(OffscreenFrameEventArg(*this, delivered,
+                                                     width, height, data));
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER_ARB);
+        }
+        delivered++;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, 0);
+}
+
+void OffscreenFrame::CreateContext() {
+#ifdef OE_HAVE_EGL
+    EGLDisplay dpy = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (dpy == EGL_NO_DISPLAY || !eglInitialize(dpy, NULL, NULL))
+        throw Exception("Offscreen frame: no EGL display.");
+
+    const EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+        EGL_ALPHA_SIZE, 8, EGL_DEPTH_SIZE, 24,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint count = 0;
+    if (!eglChooseConfig(dpy, configAttribs, &config, 1, &count) || count == 0)
+        throw Exception("Offscreen frame: no matching EGL config.");
+
+    const EGLint surfaceAttribs[] = {
+        EGL_WIDTH, (EGLint)width,
+        EGL_HEIGHT, (EGLint)height,
+        EGL_NONE
+    };
+    EGLSurface surf = eglCreatePbufferSurface(dpy, config, surfaceAttribs);
+    if (surf == EGL_NO_SURFACE)
+        throw Exception("Offscreen frame: could not create pbuffer.");
+
+    eglBindAPI(EGL_OPENGL_API);
+    EGLContext ctx = eglCreateContext(dpy, config, EGL_NO_CONTEXT, NULL);
+    if (ctx == EGL_NO_CONTEXT)
+        throw Exception("Offscreen frame: could not create context.");
+    eglMakeCurrent(dpy, surf, surf, ctx);
+    // never wait for a display refresh
+    eglSwapInterval(dpy, 0);
+
+    display = dpy;
+    surface = surf;
+    context = ctx;
+    logger.info << "Offscreen frame: " << width << "x" << height
+                << " EGL pbuffer" << logger.end;
+#else
+    throw Exception("Offscreen frame: built without EGL support.");
+#endif
+}
+
+void OffscreenFrame::DestroyContext() {
+#ifdef OE_HAVE_EGL
+    if (display == NULL) return;
+    EGLDisplay dpy = (EGLDisplay)display;
+    eglMakeCurrent(dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroyContext(dpy, (EGLContext)context);
+    eglDestroySurface(dpy, (EGLSurface)surface);
+    eglTerminate(dpy);
+    display = surface = context = NULL;
+#endif
+}
+
+/**
+ * Create an offscreen environment.
+ *
+ * @param width Frame width in pixels.
+ * @param height Frame height in pixels.
+ */
+OffscreenEnvironment::OffscreenEnvironment(unsigned int width,
+                                           unsigned int height)
+    : frame(new OffscreenFrame(width, height))
+    , mouse(new NullMouse())
+    , keyboard(new NullKeyboard())
+    , joystick(new NullJoystick()) {}
+
+OffscreenEnvironment::~OffscreenEnvironment() {
+    delete frame;
+    delete mouse;
+    delete keyboard;
+    delete joystick;
+}
+
+IFrame& OffscreenEnvironment::CreateFrame() {
+    return *frame;
+}
+
+OffscreenFrame& OffscreenEnvironment::GetOffscreenFrame() {
+    return *frame;
+}
+
+IMouse* OffscreenEnvironment::GetMouse() {
+    return mouse;
+}
+
+IKeyboard* OffscreenEnvironment::GetKeyboard() {
+    return keyboard;
+}
+
+IJoystick* OffscreenEnvironment::GetJoystick() {
+    return joystick;
+}
+
+void OffscreenEnvironment::Handle(Core::InitializeEventArg arg) {
+    frame->Handle(arg);
+}
+
+void OffscreenEnvironment::Handle(Core::ProcessEventArg arg) {
+    frame->Handle(arg);
+}
+
+void OffscreenEnvironment::Handle(Core::DeinitializeEventArg arg) {
+    frame->Handle(arg);
+}
+
+} // NS Display
+} // NS OpenEngine
@@ -0,0 +1,149 @@
+// Offscreen rendering environment.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OE_OFFSCREEN_ENVIRONMENT_H_
+#define _OE_OFFSCREEN_ENVIRONMENT_H_
+
+#include <Core/Event.h>
+#include <Core/IEngine.h>
+#include <Display/IEnvironment.h>
+#include <Display/IFrame.h>
+
+namespace OpenEngine {
+namespace Display {
+
+class OffscreenFrame;
+
+/**
+ * Event argument of a finished offscreen frame.
+ * The pixels are tightly packed RGBA rows, bottom row first, and are
+ * only valid during the notification.
+ */
+struct OffscreenFrameEventArg {
+    OffscreenFrame& frame;
+    unsigned int number;
+    unsigned int width, height;
+    const unsigned char* pixels;
+    OffscreenFrameEventArg(OffscreenFrame& frame,
+                           unsigned int number,
+                           unsigned int width,
+                           unsigned int height,
+                           const unsigned char* pixels)
+        : frame(frame), number(number)
+        , width(width), height(height), pixels(pixels) {}
+};
+
+/**
+ * Offscreen frame.
+ *
+ * Renders into an EGL pbuffer surface without a window and without
+ * synchronizing to the display, so frames are produced as fast as
+ * possible. When readback is enabled each frame is read back through
+ * a ring of pixel buffer objects and delivered by the frame ready
+ * event a couple of frames later, so reading back never waits for
+ * the GPU to finish the current frame.
+ */
+class OffscreenFrame : public IFrame {
+public:
+    OffscreenFrame(unsigned int width, unsigned int height);
+    virtual ~OffscreenFrame();
+
+    bool IsFocused() const;
+    unsigned int GetWidth() const;
+    unsigned int GetHeight() const;
+    unsigned int GetDepth() const;
+    FrameOption GetOptions() const;
+    bool GetOption(const FrameOption option) const;
+    void SetWidth(const unsigned int width);
+    void SetHeight(const unsigned int height);
+    void SetDepth(const unsigned int depth);
+    void SetOptions(const FrameOption options);
+    void ToggleOption(const FrameOption option);
+
+    void SetCanvas(IRenderCanvas* canvas);
+    IRenderCanvas* GetCanvas();
+
+    void SetReadback(bool enable);
+    Core::IEvent<OffscreenFrameEventArg>& FrameReadyEvent();
+
+    void StopAfter(unsigned int frames, Core::IEngine& engine);
+    unsigned int GetFrameCount() const;
+
+    void Handle(Core::InitializeEventArg arg);
+    void Handle(Core::ProcessEventArg arg);
+    void Handle(Core::DeinitializeEventArg arg);
+
+private:
+    // number of pixel buffers in the readback ring
+    static const unsigned int BUFFERS = 3;
+
+    unsigned int width, height;
+    IRenderCanvas* canvas;
+    bool init;
+    bool readback;
+    unsigned int frames;
+    unsigned int delivered;
+    unsigned int limit;
+    Core::IEngine* engine;
+    Core::Event<OffscreenFrameEventArg> frameReady;
+
+    // egl handles, kept opaque so the header does not need egl
+    void* display;
+    void* surface;
+    void* context;
+
+    unsigned int pbos[BUFFERS];
+    bool usePBO;
+    unsigned char* pixels;
+
+    void CreateContext();
+    void DestroyContext();
+    void Readback();
+};
+
+/**
+ * Offscreen environment.
+ *
+ * Creates an OffscreenFrame and input devices that never produce
+ * events. Use it as the environment of SimpleSetup to render without
+ * a display, for instance on build servers.
+ *
+ * @code
+ * OffscreenEnvironment* env = new OffscreenEnvironment(256, 256);
+ * SimpleSetup setup("thumbnails", env);
+ * env->GetOffscreenFrame().StopAfter(100, setup.GetEngine());
+ * setup.GetEngine().Start();
+ * @endcode
+ */
+class OffscreenEnvironment : public IEnvironment {
+public:
+    OffscreenEnvironment(unsigned int width, unsigned int height);
+    virtual ~OffscreenEnvironment();
+
+    IFrame& CreateFrame();
+    OffscreenFrame& GetOffscreenFrame();
+    Devices::IMouse* GetMouse();
+    Devices::IKeyboard* GetKeyboard();
+    Devices::IJoystick* GetJoystick();
+
+    void Handle(Core::InitializeEventArg arg);
+    void Handle(Core::ProcessEventArg arg);
+    void Handle(Core::DeinitializeEventArg arg);
+
+private:
+    OffscreenFrame* frame;
+    Devices::IMouse* mouse;
+    Devices::IKeyboard* keyboard;
+    Devices::IJoystick* joystick;
+};
+
+} // NS Display
+} // NS OpenEngine
+
+#endif // _OE_OFFSCREEN_ENVIRONMENT_H_
@@ -0,0 +1,283 @@
+// Asynchronous logger writing on a background thread.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Logging/AsyncLogger.h>
+
+#include <Core/Thread.h>
+#include <Logging/Logger.h>
+#include <Logging/StreamLogger.h>
+
+#include <cstdio>
+#include <sstream>
+
+namespace OpenEngine {
+namespace Logging {
+
+using Core::Mutex;
+using Core::Thread;
+using std::string;
+
+// time the writer sleeps when the ring is empty
+static const unsigned int IDLE_USEC = 2000;
+
+// Drains the ring until stopped.
+class AsyncLogger::WriterThread : public Thread {
+    AsyncLogger& owner;
+    Mutex lock;
+    bool running;
+public:
+    WriterThread(AsyncLogger& owner) : owner(owner), running(true) {}
+    void Stop() {
+        lock.Lock();
+        running = false;
+        lock.Unlock();
+    }
+    bool IsRunning() {
+        lock.Lock();
+        bool r = running;
+        lock.Unlock();
+        return r;
+    }
+    void Run() {
+        while (IsRunning())
+            if (!owner.Drain()) Thread::Sleep(IDLE_USEC);
+    }
+};
+
+/**
+ * Create an asynchronous logger and start its writer thread.
+ *
+ * @param sink Logger to write the messages to on the writer thread,
+ *             owned by the asynchronous logger.
+ * @param capacity Messages the ring holds, rounded up to a power of
+ *                 two.
+ */
+AsyncLogger::AsyncLogger(ILogger* sink, unsigned int capacity)
+    : sink(sink)
+    , tail(0)
+    , head(0)
+    , drops(0)
+    , thread(NULL)
+    , filelog(NULL)
+    , maxBytes(0)
+    , maxFiles(0)
+    , limit(0)
+    , second(0)
+    , written(0)
+    , skipped(0)
+    , reported(0)
+    , lastType()
+    , repeats(0)
+{
+    unsigned int size = 1;
+    while (size < capacity) size <<= 1;
+    ring.resize(size);
+    for (unsigned int i = 0; i < size; ++i) ring[i].sequence = i;
+    timer.Start();
+    thread = new WriterThread(*this);
+    thread->Start();
+}
+
+/**
+ * Destroy the logger, writing the messages still in the ring.
+ * The logger must be removed from the Logger first.
+ */
+AsyncLogger::~AsyncLogger() {
+    thread->Stop();
+    thread->Wait();
+    delete thread;
+    Drain();
+    lock.Lock();
+    Summarize();
+    delete filelog;
+    file.close();
+    lock.Unlock();
+    delete sink;
+}
+
+/**
+ * Also write the messages to a file, rotated when it grows past a
+ * size. The file is moved to file.1, file.1 to file.2 and so on,
+ * keeping at most the given number of files including the current
+ * one. Messages are appended to an existing file.
+ *
+ * @param file Name of the log file, empty to stop writing a file.
+ * @param maxBytes Size the file is rotated at.
+ * @param maxFiles Number of files kept.
+ */
+void AsyncLogger::SetFile(string file, unsigned long maxBytes,
+                          unsigned int maxFiles) {
+    lock.Lock();
+    delete filelog;
+    filelog = NULL;
+    this->file.close();
+    this->file.clear();
+    filename = file;
+    this->maxBytes = maxBytes;
+    this->maxFiles = maxFiles;
+    bool failed = false;
+    if (!filename.empty()) {
+        this->file.open(filename.c_str(), std::ofstream::out | std::ofstream::app);
+        if (this->file.good()) filelog = new StreamLogger(&this->file);
+        else failed = true;
+    }
+    lock.Unlock();
+    if (failed)
+        logger.warning << "AsyncLogger: can not open log file '" << file
+                       << "'" << logger.end;
+}
+
+/**
+ * Limit the lines written each second. The lines beyond the limit
+ * are skipped and their number written at the end of the second.
+ *
+ * @param linesPerSecond Lines written each second, zero for no
+ *                       limit.
+ */
+void AsyncLogger::SetRateLimit(unsigned int linesPerSecond) {
+    lock.Lock();
+    limit = linesPerSecond;
+    lock.Unlock();
+}
+
+/**
+ * Get the number of messages dropped because the ring was full.
+ */
+unsigned int AsyncLogger::GetDropCount() const {
+    return drops;
+}
+
+/**
+ * Queue a message for the writer thread.
+ * May be called from any thread.
+ */
+void AsyncLogger::Write(LoggerType type, string msg) {
+    const unsigned int mask = ring.size() - 1;
+    unsigned int pos = tail;
+    for (;;) {
+        int diff = (int)(ring[pos & mask].sequence - pos);
+        if (diff == 0) {
+            if (__sync_bool_compare_and_swap(&tail, pos, pos + 1)) break;
+            pos = tail;
+        } else if (diff < 0) {
+            // the writer has not freed the slot of a lap ago
+            __sync_fetch_and_add(&drops, 1);
+            return;
+        } else
+            pos = tail;
+    }
+    Slot& slot = ring[pos & mask];
+    slot.type = type;
+    slot.msg.swap(msg);
+    __sync_synchronize();
+    slot.sequence = pos + 1;
+}
+
+// Write the queued messages on the writer thread. Returns false if
+// there were none.
+bool AsyncLogger::Drain() {
+    const unsigned int mask = ring.size() - 1;
+    bool any = false;
+    string msg;
+    lock.Lock();
+    for (;;) {
+        Slot& slot = ring[head & mask];
+        if (slot.sequence != head + 1) break;
+        __sync_synchronize();
+        LoggerType type = slot.type;
+        msg.swap(slot.msg);
+        slot.msg.clear();
+        __sync_synchronize();
+        slot.sequence = head + ring.size();
+        head++;
+        Output(type, msg);
+        any = true;
+    }
+    // the summaries of a quiet second are written as well
+    Tick();
+    lock.Unlock();
+    return any;
+}
+
+// Collapse repeats and apply the rate limit.
+void AsyncLogger::Output(LoggerType type, const string& msg) {
+    Tick();
+    if (!last.empty() && type == lastType && msg == last) {
+        repeats++;
+        return;
+    }
+    if (repeats > 0) {
+        std::ostringstream line;
+        line << "last message repeated " << repeats << " times";
+        Emit(lastType, line.str());
+        repeats = 0;
+    }
+    if (limit > 0 && written >= limit) {
+        skipped++;
+        return;
+    }
+    written++;
+    last = msg;
+    lastType = type;
+    Emit(type, msg);
+}
+
+void AsyncLogger::Emit(LoggerType type, const string& msg) {
+    sink->Write(type, msg);
+    if (filelog == NULL) return;
+    filelog->Write(type, msg);
+    if (maxBytes > 0 && (unsigned long)file.tellp() >= maxBytes) Rotate();
+}
+
+// Start a new second of the rate limit.
+void AsyncLogger::Tick() {
+    unsigned int now = timer.GetElapsedTime().AsInt() / 1000000;
+    if (now == second) return;
+    Summarize();
+    second = now;
+    written = 0;
+}
+
+// Write the repeats, skipped and dropped messages not yet reported.
+void AsyncLogger::Summarize() {
+    if (repeats > 0) {
+        std::ostringstream line;
+        line << "last message repeated " << repeats << " times";
+        Emit(lastType, line.str());
+        repeats = 0;
+    }
+    unsigned int dropped = drops - reported;
+    if (skipped == 0 && dropped == 0) return;
+    std::ostringstream line;
+    line << "AsyncLogger: skipped " << skipped
+         << " messages over the rate limit and dropped " << dropped
+         << " messages on a full queue";
+    // reported in the type of the last message
+    Emit(lastType, line.str());
+    skipped = 0;
+    reported += dropped;
+}
+
+void AsyncLogger::Rotate() {
+    file.close();
+    file.clear();
+    if (maxFiles <= 1)
+        std::remove(filename.c_str());
+    for (unsigned int i = maxFiles; i > 1; --i) {
+        std::ostringstream from, to;
+        from << filename;
+        if (i > 2) from << "." << i - 2;
+        to << filename << "." << i - 1;
+        std::rename(from.str().c_str(), to.str().c_str());
+    }
+    file.open(filename.c_str(), std::ofstream::out | std::ofstream::trunc);
+}
+
+} // NS Logging
+} // NS OpenEngine
@@ -0,0 +1,101 @@
+// Asynchronous logger writing on a background thread.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OE_ASYNC_LOGGER_H_
+#define _OE_ASYNC_LOGGER_H_
+
+#include <Core/Mutex.h>
+#include <Logging/ILogger.h>
+#include <Utils/Timer.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace OpenEngine {
+namespace Logging {
+
+class StreamLogger;
+
+/**
+ * Asynchronous logger writing on a background thread.
+ *
+ * Write() only moves the message into a fixed ring, without locks,
+ * and returns, so logging from the render thread or the loaders does
+ * not wait for formatting or output. A writer thread drains the ring
+ * into the wrapped logger and, if one is set with SetFile(), into a
+ * log file that is rotated when it grows past a size.
+ *
+ * Messages repeated back to back are written once, followed by a
+ * line with the number of repeats, and with a rate limit set the
+ * lines beyond it in a second are skipped and counted. Messages
+ * arriving while the ring is full are dropped and counted as well.
+ *
+ * @code
+ * AsyncLogger* log = new AsyncLogger(new ColorStreamLogger(&std::cout));
+ * log->SetFile("engine.log");
+ * Logger::AddLogger(log);
+ * @endcode
+ */
+class AsyncLogger : public ILogger {
+public:
+    AsyncLogger(ILogger* sink, unsigned int capacity = 4096);
+    virtual ~AsyncLogger();
+
+    void SetFile(std::string file, unsigned long maxBytes = 10ul << 20,
+                 unsigned int maxFiles = 3);
+    void SetRateLimit(unsigned int linesPerSecond);
+    unsigned int GetDropCount() const;
+
+    void Write(LoggerType type, std::string msg);
+
+private:
+    class WriterThread;
+
+    struct Slot {
+        // position the slot is free or full for, see Write()
+        volatile unsigned int sequence;
+        LoggerType type;
+        std::string msg;
+    };
+
+    ILogger* sink;
+    std::vector<Slot> ring;
+    // claimed by the producers, head is moved by the writer only
+    volatile unsigned int tail;
+    unsigned int head;
+    volatile unsigned int drops;
+    WriterThread* thread;
+
+    // guards the members below against the settings
+    Core::Mutex lock;
+    std::ofstream file;
+    StreamLogger* filelog;
+    std::string filename;
+    unsigned long maxBytes;
+    unsigned int maxFiles;
+    unsigned int limit;
+    Utils::Timer timer;
+    unsigned int second, written, skipped, reported;
+    LoggerType lastType;
+    std::string last;
+    unsigned int repeats;
+
+    bool Drain();
+    void Output(LoggerType type, const std::string& msg);
+    void Emit(LoggerType type, const std::string& msg);
+    void Tick();
+    void Summarize();
+    void Rotate();
+};
+
+} // NS Logging
+} // NS OpenEngine
+
+#endif // _OE_ASYNC_LOGGER_H_
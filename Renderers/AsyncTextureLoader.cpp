@@ -0,0 +1,359 @@
+// Asynchronous texture loader.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Renderers/AsyncTextureLoader.h>
+
+#include <Core/Exceptions.h>
+#include <Core/Thread.h>
+#include <Geometry/Face.h>
+#include <Geometry/FaceSet.h>
+#include <Geometry/Material.h>
+#include <Geometry/Mesh.h>
+#include <Logging/Logger.h>
+#include <Renderers/OpenGL/CompressedTextureCache.h>
+#include <Scene/GeometryNode.h>
+#include <Scene/ISceneNodeVisitor.h>
+#include <Scene/MeshNode.h>
+#include <Utils/Timer.h>
+
+namespace OpenEngine {
+namespace Renderers {
+
+using namespace Core;
+using namespace Geometry;
+using namespace Resources;
+using namespace Scene;
+using OpenGL::CompressedTextureCache;
+using Utils::Timer;
+
+/**
+ * Worker thread decoding queued textures.
+ * The thread exits as soon as there is nothing left in the decode
+ * queue, new threads are started on demand by Load().
+ */
+class AsyncTextureLoader::DecodeThread : public Thread {
+    AsyncTextureLoader& owner;
+public:
+    bool done;
+    DecodeThread(AsyncTextureLoader& owner) : owner(owner), done(false) {}
+    void Run() {
+        Request req(ITexture2DPtr(), TextureLoader::RELOAD_DEFAULT);
+        while (owner.NextDecode(this, req)) {
+            owner.Decode(req);
+            owner.Decoded(req);
+        }
+    }
+};
+
+/**
+ * Scheduler task decoding a single queued texture.
+ */
+class AsyncTextureLoader::DecodeTask : public ITask {
+    AsyncTextureLoader& owner;
+public:
+    DecodeTask(AsyncTextureLoader& owner) : owner(owner) {}
+    void Run() {
+        Request req(ITexture2DPtr(), TextureLoader::RELOAD_DEFAULT);
+        if (owner.NextDecode(NULL, req)) {
+            owner.Decode(req);
+            owner.Decoded(req);
+        }
+        delete this;
+    }
+};
+
+/**
+ * Scene visitor collecting all textures referenced from geometry.
+ */
+class TextureCollector : public ISceneNodeVisitor {
+    AsyncTextureLoader& loader;
+    TextureLoader::ReloadPolicy policy;
+public:
+    TextureCollector(AsyncTextureLoader& loader,
+                     TextureLoader::ReloadPolicy policy)
+        : loader(loader), policy(policy) {}
+    void VisitGeometryNode(GeometryNode* node) {
+        FaceSet* faces = node->GetFaceSet();
+        if (faces != NULL) {
+            for (FaceList::iterator itr = faces->begin();
+                 itr != faces->end(); ++itr)
+                if ((*itr)->mat && (*itr)->mat->texr)
+                    loader.Load((*itr)->mat->texr, policy);
+        }
+        node->VisitSubNodes(*this);
+    }
+    void VisitMeshNode(MeshNode* node) {
+        MaterialPtr mat = node->GetMesh()->GetMaterial();
+        if (mat && mat->texr)
+            loader.Load(mat->texr, policy);
+        node->VisitSubNodes(*this);
+    }
+};
+
+/**
+ * Create an asynchronous loader uploading through a texture loader.
+ * Asynchronous loading is disabled until SetAsync() is called.
+ *
+ * @param loader Texture loader used for the actual uploads.
+ */
+AsyncTextureLoader::AsyncTextureLoader(TextureLoader& loader)
+    : loader(loader)
+    , cache(NULL)
+    , scheduler(NULL)
+    , async(false)
+    , maxWorkers(2)
+    , budget(4000)
+    , running(0) {}
+
+/**
+ * Destroy the loader.
+ * Pending decodes are discarded and all workers are joined.
+ */
+AsyncTextureLoader::~AsyncTextureLoader() {
+    lock.Lock();
+    decodeQueue.clear();
+    lock.Unlock();
+    if (scheduler != NULL) scheduler->Wait(tasks);
+    for (std::list<DecodeThread*>::iterator itr = workers.begin();
+         itr != workers.end(); ++itr) {
+        (*itr)->Wait();
+        delete *itr;
+    }
+}
+
+/**
+ * Load all textures in a scene.
+ *
+ * @param node Scene to search for textures.
+ * @param policy Reload policy passed on to the texture loader.
+ */
+void AsyncTextureLoader::Load(ISceneNode& node,
+                              TextureLoader::ReloadPolicy policy) {
+    if (!async && cache == NULL) {
+        loader.Load(node, policy);
+        return;
+    }
+    TextureCollector collector(*this, policy);
+    node.Accept(collector);
+}
+
+/**
+ * Load a single texture.
+ * In asynchronous mode the texture is queued for decoding and will
+ * be uploaded during one of the following pre-process phases.
+ * Textures already waiting in the queues are ignored.
+ *
+ * @param texr Texture to load.
+ * @param policy Reload policy passed on to the texture loader.
+ */
+void AsyncTextureLoader::Load(ITexture2DPtr texr,
+                              TextureLoader::ReloadPolicy policy) {
+    if (!texr) return;
+    Timer timer;
+    timer.Start();
+    if (cache != NULL && cache->IsRegistered(texr)) {
+        // compressed textures are uploaded once
+        if (texr->GetID() != 0) return;
+        if (!async) {
+            if (!cache->Prepare(texr) || !cache->Upload(texr))
+                loader.Load(texr, policy);
+            stats.loads++;
+            stats.latency += timer.GetElapsedTime().AsInt();
+            return;
+        }
+    }
+    else if (!async) {
+        loader.Load(texr, policy);
+        stats.loads++;
+        stats.latency += timer.GetElapsedTime().AsInt();
+        return;
+    }
+    lock.Lock();
+    bool added = queued.insert(texr.get()).second;
+    if (added) decodeQueue.push_back(Request(texr, policy));
+    lock.Unlock();
+    if (scheduler == NULL) StartWorkers();
+    else if (added) scheduler->Submit(new DecodeTask(*this), &tasks);
+}
+
+/**
+ * Enable or disable asynchronous loading.
+ * Textures already queued will still be uploaded when disabling.
+ */
+void AsyncTextureLoader::SetAsync(bool enable) {
+    async = enable;
+}
+
+bool AsyncTextureLoader::IsAsync() const {
+    return async;
+}
+
+/**
+ * Set the maximum number of decode threads.
+ *
+ * @param workers Number of threads, at least one is used.
+ */
+void AsyncTextureLoader::SetWorkerCount(unsigned int workers) {
+    maxWorkers = (workers == 0) ? 1 : workers;
+}
+
+/**
+ * Set the amount of time spent uploading textures per frame.
+ *
+ * @param usec Upload budget in microseconds.
+ */
+void AsyncTextureLoader::SetUploadBudget(unsigned int usec) {
+    budget = usec;
+}
+
+/**
+ * Set the cache used to compress textures.
+ * Only affects textures loaded after the call.
+ *
+ * @param cache Compressed texture cache, NULL disables compression.
+ */
+void AsyncTextureLoader::SetCompression(CompressedTextureCache* cache) {
+    this->cache = cache;
+}
+
+/**
+ * Get the cache used to compress textures, NULL if disabled.
+ */
+CompressedTextureCache* AsyncTextureLoader::GetCompression() const {
+    return cache;
+}
+
+/**
+ * Decode on a task scheduler instead of the loader's own threads.
+ * Must be set before any texture is queued.
+ *
+ * @param scheduler Task scheduler, NULL to use the own threads.
+ */
+void AsyncTextureLoader::SetScheduler(TaskScheduler* scheduler) {
+    this->scheduler = scheduler;
+}
+
+/**
+ * Number of textures waiting to be decoded or uploaded.
+ */
+unsigned int AsyncTextureLoader::GetPendingCount() {
+    lock.Lock();
+    unsigned int count = queued.size();
+    lock.Unlock();
+    return count;
+}
+
+/**
+ * Get the loading statistics.
+ * Must be called on the render thread.
+ */
+AsyncTextureLoader::Stats AsyncTextureLoader::GetStats() const {
+    return stats;
+}
+
+/**
+ * Upload decoded textures within the upload budget.
+ */
+void AsyncTextureLoader::Handle(RenderingEventArg arg) {
+    ReapWorkers();
+    Timer timer;
+    timer.Start();
+    for (;;) {
+        lock.Lock();
+        if (uploadQueue.empty()) {
+            lock.Unlock();
+            break;
+        }
+        Request req = uploadQueue.front();
+        uploadQueue.pop_front();
+        queued.erase(req.texr.get());
+        lock.Unlock();
+
+        if (req.failed) {
+            logger.warning << "AsyncTextureLoader: failed decoding texture"
+                           << logger.end;
+            stats.failures++;
+        } else {
+            if (!req.compressed || !cache->Upload(req.texr))
+                loader.Load(req.texr, req.policy);
+            stats.loads++;
+            stats.latency += req.timer.GetElapsedTime().AsInt();
+        }
+
+        if ((unsigned int)timer.GetElapsedTime().AsInt() >= budget)
+            break;
+    }
+}
+
+bool AsyncTextureLoader::NextDecode(DecodeThread* worker, Request& req) {
+    lock.Lock();
+    if (decodeQueue.empty()) {
+        // the worker exits, it is reaped on the next pre-process
+        if (worker != NULL) {
+            worker->done = true;
+            running--;
+        }
+        lock.Unlock();
+        return false;
+    }
+    req = decodeQueue.front();
+    decodeQueue.pop_front();
+    lock.Unlock();
+    return true;
+}
+
+void AsyncTextureLoader::Decode(Request& req) {
+    try {
+        if (cache != NULL)
+            req.compressed = cache->Prepare(req.texr);
+        else
+            req.texr->Load();
+    } catch (Exception& e) {
+        // drop the image data, the upload will be skipped
+        req.texr->Unload();
+        req.failed = true;
+    }
+}
+
+void AsyncTextureLoader::Decoded(Request& req) {
+    lock.Lock();
+    uploadQueue.push_back(req);
+    lock.Unlock();
+}
+
+void AsyncTextureLoader::StartWorkers() {
+    lock.Lock();
+    while (running < maxWorkers && running < decodeQueue.size()) {
+        DecodeThread* t = new DecodeThread(*this);
+        workers.push_back(t);
+        running++;
+        t->Start();
+    }
+    lock.Unlock();
+}
+
+void AsyncTextureLoader::ReapWorkers() {
+    std::list<DecodeThread*> done;
+    lock.Lock();
+    std::list<DecodeThread*>::iterator itr = workers.begin();
+    while (itr != workers.end()) {
+        if ((*itr)->done) {
+            done.push_back(*itr);
+            itr = workers.erase(itr);
+        } else ++itr;
+    }
+    lock.Unlock();
+    for (itr = done.begin(); itr != done.end(); ++itr) {
+        (*itr)->Wait();
+        delete *itr;
+    }
+}
+
+} // NS Renderers
+} // NS OpenEngine
@@ -0,0 +1,139 @@
+// Asynchronous texture loader.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OE_ASYNC_TEXTURE_LOADER_H_
+#define _OE_ASYNC_TEXTURE_LOADER_H_
+
+#include <Core/IListener.h>
+#include <Core/Mutex.h>
+#include <Core/TaskScheduler.h>
+#include <Renderers/IRenderer.h>
+#include <Renderers/TextureLoader.h>
+#include <Resources/ITexture2D.h>
+#include <Utils/Timer.h>
+
+#include <list>
+#include <set>
+
+namespace OpenEngine {
+    namespace Scene {
+        class ISceneNode;
+    }
+namespace Renderers {
+    namespace OpenGL {
+        class CompressedTextureCache;
+    }
+
+/**
+ * Asynchronous texture loader.
+ *
+ * Decodes textures on a small set of worker threads and hands the
+ * decoded images back to the render thread where they are uploaded
+ * through an ordinary TextureLoader.
+ * The loader must be attached to the renderer pre-process event. On
+ * each pre-process at most the upload budget (in microseconds) is
+ * spent uploading textures, but at least one texture is uploaded per
+ * frame so that loading always progresses.
+ *
+ * When asynchronous loading is disabled (the default) all requests
+ * are forwarded directly to the texture loader.
+ *
+ * Textures that are not yet uploaded simply render without a texture
+ * bound.
+ *
+ * With a task scheduler set the textures are decoded as tasks on the
+ * scheduler instead of on the loader's own threads.
+ *
+ * With a compressed texture cache set, the textures registered with
+ * the cache are compressed as part of decoding and uploaded
+ * compressed, in both asynchronous and synchronous mode.
+ */
+class AsyncTextureLoader
+    : public Core::IListener<RenderingEventArg> {
+public:
+    /**
+     * Loading statistics, totals since creation. The latency is the
+     * time from a texture being requested to it being uploaded, in
+     * microseconds.
+     */
+    struct Stats {
+        unsigned int loads, failures;
+        unsigned long latency;
+        Stats() : loads(0), failures(0), latency(0) {}
+    };
+
+    AsyncTextureLoader(TextureLoader& loader);
+    virtual ~AsyncTextureLoader();
+
+    void Load(Scene::ISceneNode& node,
+              TextureLoader::ReloadPolicy policy = TextureLoader::RELOAD_DEFAULT);
+    void Load(Resources::ITexture2DPtr texr,
+              TextureLoader::ReloadPolicy policy = TextureLoader::RELOAD_DEFAULT);
+
+    void SetAsync(bool enable);
+    bool IsAsync() const;
+
+    void SetWorkerCount(unsigned int workers);
+    void SetUploadBudget(unsigned int usec);
+    void SetCompression(OpenGL::CompressedTextureCache* cache);
+    OpenGL::CompressedTextureCache* GetCompression() const;
+    void SetScheduler(Core::TaskScheduler* scheduler);
+
+    unsigned int GetPendingCount();
+    Stats GetStats() const;
+
+    void Handle(RenderingEventArg arg);
+
+private:
+    class DecodeThread;
+    class DecodeTask;
+
+    struct Request {
+        Resources::ITexture2DPtr texr;
+        TextureLoader::ReloadPolicy policy;
+        bool failed;
+        bool compressed;
+        // running since the request
+        Utils::Timer timer;
+        Request(Resources::ITexture2DPtr texr,
+                TextureLoader::ReloadPolicy policy)
+            : texr(texr), policy(policy), failed(false), compressed(false) {
+            timer.Start();
+        }
+    };
+
+    TextureLoader& loader;
+    OpenGL::CompressedTextureCache* cache;
+    Core::TaskScheduler* scheduler;
+    Core::TaskGroup tasks;
+    bool async;
+    unsigned int maxWorkers;
+    unsigned int budget;
+    // written on the render thread only
+    Stats stats;
+
+    // all members below are guarded by the lock
+    Core::Mutex lock;
+    std::list<Request> decodeQueue;
+    std::list<Request> uploadQueue;
+    std::set<Resources::ITexture2D*> queued;
+    std::list<DecodeThread*> workers;
+    unsigned int running;
+
+    bool NextDecode(DecodeThread* worker, Request& req);
+    void Decode(Request& req);
+    void Decoded(Request& req);
+    void StartWorkers();
+    void ReapWorkers();
+};
+
+} // NS Renderers
+} // NS OpenEngine
+
+#endif // _OE_ASYNC_TEXTURE_LOADER_H_
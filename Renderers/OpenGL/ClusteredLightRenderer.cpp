@@ -0,0 +1,591 @@
+// Clustered light renderer.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Renderers/OpenGL/ClusteredLightRenderer.h>
+
+#include <Display/IRenderCanvas.h>
+#include <Display/IViewingVolume.h>
+#include <Geometry/Face.h>
+#include <Geometry/FaceSet.h>
+#include <Geometry/Material.h>
+#include <Geometry/Mesh.h>
+#include <Logging/Logger.h>
+#include <Math/Vector.h>
+#include <Meta/OpenGL.h>
+#include <Resources/IShaderResource.h>
+#include <Scene/DirectionalLightNode.h>
+#include <Scene/GeometryNode.h>
+#include <Scene/ISceneNodeVisitor.h>
+#include <Scene/MeshNode.h>
+#include <Scene/PointLightNode.h>
+#include <Scene/SpotLightNode.h>
+#include <Scene/TransformationNode.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace OpenEngine {
+namespace Renderers {
+namespace OpenGL {
+
+using namespace Geometry;
+using namespace Math;
+using namespace Resources;
+using namespace Scene;
+
+// light intensity below which a light is considered out of range
+static const float INTENSITY_LIMIT = 1.0f / 256.0f;
+
+// out = a * b, column major 4x4 matrices
+static void Multiply(const float* a, const float* b, float* out) {
+    for (unsigned int c = 0; c < 4; ++c)
+        for (unsigned int r = 0; r < 4; ++r) {
+            float sum = 0;
+            for (unsigned int k = 0; k < 4; ++k)
+                sum += a[k*4 + r] * b[c*4 + k];
+            out[c*4 + r] = sum;
+        }
+}
+
+// out = m * (v, w), keeping the first three components
+static void Transform(const float* m, const float* v, float w, float* out) {
+    for (unsigned int r = 0; r < 3; ++r)
+        out[r] = m[r] * v[0] + m[4 + r] * v[1] + m[8 + r] * v[2] + m[12 + r] * w;
+}
+
+static void Copy(const Vector<4,float>& v, float* out) {
+    for (unsigned int i = 0; i < 4; ++i) out[i] = v[i];
+}
+
+// Distance at which the attenuated intensity falls below the limit,
+// negative if the light never falls off.
+static float Range(float c, float l, float q) {
+    const float inv = 1.0f / INTENSITY_LIMIT;
+    if (c >= inv) return 0.0f;
+    if (q > 0.0f) return (-l + std::sqrt(l*l - 4.0f*q*(c - inv))) / (2.0f*q);
+    if (l > 0.0f) return (inv - c) / l;
+    return -1.0f;
+}
+
+static bool IsGlobal(const ClusteredLightRenderer::Light& l) {
+    return l.type == ClusteredLightRenderer::Light::DIRECTIONAL || l.radius < 0;
+}
+
+/**
+ * Scene visitor collecting lights in view space.
+ */
+class LightCollector : public ISceneNodeVisitor {
+    typedef ClusteredLightRenderer::Light Light;
+    std::vector<Light>& lights;
+    // stack of column major model view transformations
+    std::vector<float> stack;
+
+    const float* Top() const { return &stack[stack.size() - 16]; }
+
+    void Colors(LightNode* node, Light& l) {
+        Copy(node->ambient, l.ambient);
+        Copy(node->diffuse, l.diffuse);
+        Copy(node->specular, l.specular);
+    }
+
+    void Place(Light& l) {
+        static const float origin[3] = { 0, 0, 0 };
+        static const float forward[3] = { 0, 0, -1 };
+        Transform(Top(), origin, 1.0f, l.position);
+        Transform(Top(), forward, 0.0f, l.direction);
+        float len = std::sqrt(l.direction[0]*l.direction[0] +
+                              l.direction[1]*l.direction[1] +
+                              l.direction[2]*l.direction[2]);
+        if (len > 0)
+            for (unsigned int i = 0; i < 3; ++i) l.direction[i] /= len;
+    }
+public:
+    LightCollector(std::vector<Light>& lights, const float view[16])
+        : lights(lights), stack(view, view + 16) {}
+
+    void VisitTransformationNode(TransformationNode* node) {
+        float local[16], m[16];
+        node->GetTransformationMatrix().ToArray(local);
+        Multiply(Top(), local, m);
+        stack.insert(stack.end(), m, m + 16);
+        node->VisitSubNodes(*this);
+        stack.resize(stack.size() - 16);
+    }
+
+    void VisitDirectionalLightNode(DirectionalLightNode* node) {
+        Light l;
+        l.type = Light::DIRECTIONAL;
+        Colors(node, l);
+        Place(l);
+        l.attenuation[0] = 1;
+        l.attenuation[1] = l.attenuation[2] = 0;
+        l.radius = -1;
+        l.cutoff = 180;
+        l.exponent = 0;
+        lights.push_back(l);
+        node->VisitSubNodes(*this);
+    }
+
+    void VisitPointLightNode(PointLightNode* node) {
+        Light l;
+        l.type = Light::POINT;
+        Colors(node, l);
+        Place(l);
+        l.attenuation[0] = node->constAtt;
+        l.attenuation[1] = node->linearAtt;
+        l.attenuation[2] = node->quadAtt;
+        l.radius = Range(node->constAtt, node->linearAtt, node->quadAtt);
+        l.cutoff = 180;
+        l.exponent = 0;
+        lights.push_back(l);
+        node->VisitSubNodes(*this);
+    }
+
+    void VisitSpotLightNode(SpotLightNode* node) {
+        Light l;
+        l.type = Light::SPOT;
+        Colors(node, l);
+        Place(l);
+        l.attenuation[0] = node->constAtt;
+        l.attenuation[1] = node->linearAtt;
+        l.attenuation[2] = node->quadAtt;
+        l.radius = Range(node->constAtt, node->linearAtt, node->quadAtt);
+        l.cutoff = node->cutoff;
+        l.exponent = node->exponent;
+        lights.push_back(l);
+        node->VisitSubNodes(*this);
+    }
+};
+
+/**
+ * Scene visitor collecting the shaders of all materials.
+ */
+class ShaderCollector : public ISceneNodeVisitor {
+    std::set<IShaderResource*>& shaders;
+public:
+    ShaderCollector(std::set<IShaderResource*>& shaders) : shaders(shaders) {}
+    void VisitGeometryNode(GeometryNode* node) {
+        FaceSet* faces = node->GetFaceSet();
+        if (faces != NULL)
+            for (FaceList::iterator itr = faces->begin();
+                 itr != faces->end(); ++itr)
+                if ((*itr)->mat && (*itr)->mat->shad)
+                    shaders.insert((*itr)->mat->shad.get());
+        node->VisitSubNodes(*this);
+    }
+    void VisitMeshNode(MeshNode* node) {
+        MaterialPtr mat = node->GetMesh()->GetMaterial();
+        if (mat && mat->shad) shaders.insert(mat->shad.get());
+        node->VisitSubNodes(*this);
+    }
+};
+
+// Orders lights by importance for the fixed function lights.
+class Importance {
+    const std::vector<ClusteredLightRenderer::Light>& lights;
+public:
+    Importance(const std::vector<ClusteredLightRenderer::Light>& lights)
+        : lights(lights) {}
+    bool operator()(unsigned int a, unsigned int b) const {
+        const ClusteredLightRenderer::Light& la = lights[a];
+        const ClusteredLightRenderer::Light& lb = lights[b];
+        if (IsGlobal(la) != IsGlobal(lb)) return IsGlobal(la);
+        const float* pa = la.position;
+        const float* pb = lb.position;
+        return pa[0]*pa[0] + pa[1]*pa[1] + pa[2]*pa[2] <
+               pb[0]*pb[0] + pb[1]*pb[1] + pb[2]*pb[2];
+    }
+};
+
+ClusteredLightRenderer::ClusteredLightRenderer()
+    : scene(NULL)
+    , supported(false)
+    , initialized(false)
+    , shadersDirty(true)
+    , clusters(TILES_X * TILES_Y * SLICES) {
+    textures[0] = textures[1] = textures[2] = 0;
+}
+
+ClusteredLightRenderer::~ClusteredLightRenderer() {
+    if (textures[0] != 0) glDeleteTextures(3, textures);
+}
+
+/**
+ * Set the scene to light.
+ * When no scene is set the scene of the canvas is used.
+ *
+ * @param scene Scene containing the lights.
+ */
+void ClusteredLightRenderer::SetScene(ISceneNode* scene) {
+    this->scene = scene;
+    shadersDirty = true;
+}
+
+/**
+ * Point the light samplers of all shaders in the scene at the light
+ * textures again in the next frame. Call it when shaders have been
+ * rebuilt, as their programs lose the sampler bindings.
+ */
+void ClusteredLightRenderer::InvalidateShaders() {
+    configured.clear();
+    shadersDirty = true;
+}
+
+/**
+ * Number of lights in the scene in the last frame.
+ */
+unsigned int ClusteredLightRenderer::GetLightCount() const {
+    return lights.size();
+}
+
+/**
+ * Number of lights that survived culling in the last frame.
+ */
+unsigned int ClusteredLightRenderer::GetVisibleCount() const {
+    return visible.size();
+}
+
+/**
+ * GLSL source of the clustered lighting functions.
+ * Prepend it to a fragment shader and call
+ * @code oe_ClusteredLighting(position, normal, diffuse) @endcode
+ * with the view space position and normal of the fragment to get the
+ * diffuse light of all lights affecting it.
+ */
+const char* ClusteredLightRenderer::GetShaderSource() {
+    return
+        "uniform sampler2D oe_LightData;\n"
+        "uniform sampler2D oe_LightClusters;\n"
+        "uniform sampler2D oe_LightIndices;\n"
+        "const float OE_TILES_X = 16.0;\n"
+        "const float OE_TILES_Y = 9.0;\n"
+        "const float OE_SLICES = 24.0;\n"
+        "const vec2 OE_LIGHT_SIZE = vec2(4.0, 1024.0);\n"
+        "const vec2 OE_INDEX_SIZE = vec2(1024.0, 256.0);\n"
+        "vec4 oe_Light(float row, float col) {\n"
+        "    return texture2D(oe_LightData, (vec2(col, row) + 0.5) / OE_LIGHT_SIZE);\n"
+        "}\n"
+        "vec3 oe_Shade(float row, vec3 p, vec3 n, vec3 diffuse) {\n"
+        "    vec4 pos = oe_Light(row, 0.0);\n"
+        "    vec4 col = oe_Light(row, 1.0);\n"
+        "    vec4 dir = oe_Light(row, 2.0);\n"
+        "    vec4 att = oe_Light(row, 3.0);\n"
+        "    vec3 l = -dir.xyz;\n"
+        "    float a = 1.0;\n"
+        "    if (col.w > 0.5) {\n"
+        "        l = pos.xyz - p;\n"
+        "        float d = length(l);\n"
+        "        l /= d;\n"
+        "        a = 1.0 / (att.x + att.y * d + att.z * d * d);\n"
+        "        if (pos.w >= 0.0 && d > pos.w) a = 0.0;\n"
+        "        if (col.w > 1.5) {\n"
+        "            float s = dot(-l, dir.xyz);\n"
+        "            a *= (s < dir.w) ? 0.0 : pow(s, att.w);\n"
+        "        }\n"
+        "    }\n"
+        "    return col.rgb * diffuse * max(dot(n, l), 0.0) * a;\n"
+        "}\n"
+        "vec3 oe_ClusteredLighting(vec3 p, vec3 n, vec3 diffuse) {\n"
+        "    vec4 grid = oe_Light(0.0, 0.0);\n"
+        "    vec4 depth = oe_Light(0.0, 1.0);\n"
+        "    vec4 view = oe_Light(0.0, 2.0);\n"
+        "    vec3 result = vec3(0.0);\n"
+        "    for (float i = 0.0; i < grid.w; i += 1.0)\n"
+        "        result += oe_Shade(i + 1.0, p, n, diffuse);\n"
+        "    vec2 tile = floor(gl_FragCoord.xy / view.xy * vec2(OE_TILES_X, OE_TILES_Y));\n"
+        "    float slice = floor(log(-p.z / depth.x) / depth.z * OE_SLICES);\n"
+        "    slice = clamp(slice, 0.0, OE_SLICES - 1.0);\n"
+        "    vec2 cell = vec2(tile.x + tile.y * OE_TILES_X, slice);\n"
+        "    vec2 list = texture2D(oe_LightClusters,\n"
+        "        (cell + 0.5) / vec2(OE_TILES_X * OE_TILES_Y, OE_SLICES)).ra;\n"
+        "    for (float i = 0.0; i < list.y; i += 1.0) {\n"
+        "        float k = list.x + i;\n"
+        "        vec2 at = vec2(mod(k, OE_INDEX_SIZE.x), floor(k / OE_INDEX_SIZE.x));\n"
+        "        float row = texture2D(oe_LightIndices, (at + 0.5) / OE_INDEX_SIZE).r;\n"
+        "        result += oe_Shade(row, p, n, diffuse);\n"
+        "    }\n"
+        "    return result;\n"
+        "}\n";
+}
+
+/**
+ * Cull, bin and upload the lights of the scene.
+ */
+void ClusteredLightRenderer::Handle(RenderingEventArg arg) {
+    if (!initialized) Initialize();
+    ISceneNode* root = (scene != NULL) ? scene : arg.canvas.GetScene();
+    if (root == NULL) return;
+
+    Display::IViewingVolume* volume = arg.canvas.GetViewingVolume();
+    float view[16], proj[16];
+    volume->GetViewMatrix().ToArray(view);
+    volume->GetProjectionMatrix().ToArray(proj);
+    // near and far planes of a perspective projection
+    float zNear = proj[14] / (proj[10] - 1.0f);
+    float zFar = proj[14] / (proj[10] + 1.0f);
+
+    Collect(*root, view);
+    Cull(proj);
+    SetFixedFunction();
+    if (!supported) return;
+    Bin(proj, zNear, zFar);
+    Upload(arg.canvas.GetWidth(), arg.canvas.GetHeight(), zNear, zFar);
+    if (shadersDirty) {
+        ConfigureShaders(*root);
+        shadersDirty = false;
+    }
+}
+
+void ClusteredLightRenderer::Initialize() {
+    initialized = true;
+    supported = GLEW_ARB_texture_float && GLEW_ARB_shader_objects;
+    if (!supported) {
+        logger.warning << "ClusteredLightRenderer: float textures not "
+                       << "supported, only fixed function lights are set"
+                       << logger.end;
+        return;
+    }
+    glGenTextures(3, textures);
+    const GLint formats[3] = {
+        GL_RGBA32F_ARB, GL_LUMINANCE_ALPHA32F_ARB, GL_LUMINANCE32F_ARB
+    };
+    const GLenum layouts[3] = { GL_RGBA, GL_LUMINANCE_ALPHA, GL_LUMINANCE };
+    const GLsizei widths[3] = { 4, TILES_X * TILES_Y, INDEX_WIDTH };
+    const GLsizei heights[3] = { MAX_LIGHTS + 1, SLICES, INDEX_HEIGHT };
+    for (unsigned int i = 0; i < 3; ++i) {
+        glBindTexture(GL_TEXTURE_2D, textures[i]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexImage2D(GL_TEXTURE_2D, 0, formats[i], widths[i], heights[i], 0,
+                     layouts[i], GL_FLOAT, NULL);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    lightData.resize(4 * 4 * (MAX_LIGHTS + 1));
+    clusterData.resize(2 * TILES_X * TILES_Y * SLICES);
+}
+
+void ClusteredLightRenderer::Collect(ISceneNode& root, const float view[16]) {
+    lights.clear();
+    LightCollector collector(lights, view);
+    root.Accept(collector);
+}
+
+// Keep the global lights and the local lights whose sphere of
+// influence intersects the frustum. Global lights come first.
+void ClusteredLightRenderer::Cull(const float proj[16]) {
+    // view space frustum planes, (a, b, c, d) with the inside positive
+    float planes[6][4];
+    for (unsigned int i = 0; i < 3; ++i)
+        for (unsigned int k = 0; k < 4; ++k) {
+            planes[2*i][k]     = proj[k*4 + 3] + proj[k*4 + i];
+            planes[2*i + 1][k] = proj[k*4 + 3] - proj[k*4 + i];
+        }
+    visible.clear();
+    for (unsigned int i = 0; i < lights.size() && visible.size() < MAX_LIGHTS; ++i)
+        if (IsGlobal(lights[i])) visible.push_back(i);
+    for (unsigned int i = 0; i < lights.size() && visible.size() < MAX_LIGHTS; ++i) {
+        const Light& l = lights[i];
+        if (IsGlobal(l) || l.radius <= 0) continue;
+        bool inside = true;
+        for (unsigned int p = 0; p < 6 && inside; ++p) {
+            const float* pl = planes[p];
+            float len = std::sqrt(pl[0]*pl[0] + pl[1]*pl[1] + pl[2]*pl[2]);
+            float d = pl[0]*l.position[0] + pl[1]*l.position[1] +
+                      pl[2]*l.position[2] + pl[3];
+            inside = d >= -l.radius * len;
+        }
+        if (inside) visible.push_back(i);
+    }
+}
+
+// Add each visible local light to the clusters its sphere overlaps.
+void ClusteredLightRenderer::Bin(const float proj[16], float zNear, float zFar) {
+    for (unsigned int i = 0; i < clusters.size(); ++i)
+        clusters[i].clear();
+    float logDepth = std::log(zFar / zNear);
+    for (unsigned int k = 0; k < visible.size(); ++k) {
+        const Light& l = lights[visible[k]];
+        if (IsGlobal(l)) continue;
+        const float* c = l.position;
+        float r = l.radius;
+
+        float zmin = std::max(zNear, -c[2] - r);
+        float zmax = std::min(zFar, -c[2] + r);
+        if (zmin > zmax) continue;
+        int s0 = (int)(std::log(zmin / zNear) / logDepth * SLICES);
+        int s1 = (int)(std::log(zmax / zNear) / logDepth * SLICES);
+        s0 = std::max(0, std::min((int)SLICES - 1, s0));
+        s1 = std::max(0, std::min((int)SLICES - 1, s1));
+
+        // screen rectangle of the bounding box, all of the screen if
+        // the box reaches behind the near plane
+        float x0 = -1, x1 = 1, y0 = -1, y1 = 1;
+        if (-c[2] - r > zNear) {
+            x0 = y0 = 1;
+            x1 = y1 = -1;
+            for (unsigned int i = 0; i < 8; ++i) {
+                float v[3] = { c[0] + ((i & 1) ? r : -r),
+                               c[1] + ((i & 2) ? r : -r),
+                               c[2] + ((i & 4) ? r : -r) };
+                float x = proj[0]*v[0] + proj[4]*v[1] + proj[8]*v[2] + proj[12];
+                float y = proj[1]*v[0] + proj[5]*v[1] + proj[9]*v[2] + proj[13];
+                float w = proj[3]*v[0] + proj[7]*v[1] + proj[11]*v[2] + proj[15];
+                x0 = std::min(x0, x / w);
+                x1 = std::max(x1, x / w);
+                y0 = std::min(y0, y / w);
+                y1 = std::max(y1, y / w);
+            }
+        }
+        if (x0 > 1 || x1 < -1 || y0 > 1 || y1 < -1) continue;
+        int tx0 = std::max(0, (int)((x0 * 0.5f + 0.5f) * TILES_X));
+        int tx1 = std::min((int)TILES_X - 1, (int)((x1 * 0.5f + 0.5f) * TILES_X));
+        int ty0 = std::max(0, (int)((y0 * 0.5f + 0.5f) * TILES_Y));
+        int ty1 = std::min((int)TILES_Y - 1, (int)((y1 * 0.5f + 0.5f) * TILES_Y));
+
+        for (int s = s0; s <= s1; ++s)
+            for (int y = ty0; y <= ty1; ++y)
+                for (int x = tx0; x <= tx1; ++x)
+                    clusters[(s * TILES_Y + y) * TILES_X + x].push_back(k);
+    }
+}
+
+void ClusteredLightRenderer::Upload(unsigned int width, unsigned int height,
+                                    float zNear, float zFar) {
+    unsigned int globals = 0;
+    while (globals < visible.size() && IsGlobal(lights[visible[globals]]))
+        globals++;
+
+    // row zero holds the grid description, each light a row after it
+    float* p = &lightData[0];
+    p[0] = TILES_X; p[1] = TILES_Y; p[2] = SLICES; p[3] = globals;
+    p[4] = zNear; p[5] = zFar; p[6] = std::log(zFar / zNear); p[7] = visible.size();
+    p[8] = width; p[9] = height; p[10] = 0; p[11] = 0;
+    p[12] = p[13] = p[14] = p[15] = 0;
+    for (unsigned int k = 0; k < visible.size(); ++k) {
+        const Light& l = lights[visible[k]];
+        float* t = &lightData[16 * (k + 1)];
+        t[0] = l.position[0]; t[1] = l.position[1]; t[2] = l.position[2];
+        t[3] = l.radius;
+        t[4] = l.diffuse[0]; t[5] = l.diffuse[1]; t[6] = l.diffuse[2];
+        t[7] = l.type;
+        t[8] = l.direction[0]; t[9] = l.direction[1]; t[10] = l.direction[2];
+        t[11] = std::cos(l.cutoff * 3.14159265f / 180.0f);
+        t[12] = l.attenuation[0]; t[13] = l.attenuation[1];
+        t[14] = l.attenuation[2]; t[15] = l.exponent;
+    }
+
+    // flatten the cluster lists, indices refer to light rows
+    indexData.clear();
+    const unsigned int capacity = INDEX_WIDTH * INDEX_HEIGHT;
+    for (unsigned int i = 0; i < clusters.size(); ++i) {
+        std::vector<unsigned int>& list = clusters[i];
+        unsigned int count = std::min((unsigned int)list.size(),
+                                      capacity - (unsigned int)indexData.size());
+        clusterData[2*i] = indexData.size();
+        clusterData[2*i + 1] = count;
+        for (unsigned int j = 0; j < count; ++j)
+            indexData.push_back(list[j] + 1);
+    }
+    unsigned int rows = (indexData.size() + INDEX_WIDTH - 1) / INDEX_WIDTH;
+    indexData.resize(rows * INDEX_WIDTH, 0.0f);
+
+    glBindTexture(GL_TEXTURE_2D, textures[0]);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 4, visible.size() + 1,
+                    GL_RGBA, GL_FLOAT, &lightData[0]);
+    glBindTexture(GL_TEXTURE_2D, textures[1]);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, TILES_X * TILES_Y, SLICES,
+                    GL_LUMINANCE_ALPHA, GL_FLOAT, &clusterData[0]);
+    glBindTexture(GL_TEXTURE_2D, textures[2]);
+    if (rows > 0)
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, INDEX_WIDTH, rows,
+                        GL_LUMINANCE, GL_FLOAT, &indexData[0]);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    const unsigned int units[3] = { LIGHT_UNIT, CLUSTER_UNIT, INDEX_UNIT };
+    for (unsigned int i = 0; i < 3; ++i) {
+        glActiveTexture(GL_TEXTURE0 + units[i]);
+        glBindTexture(GL_TEXTURE_2D, textures[i]);
+    }
+    glActiveTexture(GL_TEXTURE0);
+}
+
+// Set the most important lights as fixed function lights. The light
+// positions are already in view space.
+void ClusteredLightRenderer::SetFixedFunction() {
+    std::vector<unsigned int> order(visible);
+    std::sort(order.begin(), order.end(), Importance(lights));
+    GLint max = 8;
+    glGetIntegerv(GL_MAX_LIGHTS, &max);
+
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
+    for (GLint i = 0; i < max; ++i) {
+        GLenum id = GL_LIGHT0 + i;
+        if ((unsigned int)i >= order.size()) {
+            glDisable(id);
+            continue;
+        }
+        const Light& l = lights[order[i]];
+        GLfloat pos[4];
+        if (l.type == Light::DIRECTIONAL) {
+            pos[0] = -l.direction[0];
+            pos[1] = -l.direction[1];
+            pos[2] = -l.direction[2];
+            pos[3] = 0;
+        } else {
+            pos[0] = l.position[0];
+            pos[1] = l.position[1];
+            pos[2] = l.position[2];
+            pos[3] = 1;
+        }
+        glLightfv(id, GL_POSITION, pos);
+        glLightfv(id, GL_AMBIENT, l.ambient);
+        glLightfv(id, GL_DIFFUSE, l.diffuse);
+        glLightfv(id, GL_SPECULAR, l.specular);
+        glLightf(id, GL_CONSTANT_ATTENUATION, l.attenuation[0]);
+        glLightf(id, GL_LINEAR_ATTENUATION, l.attenuation[1]);
+        glLightf(id, GL_QUADRATIC_ATTENUATION, l.attenuation[2]);
+        glLightfv(id, GL_SPOT_DIRECTION, l.direction);
+        glLightf(id, GL_SPOT_CUTOFF, l.type == Light::SPOT ? l.cutoff : 180.0f);
+        glLightf(id, GL_SPOT_EXPONENT, l.exponent);
+        glEnable(id);
+    }
+    glPopMatrix();
+}
+
+// Point the light samplers of every shader in the scene at the light
+// texture units.
+void ClusteredLightRenderer::ConfigureShaders(ISceneNode& root) {
+    std::set<IShaderResource*> shaders;
+    ShaderCollector collector(shaders);
+    root.Accept(collector);
+    for (std::set<IShaderResource*>::iterator itr = shaders.begin();
+         itr != shaders.end(); ++itr) {
+        if (!configured.insert(*itr).second) continue;
+        (*itr)->ApplyShader();
+        GLint program = 0;
+        glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+        if (program != 0) {
+            GLint loc = glGetUniformLocation(program, "oe_LightData");
+            if (loc >= 0) glUniform1i(loc, LIGHT_UNIT);
+            loc = glGetUniformLocation(program, "oe_LightClusters");
+            if (loc >= 0) glUniform1i(loc, CLUSTER_UNIT);
+            loc = glGetUniformLocation(program, "oe_LightIndices");
+            if (loc >= 0) glUniform1i(loc, INDEX_UNIT);
+        }
+        (*itr)->ReleaseShader();
+    }
+}
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
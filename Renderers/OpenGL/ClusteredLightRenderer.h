@@ -0,0 +1,124 @@
+// Clustered light renderer.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OE_OPENGL_CLUSTERED_LIGHT_RENDERER_H_
+#define _OE_OPENGL_CLUSTERED_LIGHT_RENDERER_H_
+
+#include <Core/IListener.h>
+#include <Renderers/IRenderer.h>
+
+#include <set>
+#include <vector>
+
+namespace OpenEngine {
+    namespace Resources {
+        class IShaderResource;
+    }
+    namespace Scene {
+        class ISceneNode;
+    }
+namespace Renderers {
+namespace OpenGL {
+
+/**
+ * Clustered light renderer.
+ *
+ * Replaces the LightRenderer for scenes with many lights. Each frame
+ * the lights of the scene are culled against the view frustum and
+ * the visible lights are binned into a grid of clusters, screen space
+ * tiles split into exponential depth slices. The lights and the
+ * cluster lists are uploaded as float textures which shaders sample
+ * to light a fragment with only the lights of its cluster, see
+ * GetShaderSource().
+ *
+ * The few most important lights, directional lights first and then
+ * the point and spot lights nearest to the camera, are also set as
+ * fixed function lights so materials without shaders are still lit.
+ *
+ * The sampler uniforms of the shaders used by the scene are set the
+ * first time the renderer sees them. Call SetScene() again when the
+ * materials of the scene change.
+ *
+ * Attach the renderer to the renderer pre-process event.
+ */
+class ClusteredLightRenderer
+    : public Core::IListener<RenderingEventArg> {
+public:
+    // cluster grid and capacity, must match the shader source
+    static const unsigned int TILES_X = 16;
+    static const unsigned int TILES_Y = 9;
+    static const unsigned int SLICES = 24;
+    static const unsigned int MAX_LIGHTS = 1023;
+    static const unsigned int INDEX_WIDTH = 1024;
+    static const unsigned int INDEX_HEIGHT = 256;
+
+    // texture units the light data is bound to
+    static const unsigned int LIGHT_UNIT = 5;
+    static const unsigned int CLUSTER_UNIT = 6;
+    static const unsigned int INDEX_UNIT = 7;
+
+    ClusteredLightRenderer();
+    virtual ~ClusteredLightRenderer();
+
+    void SetScene(Scene::ISceneNode* scene);
+    void InvalidateShaders();
+
+    unsigned int GetLightCount() const;
+    unsigned int GetVisibleCount() const;
+
+    static const char* GetShaderSource();
+
+    void Handle(RenderingEventArg arg);
+
+    /**
+     * Light in view space.
+     */
+    struct Light {
+        enum Type { DIRECTIONAL = 0, POINT = 1, SPOT = 2 };
+        Type type;
+        float position[3];
+        float direction[3];
+        float ambient[4], diffuse[4], specular[4];
+        float attenuation[3];
+        float radius;
+        float cutoff, exponent;
+    };
+
+private:
+    Scene::ISceneNode* scene;
+    bool supported;
+    bool initialized;
+    bool shadersDirty;
+    unsigned int textures[3];
+    std::set<Resources::IShaderResource*> configured;
+
+    std::vector<Light> lights;
+    std::vector<unsigned int> visible;
+    std::vector<std::vector<unsigned int> > clusters;
+
+    // texture data uploaded each frame
+    std::vector<float> lightData;
+    std::vector<float> clusterData;
+    std::vector<float> indexData;
+
+    void Initialize();
+    void Collect(Scene::ISceneNode& root, const float view[16]);
+    void Cull(const float proj[16]);
+    void Bin(const float proj[16], float zNear, float zFar);
+    void Upload(unsigned int width, unsigned int height,
+                float zNear, float zFar);
+    void SetFixedFunction();
+    void ConfigureShaders(Scene::ISceneNode& root);
+};
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
+
+#endif // _OE_OPENGL_CLUSTERED_LIGHT_RENDERER_H_
@@ -0,0 +1,504 @@
+// Compressed texture cache.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Renderers/OpenGL/CompressedTextureCache.h>
+
+#include <Meta/OpenGL.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sys/stat.h>
+
+namespace OpenEngine {
+namespace Renderers {
+namespace OpenGL {
+
+using namespace Core;
+using namespace Resources;
+using std::string;
+using std::vector;
+
+// cache file layout, all values are native endian 32 bit:
+//   magic, version, format, width, height, level count,
+//   per level: size in bytes, compressed blocks
+static const char CACHE_MAGIC[4] = { 'O', 'E', 'D', 'X' };
+static const unsigned int CACHE_VERSION = 1;
+
+static unsigned short Pack565(const int c[3]) {
+    return ((c[0] >> 3) << 11) | ((c[1] >> 2) << 5) | (c[2] >> 3);
+}
+
+static void Unpack565(unsigned short v, int c[3]) {
+    int r = (v >> 11) & 31, g = (v >> 5) & 63, b = v & 31;
+    c[0] = (r << 3) | (r >> 2);
+    c[1] = (g << 2) | (g >> 4);
+    c[2] = (b << 3) | (b >> 2);
+}
+
+// Encode the colors of a 4x4 RGBA block as a DXT1 block. The end
+// points are the inset corners of the color bounding box, ordered so
+// the block always uses the four color mode.
+static void EncodeColorBlock(const unsigned char* block, unsigned char* out) {
+    int mn[3] = { 255, 255, 255 }, mx[3] = { 0, 0, 0 };
+    for (unsigned int i = 0; i < 16; ++i)
+        for (unsigned int c = 0; c < 3; ++c) {
+            mn[c] = std::min(mn[c], (int)block[i*4 + c]);
+            mx[c] = std::max(mx[c], (int)block[i*4 + c]);
+        }
+    for (unsigned int c = 0; c < 3; ++c) {
+        int inset = (mx[c] - mn[c]) >> 4;
+        mn[c] += inset;
+        mx[c] -= inset;
+    }
+    // packing preserves the ordering, so c0 >= c1
+    unsigned short c0 = Pack565(mx), c1 = Pack565(mn);
+    unsigned int indices = 0;
+    if (c0 != c1) {
+        int p[4][3];
+        Unpack565(c0, p[0]);
+        Unpack565(c1, p[1]);
+        for (unsigned int c = 0; c < 3; ++c) {
+            p[2][c] = (2*p[0][c] + p[1][c]) / 3;
+            p[3][c] = (p[0][c] + 2*p[1][c]) / 3;
+        }
+        for (unsigned int i = 0; i < 16; ++i) {
+            unsigned int best = 0;
+            int bestDist = 1 << 30;
+            for (unsigned int j = 0; j < 4; ++j) {
+                int dist = 0;
+                for (unsigned int c = 0; c < 3; ++c) {
+                    int d = block[i*4 + c] - p[j][c];
+                    dist += d * d;
+                }
+                if (dist < bestDist) {
+                    bestDist = dist;
+                    best = j;
+                }
+            }
+            indices |= best << (2*i);
+        }
+    }
+    out[0] = c0 & 0xff;
+    out[1] = c0 >> 8;
+    out[2] = c1 & 0xff;
+    out[3] = c1 >> 8;
+    for (unsigned int i = 0; i < 4; ++i)
+        out[4 + i] = (indices >> (8*i)) & 0xff;
+}
+
+// Encode the alpha of a 4x4 RGBA block as a DXT5 alpha block using
+// the eight value mode.
+static void EncodeAlphaBlock(const unsigned char* block, unsigned char* out) {
+    int mn = 255, mx = 0;
+    for (unsigned int i = 0; i < 16; ++i) {
+        mn = std::min(mn, (int)block[i*4 + 3]);
+        mx = std::max(mx, (int)block[i*4 + 3]);
+    }
+    out[0] = mx;
+    out[1] = mn;
+    memset(out + 2, 0, 6);
+    if (mx == mn) return;
+    int a[8];
+    a[0] = mx;
+    a[1] = mn;
+    for (unsigned int i = 2; i < 8; ++i)
+        a[i] = ((8 - i) * mx + (i - 1) * mn) / 7;
+    for (unsigned int i = 0; i < 16; ++i) {
+        unsigned int best = 0;
+        int bestDist = 256;
+        for (unsigned int j = 0; j < 8; ++j) {
+            int d = std::abs(block[i*4 + 3] - a[j]);
+            if (d < bestDist) {
+                bestDist = d;
+                best = j;
+            }
+        }
+        unsigned int bit = 3*i;
+        out[2 + bit/8] |= (best << (bit % 8)) & 0xff;
+        if (bit % 8 > 5)
+            out[3 + bit/8] |= best >> (8 - bit % 8);
+    }
+}
+
+static void EncodeLevel(const unsigned char* pixels,
+                        unsigned int width, unsigned int height,
+                        unsigned int channels,
+                        CompressedTextureCache::Format format,
+                        vector<unsigned char>& out) {
+    unsigned int bw = (width + 3) / 4, bh = (height + 3) / 4;
+    unsigned int blockSize = (format == CompressedTextureCache::DXT1) ? 8 : 16;
+    out.resize(bw * bh * blockSize);
+    unsigned char block[64];
+    for (unsigned int by = 0; by < bh; ++by)
+        for (unsigned int bx = 0; bx < bw; ++bx) {
+            // gather the block as rgba, clamping at the image border
+            for (unsigned int y = 0; y < 4; ++y)
+                for (unsigned int x = 0; x < 4; ++x) {
+                    unsigned int px = std::min(bx*4 + x, width - 1);
+                    unsigned int py = std::min(by*4 + y, height - 1);
+                    const unsigned char* src =
+                        pixels + (py * width + px) * channels;
+                    unsigned char* dst = block + (y*4 + x) * 4;
+                    dst[0] = src[0];
+                    dst[1] = src[1];
+                    dst[2] = src[2];
+                    dst[3] = (channels == 4) ? src[3] : 255;
+                }
+            unsigned char* p = &out[(by * bw + bx) * blockSize];
+            if (format == CompressedTextureCache::DXT5) {
+                EncodeAlphaBlock(block, p);
+                p += 8;
+            }
+            EncodeColorBlock(block, p);
+        }
+}
+
+// Halve an image with a box filter.
+static void Downsample(vector<unsigned char>& pixels,
+                       unsigned int& width, unsigned int& height,
+                       unsigned int channels) {
+    unsigned int w = std::max(1u, width / 2), h = std::max(1u, height / 2);
+    vector<unsigned char> dst(w * h * channels);
+    for (unsigned int y = 0; y < h; ++y) {
+        unsigned int y0 = std::min(2*y, height - 1);
+        unsigned int y1 = std::min(2*y + 1, height - 1);
+        for (unsigned int x = 0; x < w; ++x) {
+            unsigned int x0 = std::min(2*x, width - 1);
+            unsigned int x1 = std::min(2*x + 1, width - 1);
+            for (unsigned int c = 0; c < channels; ++c) {
+                unsigned int sum =
+                    pixels[(y0 * width + x0) * channels + c] +
+                    pixels[(y0 * width + x1) * channels + c] +
+                    pixels[(y1 * width + x0) * channels + c] +
+                    pixels[(y1 * width + x1) * channels + c];
+                dst[(y * w + x) * channels + c] = (sum + 2) / 4;
+            }
+        }
+    }
+    pixels.swap(dst);
+    width = w;
+    height = h;
+}
+
+// entries are not pruned below this count
+static const unsigned int MIN_PRUNE = 64;
+
+CompressedTextureCache::CompressedTextureCache()
+    : pruneAt(MIN_PRUNE) {}
+
+CompressedTextureCache::~CompressedTextureCache() {
+    for (std::map<ITexture2D*, Entry>::iterator itr = entries.begin();
+         itr != entries.end(); ++itr)
+        delete itr->second.image;
+}
+
+/**
+ * Register a texture loaded from an image file.
+ *
+ * @param texr Texture to compress.
+ * @param file Image file the texture is loaded from.
+ */
+void CompressedTextureCache::Register(ITexture2DPtr texr, string file) {
+    lock.Lock();
+    if (entries.size() >= pruneAt) Prune();
+    Entry& e = entries[texr.get()];
+    delete e.image;
+    e.texr = texr;
+    e.file = file;
+    e.image = NULL;
+    e.width = e.height = 0;
+    lock.Unlock();
+}
+
+bool CompressedTextureCache::IsRegistered(ITexture2DPtr texr) {
+    string file;
+    return Lookup(texr, file);
+}
+
+/**
+ * Get the size of a prepared texture, taken from the cache header
+ * when the texture was read from the cache.
+ *
+ * @param texr Texture.
+ * @param width Set to the width of the largest level.
+ * @param height Set to the height of the largest level.
+ * @return False if the texture has not been prepared compressed.
+ */
+bool CompressedTextureCache::GetSize(ITexture2DPtr texr,
+                                     unsigned int& width,
+                                     unsigned int& height) {
+    bool found = false;
+    lock.Lock();
+    std::map<ITexture2D*, Entry>::iterator itr = entries.find(texr.get());
+    if (itr != entries.end() && itr->second.texr.lock() == texr &&
+        itr->second.width != 0) {
+        width = itr->second.width;
+        height = itr->second.height;
+        found = true;
+    }
+    lock.Unlock();
+    return found;
+}
+
+/**
+ * Prepare a texture for uploading.
+ * Reads the compressed image from the cache, or decodes and
+ * compresses the image and writes the cache. Textures that are not
+ * registered or can not be compressed are loaded as usual.
+ * Safe to call from any thread.
+ *
+ * @param texr Texture to prepare.
+ * @return True if a compressed image is ready for Upload(), false if
+ *         the texture was loaded for an ordinary upload.
+ */
+bool CompressedTextureCache::Prepare(ITexture2DPtr texr) {
+    string file;
+    if (!Lookup(texr, file)) {
+        texr->Load();
+        return false;
+    }
+    Image image;
+    if (!CacheIsFresh(file) || !ReadCache(file, image)) {
+        texr->Load();
+        unsigned int channels = texr->GetDepth() / 8;
+        if ((channels != 3 && channels != 4) || texr->GetData() == NULL)
+            return false;
+        const unsigned char* pixels = texr->GetData();
+        vector<unsigned char> swizzled;
+        if (texr->GetColorFormat() == BGR || texr->GetColorFormat() == BGRA) {
+            // the encoder expects red first
+            unsigned int size =
+                texr->GetWidth() * texr->GetHeight() * channels;
+            swizzled.assign(pixels, pixels + size);
+            for (unsigned int i = 0; i < size; i += channels)
+                std::swap(swizzled[i], swizzled[i + 2]);
+            pixels = &swizzled[0];
+        } else if (texr->GetColorFormat() != RGB &&
+                   texr->GetColorFormat() != RGBA)
+            return false;
+        Compress(pixels, texr->GetWidth(), texr->GetHeight(),
+                 channels, image);
+        texr->Unload();
+        WriteCache(file, image);
+    }
+    Image* ready = new Image();
+    ready->format = image.format;
+    ready->width = image.width;
+    ready->height = image.height;
+    ready->levels.swap(image.levels);
+    lock.Lock();
+    Entry& e = entries[texr.get()];
+    delete e.image;
+    e.image = ready;
+    e.width = ready->width;
+    e.height = ready->height;
+    lock.Unlock();
+    return true;
+}
+
+/**
+ * Upload a prepared texture.
+ * Must be called on the render thread. When the driver does not
+ * support DXT compression the texture is loaded uncompressed
+ * instead.
+ *
+ * @param texr Texture to upload.
+ * @return True if the texture was uploaded, false if it was loaded
+ *         for an ordinary upload.
+ */
+bool CompressedTextureCache::Upload(ITexture2DPtr texr) {
+    Image* image = NULL;
+    lock.Lock();
+    std::map<ITexture2D*, Entry>::iterator itr = entries.find(texr.get());
+    if (itr != entries.end()) {
+        image = itr->second.image;
+        itr->second.image = NULL;
+    }
+    lock.Unlock();
+
+    if (image == NULL || !GLEW_EXT_texture_compression_s3tc) {
+        delete image;
+        texr->Load();
+        return false;
+    }
+
+    GLenum format = (image->format == DXT1)
+        ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+        : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    GLuint id;
+    glGenTextures(1, &id);
+    glBindTexture(GL_TEXTURE_2D, id);
+    unsigned int w = image->width, h = image->height;
+    for (unsigned int i = 0; i < image->levels.size(); ++i) {
+        glCompressedTexImage2D(GL_TEXTURE_2D, i, format, w, h, 0,
+                               image->levels[i].size(),
+                               &image->levels[i][0]);
+        w = std::max(1u, w / 2);
+        h = std::max(1u, h / 2);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL,
+                    image->levels.size() - 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                    GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    texr->SetID(id);
+    delete image;
+    return true;
+}
+
+/**
+ * Compress an image with a full mip chain.
+ * Three channel images are compressed as DXT1, four channel images
+ * as DXT5.
+ *
+ * @param pixels Tightly packed pixels.
+ * @param width Image width.
+ * @param height Image height.
+ * @param channels Number of channels, 3 or 4.
+ * @param image Resulting compressed image.
+ */
+void CompressedTextureCache::Compress(const unsigned char* pixels,
+                                      unsigned int width,
+                                      unsigned int height,
+                                      unsigned int channels,
+                                      Image& image) {
+    image.format = (channels == 4) ? DXT5 : DXT1;
+    image.width = width;
+    image.height = height;
+    image.levels.clear();
+    vector<unsigned char> level(pixels, pixels + width * height * channels);
+    for (;;) {
+        image.levels.push_back(vector<unsigned char>());
+        EncodeLevel(&level[0], width, height, channels,
+                    image.format, image.levels.back());
+        if (width == 1 && height == 1) break;
+        Downsample(level, width, height, channels);
+    }
+}
+
+bool CompressedTextureCache::Lookup(ITexture2DPtr texr, string& file) {
+    bool found = false;
+    lock.Lock();
+    std::map<ITexture2D*, Entry>::iterator itr = entries.find(texr.get());
+    if (itr != entries.end() && itr->second.texr.lock() == texr) {
+        file = itr->second.file;
+        found = true;
+    }
+    lock.Unlock();
+    return found;
+}
+
+// Remove the entries of released textures. Called with the lock held
+// when the entries have doubled since the last prune.
+void CompressedTextureCache::Prune() {
+    std::map<ITexture2D*, Entry>::iterator itr = entries.begin();
+    while (itr != entries.end()) {
+        if (!itr->second.texr.expired()) {
+            ++itr;
+            continue;
+        }
+        delete itr->second.image;
+        entries.erase(itr++);
+    }
+    pruneAt = std::max(MIN_PRUNE, (unsigned int)entries.size() * 2);
+}
+
+string CompressedTextureCache::CacheFile(const string& file) {
+    return file + ".oedxt";
+}
+
+bool CompressedTextureCache::CacheIsFresh(const string& file) {
+    struct stat src, cache;
+    if (stat(file.c_str(), &src) != 0) return false;
+    if (stat(CacheFile(file).c_str(), &cache) != 0) return false;
+    return cache.st_mtime >= src.st_mtime;
+}
+
+bool CompressedTextureCache::ReadCache(const string& file, Image& image) {
+    std::ifstream in(CacheFile(file).c_str(), std::ios::binary);
+    if (!in) return false;
+    unsigned int header[6];
+    in.read((char*)header, sizeof(header));
+    if (!in.good() ||
+        memcmp(header, CACHE_MAGIC, 4) != 0 ||
+        header[1] != CACHE_VERSION ||
+        header[2] > DXT5 ||
+        header[3] == 0 || header[4] == 0 ||
+        header[5] == 0 || header[5] > 32)
+        return false;
+    image.format = (Format)header[2];
+    image.width = header[3];
+    image.height = header[4];
+    image.levels.resize(header[5]);
+    for (unsigned int i = 0; i < header[5]; ++i) {
+        unsigned int size = 0;
+        in.read((char*)&size, 4);
+        if (!in.good() || size == 0 || size > (1u << 28)) return false;
+        image.levels[i].resize(size);
+        in.read((char*)&image.levels[i][0], size);
+    }
+    return in.good();
+}
+
+void CompressedTextureCache::WriteCache(const string& file,
+                                        const Image& image) {
+    string cache = CacheFile(file);
+    std::ofstream out(cache.c_str(), std::ios::binary | std::ios::trunc);
+    if (!out) return;
+    unsigned int header[6];
+    memcpy(header, CACHE_MAGIC, 4);
+    header[1] = CACHE_VERSION;
+    header[2] = image.format;
+    header[3] = image.width;
+    header[4] = image.height;
+    header[5] = image.levels.size();
+    out.write((const char*)header, sizeof(header));
+    for (unsigned int i = 0; i < image.levels.size(); ++i) {
+        unsigned int size = image.levels[i].size();
+        out.write((const char*)&size, 4);
+        out.write((const char*)&image.levels[i][0], size);
+    }
+    if (!out.good()) {
+        out.close();
+        remove(cache.c_str());
+    }
+}
+
+/**
+ * Create the plug-in.
+ *
+ * @param cache Cache to register the textures with, deleted with the
+ *              plug-in.
+ */
+CompressedTexturePlugin::CompressedTexturePlugin(CompressedTextureCache* cache)
+    : cache(cache) {
+    this->AddExtension("png");
+    this->AddExtension("jpg");
+    this->AddExtension("jpeg");
+    this->AddExtension("tga");
+    this->AddExtension("bmp");
+}
+
+CompressedTexturePlugin::~CompressedTexturePlugin() {
+    delete cache;
+}
+
+ITexture2DPtr CompressedTexturePlugin::CreateResource(string file) {
+    ITexture2DPtr texr = images.CreateResource(file);
+    cache->Register(texr, file);
+    return texr;
+}
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
@@ -0,0 +1,118 @@
+// Compressed texture cache.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OE_OPENGL_COMPRESSED_TEXTURE_CACHE_H_
+#define _OE_OPENGL_COMPRESSED_TEXTURE_CACHE_H_
+
+#include <Core/Mutex.h>
+#include <Resources/IResourcePlugin.h>
+#include <Resources/ITexture2D.h>
+#include <Resources/SDLImage.h>
+
+#include <boost/weak_ptr.hpp>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace OpenEngine {
+namespace Renderers {
+namespace OpenGL {
+
+/**
+ * Compressed texture cache.
+ *
+ * Textures registered with the cache are transcoded to DXT1 (RGB) or
+ * DXT5 (RGBA) with a full mip chain the first time they are loaded,
+ * and the result is written next to the image file with the
+ * extension ".oedxt". Later loads read the cache instead of decoding
+ * the image, as long as the cache is not older than the image.
+ *
+ * Prepare() does the decoding and compression and may run on any
+ * thread, Upload() creates the GL texture and must run on the render
+ * thread. Register textures through the CompressedTexturePlugin.
+ *
+ * Compressed textures are uploaded once and are not reloaded when
+ * the image changes. A texture read from the cache is never loaded,
+ * so its size is only known to the cache, see GetSize().
+ */
+class CompressedTextureCache {
+public:
+    enum Format { DXT1, DXT5 };
+
+    /**
+     * Compressed image with its mip levels, largest first.
+     */
+    struct Image {
+        Format format;
+        unsigned int width, height;
+        std::vector<std::vector<unsigned char> > levels;
+    };
+
+    CompressedTextureCache();
+    virtual ~CompressedTextureCache();
+
+    void Register(Resources::ITexture2DPtr texr, std::string file);
+    bool IsRegistered(Resources::ITexture2DPtr texr);
+    bool GetSize(Resources::ITexture2DPtr texr,
+                 unsigned int& width, unsigned int& height);
+
+    bool Prepare(Resources::ITexture2DPtr texr);
+    bool Upload(Resources::ITexture2DPtr texr);
+
+    static void Compress(const unsigned char* pixels,
+                         unsigned int width, unsigned int height,
+                         unsigned int channels, Image& image);
+
+private:
+    struct Entry {
+        boost::weak_ptr<Resources::ITexture2D> texr;
+        std::string file;
+        Image* image;
+        // size of the prepared image, zero until prepared
+        unsigned int width, height;
+        Entry() : image(NULL), width(0), height(0) {}
+    };
+
+    // guards the entries
+    Core::Mutex lock;
+    std::map<Resources::ITexture2D*, Entry> entries;
+    // entry count at which the released textures are removed
+    unsigned int pruneAt;
+
+    bool Lookup(Resources::ITexture2DPtr texr, std::string& file);
+    void Prune();
+    static std::string CacheFile(const std::string& file);
+    static bool CacheIsFresh(const std::string& file);
+    static bool ReadCache(const std::string& file, Image& image);
+    static void WriteCache(const std::string& file, const Image& image);
+};
+
+/**
+ * Image plug-in registering the created textures with a compressed
+ * texture cache. The images themselves are loaded by the SDL image
+ * plug-in. Register it before the SDL image plug-in to take
+ * precedence. The plug-in owns the cache, as registered plug-ins live
+ * as long as the resource manager.
+ */
+class CompressedTexturePlugin
+    : public Resources::IResourcePlugin<Resources::ITexture2D> {
+public:
+    CompressedTexturePlugin(CompressedTextureCache* cache);
+    virtual ~CompressedTexturePlugin();
+    Resources::ITexture2DPtr CreateResource(std::string file);
+private:
+    CompressedTextureCache* cache;
+    Resources::SDLImagePlugin images;
+};
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
+
+#endif // _OE_OPENGL_COMPRESSED_TEXTURE_CACHE_H_
@@ -0,0 +1,487 @@
+// State sorted draw list.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Renderers/OpenGL/DrawList.h>
+
+#include <Geometry/FaceSet.h>
+#include <Meta/OpenGL.h>
+#include <Renderers/OpenGL/ProgramCache.h>
+#include <Resources/IShaderResource.h>
+#include <Resources/ITexture2D.h>
+
+#include <algorithm>
+
+namespace OpenEngine {
+namespace Renderers {
+namespace OpenGL {
+
+using namespace Geometry;
+using namespace Resources;
+
+// number of frames a face set may go unseen before its batches are
+// dropped from the cache
+static const unsigned int EVICT_FRAMES = 120;
+
+// fewest copies of a batch drawn with an instanced call
+static const unsigned int MIN_INSTANCES = 4;
+
+// fixed function transformation with a per-instance model matrix
+static const char* INSTANCE_VERTEX =
+    "#version 120\n"
+    "attribute mat4 oe_InstanceMatrix;\n"
+    "varying vec3 position;\n"
+    "varying vec3 normal;\n"
+    "void main() {\n"
+    "    vec4 p = gl_ModelViewMatrix * (oe_InstanceMatrix * gl_Vertex);\n"
+    "    position = p.xyz;\n"
+    "    normal = gl_NormalMatrix * (mat3(oe_InstanceMatrix) * gl_Normal);\n"
+    "    gl_FrontColor = gl_Color;\n"
+    "    gl_TexCoord[0] = gl_MultiTexCoord0;\n"
+    "    gl_Position = gl_ProjectionMatrix * p;\n"
+    "}\n";
+
+// fixed function lighting of the first enabled lights, per fragment
+static const char* INSTANCE_FRAGMENT =
+    "#version 120\n"
+    "uniform int oe_LightCount;\n"
+    "uniform bool oe_Lighting;\n"
+    "uniform bool oe_Textured;\n"
+    "uniform sampler2D oe_Texture;\n"
+    "varying vec3 position;\n"
+    "varying vec3 normal;\n"
+    "void main() {\n"
+    "    vec4 color = gl_Color;\n"
+    "    if (oe_Lighting) {\n"
+    "        vec3 n = normalize(normal);\n"
+    "        vec3 e = -normalize(position);\n"
+    "        color = gl_FrontLightModelProduct.sceneColor;\n"
+    "        for (int i = 0; i < 8; ++i) {\n"
+    "            if (i >= oe_LightCount) break;\n"
+    "            vec4 lp = gl_LightSource[i].position;\n"
+    "            vec3 l = lp.xyz;\n"
+    "            float att = 1.0;\n"
+    "            if (lp.w != 0.0) {\n"
+    "                l = lp.xyz - position;\n"
+    "                float d = length(l);\n"
+    "                att = 1.0 / (gl_LightSource[i].constantAttenuation +\n"
+    "                             gl_LightSource[i].linearAttenuation * d +\n"
+    "                             gl_LightSource[i].quadraticAttenuation * d * d);\n"
+    "            }\n"
+    "            l = normalize(l);\n"
+    "            float nl = max(dot(n, l), 0.0);\n"
+    "            float s = 0.0;\n"
+    "            if (nl > 0.0)\n"
+    "                s = pow(max(dot(n, normalize(l + e)), 0.0),\n"
+    "                        gl_FrontMaterial.shininess);\n"
+    "            color += att * (gl_FrontLightProduct[i].ambient +\n"
+    "                            nl * gl_FrontLightProduct[i].diffuse +\n"
+    "                            s * gl_FrontLightProduct[i].specular);\n"
+    "        }\n"
+    "        color.a = gl_FrontMaterial.diffuse.a;\n"
+    "    }\n"
+    "    if (oe_Textured) color *= texture2D(oe_Texture, gl_TexCoord[0].st);\n"
+    "    gl_FragColor = color;\n"
+    "}\n";
+
+bool DrawList::Item::operator<(const Item& other) const {
+    if (shader != other.shader) return shader < other.shader;
+    if (texture != other.texture) return texture < other.texture;
+    if (material != other.material) return material < other.material;
+    if (batch != other.batch) return batch < other.batch;
+    return matrix < other.matrix;
+}
+
+DrawList::DrawList()
+    : sorted(false), submitted(false)
+    , frame(0), draws(0), changes(0), instanced(0)
+    , instancing(true)
+    , initialized(false)
+    , cache(NULL)
+    , ownCache(NULL)
+    , pending(0)
+    , program(0)
+    , matrixLoc(-1), lightCountLoc(-1), lightingLoc(-1)
+    , texturedLoc(-1), textureLoc(-1) {}
+
+/**
+ * Destroy the list.
+ * Buffers of instanced batches are left to the GL context.
+ */
+DrawList::~DrawList() {
+    Clear();
+    delete ownCache;
+}
+
+/**
+ * Enable or disable drawing repeated face sets instanced.
+ * Instancing is enabled by default.
+ */
+void DrawList::SetInstancing(bool enable) {
+    instancing = enable;
+}
+
+/**
+ * Build the instancing program through a program cache, so its
+ * binary is kept between runs. Must be set before the first flush.
+ *
+ * @param cache Cache to use, NULL for a cache of the list's own.
+ */
+void DrawList::SetProgramCache(ProgramCache* cache) {
+    this->cache = cache;
+}
+
+/**
+ * Add a face set to the list.
+ *
+ * @param faces Face set to draw.
+ * @param modelview Column major model transformation of the faces,
+ *                  relative to the view transformation in effect when
+ *                  the list is flushed.
+ */
+void DrawList::Add(FaceSet* faces, const float modelview[16]) {
+    if (faces == NULL || faces->Size() == 0) return;
+    Chunk* chunk = Lookup(faces);
+    chunk->lastUsed = frame;
+
+    unsigned int matrix = matrices.size();
+    matrices.insert(matrices.end(), modelview, modelview + 16);
+
+    for (std::vector<Batch*>::iterator itr = chunk->batches.begin();
+         itr != chunk->batches.end(); ++itr) {
+        Material* mat = (*itr)->mat.get();
+        Item item;
+        item.shader  = (mat && mat->shad) ? (void*)mat->shad.get() : NULL;
+        item.texture = (mat && mat->texr) ? mat->texr->GetID() : 0;
+        item.material = mat;
+        item.matrix = matrix;
+        item.batch = *itr;
+        items.push_back(item);
+    }
+    sorted = false;
+}
+
+/**
+ * Sort and submit all geometry added since the last flush, and start
+ * a new frame.
+ */
+void DrawList::Flush() {
+    Submit();
+    Discard();
+}
+
+/**
+ * Sort and submit all geometry added since the last flush, keeping
+ * it in the list. Submitting again draws the same geometry with the
+ * transformations then in effect, such as those of another view.
+ * The counters sum up all submissions until the next flush.
+ */
+void DrawList::Submit() {
+    if (!sorted) std::sort(items.begin(), items.end());
+    sorted = true;
+
+    if (!submitted) draws = changes = instanced = 0;
+    submitted = true;
+    if (!garbage.empty()) {
+        glDeleteBuffersARB(garbage.size(), &garbage[0]);
+        garbage.clear();
+    }
+    if (instancing && !initialized) InitializeInstancing();
+    if (pending != 0 && cache->IsReady(pending - 1)) {
+        program = cache->GetProgram(pending - 1);
+        pending = 0;
+        if (program != 0) {
+            matrixLoc = glGetAttribLocation(program, "oe_InstanceMatrix");
+            lightCountLoc = glGetUniformLocation(program, "oe_LightCount");
+            lightingLoc = glGetUniformLocation(program, "oe_Lighting");
+            texturedLoc = glGetUniformLocation(program, "oe_Textured");
+            textureLoc = glGetUniformLocation(program, "oe_Texture");
+            if (matrixLoc < 0) program = 0;
+        }
+    }
+    bool instance = instancing && program != 0;
+
+    glPushAttrib(GL_ENABLE_BIT | GL_LIGHTING_BIT | GL_TEXTURE_BIT);
+    glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_NORMAL_ARRAY);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+
+    void* shader = NULL;
+    unsigned int texture = 0;
+    Material* material = NULL;
+    bool first = true;
+    for (std::vector<Item>::iterator itr = items.begin();
+         itr != items.end(); ) {
+        if (first || itr->shader != shader) {
+            if (shader != NULL)
+                ((IShaderResource*)shader)->ReleaseShader();
+            if (itr->shader != NULL)
+                ((IShaderResource*)itr->shader)->ApplyShader();
+            shader = itr->shader;
+            changes++;
+        }
+        if (first || itr->texture != texture) {
+            if (itr->texture != 0) {
+                glEnable(GL_TEXTURE_2D);
+                glBindTexture(GL_TEXTURE_2D, itr->texture);
+            } else
+                glDisable(GL_TEXTURE_2D);
+            texture = itr->texture;
+            changes++;
+        }
+        if (first || itr->material != material) {
+            ApplyMaterial(itr->material);
+            material = itr->material;
+            changes++;
+        }
+        first = false;
+
+        // the copies of a batch are next to each other after sorting
+        if (instance && itr->shader == NULL) {
+            std::vector<Item>::iterator end = itr + 1;
+            while (end != items.end() && end->batch == itr->batch) ++end;
+            if ((unsigned int)(end - itr) >= MIN_INSTANCES) {
+                DrawInstanced(itr, end);
+                itr = end;
+                continue;
+            }
+        }
+        Draw(*itr++);
+    }
+    if (shader != NULL)
+        ((IShaderResource*)shader)->ReleaseShader();
+
+    glPopClientAttrib();
+    glPopAttrib();
+}
+
+/**
+ * Drop the geometry added since the last flush without drawing it,
+ * and start a new frame.
+ */
+void DrawList::Discard() {
+    items.clear();
+    matrices.clear();
+    submitted = false;
+    if (++frame % EVICT_FRAMES == 0) Evict();
+}
+
+/**
+ * Drop the cached batches of a face set.
+ * Must be called if the faces of a face set change.
+ */
+void DrawList::Invalidate(FaceSet* faces) {
+    std::map<FaceSet*, Chunk*>::iterator itr = chunks.find(faces);
+    if (itr == chunks.end()) return;
+    for (std::vector<Batch*>::iterator b = itr->second->batches.begin();
+         b != itr->second->batches.end(); ++b) {
+        if ((*b)->vbo != 0) garbage.push_back((*b)->vbo);
+        if ((*b)->instanceVbo != 0) garbage.push_back((*b)->instanceVbo);
+        delete *b;
+    }
+    delete itr->second;
+    chunks.erase(itr);
+}
+
+/**
+ * Drop all cached batches.
+ */
+void DrawList::Clear() {
+    while (!chunks.empty())
+        Invalidate(chunks.begin()->first);
+    items.clear();
+    matrices.clear();
+}
+
+/**
+ * Number of draw calls issued by the last flush.
+ */
+unsigned int DrawList::GetDrawCount() const {
+    return draws;
+}
+
+/**
+ * Number of shader, texture and material changes in the last flush.
+ */
+unsigned int DrawList::GetStateChangeCount() const {
+    return changes;
+}
+
+/**
+ * Number of copies drawn by instanced calls in the last flush.
+ */
+unsigned int DrawList::GetInstanceCount() const {
+    return instanced;
+}
+
+DrawList::Chunk* DrawList::Lookup(FaceSet* faces) {
+    std::map<FaceSet*, Chunk*>::iterator itr = chunks.find(faces);
+    if (itr != chunks.end()) {
+        Chunk* c = itr->second;
+        // a new face set may reuse the address of a deleted one
+        if (!c->first.expired() &&
+            c->first.lock() == *faces->begin() &&
+            c->size == faces->Size())
+            return c;
+        Invalidate(faces);
+    }
+    Chunk* c = Build(faces);
+    chunks[faces] = c;
+    return c;
+}
+
+DrawList::Chunk* DrawList::Build(FaceSet* faces) {
+    Chunk* chunk = new Chunk();
+    chunk->first = *faces->begin();
+    chunk->size = faces->Size();
+    chunk->lastUsed = frame;
+
+    std::map<Material*, Batch*> bymat;
+    for (FaceList::iterator itr = faces->begin();
+         itr != faces->end(); ++itr) {
+        FacePtr f = *itr;
+        Batch*& b = bymat[f->mat.get()];
+        if (b == NULL) {
+            b = new Batch();
+            b->mat = f->mat;
+            b->count = 0;
+            b->vbo = b->instanceVbo = 0;
+            chunk->batches.push_back(b);
+        }
+        float v[3], n[3], t[2];
+        for (unsigned int i = 0; i < 3; ++i) {
+            f->vert[i].ToArray(v);
+            f->norm[i].ToArray(n);
+            f->texc[i].ToArray(t);
+            b->verts.insert(b->verts.end(), v, v + 3);
+            b->norms.insert(b->norms.end(), n, n + 3);
+            b->texcs.insert(b->texcs.end(), t, t + 2);
+        }
+        b->count += 3;
+    }
+    return chunk;
+}
+
+void DrawList::Evict() {
+    std::vector<FaceSet*> old;
+    for (std::map<FaceSet*, Chunk*>::iterator itr = chunks.begin();
+         itr != chunks.end(); ++itr)
+        if (frame - itr->second->lastUsed > EVICT_FRAMES)
+            old.push_back(itr->first);
+    for (std::vector<FaceSet*>::iterator itr = old.begin();
+         itr != old.end(); ++itr)
+        Invalidate(*itr);
+}
+
+void DrawList::InitializeInstancing() {
+    initialized = true;
+    if (!GLEW_ARB_instanced_arrays || !GLEW_ARB_draw_instanced ||
+        !GLEW_ARB_vertex_buffer_object || !GLEW_VERSION_2_0)
+        return;
+    if (cache == NULL) cache = ownCache = new ProgramCache("");
+    pending = cache->Submit(INSTANCE_VERTEX, INSTANCE_FRAGMENT) + 1;
+}
+
+void DrawList::Draw(const Item& item) {
+    Batch* b = item.batch;
+    glPushMatrix();
+    glMultMatrixf(&matrices[item.matrix]);
+    glVertexPointer(3, GL_FLOAT, 0, &b->verts[0]);
+    glNormalPointer(GL_FLOAT, 0, &b->norms[0]);
+    glTexCoordPointer(2, GL_FLOAT, 0, &b->texcs[0]);
+    glDrawArrays(GL_TRIANGLES, 0, b->count);
+    glPopMatrix();
+    draws++;
+}
+
+// Draw the copies of a batch with one call. The vertices are moved
+// to a buffer the first time, the instance buffer is only uploaded
+// when the set of transformations differs from the previous frame.
+void DrawList::DrawInstanced(std::vector<Item>::iterator begin,
+                             std::vector<Item>::iterator end) {
+    Batch* b = begin->batch;
+    unsigned int n = end - begin;
+    if (b->vbo == 0) {
+        unsigned int v = b->verts.size() * sizeof(float);
+        unsigned int t = b->texcs.size() * sizeof(float);
+        glGenBuffersARB(1, &b->vbo);
+        glBindBufferARB(GL_ARRAY_BUFFER_ARB, b->vbo);
+        glBufferDataARB(GL_ARRAY_BUFFER_ARB, 2*v + t, NULL, GL_STATIC_DRAW_ARB);
+        glBufferSubDataARB(GL_ARRAY_BUFFER_ARB, 0, v, &b->verts[0]);
+        glBufferSubDataARB(GL_ARRAY_BUFFER_ARB, v, v, &b->norms[0]);
+        glBufferSubDataARB(GL_ARRAY_BUFFER_ARB, 2*v, t, &b->texcs[0]);
+    }
+
+    scratch.resize(n * 16);
+    for (unsigned int i = 0; i < n; ++i)
+        std::copy(&matrices[begin[i].matrix], &matrices[begin[i].matrix] + 16,
+                  &scratch[i * 16]);
+    if (b->instanceVbo == 0) glGenBuffersARB(1, &b->instanceVbo);
+    glBindBufferARB(GL_ARRAY_BUFFER_ARB, b->instanceVbo);
+    if (scratch.size() != b->instances.size()) {
+        glBufferDataARB(GL_ARRAY_BUFFER_ARB, scratch.size() * sizeof(float),
+                        &scratch[0], GL_DYNAMIC_DRAW_ARB);
+        b->instances = scratch;
+    } else if (!std::equal(scratch.begin(), scratch.end(),
+                           b->instances.begin())) {
+        glBufferSubDataARB(GL_ARRAY_BUFFER_ARB, 0,
+                           scratch.size() * sizeof(float), &scratch[0]);
+        b->instances.swap(scratch);
+    }
+    for (unsigned int c = 0; c < 4; ++c) {
+        glEnableVertexAttribArrayARB(matrixLoc + c);
+        glVertexAttribPointerARB(matrixLoc + c, 4, GL_FLOAT, GL_FALSE,
+                                 16 * sizeof(float),
+                                 (const GLvoid*)(c * 4 * sizeof(float)));
+        glVertexAttribDivisorARB(matrixLoc + c, 1);
+    }
+
+    unsigned int v = b->verts.size() * sizeof(float);
+    glBindBufferARB(GL_ARRAY_BUFFER_ARB, b->vbo);
+    glVertexPointer(3, GL_FLOAT, 0, (const GLvoid*)0);
+    glNormalPointer(GL_FLOAT, 0, (const GLvoid*)(unsigned long)v);
+    glTexCoordPointer(2, GL_FLOAT, 0, (const GLvoid*)(unsigned long)(2*v));
+
+    // the first contiguous enabled lights are lit
+    GLint lights = 0;
+    while (lights < 8 && glIsEnabled(GL_LIGHT0 + lights)) lights++;
+    glUseProgram(program);
+    glUniform1i(lightCountLoc, lights);
+    glUniform1i(lightingLoc, glIsEnabled(GL_LIGHTING));
+    glUniform1i(texturedLoc, begin->texture != 0);
+    glUniform1i(textureLoc, 0);
+    glDrawArraysInstancedARB(GL_TRIANGLES, 0, b->count, n);
+    glUseProgram(0);
+
+    for (unsigned int c = 0; c < 4; ++c) {
+        glVertexAttribDivisorARB(matrixLoc + c, 0);
+        glDisableVertexAttribArrayARB(matrixLoc + c);
+    }
+    glBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
+    draws++;
+    instanced += n;
+}
+
+void DrawList::ApplyMaterial(Material* mat) {
+    if (mat == NULL) return;
+    float c[4];
+    mat->diffuse.ToArray(c);
+    glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, c);
+    mat->ambient.ToArray(c);
+    glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, c);
+    mat->specular.ToArray(c);
+    glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, c);
+    mat->emission.ToArray(c);
+    glMaterialfv(GL_FRONT_AND_BACK, GL_EMISSION, c);
+    glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, mat->shininess);
+}
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
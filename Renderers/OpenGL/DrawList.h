@@ -0,0 +1,125 @@
+// State sorted draw list.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OE_OPENGL_DRAW_LIST_H_
+#define _OE_OPENGL_DRAW_LIST_H_
+
+#include <Geometry/Face.h>
+#include <Geometry/Material.h>
+
+#include <boost/weak_ptr.hpp>
+#include <map>
+#include <vector>
+
+namespace OpenEngine {
+    namespace Geometry {
+        class FaceSet;
+    }
+namespace Renderers {
+namespace OpenGL {
+
+class ProgramCache;
+
+/**
+ * State sorted draw list.
+ *
+ * Geometry is added to the list during scene traversal together with
+ * its accumulated model transformation. When flushed the list is
+ * sorted by shader, texture and material and submitted with vertex
+ * arrays, so every state is applied once per frame and all faces of
+ * a face set sharing a material are drawn with a single call.
+ *
+ * The per material vertex arrays of a face set are built the first
+ * time the face set is added and cached until the face set is no
+ * longer seen for a number of frames. Face sets are assumed to be
+ * static, a face set whose faces change must be removed with
+ * Invalidate().
+ */
+class DrawList {
+public:
+    DrawList();
+    virtual ~DrawList();
+
+    void SetInstancing(bool enable);
+    void SetProgramCache(ProgramCache* cache);
+
+    void Add(Geometry::FaceSet* faces, const float modelview[16]);
+    void Flush();
+    void Submit();
+    void Discard();
+
+    void Invalidate(Geometry::FaceSet* faces);
+    void Clear();
+
+    unsigned int GetDrawCount() const;
+    unsigned int GetStateChangeCount() const;
+    unsigned int GetInstanceCount() const;
+
+private:
+    // faces of a face set sharing one material
+    struct Batch {
+        Geometry::MaterialPtr mat;
+        std::vector<float> verts, norms, texcs;
+        unsigned int count;
+        // vertex and instance buffers of an instanced batch
+        unsigned int vbo, instanceVbo;
+        std::vector<float> instances;
+    };
+
+    // cached batches of a face set
+    struct Chunk {
+        std::vector<Batch*> batches;
+        boost::weak_ptr<Geometry::Face> first;
+        unsigned int size;
+        unsigned int lastUsed;
+    };
+
+    // a draw in the list, kept small so sorting stays cheap
+    struct Item {
+        void* shader;
+        unsigned int texture;
+        Geometry::Material* material;
+        unsigned int matrix;
+        Batch* batch;
+        bool operator<(const Item& other) const;
+    };
+
+    std::map<Geometry::FaceSet*, Chunk*> chunks;
+    std::vector<Item> items;
+    std::vector<float> matrices;
+    bool sorted, submitted;
+    unsigned int frame;
+    unsigned int draws, changes, instanced;
+
+    // instancing program, built in the background on first use
+    bool instancing;
+    bool initialized;
+    ProgramCache* cache;
+    ProgramCache* ownCache;
+    unsigned int pending;
+    unsigned int program;
+    int matrixLoc, lightCountLoc, lightingLoc, texturedLoc, textureLoc;
+    std::vector<unsigned int> garbage;
+    std::vector<float> scratch;
+
+    Chunk* Lookup(Geometry::FaceSet* faces);
+    Chunk* Build(Geometry::FaceSet* faces);
+    void Evict();
+    void ApplyMaterial(Geometry::Material* mat);
+    void InitializeInstancing();
+    void Draw(const Item& item);
+    void DrawInstanced(std::vector<Item>::iterator begin,
+                       std::vector<Item>::iterator end);
+};
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
+
+#endif // _OE_OPENGL_DRAW_LIST_H_
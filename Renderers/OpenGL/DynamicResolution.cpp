@@ -0,0 +1,226 @@
+// Dynamic resolution scene rendering.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Renderers/OpenGL/DynamicResolution.h>
+
+#include <Display/IRenderCanvas.h>
+#include <Logging/Logger.h>
+#include <Meta/OpenGL.h>
+
+#include <cmath>
+
+namespace OpenEngine {
+namespace Renderers {
+namespace OpenGL {
+
+// the scale grows while the scene takes less than this part of the budget
+static const float GROW_BELOW = 0.8f;
+
+// part of the way to the estimated scale taken per sample when growing
+static const float GROW_RATE = 0.1f;
+
+/**
+ * Create a disabled decorator.
+ *
+ * @param listener Rendering listener drawing the scene.
+ */
+DynamicResolution::DynamicResolution(Core::IListener<RenderingEventArg>& listener)
+    : listener(listener)
+    , enabled(false)
+    , initialized(false)
+    , supported(false)
+    , budget(16000)
+    , minScale(0.5f)
+    , scale(1.0f)
+    , fbo(0)
+    , color(0)
+    , depth(0)
+    , width(0)
+    , height(0)
+    , queryHead(0)
+    , queryTail(0) {}
+
+/**
+ * Destroy the decorator.
+ * The framebuffer and queries are left for the context to clean up
+ * since we can not know if the context still exists.
+ */
+DynamicResolution::~DynamicResolution() {}
+
+/**
+ * Enable or disable the dynamic resolution.
+ * Disabled, the scene is rendered directly at native resolution.
+ */
+void DynamicResolution::Enable(bool enable) {
+    enabled = enable;
+    if (!enabled) scale = 1.0f;
+}
+
+bool DynamicResolution::IsEnabled() const {
+    return enabled;
+}
+
+/**
+ * Set the GPU time the scene may take per frame.
+ * Leave room in the frame for the HUD and the swap.
+ *
+ * @param msec Budget in milliseconds.
+ */
+void DynamicResolution::SetBudget(float msec) {
+    budget = (unsigned int)(msec * 1000.0f);
+}
+
+/**
+ * Set the lowest scale of the canvas size the scene is rendered at.
+ *
+ * @param scale Scale between zero and one.
+ */
+void DynamicResolution::SetMinimumScale(float scale) {
+    minScale = (scale < 0.1f) ? 0.1f : (scale > 1.0f) ? 1.0f : scale;
+    if (this->scale < minScale) this->scale = minScale;
+}
+
+/**
+ * Get the current scale of the canvas size the scene is rendered at.
+ */
+float DynamicResolution::GetScale() const {
+    return scale;
+}
+
+/**
+ * Render the scene, at the current scale when enabled.
+ */
+void DynamicResolution::Handle(RenderingEventArg arg) {
+    if (!enabled) {
+        listener.Handle(arg);
+        return;
+    }
+    if (!initialized) Initialize();
+    if (!supported) {
+        listener.Handle(arg);
+        return;
+    }
+    Poll();
+
+    GLint target = 0, viewport[4];
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT, &target);
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    unsigned int w = arg.canvas.GetWidth(), h = arg.canvas.GetHeight();
+    if (w != width || h != height) {
+        Resize(w, h);
+        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, target);
+        if (!supported) {
+            listener.Handle(arg);
+            return;
+        }
+    }
+    GLsizei sw = (GLsizei)(w * scale + 0.5f), sh = (GLsizei)(h * scale + 0.5f);
+    if (sw < 1) sw = 1;
+    if (sh < 1) sh = 1;
+
+    // at full scale the scene is rendered directly and only measured
+    bool offscreen = scale < 1.0f;
+    if (offscreen) {
+        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fbo);
+        glViewport(0, 0, sw, sh);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
+    // all queries in flight, skip measuring this frame
+    bool query = (queryHead + 1) % QUERIES != queryTail;
+    if (query) glQueryCounter(queries[queryHead * 2], GL_TIMESTAMP);
+    listener.Handle(arg);
+    if (query) {
+        glQueryCounter(queries[queryHead * 2 + 1], GL_TIMESTAMP);
+        queryHead = (queryHead + 1) % QUERIES;
+    }
+    if (!offscreen) return;
+
+    glBindFramebufferEXT(GL_READ_FRAMEBUFFER_EXT, fbo);
+    glBindFramebufferEXT(GL_DRAW_FRAMEBUFFER_EXT, target);
+    glBlitFramebufferEXT(0, 0, sw, sh,
+                         viewport[0], viewport[1],
+                         viewport[0] + viewport[2], viewport[1] + viewport[3],
+                         GL_COLOR_BUFFER_BIT, GL_LINEAR);
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, target);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
+
+void DynamicResolution::Initialize() {
+    initialized = true;
+    supported = GLEW_EXT_framebuffer_object && GLEW_EXT_framebuffer_blit &&
+        GLEW_ARB_timer_query;
+    if (!supported) {
+        logger.warning << "DynamicResolution: framebuffer blits or timer "
+                       << "queries not supported, rendering at native "
+                       << "resolution" << logger.end;
+        return;
+    }
+    glGenFramebuffersEXT(1, &fbo);
+    glGenRenderbuffersEXT(1, &color);
+    glGenRenderbuffersEXT(1, &depth);
+    glGenQueries(QUERIES * 2, queries);
+}
+
+// Allocate the offscreen target at the full canvas size, so changing
+// the scale never reallocates it.
+void DynamicResolution::Resize(unsigned int width, unsigned int height) {
+    this->width = width;
+    this->height = height;
+    glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, color);
+    glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT, GL_RGBA8, width, height);
+    glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, depth);
+    glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT, GL_DEPTH_COMPONENT24,
+                             width, height);
+    glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, 0);
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fbo);
+    glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT,
+                                 GL_RENDERBUFFER_EXT, color);
+    glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT,
+                                 GL_RENDERBUFFER_EXT, depth);
+    if (glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT) !=
+        GL_FRAMEBUFFER_COMPLETE_EXT) {
+        logger.warning << "DynamicResolution: incomplete framebuffer of "
+                       << width << "x" << height
+                       << ", rendering at native resolution" << logger.end;
+        supported = false;
+        scale = 1.0f;
+    }
+}
+
+// Collect the measurements of earlier frames that are done.
+void DynamicResolution::Poll() {
+    while (queryTail != queryHead) {
+        GLint available = 0;
+        glGetQueryObjectiv(queries[queryTail * 2 + 1],
+                           GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) break;
+        GLuint64 begin = 0, end = 0;
+        glGetQueryObjectui64v(queries[queryTail * 2], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(queries[queryTail * 2 + 1], GL_QUERY_RESULT, &end);
+        Adjust((unsigned int)((end - begin) / 1000));
+        queryTail = (queryTail + 1) % QUERIES;
+    }
+}
+
+// Move the scale towards the one estimated to meet the budget, at
+// once when over budget and slowly when well under it.
+void DynamicResolution::Adjust(unsigned int usec) {
+    if (usec == 0) return;
+    float estimate = scale * std::sqrt((float)budget / usec);
+    if (usec > budget)
+        scale = estimate;
+    else if (usec < budget * GROW_BELOW)
+        scale += (estimate - scale) * GROW_RATE;
+    if (scale < minScale) scale = minScale;
+    if (scale > 1.0f) scale = 1.0f;
+}
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
@@ -0,0 +1,79 @@
+// Dynamic resolution scene rendering.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OE_OPENGL_DYNAMIC_RESOLUTION_H_
+#define _OE_OPENGL_DYNAMIC_RESOLUTION_H_
+
+#include <Core/IListener.h>
+#include <Renderers/IRenderer.h>
+
+namespace OpenEngine {
+namespace Renderers {
+namespace OpenGL {
+
+/**
+ * Listener decorator rendering the scene at a dynamic resolution.
+ *
+ * When enabled the decorated rendering listener, typically the
+ * rendering view, renders into an offscreen target with a viewport
+ * scaled down from the canvas. The scaled image is then stretched
+ * into the canvas, so the listeners of the post-process event, such
+ * as the HUD, draw at the native resolution.
+ *
+ * The time the GPU spends on the scene is measured with timestamp
+ * queries, read back a few frames later so measuring never stalls.
+ * The scale drops at once when the scene is over its time budget and
+ * creeps back up while it is well under the budget. The scale
+ * applies to both axes, so the pixel count and roughly the GPU time
+ * follow its square.
+ *
+ * A disabled decorator costs a single test per frame. Requires
+ * framebuffer blits and timer queries, without them the scene is
+ * rendered at native resolution.
+ */
+class DynamicResolution : public Core::IListener<RenderingEventArg> {
+public:
+    DynamicResolution(Core::IListener<RenderingEventArg>& listener);
+    virtual ~DynamicResolution();
+
+    void Enable(bool enable);
+    bool IsEnabled() const;
+    void SetBudget(float msec);
+    void SetMinimumScale(float scale);
+    float GetScale() const;
+
+    void Handle(RenderingEventArg arg);
+
+private:
+    // timestamp query pairs in flight
+    static const unsigned int QUERIES = 4;
+
+    Core::IListener<RenderingEventArg>& listener;
+    bool enabled;
+    bool initialized;
+    bool supported;
+    unsigned int budget;
+    float minScale;
+    float scale;
+    unsigned int fbo, color, depth;
+    unsigned int width, height;
+    unsigned int queries[QUERIES * 2];
+    unsigned int queryHead, queryTail;
+
+    void Initialize();
+    void Resize(unsigned int width, unsigned int height);
+    void Poll();
+    void Adjust(unsigned int usec);
+};
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
+
+#endif // _OE_OPENGL_DYNAMIC_RESOLUTION_H_
@@ -0,0 +1,259 @@
+// Views sharing one scene traversal.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Renderers/OpenGL/MultiView.h>
+
+#include <Display/IViewingVolume.h>
+#include <Meta/OpenGL.h>
+
+namespace OpenEngine {
+namespace Renderers {
+namespace OpenGL {
+
+using Display::IViewingVolume;
+using Math::Vector;
+
+// c = a * b of column major matrices
+static void Multiply(const float a[16], const float b[16], float c[16]) {
+    for (unsigned int col = 0; col < 4; ++col)
+        for (unsigned int r = 0; r < 4; ++r) {
+            float sum = 0;
+            for (unsigned int k = 0; k < 4; ++k)
+                sum += a[k*4 + r] * b[col*4 + k];
+            c[col*4 + r] = sum;
+        }
+}
+
+/**
+ * Create the views with view zero covering the canvas.
+ */
+MultiView::MultiView() {
+    Clear();
+}
+
+MultiView::~MultiView() {}
+
+/**
+ * Add a view.
+ *
+ * @param volume Viewing volume of the view, NULL to follow the
+ *               viewing volume of the canvas with the aspect of the
+ *               rectangle.
+ * @param x Left edge as a fraction of the canvas width.
+ * @param y Bottom edge as a fraction of the canvas height.
+ * @param width Width as a fraction of the canvas width.
+ * @param height Height as a fraction of the canvas height.
+ * @return Index of the view.
+ */
+unsigned int MultiView::AddView(IViewingVolume* volume,
+                                float x, float y, float width, float height) {
+    View v;
+    v.volume = volume;
+    v.eye = 0;
+    views.push_back(v);
+    SetViewport(views.size() - 1, x, y, width, height);
+    return views.size() - 1;
+}
+
+/**
+ * Set the rectangle of a view, as fractions of the canvas size.
+ */
+void MultiView::SetViewport(unsigned int view,
+                            float x, float y, float width, float height) {
+    if (view >= views.size()) return;
+    float* rect = views[view].rect;
+    rect[0] = x;
+    rect[1] = y;
+    rect[2] = width;
+    rect[3] = height;
+}
+
+/**
+ * Move a view sideways from its viewing volume, as an eye of stereo.
+ *
+ * @param view Index of the view.
+ * @param offset Distance to the right of the viewing volume, negative
+ *               for the left eye.
+ */
+void MultiView::SetEyeOffset(unsigned int view, float offset) {
+    if (view < views.size()) views[view].eye = offset;
+}
+
+/**
+ * Remove all added views and let view zero cover the canvas again.
+ */
+void MultiView::Clear() {
+    views.clear();
+    AddView(NULL, 0, 0, 1, 1);
+}
+
+/**
+ * Number of views, including view zero.
+ */
+unsigned int MultiView::GetViewCount() const {
+    return views.size();
+}
+
+/**
+ * Check if there is more to render than the canvas volume covering
+ * the whole canvas.
+ */
+bool MultiView::IsActive() const {
+    const View& v = views[0];
+    return views.size() > 1 || v.eye != 0 ||
+        v.rect[0] != 0 || v.rect[1] != 0 || v.rect[2] != 1 || v.rect[3] != 1;
+}
+
+/**
+ * Prepare the views of a frame and restrict the traversal to the
+ * rectangle of view zero.
+ *
+ * @param volume Viewing volume of the canvas.
+ */
+void MultiView::Begin(IViewingVolume& volume) {
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    for (std::vector<View>::iterator itr = views.begin();
+         itr != views.end(); ++itr) {
+        View& v = *itr;
+        IViewingVolume* vol = (v.volume != NULL) ? v.volume : &volume;
+        vol->GetViewMatrix().ToArray(v.view);
+        vol->GetProjectionMatrix().ToArray(v.proj);
+        // the canvas volume has the aspect of the canvas, scale x to
+        // that of the rectangle so a half width eye is not squashed
+        if (v.volume == NULL && v.rect[2] > 0 && v.rect[3] != v.rect[2]) {
+            float scale = v.rect[3] / v.rect[2];
+            for (unsigned int k = 0; k < 4; ++k)
+                v.proj[k*4] *= scale;
+        }
+        // the eye moves right, the world left
+        v.view[12] -= v.eye;
+
+        // world space frustum planes of projection * view, (a, b, c, d)
+        // with the inside positive
+        float clip[16];
+        Multiply(v.proj, v.view, clip);
+        for (unsigned int i = 0; i < 3; ++i)
+            for (unsigned int k = 0; k < 4; ++k) {
+                v.planes[2*i][k]     = clip[k*4 + 3] + clip[k*4 + i];
+                v.planes[2*i + 1][k] = clip[k*4 + 3] - clip[k*4 + i];
+            }
+    }
+
+    // the lights are placed in the eye space of the canvas volume,
+    // whose view transformation is rigid
+    float view[16];
+    volume.GetViewMatrix().ToArray(view);
+    for (unsigned int c = 0; c < 3; ++c)
+        for (unsigned int r = 0; r < 3; ++r)
+            inverse[c*4 + r] = view[r*4 + c];
+    for (unsigned int r = 0; r < 3; ++r)
+        inverse[12 + r] = -(inverse[r] * view[12] +
+                            inverse[4 + r] * view[13] +
+                            inverse[8 + r] * view[14]);
+    inverse[3] = inverse[7] = inverse[11] = 0;
+    inverse[15] = 1;
+    for (unsigned int l = 0; l < LIGHTS; ++l) {
+        lit[l] = glIsEnabled(GL_LIGHT0 + l) == GL_TRUE;
+        if (!lit[l]) continue;
+        glGetLightfv(GL_LIGHT0 + l, GL_POSITION, positions[l]);
+        glGetLightfv(GL_LIGHT0 + l, GL_SPOT_DIRECTION, directions[l]);
+    }
+
+    // the projection stack may be only two deep, so the matrices are
+    // saved rather than pushed
+    glGetFloatv(GL_PROJECTION_MATRIX, savedProj);
+    glGetFloatv(GL_MODELVIEW_MATRIX, savedView);
+    glPushAttrib(GL_VIEWPORT_BIT | GL_SCISSOR_BIT | GL_ENABLE_BIT |
+                 GL_LIGHTING_BIT);
+    const float* rect = views[0].rect;
+    glViewport(viewport[0] + GLint(rect[0] * viewport[2]),
+               viewport[1] + GLint(rect[1] * viewport[3]),
+               GLsizei(rect[2] * viewport[2]), GLsizei(rect[3] * viewport[3]));
+}
+
+/**
+ * Check if a box is inside or intersects the frustum of any view.
+ *
+ * @param box World space bounding box.
+ */
+bool MultiView::IsVisible(const Geometry::Box& box) const {
+    float min[3], max[3];
+    for (unsigned int i = 0; i < 8; ++i) {
+        Vector<3,float> c = box.GetCorner(i);
+        for (unsigned int k = 0; k < 3; ++k) {
+            if (i == 0 || c[k] < min[k]) min[k] = c[k];
+            if (i == 0 || c[k] > max[k]) max[k] = c[k];
+        }
+    }
+    for (std::vector<View>::const_iterator itr = views.begin();
+         itr != views.end(); ++itr) {
+        bool inside = true;
+        for (unsigned int p = 0; p < 6 && inside; ++p) {
+            // the corner furthest along the plane normal
+            const float* pl = itr->planes[p];
+            float s = pl[3];
+            for (unsigned int k = 0; k < 3; ++k)
+                s += pl[k] * (pl[k] >= 0 ? max[k] : min[k]);
+            inside = s >= 0;
+        }
+        if (inside) return true;
+    }
+    return false;
+}
+
+/**
+ * Set up the viewport, matrices and lights of a view for submitting
+ * the geometry of the frame. Views after view zero are cleared, so
+ * they may overlap view zero as picture in picture.
+ *
+ * @param view Index of the view.
+ */
+void MultiView::Apply(unsigned int view) {
+    const View& v = views[view];
+    GLint x = viewport[0] + GLint(v.rect[0] * viewport[2]);
+    GLint y = viewport[1] + GLint(v.rect[1] * viewport[3]);
+    GLsizei w = GLsizei(v.rect[2] * viewport[2]);
+    GLsizei h = GLsizei(v.rect[3] * viewport[3]);
+    glViewport(x, y, w, h);
+    if (view > 0) {
+        glScissor(x, y, w, h);
+        glEnable(GL_SCISSOR_TEST);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glDisable(GL_SCISSOR_TEST);
+    }
+    glMatrixMode(GL_PROJECTION);
+    glLoadMatrixf(v.proj);
+    glMatrixMode(GL_MODELVIEW);
+
+    // from the eye space of the canvas volume to that of the view
+    float m[16];
+    Multiply(v.view, inverse, m);
+    glLoadMatrixf(m);
+    for (unsigned int l = 0; l < LIGHTS; ++l) {
+        if (!lit[l]) continue;
+        glLightfv(GL_LIGHT0 + l, GL_POSITION, positions[l]);
+        glLightfv(GL_LIGHT0 + l, GL_SPOT_DIRECTION, directions[l]);
+    }
+    glLoadMatrixf(v.view);
+}
+
+/**
+ * Restore the viewport, matrices and lights of the canvas.
+ */
+void MultiView::End() {
+    glMatrixMode(GL_PROJECTION);
+    glLoadMatrixf(savedProj);
+    glMatrixMode(GL_MODELVIEW);
+    glLoadMatrixf(savedView);
+    glPopAttrib();
+}
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
@@ -0,0 +1,91 @@
+// Views sharing one scene traversal.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OE_OPENGL_MULTI_VIEW_H_
+#define _OE_OPENGL_MULTI_VIEW_H_
+
+#include <Geometry/Box.h>
+
+#include <vector>
+
+namespace OpenEngine {
+    namespace Display {
+        class IViewingVolume;
+    }
+namespace Renderers {
+namespace OpenGL {
+
+/**
+ * Views sharing one scene traversal.
+ *
+ * A view is a viewing volume and a rectangle of the canvas, given as
+ * fractions of the canvas size. View zero is the viewing volume of
+ * the canvas itself and covers the whole canvas until its rectangle
+ * is changed. Further views are for split screen, picture in picture
+ * or the eyes of stereo rendering, where a view without a volume
+ * follows the canvas volume moved sideways by its eye offset. The
+ * projection of a view following the canvas volume is adjusted to the
+ * aspect of its rectangle.
+ *
+ * A rendering view traverses and culls the scene once for all views,
+ * testing nodes against the union of their frustums, and collects the
+ * geometry in a draw list. Each view then submits the same list with
+ * its own viewport and matrices, the fixed function lights moved into
+ * its eye space, so the cost of a view is the submission only.
+ *
+ * The rendering view calls Begin() before and End() after the
+ * traversal, with the GL context current, and Apply() before each
+ * submission of the list.
+ */
+class MultiView {
+public:
+    MultiView();
+    virtual ~MultiView();
+
+    unsigned int AddView(Display::IViewingVolume* volume,
+                         float x, float y, float width, float height);
+    void SetViewport(unsigned int view,
+                     float x, float y, float width, float height);
+    void SetEyeOffset(unsigned int view, float offset);
+    void Clear();
+
+    unsigned int GetViewCount() const;
+    bool IsActive() const;
+
+    void Begin(Display::IViewingVolume& volume);
+    bool IsVisible(const Geometry::Box& box) const;
+    void Apply(unsigned int view);
+    void End();
+
+private:
+    // number of fixed function lights moved between views
+    static const unsigned int LIGHTS = 8;
+
+    struct View {
+        Display::IViewingVolume* volume;
+        float rect[4];
+        float eye;
+        // matrices and world space frustum planes of the frame
+        float view[16], proj[16];
+        float planes[6][4];
+    };
+
+    std::vector<View> views;
+    int viewport[4];
+    float inverse[16];
+    float savedProj[16], savedView[16];
+    bool lit[LIGHTS];
+    float positions[LIGHTS][4], directions[LIGHTS][3];
+};
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
+
+#endif // _OE_OPENGL_MULTI_VIEW_H_
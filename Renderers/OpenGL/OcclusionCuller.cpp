@@ -0,0 +1,224 @@
+// Occlusion culler.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Renderers/OpenGL/OcclusionCuller.h>
+
+#include <Logging/Logger.h>
+#include <Math/Vector.h>
+#include <Meta/OpenGL.h>
+
+#include <algorithm>
+
+namespace OpenEngine {
+namespace Renderers {
+namespace OpenGL {
+
+using Math::Vector;
+
+// frames between the queries of a visible node
+static const unsigned int VISIBLE_INTERVAL = 8;
+
+// number of frames a node may go unseen before it is forgotten
+static const unsigned int EVICT_FRAMES = 120;
+
+// the camera is treated as inside boxes closer than this, so a box
+// clipped by the near plane is never reported occluded
+static const float INSIDE_MARGIN = 1.0f;
+
+OcclusionCuller::OcclusionCuller()
+    : initialized(false)
+    , supported(false)
+    , frame(0)
+    , occluded(0) {
+    eye[0] = eye[1] = eye[2] = 0;
+}
+
+/**
+ * Destroy the culler.
+ * The queries are left for the context to clean up since we can not
+ * know if the context still exists.
+ */
+OcclusionCuller::~OcclusionCuller() {}
+
+/**
+ * Start a frame.
+ *
+ * @param eye Camera position in world coordinates.
+ */
+void OcclusionCuller::Begin(const float eye[3]) {
+    if (!initialized) Initialize();
+    frame++;
+    occluded = 0;
+    std::copy(eye, eye + 3, this->eye);
+}
+
+/**
+ * Decide whether a node is rendered this frame.
+ * A node that is not rendered should not have its sub nodes
+ * visited.
+ *
+ * @param node Node, used as the key of its query.
+ * @param box World space bounding box of the node.
+ * @return True if the node may be visible.
+ */
+bool OcclusionCuller::IsVisible(const void* node, const Geometry::Box& box) {
+    if (!supported) return true;
+    std::map<const void*, Node>::iterator itr = nodes.find(node);
+    if (itr == nodes.end()) {
+        Node n;
+        n.query = 0;
+        n.visible = true;
+        n.pending = false;
+        n.seen = 0;
+        itr = nodes.insert(std::make_pair(node, n)).first;
+    }
+    Node& n = itr->second;
+    for (unsigned int i = 0; i < 8; ++i) {
+        Vector<3,float> c = box.GetCorner(i);
+        for (unsigned int k = 0; k < 3; ++k) {
+            if (i == 0 || c[k] < n.min[k]) n.min[k] = c[k];
+            if (i == 0 || c[k] > n.max[k]) n.max[k] = c[k];
+        }
+    }
+
+    if (n.pending) Poll(n);
+    // a result from before the node was last out of sight may be stale
+    bool fresh = n.seen + 1 != frame;
+    n.seen = frame;
+    bool inside = true;
+    for (unsigned int k = 0; k < 3 && inside; ++k)
+        inside = eye[k] >= n.min[k] - INSIDE_MARGIN &&
+                 eye[k] <= n.max[k] + INSIDE_MARGIN;
+    if (fresh || inside) n.visible = true;
+
+    if (!n.visible) {
+        occluded++;
+        if (!n.pending) queue.push_back(&n);
+        return false;
+    }
+    unsigned int stagger = ((unsigned long)node >> 4) % VISIBLE_INTERVAL;
+    if (!inside && !n.pending &&
+        (fresh || (frame + stagger) % VISIBLE_INTERVAL == 0))
+        queue.push_back(&n);
+    return true;
+}
+
+/**
+ * Finish a frame by issuing the queries of the frame.
+ * Must be called after the scene is rendered, with the depth buffer
+ * of the frame bound.
+ *
+ * @param view Column major view transformation of the frame.
+ */
+void OcclusionCuller::End(const float view[16]) {
+    if (!supported) return;
+    if (!queue.empty()) {
+        glPushAttrib(GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT |
+                     GL_DEPTH_BUFFER_BIT | GL_CURRENT_BIT);
+        glDisable(GL_LIGHTING);
+        glDisable(GL_TEXTURE_2D);
+        glDisable(GL_CULL_FACE);
+        glEnable(GL_DEPTH_TEST);
+        glDepthFunc(GL_LEQUAL);
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glDepthMask(GL_FALSE);
+        if (GLEW_VERSION_2_0) glUseProgram(0);
+        glMatrixMode(GL_MODELVIEW);
+        glPushMatrix();
+        glLoadMatrixf(view);
+
+        for (std::vector<Node*>::iterator itr = queue.begin();
+             itr != queue.end(); ++itr) {
+            Node& n = **itr;
+            if (n.query == 0) {
+                if (freeQueries.empty()) glGenQueriesARB(1, &n.query);
+                else {
+                    n.query = freeQueries.back();
+                    freeQueries.pop_back();
+                }
+            }
+            const float* a = n.min;
+            const float* b = n.max;
+            glBeginQueryARB(GL_SAMPLES_PASSED_ARB, n.query);
+            glBegin(GL_QUADS);
+            glVertex3f(a[0], a[1], a[2]); glVertex3f(b[0], a[1], a[2]);
+            glVertex3f(b[0], b[1], a[2]); glVertex3f(a[0], b[1], a[2]);
+            glVertex3f(a[0], a[1], b[2]); glVertex3f(a[0], b[1], b[2]);
+            glVertex3f(b[0], b[1], b[2]); glVertex3f(b[0], a[1], b[2]);
+            glVertex3f(a[0], a[1], a[2]); glVertex3f(a[0], b[1], a[2]);
+            glVertex3f(a[0], b[1], b[2]); glVertex3f(a[0], a[1], b[2]);
+            glVertex3f(b[0], a[1], a[2]); glVertex3f(b[0], a[1], b[2]);
+            glVertex3f(b[0], b[1], b[2]); glVertex3f(b[0], b[1], a[2]);
+            glVertex3f(a[0], a[1], a[2]); glVertex3f(a[0], a[1], b[2]);
+            glVertex3f(b[0], a[1], b[2]); glVertex3f(b[0], a[1], a[2]);
+            glVertex3f(a[0], b[1], a[2]); glVertex3f(b[0], b[1], a[2]);
+            glVertex3f(b[0], b[1], b[2]); glVertex3f(a[0], b[1], b[2]);
+            glEnd();
+            glEndQueryARB(GL_SAMPLES_PASSED_ARB);
+            n.pending = true;
+        }
+
+        glPopMatrix();
+        glPopAttrib();
+        queue.clear();
+    }
+    if (frame % EVICT_FRAMES == 0) Evict();
+}
+
+/**
+ * Check if the driver supports occlusion queries.
+ * Without them every node is visible.
+ */
+bool OcclusionCuller::IsSupported() {
+    if (!initialized) Initialize();
+    return supported;
+}
+
+/**
+ * Number of nodes found occluded in the current frame.
+ */
+unsigned int OcclusionCuller::GetOccludedCount() const {
+    return occluded;
+}
+
+void OcclusionCuller::Initialize() {
+    initialized = true;
+    supported = GLEW_ARB_occlusion_query;
+    if (!supported)
+        logger.warning << "OcclusionCuller: occlusion queries not "
+                       << "supported, nothing is culled" << logger.end;
+}
+
+// Read the result of a query if it is available, never waiting.
+void OcclusionCuller::Poll(Node& n) {
+    GLint available = GL_FALSE;
+    glGetQueryObjectivARB(n.query, GL_QUERY_RESULT_AVAILABLE_ARB, &available);
+    if (available == GL_FALSE) return;
+    GLuint samples = 0;
+    glGetQueryObjectuivARB(n.query, GL_QUERY_RESULT_ARB, &samples);
+    n.visible = samples > 0;
+    n.pending = false;
+}
+
+// Forget nodes out of sight for a while, such as the nodes of a
+// rebuilt culling structure, and keep their queries for reuse.
+void OcclusionCuller::Evict() {
+    for (std::map<const void*, Node>::iterator itr = nodes.begin();
+         itr != nodes.end(); ) {
+        if (frame - itr->second.seen > EVICT_FRAMES) {
+            if (itr->second.query != 0)
+                freeQueries.push_back(itr->second.query);
+            nodes.erase(itr++);
+        } else ++itr;
+    }
+}
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
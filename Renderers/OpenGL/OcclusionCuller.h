@@ -0,0 +1,82 @@
+// Occlusion culler.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OE_OPENGL_OCCLUSION_CULLER_H_
+#define _OE_OPENGL_OCCLUSION_CULLER_H_
+
+#include <Geometry/Box.h>
+
+#include <map>
+#include <vector>
+
+namespace OpenEngine {
+namespace Renderers {
+namespace OpenGL {
+
+/**
+ * Occlusion culler using hardware occlusion queries.
+ *
+ * Decides for the nodes of an acceleration structure, such as the
+ * quad nodes of frustum culling, whether they are to be rendered,
+ * from the occlusion queries of previous frames. The rendering never
+ * waits for a query: a node keeps its last known visibility until a
+ * new result is available.
+ *
+ * After the scene is rendered the bounding boxes of the nodes that
+ * need a new result are drawn as queries against the depth buffer of
+ * the frame. Occluded nodes are queried every frame so they reappear
+ * as soon as possible, visible nodes only every few frames, staggered
+ * so the queries are spread over the frames.
+ *
+ * A node not seen in the previous frame, and a node the camera is
+ * inside, is always visible since its old result may be out of date.
+ *
+ * The culler is used by a rendering view, call Begin() before and
+ * End() after rendering the scene, with the GL context current.
+ */
+class OcclusionCuller {
+public:
+    OcclusionCuller();
+    virtual ~OcclusionCuller();
+
+    void Begin(const float eye[3]);
+    bool IsVisible(const void* node, const Geometry::Box& box);
+    void End(const float view[16]);
+
+    bool IsSupported();
+    unsigned int GetOccludedCount() const;
+
+private:
+    struct Node {
+        unsigned int query;
+        bool visible;
+        bool pending;
+        unsigned int seen;
+        float min[3], max[3];
+    };
+
+    bool initialized;
+    bool supported;
+    unsigned int frame;
+    float eye[3];
+    std::map<const void*, Node> nodes;
+    std::vector<Node*> queue;
+    std::vector<unsigned int> freeQueries;
+    unsigned int occluded;
+
+    void Initialize();
+    void Poll(Node& n);
+    void Evict();
+};
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
+
+#endif // _OE_OPENGL_OCCLUSION_CULLER_H_
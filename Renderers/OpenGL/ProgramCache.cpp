@@ -0,0 +1,449 @@
+// Shader program binary cache.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Renderers/OpenGL/ProgramCache.h>
+
+#include <Logging/Logger.h>
+#include <Meta/OpenGL.h>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+namespace OpenEngine {
+namespace Renderers {
+namespace OpenGL {
+
+using std::string;
+using std::vector;
+
+// cache file layout, all values are native endian 32 bit:
+//   magic, version, binary format, size in bytes, program binary
+static const char CACHE_MAGIC[4] = { 'O', 'E', 'P', 'B' };
+static const unsigned int CACHE_VERSION = 1;
+
+// 32 bit FNV-1a, continued from the given hash
+static unsigned int Hash(const string& s, unsigned int h) {
+    for (unsigned int i = 0; i < s.size(); ++i) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static string GLString(GLenum name) {
+    const GLubyte* s = glGetString(name);
+    return s == NULL ? string() : string((const char*)s);
+}
+
+static GLuint CompileShader(GLenum type, const string& source) {
+    GLuint shader = glCreateShader(type);
+    const char* src = source.c_str();
+    glShaderSource(shader, 1, &src, NULL);
+    glCompileShader(shader);
+    return shader;
+}
+
+static string InfoLog(GLuint object, bool program) {
+    GLint length = 0;
+    if (program) glGetProgramiv(object, GL_INFO_LOG_LENGTH, &length);
+    else         glGetShaderiv(object, GL_INFO_LOG_LENGTH, &length);
+    if (length <= 1) return string();
+    vector<char> log(length);
+    if (program) glGetProgramInfoLog(object, length, NULL, &log[0]);
+    else         glGetShaderInfoLog(object, length, NULL, &log[0]);
+    return string(&log[0]);
+}
+
+// The GL entry points redirected while a cache captures. Compiling is
+// deferred so a cached program never compiles its shaders.
+class ProgramCache::Hooks {
+public:
+    static ProgramCache* cache;
+    static std::set<GLuint> deferred;
+    static PFNGLCOMPILESHADERPROC compileShader;
+    static PFNGLGETSHADERIVPROC getShaderiv;
+    static PFNGLLINKPROGRAMPROC linkProgram;
+
+    static void GLAPIENTRY CompileShader(GLuint shader) {
+        deferred.insert(shader);
+    }
+    // deferred shaders report a successful compile without a log
+    static void GLAPIENTRY GetShaderiv(GLuint shader, GLenum pname,
+                                       GLint* params) {
+        if (deferred.find(shader) != deferred.end()) {
+            if (pname == GL_COMPILE_STATUS) {
+                *params = GL_TRUE;
+                return;
+            }
+            if (pname == GL_INFO_LOG_LENGTH) {
+                *params = 0;
+                return;
+            }
+        }
+        getShaderiv(shader, pname, params);
+    }
+    static void GLAPIENTRY LinkProgram(GLuint program) {
+        cache->LinkCaptured(program);
+    }
+    // compile a deferred shader for real
+    static void Compile(GLuint shader) {
+        if (deferred.erase(shader) == 0) return;
+        compileShader(shader);
+    }
+    static GLint Type(GLuint shader) {
+        GLint type = 0;
+        getShaderiv(shader, GL_SHADER_TYPE, &type);
+        return type;
+    }
+    static string Source(GLuint shader) {
+        GLint length = 0;
+        getShaderiv(shader, GL_SHADER_SOURCE_LENGTH, &length);
+        if (length <= 1) return string();
+        vector<char> source(length);
+        glGetShaderSource(shader, length, NULL, &source[0]);
+        return string(&source[0]);
+    }
+};
+
+ProgramCache* ProgramCache::Hooks::cache = NULL;
+std::set<GLuint> ProgramCache::Hooks::deferred;
+PFNGLCOMPILESHADERPROC ProgramCache::Hooks::compileShader = NULL;
+PFNGLGETSHADERIVPROC ProgramCache::Hooks::getShaderiv = NULL;
+PFNGLLINKPROGRAMPROC ProgramCache::Hooks::linkProgram = NULL;
+
+/**
+ * Create a program cache.
+ *
+ * @param directory Directory to store program binaries in, created
+ *                  when the first binary is stored.
+ */
+ProgramCache::ProgramCache(string directory)
+    : directory(directory)
+    , initialized(false)
+    , binaries(false)
+    , parallel(false)
+    , hits(0)
+    , misses(0) {
+    if (!this->directory.empty() &&
+        this->directory[this->directory.size()-1] != '/')
+        this->directory += '/';
+}
+
+/**
+ * Destroy the cache.
+ * Programs already retrieved with GetProgram() are owned by the
+ * caller and left alone, the cache only deletes the objects of builds
+ * still in flight.
+ */
+ProgramCache::~ProgramCache() {
+    for (unsigned int i = 0; i < programs.size(); ++i) {
+        Program& p = programs[i];
+        if (p.state != LINKING) continue;
+        glDeleteShader(p.vertex);
+        glDeleteShader(p.fragment);
+        glDeleteProgram(p.program);
+    }
+}
+
+/**
+ * Start building a program.
+ * Loads the cached binary of the sources if there is one, otherwise
+ * compiles and links the sources, in the background when the driver
+ * supports it.
+ *
+ * @param vertex Vertex shader source.
+ * @param fragment Fragment shader source.
+ * @return Handle to pass to IsReady() and GetProgram().
+ */
+unsigned int ProgramCache::Submit(const string& vertex,
+                                  const string& fragment) {
+    if (!initialized) Initialize();
+    Program p;
+    p.state = LINKING;
+    p.program = glCreateProgram();
+    p.vertex = p.fragment = 0;
+    p.file = CacheFile(vertex, fragment);
+    if (binaries && LoadBinary(p)) {
+        hits++;
+        p.state = DONE;
+        programs.push_back(p);
+        return programs.size() - 1;
+    }
+    misses++;
+    p.vertex = CompileShader(GL_VERTEX_SHADER, vertex);
+    p.fragment = CompileShader(GL_FRAGMENT_SHADER, fragment);
+    glAttachShader(p.program, p.vertex);
+    glAttachShader(p.program, p.fragment);
+    if (binaries)
+        glProgramParameteri(p.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+                            GL_TRUE);
+    // without parallel compilation the driver blocks here
+    glLinkProgram(p.program);
+    programs.push_back(p);
+    return programs.size() - 1;
+}
+
+/**
+ * Check if a program is built.
+ *
+ * @param handle Handle returned by Submit().
+ * @return True if GetProgram() returns without waiting.
+ */
+bool ProgramCache::IsReady(unsigned int handle) {
+    if (handle >= programs.size()) return true;
+    Program& p = programs[handle];
+    if (p.state != LINKING) return true;
+#ifdef GL_KHR_parallel_shader_compile
+    if (parallel) {
+        GLint done = GL_FALSE;
+        glGetProgramiv(p.program, GL_COMPLETION_STATUS_KHR, &done);
+        if (done == GL_FALSE) return false;
+    }
+#endif
+    Finish(p);
+    return true;
+}
+
+/**
+ * Get a built program, waiting for it if needed.
+ * The caller owns the program, a handle can be retrieved once.
+ *
+ * @param handle Handle returned by Submit().
+ * @return Program name, zero if the build failed.
+ */
+unsigned int ProgramCache::GetProgram(unsigned int handle) {
+    if (handle >= programs.size()) return 0;
+    Program& p = programs[handle];
+    if (p.state == LINKING) Finish(p);
+    unsigned int program = (p.state == DONE) ? p.program : 0;
+    p.state = FAILED;
+    p.program = 0;
+    return program;
+}
+
+/**
+ * Build a program, waiting for it.
+ *
+ * @param vertex Vertex shader source.
+ * @param fragment Fragment shader source.
+ * @return Program name, zero if the build failed.
+ */
+unsigned int ProgramCache::Build(const string& vertex,
+                                 const string& fragment) {
+    return GetProgram(Submit(vertex, fragment));
+}
+
+/**
+ * Start routing the programs linked by other code through the cache.
+ * Captures do not nest and only one cache captures at a time.
+ * Shaders compiled while capturing report success at once, their
+ * compile errors are reported when the program fails to link.
+ */
+void ProgramCache::BeginCapture() {
+    if (Hooks::cache != NULL) return;
+    if (!initialized) Initialize();
+    Hooks::cache = this;
+    Hooks::compileShader = glCompileShader;
+    Hooks::getShaderiv = glGetShaderiv;
+    Hooks::linkProgram = glLinkProgram;
+    __glewCompileShader = &Hooks::CompileShader;
+    __glewGetShaderiv = &Hooks::GetShaderiv;
+    __glewLinkProgram = &Hooks::LinkProgram;
+}
+
+/**
+ * Stop routing programs through the cache.
+ * Shaders compiled while capturing but not linked into a program are
+ * compiled now. The shaders of programs loaded from a binary are left
+ * uncompiled and can only be deleted.
+ */
+void ProgramCache::EndCapture() {
+    if (Hooks::cache != this) return;
+    __glewCompileShader = Hooks::compileShader;
+    __glewGetShaderiv = Hooks::getShaderiv;
+    __glewLinkProgram = Hooks::linkProgram;
+    Hooks::cache = NULL;
+    std::set<GLuint> left;
+    left.swap(Hooks::deferred);
+    for (std::set<GLuint>::iterator itr = left.begin();
+         itr != left.end(); ++itr)
+        if (glIsShader(*itr)) glCompileShader(*itr);
+}
+
+/**
+ * Number of programs loaded from cached binaries.
+ */
+unsigned int ProgramCache::GetHitCount() const {
+    return hits;
+}
+
+/**
+ * Number of programs compiled from source.
+ */
+unsigned int ProgramCache::GetMissCount() const {
+    return misses;
+}
+
+void ProgramCache::Initialize() {
+    initialized = true;
+    driver = GLString(GL_VENDOR) + "\n" + GLString(GL_RENDERER) + "\n"
+        + GLString(GL_VERSION);
+    if (GLEW_ARB_get_program_binary && !directory.empty()) {
+        GLint formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        binaries = formats > 0;
+    }
+#ifdef GL_KHR_parallel_shader_compile
+    if (GLEW_KHR_parallel_shader_compile) {
+        glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+        parallel = true;
+    }
+#endif
+}
+
+// The driver strings go into the key so a driver update never loads
+// a binary built by another driver.
+string ProgramCache::CacheFile(const string& vertex,
+                               const string& fragment) const {
+    unsigned int a = Hash(fragment, Hash(vertex, Hash(driver, 2166136261u)));
+    unsigned int b = Hash(driver, Hash(fragment, Hash(vertex, a ^ 0x9e3779b9u)));
+    char name[32];
+    sprintf(name, "%08x%08x.oeprog", a, b);
+    return directory + name;
+}
+
+bool ProgramCache::LoadBinary(Program& p) {
+    if (ReadBinary(p.file, p.program)) return true;
+    // rejected by the driver, rebuild from source and overwrite it
+    glDeleteProgram(p.program);
+    p.program = glCreateProgram();
+    return false;
+}
+
+// Load a cached binary into a program, false if there is none or the
+// driver rejects it.
+bool ProgramCache::ReadBinary(const string& file, unsigned int program) {
+    std::ifstream in(file.c_str(), std::ios::binary);
+    if (!in) return false;
+    unsigned int header[4];
+    in.read((char*)header, sizeof(header));
+    if (!in.good() ||
+        memcmp(header, CACHE_MAGIC, 4) != 0 ||
+        header[1] != CACHE_VERSION ||
+        header[3] == 0 || header[3] > (1u << 26))
+        return false;
+    vector<char> binary(header[3]);
+    in.read(&binary[0], binary.size());
+    if (!in.good()) return false;
+    glProgramBinary(program, header[2], &binary[0], binary.size());
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    return linked == GL_TRUE;
+}
+
+// Link a program while capturing. The sources of the attached shaders
+// form the key, so the program is loaded from its binary when cached
+// and otherwise compiled, linked and stored. Programs with shader
+// stages other than vertex and fragment are only compiled and linked.
+void ProgramCache::LinkCaptured(unsigned int program) {
+    GLint count = 0;
+    glGetProgramiv(program, GL_ATTACHED_SHADERS, &count);
+    vector<GLuint> shaders(count > 0 ? count : 0);
+    if (count > 0) glGetAttachedShaders(program, count, NULL, &shaders[0]);
+    string vertex, fragment;
+    bool cacheable = binaries;
+    for (unsigned int i = 0; i < shaders.size(); ++i) {
+        GLint type = Hooks::Type(shaders[i]);
+        if (type == GL_VERTEX_SHADER)
+            vertex += Hooks::Source(shaders[i]);
+        else if (type == GL_FRAGMENT_SHADER)
+            fragment += Hooks::Source(shaders[i]);
+        else
+            cacheable = false;
+    }
+    string file = CacheFile(vertex, fragment);
+    if (cacheable && ReadBinary(file, program)) {
+        // the shaders are never compiled
+        for (unsigned int i = 0; i < shaders.size(); ++i)
+            Hooks::deferred.erase(shaders[i]);
+        hits++;
+        return;
+    }
+    misses++;
+    for (unsigned int i = 0; i < shaders.size(); ++i)
+        Hooks::Compile(shaders[i]);
+    if (cacheable)
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+                            GL_TRUE);
+    Hooks::linkProgram(program);
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (linked != GL_TRUE || !cacheable) return;
+    Program p;
+    p.program = program;
+    p.file = file;
+    SaveBinary(p);
+}
+
+void ProgramCache::SaveBinary(const Program& p) {
+    GLint length = 0;
+    glGetProgramiv(p.program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) return;
+    vector<char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(p.program, length, NULL, &format, &binary[0]);
+#ifdef _WIN32
+    _mkdir(directory.c_str());
+#else
+    mkdir(directory.c_str(), 0755);
+#endif
+    std::ofstream out(p.file.c_str(), std::ios::binary | std::ios::trunc);
+    if (!out) return;
+    unsigned int header[4];
+    memcpy(header, CACHE_MAGIC, 4);
+    header[1] = CACHE_VERSION;
+    header[2] = format;
+    header[3] = length;
+    out.write((const char*)header, sizeof(header));
+    out.write(&binary[0], binary.size());
+    if (!out.good()) {
+        out.close();
+        remove(p.file.c_str());
+    }
+}
+
+void ProgramCache::Finish(Program& p) {
+    GLint linked = GL_FALSE;
+    glGetProgramiv(p.program, GL_LINK_STATUS, &linked);
+    if (linked == GL_TRUE) {
+        p.state = DONE;
+        if (binaries) SaveBinary(p);
+    } else {
+        logger.warning << "ProgramCache: program failed to link\n"
+                       << InfoLog(p.vertex, false)
+                       << InfoLog(p.fragment, false)
+                       << InfoLog(p.program, true) << logger.end;
+        p.state = FAILED;
+        glDeleteProgram(p.program);
+        p.program = 0;
+    }
+    glDeleteShader(p.vertex);
+    glDeleteShader(p.fragment);
+    p.vertex = p.fragment = 0;
+}
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
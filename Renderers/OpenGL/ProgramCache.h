@@ -0,0 +1,106 @@
+// Shader program binary cache.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OE_OPENGL_PROGRAM_CACHE_H_
+#define _OE_OPENGL_PROGRAM_CACHE_H_
+
+#include <string>
+#include <vector>
+
+namespace OpenEngine {
+namespace Renderers {
+namespace OpenGL {
+
+/**
+ * Shader program binary cache.
+ *
+ * Builds GLSL programs from vertex and fragment source. Linked
+ * programs are stored as driver binaries in the cache directory,
+ * keyed by a hash of the sources and the vendor, renderer and
+ * version strings of the driver, and later builds of the same
+ * sources load the binary instead of compiling. A binary the driver
+ * rejects, for instance after a driver update, is rebuilt from
+ * source.
+ *
+ * Builds are split in Submit() and GetProgram(). When the driver
+ * supports parallel shader compilation, compiling and linking run in
+ * the background between the two calls and IsReady() tells whether
+ * GetProgram() would wait. Otherwise Submit() compiles and links
+ * right away.
+ *
+ * Programs built by other code, such as the shader resources of a
+ * scene, are routed through the cache between BeginCapture() and
+ * EndCapture(). While capturing, the GL entry points compiling and
+ * linking shaders are redirected: compiling is deferred until the
+ * program is linked, and a program whose sources are cached is loaded
+ * from its binary without compiling at all.
+ *
+ * All methods must be called with the GL context current. Without
+ * program binary support the cache only compiles.
+ *
+ * @code
+ * unsigned int h = cache.Submit(vertexSource, fragmentSource);
+ * ... // other work, one frame later etc.
+ * if (cache.IsReady(h)) program = cache.GetProgram(h);
+ * @endcode
+ */
+class ProgramCache {
+public:
+    ProgramCache(std::string directory);
+    virtual ~ProgramCache();
+
+    unsigned int Submit(const std::string& vertex,
+                        const std::string& fragment);
+    bool IsReady(unsigned int handle);
+    unsigned int GetProgram(unsigned int handle);
+    unsigned int Build(const std::string& vertex,
+                       const std::string& fragment);
+
+    void BeginCapture();
+    void EndCapture();
+
+    unsigned int GetHitCount() const;
+    unsigned int GetMissCount() const;
+
+private:
+    class Hooks;
+    friend class Hooks;
+
+    enum State { LINKING, DONE, FAILED };
+
+    struct Program {
+        State state;
+        unsigned int program;
+        unsigned int vertex, fragment;
+        std::string file;
+    };
+
+    std::string directory;
+    bool initialized;
+    bool binaries;
+    bool parallel;
+    std::string driver;
+    std::vector<Program> programs;
+    unsigned int hits, misses;
+
+    void Initialize();
+    std::string CacheFile(const std::string& vertex,
+                          const std::string& fragment) const;
+    bool LoadBinary(Program& p);
+    bool ReadBinary(const std::string& file, unsigned int program);
+    void LinkCaptured(unsigned int program);
+    void SaveBinary(const Program& p);
+    void Finish(Program& p);
+};
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
+
+#endif // _OE_OPENGL_PROGRAM_CACHE_H_
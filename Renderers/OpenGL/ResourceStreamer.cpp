@@ -0,0 +1,435 @@
+// Resource streamer.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Renderers/OpenGL/ResourceStreamer.h>
+
+#include <Core/Exceptions.h>
+#include <Display/IRenderCanvas.h>
+#include <Display/IViewingVolume.h>
+#include <Geometry/Face.h>
+#include <Geometry/FaceSet.h>
+#include <Geometry/Material.h>
+#include <Geometry/Mesh.h>
+#include <Logging/Logger.h>
+#include <Math/Vector.h>
+#include <Meta/OpenGL.h>
+#include <Renderers/AsyncTextureLoader.h>
+#include <Renderers/OpenGL/CompressedTextureCache.h>
+#include <Resources/CachedOBJResource.h>
+#include <Resources/ResourceManager.h>
+#include <Scene/GeometryNode.h>
+#include <Scene/ISceneNodeVisitor.h>
+#include <Scene/MeshNode.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace OpenEngine {
+namespace Renderers {
+namespace OpenGL {
+
+using namespace Core;
+using namespace Geometry;
+using namespace Resources;
+using namespace Scene;
+using std::string;
+using std::vector;
+
+class ResourceStreamer::PrepareTask : public ITask {
+    CachedOBJResourcePtr model;
+public:
+    PrepareTask(CachedOBJResourcePtr model) : model(model) {}
+    void Run() { model->Prepare(); }
+};
+
+// Estimates the memory held by the faces of a model.
+class GeometrySize : public ISceneNodeVisitor {
+public:
+    unsigned long bytes;
+    GeometrySize() : bytes(0) {}
+    void VisitGeometryNode(GeometryNode* node) {
+        FaceSet* faces = node->GetFaceSet();
+        if (faces != NULL)
+            for (FaceList::iterator itr = faces->begin();
+                 itr != faces->end(); ++itr)
+                bytes += sizeof(Face);
+        node->VisitSubNodes(*this);
+    }
+};
+
+// Resident size of a texture with its mipmaps. Textures read from the
+// compressed cache are never loaded, their size is known to the cache
+// and they take at most a byte per pixel.
+static unsigned long TextureSize(ITexture2DPtr texr,
+                                 CompressedTextureCache* cache) {
+    unsigned int width, height;
+    if (cache != NULL && cache->GetSize(texr, width, height))
+        return (unsigned long)width * height * 4 / 3;
+    unsigned long bpp = std::max(texr->GetDepth() / 8, 1u);
+    return (unsigned long)texr->GetWidth() * texr->GetHeight() * bpp * 4 / 3;
+}
+
+// Orders resident textures by the frame they were last used in.
+static bool LessUsed(const std::pair<unsigned int, ITexture2DPtr>& a,
+                     const std::pair<unsigned int, ITexture2DPtr>& b) {
+    return a.first < b.first;
+}
+
+/**
+ * Create a resource streamer.
+ * The budgets default to 256 MB of textures and 512 MB of models and
+ * the load distance to 500 units.
+ *
+ * @param loader Loader to load textures through.
+ */
+ResourceStreamer::ResourceStreamer(AsyncTextureLoader& loader)
+    : loader(loader)
+    , scheduler(NULL)
+    , structureLock(NULL)
+    , textureBudget(256ul << 20)
+    , modelBudget(512ul << 20)
+    , loadDistance(500.0f)
+    , frame(0) {
+    stats.textureBytes = stats.modelBytes = 0;
+    stats.textures = stats.models = 0;
+    stats.hits = stats.misses = stats.evictions = 0;
+}
+
+/**
+ * Destroy the streamer.
+ * Waits for models being prepared. Loaded models stay in the scene.
+ */
+ResourceStreamer::~ResourceStreamer() {
+    for (vector<Model*>::iterator itr = models.begin();
+         itr != models.end(); ++itr) {
+        if ((*itr)->task != NULL) {
+            scheduler->Wait((*itr)->group);
+            delete (*itr)->task;
+        }
+        delete *itr;
+    }
+}
+
+/**
+ * Set the texture budget, the estimated bytes of resident textures.
+ */
+void ResourceStreamer::SetTextureBudget(unsigned long bytes) {
+    textureBudget = bytes;
+}
+
+/**
+ * Set the model budget, the estimated bytes of loaded model geometry.
+ */
+void ResourceStreamer::SetModelBudget(unsigned long bytes) {
+    modelBudget = bytes;
+}
+
+/**
+ * Set the distance from the camera to the bounding sphere of a
+ * streamed model within which the model is loaded.
+ */
+void ResourceStreamer::SetLoadDistance(float distance) {
+    loadDistance = distance;
+}
+
+/**
+ * Prepare cached OBJ models as tasks on a scheduler.
+ *
+ * @param scheduler Scheduler to use, NULL to load on the render
+ *                  thread.
+ */
+void ResourceStreamer::SetScheduler(TaskScheduler* scheduler) {
+    this->scheduler = scheduler;
+}
+
+/**
+ * Hold a lock while adding and removing model nodes, for threads
+ * walking the scene while the streamer runs.
+ *
+ * @param lock Lock to hold, NULL for none.
+ */
+void ResourceStreamer::SetStructureLock(Mutex* lock) {
+    structureLock = lock;
+}
+
+/**
+ * Add a streamed model.
+ * The model is loaded as a sub node of the parent when needed. The
+ * parent must stay in the scene as long as the streamer is used.
+ *
+ * @param parent Node to add the model to.
+ * @param file Model file.
+ * @param center Center of the bounding sphere of the model, in the
+ *               coordinates of the scene root.
+ * @param radius Radius of the bounding sphere.
+ */
+void ResourceStreamer::AddModel(ISceneNode& parent, string file,
+                                const float center[3], float radius) {
+    Model* m = new Model();
+    m->parent = &parent;
+    m->file = file;
+    std::copy(center, center + 3, m->center);
+    m->radius = radius;
+    m->node = NULL;
+    m->task = NULL;
+    m->bytes = 0;
+    m->used = 0;
+    models.push_back(m);
+}
+
+/**
+ * Report that a geometry node is rendered this frame.
+ * The textures of its faces are looked up once per face set.
+ */
+void ResourceStreamer::Touch(GeometryNode* node) {
+    FaceSet* faces = node->GetFaceSet();
+    if (faces == NULL || faces->begin() == faces->end()) return;
+    FaceSetTextures& fst = facesets[faces];
+    FacePtr first = *faces->begin();
+    if (fst.first.expired() || fst.first.lock() != first) {
+        // new face set, or a new one at the address of a deleted one
+        fst.first = first;
+        fst.textures.clear();
+        for (FaceList::iterator itr = faces->begin();
+             itr != faces->end(); ++itr) {
+            MaterialPtr mat = (*itr)->mat;
+            if (mat && mat->texr &&
+                std::find(fst.textures.begin(), fst.textures.end(),
+                          mat->texr) == fst.textures.end())
+                fst.textures.push_back(mat->texr);
+        }
+    }
+    for (unsigned int i = 0; i < fst.textures.size(); ++i)
+        Touch(fst.textures[i]);
+}
+
+/**
+ * Report that a mesh node is rendered this frame.
+ */
+void ResourceStreamer::Touch(MeshNode* node) {
+    MaterialPtr mat = node->GetMesh()->GetMaterial();
+    if (mat) Touch(mat->texr);
+}
+
+/**
+ * Get the streaming statistics.
+ */
+ResourceStreamer::Stats ResourceStreamer::GetStats() const {
+    return stats;
+}
+
+/**
+ * Event notified when a streamed model is loaded or evicted, for
+ * instance to update a culling structure.
+ */
+IEvent<StreamingEventArg>& ResourceStreamer::StreamingEvent() {
+    return streamingEvent;
+}
+
+/**
+ * Load the streamed models near the camera and evict the least
+ * recently used resources over budget.
+ */
+void ResourceStreamer::Handle(RenderingEventArg arg) {
+    frame++;
+    UpdateModels(arg);
+    EvictTextures();
+    EvictModels();
+}
+
+void ResourceStreamer::Touch(ITexture2DPtr texr) {
+    if (!texr) return;
+    Texture& t = textures[texr.get()];
+    if (t.texr.expired()) {
+        t.texr = texr;
+        t.requested = false;
+    }
+    t.used = frame;
+    if (texr->GetID() != 0) {
+        stats.hits++;
+        t.requested = false;
+    } else if (!t.requested) {
+        stats.misses++;
+        t.requested = true;
+        loader.Load(texr);
+    }
+}
+
+void ResourceStreamer::UpdateModels(RenderingEventArg& arg) {
+    if (models.empty()) return;
+    Display::IViewingVolume* volume = arg.canvas.GetViewingVolume();
+    Math::Vector<3,float> eye = volume->GetPosition();
+
+    // world space frustum planes of projection * view, (a, b, c, d)
+    // with the inside positive
+    float view[16], proj[16], clip[16], planes[6][4];
+    volume->GetViewMatrix().ToArray(view);
+    volume->GetProjectionMatrix().ToArray(proj);
+    for (unsigned int c = 0; c < 4; ++c)
+        for (unsigned int r = 0; r < 4; ++r) {
+            float sum = 0;
+            for (unsigned int k = 0; k < 4; ++k)
+                sum += proj[k*4 + r] * view[c*4 + k];
+            clip[c*4 + r] = sum;
+        }
+    for (unsigned int i = 0; i < 3; ++i)
+        for (unsigned int k = 0; k < 4; ++k) {
+            planes[2*i][k]     = clip[k*4 + 3] + clip[k*4 + i];
+            planes[2*i + 1][k] = clip[k*4 + 3] - clip[k*4 + i];
+        }
+
+    Model* nearest = NULL;
+    float nearestDistance = 0;
+    for (vector<Model*>::iterator itr = models.begin();
+         itr != models.end(); ++itr) {
+        Model& m = **itr;
+        if (m.task != NULL && m.group.GetPendingCount() == 0) {
+            delete m.task;
+            m.task = NULL;
+            Attach(m);
+        }
+        float d[3] = { m.center[0] - eye[0],
+                       m.center[1] - eye[1],
+                       m.center[2] - eye[2] };
+        float distance = std::sqrt(d[0]*d[0] + d[1]*d[1] + d[2]*d[2])
+            - m.radius;
+        if (distance > loadDistance) continue;
+        bool inside = true;
+        for (unsigned int p = 0; p < 6 && inside; ++p) {
+            const float* pl = planes[p];
+            float len = std::sqrt(pl[0]*pl[0] + pl[1]*pl[1] + pl[2]*pl[2]);
+            float s = pl[0]*m.center[0] + pl[1]*m.center[1] +
+                      pl[2]*m.center[2] + pl[3];
+            inside = s >= -m.radius * len;
+        }
+        if (!inside) continue;
+        m.used = frame;
+        if (m.node != NULL || m.task != NULL || m.file.empty()) continue;
+        if (nearest == NULL || distance < nearestDistance) {
+            nearest = &m;
+            nearestDistance = distance;
+        }
+    }
+    if (nearest == NULL) return;
+
+    // start loading one model per frame
+    Model& m = *nearest;
+    try {
+        if (!m.resource)
+            m.resource = ResourceManager<IModelResource>::Create(m.file);
+    } catch (Exception& e) {
+        logger.warning << "ResourceStreamer: " << e.what() << logger.end;
+        m.file.clear();
+        return;
+    }
+    CachedOBJResourcePtr cached =
+        boost::dynamic_pointer_cast<CachedOBJResource>(m.resource);
+    if (cached && scheduler != NULL) {
+        m.task = new PrepareTask(cached);
+        scheduler->Submit(m.task, &m.group);
+    } else
+        Attach(m);
+}
+
+void ResourceStreamer::Attach(Model& m) {
+    try {
+        m.resource->Load();
+    } catch (Exception& e) {
+        logger.warning << "ResourceStreamer: " << e.what() << logger.end;
+        m.file.clear();
+        return;
+    }
+    m.node = m.resource->GetSceneNode();
+    if (m.node == NULL) {
+        m.file.clear();
+        return;
+    }
+    if (structureLock != NULL) structureLock->Lock();
+    m.parent->AddNode(m.node);
+    if (structureLock != NULL) structureLock->Unlock();
+    GeometrySize size;
+    m.node->Accept(size);
+    m.bytes = size.bytes;
+    stats.modelBytes += m.bytes;
+    stats.models++;
+    streamingEvent.Notify(StreamingEventArg(*m.parent, true));
+}
+
+void ResourceStreamer::Evict(Model& m) {
+    if (structureLock != NULL) structureLock->Lock();
+    m.parent->RemoveNode(m.node);
+    delete m.node;
+    if (structureLock != NULL) structureLock->Unlock();
+    m.node = NULL;
+    m.resource->Unload();
+    stats.modelBytes -= m.bytes;
+    stats.models--;
+    stats.evictions++;
+    m.bytes = 0;
+    streamingEvent.Notify(StreamingEventArg(*m.parent, false));
+}
+
+void ResourceStreamer::EvictTextures() {
+    vector<std::pair<unsigned int, ITexture2DPtr> > resident;
+    unsigned long bytes = 0;
+    for (std::map<ITexture2D*, Texture>::iterator itr = textures.begin();
+         itr != textures.end(); ) {
+        ITexture2DPtr texr = itr->second.texr.lock();
+        if (!texr) {
+            textures.erase(itr++);
+            continue;
+        }
+        if (texr->GetID() != 0) {
+            bytes += TextureSize(texr, loader.GetCompression());
+            resident.push_back(std::make_pair(itr->second.used, texr));
+        }
+        ++itr;
+    }
+    for (std::map<FaceSet*, FaceSetTextures>::iterator itr = facesets.begin();
+         itr != facesets.end(); ) {
+        if (itr->second.first.expired()) facesets.erase(itr++);
+        else ++itr;
+    }
+    stats.textures = resident.size();
+    stats.textureBytes = bytes;
+    if (bytes <= textureBudget) return;
+
+    std::sort(resident.begin(), resident.end(), LessUsed);
+    for (unsigned int i = 0; i < resident.size(); ++i) {
+        // textures used in the previous frame are still on screen
+        if (stats.textureBytes <= textureBudget ||
+            resident[i].first + 1 >= frame)
+            break;
+        ITexture2DPtr texr = resident[i].second;
+        stats.textureBytes -= TextureSize(texr, loader.GetCompression());
+        GLuint id = texr->GetID();
+        glDeleteTextures(1, &id);
+        texr->SetID(0);
+        texr->Unload();
+        stats.textures--;
+        stats.evictions++;
+    }
+}
+
+void ResourceStreamer::EvictModels() {
+    while (stats.modelBytes > modelBudget) {
+        Model* lru = NULL;
+        for (vector<Model*>::iterator itr = models.begin();
+             itr != models.end(); ++itr)
+            if ((*itr)->node != NULL && (*itr)->used + 1 < frame &&
+                (lru == NULL || (*itr)->used < lru->used))
+                lru = *itr;
+        if (lru == NULL) return;
+        Evict(*lru);
+    }
+}
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
@@ -0,0 +1,158 @@
+// Resource streamer.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OE_OPENGL_RESOURCE_STREAMER_H_
+#define _OE_OPENGL_RESOURCE_STREAMER_H_
+
+#include <Core/Event.h>
+#include <Core/IListener.h>
+#include <Core/Mutex.h>
+#include <Core/TaskScheduler.h>
+#include <Renderers/IRenderer.h>
+#include <Resources/IModelResource.h>
+#include <Resources/ITexture2D.h>
+
+#include <boost/weak_ptr.hpp>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace OpenEngine {
+    namespace Geometry {
+        class FaceSet;
+        class Face;
+    }
+    namespace Scene {
+        class ISceneNode;
+        class GeometryNode;
+        class MeshNode;
+    }
+namespace Renderers {
+    class AsyncTextureLoader;
+namespace OpenGL {
+
+/**
+ * Event argument of a streamed model being loaded or evicted.
+ * The node has been added to or removed from the parent.
+ */
+struct StreamingEventArg {
+    Scene::ISceneNode& parent;
+    bool loaded;
+    StreamingEventArg(Scene::ISceneNode& parent, bool loaded)
+        : parent(parent), loaded(loaded) {}
+};
+
+/**
+ * Resource streamer.
+ *
+ * Keeps the textures and models of a scene resident within a memory
+ * budget. Textures are loaded when geometry using them is rendered,
+ * the rendering view reports this with Touch(), so textures of
+ * geometry outside the view frustum are never requested. Models are
+ * added as streamed models, a file to load under a parent node when
+ * its bounding sphere is within the load distance of the camera and
+ * inside the view frustum. The nearest models are loaded first.
+ *
+ * When the resident bytes exceed a budget the least recently used
+ * textures or models that were not used in the previous frame are
+ * evicted: textures are deleted from the GPU and their data unloaded,
+ * model nodes are removed, deleted and their resources unloaded.
+ * Evicted resources are loaded again when they are needed.
+ *
+ * Textures are loaded through an asynchronous texture loader. Cached
+ * OBJ models are prepared as tasks when a scheduler is set, other
+ * models are loaded on the render thread.
+ *
+ * Attach the streamer to the renderer pre-process event.
+ */
+class ResourceStreamer
+    : public Core::IListener<RenderingEventArg> {
+public:
+    /**
+     * Streaming statistics, the counts are totals since creation.
+     */
+    struct Stats {
+        unsigned long textureBytes, modelBytes;
+        unsigned int textures, models;
+        unsigned int hits, misses, evictions;
+    };
+
+    ResourceStreamer(AsyncTextureLoader& loader);
+    virtual ~ResourceStreamer();
+
+    void SetTextureBudget(unsigned long bytes);
+    void SetModelBudget(unsigned long bytes);
+    void SetLoadDistance(float distance);
+    void SetScheduler(Core::TaskScheduler* scheduler);
+    void SetStructureLock(Core::Mutex* lock);
+
+    void AddModel(Scene::ISceneNode& parent, std::string file,
+                  const float center[3], float radius);
+
+    void Touch(Scene::GeometryNode* node);
+    void Touch(Scene::MeshNode* node);
+
+    Stats GetStats() const;
+    Core::IEvent<StreamingEventArg>& StreamingEvent();
+
+    void Handle(RenderingEventArg arg);
+
+private:
+    class PrepareTask;
+
+    struct Texture {
+        boost::weak_ptr<Resources::ITexture2D> texr;
+        unsigned int used;
+        bool requested;
+    };
+
+    // textures of a face set, valid while its first face is alive
+    struct FaceSetTextures {
+        boost::weak_ptr<Geometry::Face> first;
+        std::vector<Resources::ITexture2DPtr> textures;
+    };
+
+    struct Model {
+        Scene::ISceneNode* parent;
+        std::string file;
+        float center[3];
+        float radius;
+        Resources::IModelResourcePtr resource;
+        Scene::ISceneNode* node;
+        PrepareTask* task;
+        Core::TaskGroup group;
+        unsigned long bytes;
+        unsigned int used;
+    };
+
+    AsyncTextureLoader& loader;
+    Core::TaskScheduler* scheduler;
+    Core::Mutex* structureLock;
+    unsigned long textureBudget, modelBudget;
+    float loadDistance;
+    unsigned int frame;
+    std::map<Resources::ITexture2D*, Texture> textures;
+    std::map<Geometry::FaceSet*, FaceSetTextures> facesets;
+    std::vector<Model*> models;
+    Stats stats;
+    Core::Event<StreamingEventArg> streamingEvent;
+
+    void Touch(Resources::ITexture2DPtr texr);
+    void UpdateModels(RenderingEventArg& arg);
+    void Attach(Model& m);
+    void Evict(Model& m);
+    void EvictTextures();
+    void EvictModels();
+};
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
+
+#endif // _OE_OPENGL_RESOURCE_STREAMER_H_
@@ -0,0 +1,308 @@
+// Ring buffer for streaming uploads.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Renderers/OpenGL/UploadRing.h>
+
+#include <Logging/Logger.h>
+#include <Meta/OpenGL.h>
+
+#include <cstring>
+
+namespace OpenEngine {
+namespace Renderers {
+namespace OpenGL {
+
+using namespace Resources;
+
+// offsets into the ring are aligned for any use of the buffer
+static const unsigned int ALIGNMENT = 256;
+
+// longest wait for a region still read by the GPU, in nanoseconds
+static const GLuint64 WAIT_TIMEOUT = 1000000000ull;
+
+/**
+ * Create a ring.
+ * The buffer is created on first use.
+ *
+ * @param frameSize Bytes available per frame.
+ * @param frames Number of frames in flight, at least two.
+ */
+UploadRing::UploadRing(unsigned int frameSize, unsigned int frames)
+    : frameSize(frameSize)
+    , frames(frames < 2 ? 2 : frames)
+    , initialized(false)
+    , supported(false)
+    , persistent(false)
+    , buffer(0)
+    , mapping(NULL)
+    , current(0)
+    , used(0)
+    , stalls(0) {}
+
+/**
+ * Destroy the ring.
+ * The buffer and fences are left for the context to clean up since
+ * we can not know if the context still exists.
+ */
+UploadRing::~UploadRing() {
+    for (std::map<ITexture2D*, Texture>::iterator itr = textures.begin();
+         itr != textures.end(); ++itr) {
+        ITexture2DPtr texr = itr->second.texr.lock();
+        if (texr) texr->ChangedEvent().Detach(*this);
+    }
+}
+
+/**
+ * Reserve memory in the region of the current frame for writing
+ * directly into the mapped buffer.
+ * Only available with a persistently mapped buffer.
+ *
+ * @param size Bytes to reserve.
+ * @param offset Set to the offset of the memory in the buffer.
+ * @return Memory to write, valid until the next frame, or NULL if
+ *         the buffer is not mapped or the region is full.
+ */
+void* UploadRing::Allocate(unsigned int size, unsigned int& offset) {
+    if (!initialized) Initialize();
+    if (!persistent) return NULL;
+    offset = Reserve(size);
+    if (offset == ~0u) return NULL;
+    return mapping + offset;
+}
+
+/**
+ * Copy data into the region of the current frame.
+ *
+ * @param data Data to copy.
+ * @param size Bytes to copy.
+ * @param offset Set to the offset of the data in the buffer.
+ * @return False if the ring is not supported or the region is full,
+ *         in which case the data must be uploaded in another way.
+ */
+bool UploadRing::Write(const void* data, unsigned int size,
+                       unsigned int& offset) {
+    if (!initialized) Initialize();
+    if (!supported) return false;
+    offset = Reserve(size);
+    if (offset == ~0u) return false;
+    if (persistent)
+        memcpy(mapping + offset, data, size);
+    else {
+        glBindBufferARB(GL_ARRAY_BUFFER_ARB, buffer);
+        glBufferSubDataARB(GL_ARRAY_BUFFER_ARB, offset, size, data);
+        glBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
+    }
+    return true;
+}
+
+/**
+ * Get the buffer object of the ring, to bind with the offsets of the
+ * written data. Zero if the ring is not supported.
+ */
+unsigned int UploadRing::GetBuffer() {
+    if (!initialized) Initialize();
+    return buffer;
+}
+
+/**
+ * Re-upload a texture through the ring whenever it changes.
+ * The texture must already be loaded, and is reloaded as a whole.
+ *
+ * @param texr Texture to track.
+ */
+void UploadRing::Track(ITexture2DPtr texr) {
+    Texture& t = textures[texr.get()];
+    if (t.texr.lock() == texr) return;
+    t.texr = texr;
+    t.width = texr->GetWidth();
+    t.height = texr->GetHeight();
+    t.dirty = false;
+    texr->ChangedEvent().Attach(*this);
+}
+
+/**
+ * Upload the pixels of a loaded texture into its GL texture.
+ * The pixels are copied into the ring and read by the GL from there,
+ * so the upload does not wait for the GL. If the ring is full or not
+ * supported the pixels are uploaded from the texture directly, still
+ * without reallocating the GL texture.
+ *
+ * @param texr Texture with pixel data and a texture id.
+ * @return False if the texture could not be uploaded.
+ */
+bool UploadRing::Upload(ITexture2DPtr texr) {
+    if (!initialized) Initialize();
+    if (texr->GetID() == 0 || texr->GetData() == NULL) return false;
+    unsigned int format;
+    if (!GetPixelFormat(*texr, format)) {
+        logger.warning << "UploadRing: unsupported color format of texture "
+                       << texr->GetID() << logger.end;
+        return false;
+    }
+    unsigned int channels = texr->GetDepth() / 8;
+    unsigned int width = texr->GetWidth(), height = texr->GetHeight();
+    unsigned int bytes = width * height * channels;
+
+    // a texture changing its size is reallocated
+    bool resized = false;
+    std::map<ITexture2D*, Texture>::iterator itr = textures.find(texr.get());
+    if (itr != textures.end() &&
+        (itr->second.width != width || itr->second.height != height)) {
+        itr->second.width = width;
+        itr->second.height = height;
+        resized = true;
+    }
+
+    const GLvoid* pixels = texr->GetData();
+    unsigned int offset;
+    bool ring = GLEW_ARB_pixel_buffer_object &&
+        Write(texr->GetData(), bytes, offset);
+    if (ring) {
+        glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, buffer);
+        pixels = (const GLvoid*)(unsigned long)offset;
+    }
+    glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glBindTexture(GL_TEXTURE_2D, texr->GetID());
+    if (resized) {
+        GLint internal = (channels == 4) ? GL_RGBA8
+            : (channels == 3) ? GL_RGB8 : GL_LUMINANCE8;
+        glTexImage2D(GL_TEXTURE_2D, 0, internal, width, height, 0,
+                     format, GL_UNSIGNED_BYTE, pixels);
+    } else
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height,
+                        format, GL_UNSIGNED_BYTE, pixels);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glPopClientAttrib();
+    if (ring) glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
+    return true;
+}
+
+/**
+ * Check if the driver supports the ring.
+ * Without it Write() always fails and textures are uploaded from
+ * their own memory.
+ */
+bool UploadRing::IsPersistent() {
+    if (!initialized) Initialize();
+    return persistent;
+}
+
+/**
+ * Number of frames that had to wait for the GPU to release their
+ * region, a sign the ring needs more frames.
+ */
+unsigned int UploadRing::GetStallCount() const {
+    return stalls;
+}
+
+/**
+ * Get the GL pixel format of the data of a texture.
+ *
+ * @param texr Texture.
+ * @param format Set to the GL format.
+ * @return False if the color format has no GL pixel format.
+ */
+bool UploadRing::GetPixelFormat(ITexture2D& texr, unsigned int& format) {
+    switch (texr.GetColorFormat()) {
+    case RGBA: format = GL_RGBA; return true;
+    case BGRA: format = GL_BGRA; return true;
+    case RGB: format = GL_RGB; return true;
+    case BGR: format = GL_BGR; return true;
+    case LUMINANCE: format = GL_LUMINANCE; return true;
+    default: return false;
+    }
+}
+
+/**
+ * Start a new frame and upload the tracked textures that changed.
+ */
+void UploadRing::Handle(RenderingEventArg arg) {
+    if (!initialized) Initialize();
+    NextFrame();
+    for (std::map<ITexture2D*, Texture>::iterator itr = textures.begin();
+         itr != textures.end(); ) {
+        ITexture2DPtr texr = itr->second.texr.lock();
+        if (!texr) {
+            textures.erase(itr++);
+            continue;
+        }
+        if (itr->second.dirty) {
+            itr->second.dirty = false;
+            Upload(texr);
+        }
+        ++itr;
+    }
+}
+
+/**
+ * Mark a tracked texture for upload in the next frame.
+ */
+void UploadRing::Handle(Texture2DChangedEventArg arg) {
+    std::map<ITexture2D*, Texture>::iterator itr =
+        textures.find(arg.resource.get());
+    if (itr != textures.end()) itr->second.dirty = true;
+}
+
+void UploadRing::Initialize() {
+    initialized = true;
+    supported = GLEW_ARB_vertex_buffer_object && GLEW_ARB_sync;
+    if (!supported) {
+        logger.warning << "UploadRing: buffer objects or fences not "
+                       << "supported, uploads are synchronous"
+                       << logger.end;
+        return;
+    }
+    unsigned int total = frameSize * frames;
+    glGenBuffersARB(1, &buffer);
+    glBindBufferARB(GL_ARRAY_BUFFER_ARB, buffer);
+#ifdef GL_ARB_buffer_storage
+    if (GLEW_ARB_buffer_storage) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT |
+            GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_ARRAY_BUFFER_ARB, total, NULL,
+                        flags | GL_DYNAMIC_STORAGE_BIT);
+        mapping = (char*)glMapBufferRange(GL_ARRAY_BUFFER_ARB, 0, total, flags);
+        persistent = mapping != NULL;
+    } else
+#endif
+        glBufferDataARB(GL_ARRAY_BUFFER_ARB, total, NULL, GL_STREAM_DRAW_ARB);
+    glBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
+    fences.assign(frames, NULL);
+}
+
+// Fence the region written in the last frame and move on to the next
+// region, waiting for the GPU to be done with it.
+void UploadRing::NextFrame() {
+    if (!supported || used == 0) return;
+    if (fences[current] != NULL) glDeleteSync((GLsync)fences[current]);
+    fences[current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    current = (current + 1) % frames;
+    used = 0;
+    GLsync fence = (GLsync)fences[current];
+    if (fence == NULL) return;
+    if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+        stalls++;
+        glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, WAIT_TIMEOUT);
+    }
+    glDeleteSync(fence);
+    fences[current] = NULL;
+}
+
+// Reserve bytes in the current region, ~0 if they do not fit.
+unsigned int UploadRing::Reserve(unsigned int size) {
+    unsigned int start = (used + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    if (start > frameSize || size > frameSize - start) return ~0u;
+    used = start + size;
+    return current * frameSize + start;
+}
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
@@ -0,0 +1,102 @@
+// Ring buffer for streaming uploads.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OE_OPENGL_UPLOAD_RING_H_
+#define _OE_OPENGL_UPLOAD_RING_H_
+
+#include <Core/IListener.h>
+#include <Renderers/IRenderer.h>
+#include <Resources/ITexture2D.h>
+
+#include <boost/weak_ptr.hpp>
+#include <map>
+#include <vector>
+
+namespace OpenEngine {
+namespace Renderers {
+namespace OpenGL {
+
+/**
+ * Ring buffer for streaming uploads.
+ *
+ * One buffer object is split into a region per frame in flight, by
+ * default three. Data written during a frame goes into the region of
+ * that frame, and a fence is placed behind the frame so the region is
+ * reused only once the GPU is done reading it. The CPU therefore
+ * never waits for the GPU unless it runs more frames ahead than
+ * there are regions, and the driver never has to copy or rename the
+ * buffer.
+ *
+ * Where the driver supports buffer storage the buffer is persistently
+ * and coherently mapped and data is written straight into it, see
+ * Allocate(). Otherwise Write() copies through glBufferSubData into a
+ * region the fences guarantee is free.
+ *
+ * Tracked textures, such as HUD surfaces that redraw themselves, are
+ * re-uploaded through the ring as pixel unpack buffer when they
+ * change, replacing the synchronous reload of the texture loader.
+ * Load them with TextureLoader::RELOAD_NEVER and Track() them.
+ *
+ * Attach the ring to the renderer pre-process event, each pre-process
+ * starts a new frame. All methods must be called with the GL context
+ * current.
+ */
+class UploadRing
+    : public Core::IListener<RenderingEventArg>
+    , public Core::IListener<Resources::Texture2DChangedEventArg> {
+public:
+    UploadRing(unsigned int frameSize = 4 << 20, unsigned int frames = 3);
+    virtual ~UploadRing();
+
+    void* Allocate(unsigned int size, unsigned int& offset);
+    bool Write(const void* data, unsigned int size, unsigned int& offset);
+    unsigned int GetBuffer();
+
+    void Track(Resources::ITexture2DPtr texr);
+    bool Upload(Resources::ITexture2DPtr texr);
+
+    bool IsPersistent();
+    unsigned int GetStallCount() const;
+
+    static bool GetPixelFormat(Resources::ITexture2D& texr,
+                               unsigned int& format);
+
+    void Handle(RenderingEventArg arg);
+    void Handle(Resources::Texture2DChangedEventArg arg);
+
+private:
+    struct Texture {
+        boost::weak_ptr<Resources::ITexture2D> texr;
+        unsigned int width, height;
+        bool dirty;
+    };
+
+    unsigned int frameSize;
+    unsigned int frames;
+    bool initialized;
+    bool supported;
+    bool persistent;
+    unsigned int buffer;
+    char* mapping;
+    unsigned int current;
+    unsigned int used;
+    std::vector<void*> fences;
+    std::map<Resources::ITexture2D*, Texture> textures;
+    unsigned int stalls;
+
+    void Initialize();
+    void NextFrame();
+    unsigned int Reserve(unsigned int size);
+};
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
+
+#endif // _OE_OPENGL_UPLOAD_RING_H_
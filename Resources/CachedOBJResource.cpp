@@ -0,0 +1,555 @@
+// OBJ model resource with a binary mesh cache.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Resources/CachedOBJResource.h>
+
+#include <Core/Exceptions.h>
+#include <Core/Mutex.h>
+#include <Core/TaskScheduler.h>
+#include <Core/Thread.h>
+#include <Geometry/Face.h>
+#include <Geometry/FaceSet.h>
+#include <Geometry/Material.h>
+#include <Math/Vector.h>
+#include <Resources/ITexture2D.h>
+#include <Resources/ResourceManager.h>
+#include <Scene/GeometryNode.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace OpenEngine {
+namespace Resources {
+
+using namespace Core;
+using namespace Geometry;
+using namespace Math;
+using namespace Scene;
+using std::string;
+using std::vector;
+
+// cache file layout, all values are native endian 32 bit:
+//   magic, version, face count, material count,
+//   positions[faces*9], normals[faces*9], texcoords[faces*6],
+//   material index[faces],
+//   per material: ambient[4], diffuse[4], specular[4], shininess,
+//                 texture name length, texture name padded to 4 bytes,
+//   MTL file count,
+//   per MTL file: modification time,
+//                 file name length, file name padded to 4 bytes
+static const char CACHE_MAGIC[4] = { 'O', 'E', 'M', 'C' };
+static const unsigned int CACHE_VERSION = 2;
+static const unsigned int HEADER_SIZE = 16;
+
+static string DirectoryOf(const string& file) {
+    string::size_type i = file.find_last_of("/\\");
+    return (i == string::npos) ? string() : file.substr(0, i + 1);
+}
+
+// modification time of a file, 0 if it does not exist
+static unsigned int ModificationTime(const string& file) {
+    struct stat st;
+    if (stat(file.c_str(), &st) != 0) return 0;
+    return (unsigned int)st.st_mtime;
+}
+
+static string RestOfLine(std::istringstream& ls) {
+    string rest;
+    std::getline(ls, rest);
+    string::size_type b = rest.find_first_not_of(" \t");
+    string::size_type e = rest.find_last_not_of(" \t\r");
+    return (b == string::npos) ? string() : rest.substr(b, e - b + 1);
+}
+
+CachedOBJResource::MaterialData::MaterialData()
+    : shininess(0) {
+    for (unsigned int i = 0; i < 4; ++i) {
+        ambient[i] = 0.2f;
+        diffuse[i] = 0.8f;
+        specular[i] = 0.0f;
+    }
+    ambient[3] = diffuse[3] = specular[3] = 1.0f;
+}
+
+CachedOBJResource::CachedOBJResource(string file)
+    : file(file)
+    , prepared(false)
+    , failed(false)
+    , node(NULL)
+    , faces(0)
+    , verts(NULL)
+    , norms(NULL)
+    , texcs(NULL)
+    , faceMaterial(NULL)
+    , mapping(NULL)
+    , mappingSize(0) {}
+
+CachedOBJResource::~CachedOBJResource() {
+    Release();
+}
+
+/**
+ * Parse the model or map its cache.
+ * Does not touch any engine state and is safe to call from any
+ * thread, but not concurrently for the same resource.
+ */
+void CachedOBJResource::Prepare() {
+    if (prepared) return;
+    if (!CacheIsFresh() || !ReadCache()) {
+        Parse();
+        if (!failed) WriteCache();
+    }
+    prepared = true;
+}
+
+/**
+ * Build the scene node of the model.
+ * Prepares the model first if needed.
+ */
+void CachedOBJResource::Load() {
+    if (node != NULL) return;
+    Prepare();
+    if (failed) {
+        prepared = failed = false;
+        Release();
+        throw Exception("CachedOBJResource: " + error);
+    }
+
+    vector<MaterialPtr> mats;
+    for (vector<MaterialData>::iterator itr = data.materials.begin();
+         itr != data.materials.end(); ++itr) {
+        MaterialPtr m(new Material());
+        m->ambient = Vector<4,float>(itr->ambient[0], itr->ambient[1],
+                                     itr->ambient[2], itr->ambient[3]);
+        m->diffuse = Vector<4,float>(itr->diffuse[0], itr->diffuse[1],
+                                     itr->diffuse[2], itr->diffuse[3]);
+        m->specular = Vector<4,float>(itr->specular[0], itr->specular[1],
+                                      itr->specular[2], itr->specular[3]);
+        m->shininess = itr->shininess;
+        if (!itr->texture.empty())
+            m->texr = ResourceManager<ITexture2D>::Create(itr->texture);
+        mats.push_back(m);
+    }
+
+    FaceSet* fs = new FaceSet();
+    for (unsigned int f = 0; f < faces; ++f) {
+        const float* v = verts + f*9;
+        const float* n = norms + f*9;
+        const float* t = texcs + f*6;
+        FacePtr face(new Face(Vector<3,float>(v[0], v[1], v[2]),
+                              Vector<3,float>(v[3], v[4], v[5]),
+                              Vector<3,float>(v[6], v[7], v[8]),
+                              Vector<3,float>(n[0], n[1], n[2]),
+                              Vector<3,float>(n[3], n[4], n[5]),
+                              Vector<3,float>(n[6], n[7], n[8])));
+        face->texc[0] = Vector<2,float>(t[0], t[1]);
+        face->texc[1] = Vector<2,float>(t[2], t[3]);
+        face->texc[2] = Vector<2,float>(t[4], t[5]);
+        unsigned int m = faceMaterial[f];
+        face->mat = mats[m < mats.size() ? m : 0];
+        fs->Add(face);
+    }
+    node = new GeometryNode(fs);
+
+    // the arrays are not needed once the faces are built
+    Release();
+}
+
+/**
+ * Unload the model.
+ * The scene node is owned by the scene it was added to.
+ */
+void CachedOBJResource::Unload() {
+    node = NULL;
+    Release();
+}
+
+ISceneNode* CachedOBJResource::GetSceneNode() {
+    return node;
+}
+
+class PrepareThread : public Thread {
+    vector<CachedOBJResourcePtr>& models;
+    Mutex& lock;
+    unsigned int& next;
+public:
+    PrepareThread(vector<CachedOBJResourcePtr>& models,
+                  Mutex& lock, unsigned int& next)
+        : models(models), lock(lock), next(next) {}
+    void Run() {
+        for (;;) {
+            lock.Lock();
+            unsigned int i = next++;
+            lock.Unlock();
+            if (i >= models.size()) return;
+            models[i]->Prepare();
+        }
+    }
+};
+
+/**
+ * Prepare a number of models in parallel.
+ * Returns when all models are prepared, after which they can be
+ * loaded on the calling thread without parsing.
+ *
+ * @param models Models to prepare.
+ * @param threads Number of threads to parse with.
+ */
+void CachedOBJResource::PrepareAll(vector<CachedOBJResourcePtr>& models,
+                                   unsigned int threads) {
+    if (threads == 0) threads = 1;
+    if (threads > models.size()) threads = models.size();
+    Mutex lock;
+    unsigned int next = 0;
+    vector<PrepareThread*> workers;
+    for (unsigned int i = 0; i < threads; ++i) {
+        workers.push_back(new PrepareThread(models, lock, next));
+        workers.back()->Start();
+    }
+    for (unsigned int i = 0; i < workers.size(); ++i) {
+        workers[i]->Wait();
+        delete workers[i];
+    }
+}
+
+class PrepareTask : public ITask {
+    CachedOBJResourcePtr model;
+public:
+    PrepareTask(CachedOBJResourcePtr model) : model(model) {}
+    void Run() { model->Prepare(); }
+};
+
+/**
+ * Prepare a number of models as tasks on a scheduler.
+ * Returns when all models are prepared.
+ *
+ * @param models Models to prepare.
+ * @param scheduler Scheduler to run the tasks on.
+ */
+void CachedOBJResource::PrepareAll(vector<CachedOBJResourcePtr>& models,
+                                   TaskScheduler& scheduler) {
+    vector<PrepareTask> tasks;
+    tasks.reserve(models.size());
+    TaskGroup group;
+    for (unsigned int i = 0; i < models.size(); ++i) {
+        tasks.push_back(PrepareTask(models[i]));
+        scheduler.Submit(&tasks.back(), &group);
+    }
+    scheduler.Wait(group);
+}
+
+void CachedOBJResource::Release() {
+#ifndef _WIN32
+    if (mapping != NULL) munmap(mapping, mappingSize);
+#endif
+    mapping = NULL;
+    mappingSize = 0;
+    vector<char>().swap(buffer);
+    data = MeshData();
+    faces = 0;
+    verts = norms = texcs = NULL;
+    faceMaterial = NULL;
+    prepared = false;
+}
+
+string CachedOBJResource::CacheFile() const {
+    return file + ".oemesh";
+}
+
+bool CachedOBJResource::CacheIsFresh() const {
+    struct stat src, cache;
+    if (stat(file.c_str(), &src) != 0) return false;
+    if (stat(CacheFile().c_str(), &cache) != 0) return false;
+    return cache.st_mtime >= src.st_mtime;
+}
+
+bool CachedOBJResource::ReadCache() {
+    string cache = CacheFile();
+    const char* base;
+    unsigned long size;
+#ifndef _WIN32
+    int fd = open(cache.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)HEADER_SIZE) {
+        close(fd);
+        return false;
+    }
+    size = st.st_size;
+    void* m = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED) return false;
+    mapping = m;
+    mappingSize = size;
+    base = (const char*)m;
+#else
+    std::ifstream in(cache.c_str(), std::ios::binary);
+    if (!in) return false;
+    in.seekg(0, std::ios::end);
+    size = in.tellg();
+    in.seekg(0, std::ios::beg);
+    if (size < HEADER_SIZE) return false;
+    buffer.resize(size);
+    in.read(&buffer[0], size);
+    base = &buffer[0];
+#endif
+
+    const unsigned int* header = (const unsigned int*)base;
+    unsigned int faceCount = header[2];
+    unsigned int matCount = header[3];
+    // in 64 bits so a huge count in a damaged header can not wrap
+    unsigned long long arrays = HEADER_SIZE
+        + (unsigned long long)faceCount * (9 + 9 + 6 + 1) * 4;
+    if (memcmp(base, CACHE_MAGIC, 4) != 0 ||
+        header[1] != CACHE_VERSION ||
+        arrays > size) {
+        Release();
+        return false;
+    }
+    faces = faceCount;
+    verts = (const float*)(base + HEADER_SIZE);
+    norms = verts + faces*9;
+    texcs = norms + faces*9;
+    faceMaterial = (const unsigned int*)(texcs + faces*6);
+
+    const char* p = base + arrays;
+    const char* end = base + size;
+    for (unsigned int i = 0; i < matCount; ++i) {
+        if (p + 14*4 > end) { Release(); return false; }
+        MaterialData md;
+        const float* f = (const float*)p;
+        memcpy(md.ambient, f, 4*4);
+        memcpy(md.diffuse, f + 4, 4*4);
+        memcpy(md.specular, f + 8, 4*4);
+        md.shininess = f[12];
+        unsigned int len = ((const unsigned int*)p)[13];
+        p += 14*4;
+        if (p + len > end) { Release(); return false; }
+        md.texture.assign(p, len);
+        p += (len + 3) & ~3u;
+        data.materials.push_back(md);
+    }
+
+    // stale if an MTL file has changed since the cache was written
+    if (p + 4 > end) { Release(); return false; }
+    unsigned int libCount = *(const unsigned int*)p;
+    p += 4;
+    for (unsigned int i = 0; i < libCount; ++i) {
+        if (p + 2*4 > end) { Release(); return false; }
+        unsigned int time = ((const unsigned int*)p)[0];
+        unsigned int len = ((const unsigned int*)p)[1];
+        p += 2*4;
+        if (p + len > end) { Release(); return false; }
+        string lib(p, len);
+        p += (len + 3) & ~3u;
+        if (ModificationTime(lib) != time) { Release(); return false; }
+    }
+    return true;
+}
+
+void CachedOBJResource::WriteCache() const {
+    string cache = CacheFile();
+    std::ofstream out(cache.c_str(), std::ios::binary | std::ios::trunc);
+    if (!out) return;
+    unsigned int header[4];
+    memcpy(header, CACHE_MAGIC, 4);
+    header[1] = CACHE_VERSION;
+    header[2] = faces;
+    header[3] = data.materials.size();
+    out.write((const char*)header, sizeof(header));
+    out.write((const char*)verts, faces*9*4);
+    out.write((const char*)norms, faces*9*4);
+    out.write((const char*)texcs, faces*6*4);
+    out.write((const char*)faceMaterial, faces*4);
+    static const char pad[4] = { 0, 0, 0, 0 };
+    for (vector<MaterialData>::const_iterator itr = data.materials.begin();
+         itr != data.materials.end(); ++itr) {
+        out.write((const char*)itr->ambient, 4*4);
+        out.write((const char*)itr->diffuse, 4*4);
+        out.write((const char*)itr->specular, 4*4);
+        out.write((const char*)&itr->shininess, 4);
+        unsigned int len = itr->texture.size();
+        out.write((const char*)&len, 4);
+        out.write(itr->texture.data(), len);
+        out.write(pad, ((len + 3) & ~3u) - len);
+    }
+    unsigned int libCount = data.libraries.size();
+    out.write((const char*)&libCount, 4);
+    for (unsigned int i = 0; i < libCount; ++i) {
+        unsigned int len = data.libraries[i].size();
+        out.write((const char*)&data.libraryTimes[i], 4);
+        out.write((const char*)&len, 4);
+        out.write(data.libraries[i].data(), len);
+        out.write(pad, ((len + 3) & ~3u) - len);
+    }
+    if (!out.good()) {
+        out.close();
+        remove(cache.c_str());
+    }
+}
+
+// resolve an obj index, 1 based or negative relative to the end
+static int ResolveIndex(const string& s, unsigned int count) {
+    if (s.empty()) return -1;
+    int i = atoi(s.c_str());
+    if (i < 0) i += count;
+    else i -= 1;
+    return (i >= 0 && (unsigned int)i < count) ? i : -1;
+}
+
+void CachedOBJResource::Parse() {
+    std::ifstream in(file.c_str());
+    if (!in) {
+        failed = true;
+        error = "can not open " + file;
+        return;
+    }
+    vector<float> pos, nrm, tex;
+    vector<string> matNames;
+    // material 0 is the default material
+    data.materials.push_back(MaterialData());
+    unsigned int current = 0;
+    string dir = DirectoryOf(file);
+
+    string line, tag;
+    while (std::getline(in, line)) {
+        std::istringstream ls(line);
+        tag.clear();
+        ls >> tag;
+        if (tag == "v") {
+            float x = 0, y = 0, z = 0;
+            ls >> x >> y >> z;
+            pos.push_back(x); pos.push_back(y); pos.push_back(z);
+        } else if (tag == "vn") {
+            float x = 0, y = 0, z = 0;
+            ls >> x >> y >> z;
+            nrm.push_back(x); nrm.push_back(y); nrm.push_back(z);
+        } else if (tag == "vt") {
+            float u = 0, v = 0;
+            ls >> u >> v;
+            tex.push_back(u); tex.push_back(v);
+        } else if (tag == "f") {
+            // corners as position, texture and normal indices
+            vector<int> corners;
+            string c;
+            while (ls >> c) {
+                string::size_type s1 = c.find('/');
+                string::size_type s2 = (s1 == string::npos)
+                    ? string::npos : c.find('/', s1 + 1);
+                corners.push_back(ResolveIndex(c.substr(0, s1), pos.size() / 3));
+                corners.push_back((s1 == string::npos) ? -1 :
+                    ResolveIndex(c.substr(s1 + 1, s2 - s1 - 1), tex.size() / 2));
+                corners.push_back((s2 == string::npos) ? -1 :
+                    ResolveIndex(c.substr(s2 + 1), nrm.size() / 3));
+            }
+            unsigned int n = corners.size() / 3;
+            for (unsigned int k = 1; k + 1 < n; ++k) {
+                unsigned int tri[3] = { 0, k, k + 1 };
+                bool valid = true;
+                for (unsigned int i = 0; i < 3; ++i)
+                    if (corners[tri[i]*3] < 0) valid = false;
+                if (!valid) continue;
+
+                float p[9];
+                for (unsigned int i = 0; i < 3; ++i)
+                    for (unsigned int j = 0; j < 3; ++j)
+                        p[i*3 + j] = pos[corners[tri[i]*3] * 3 + j];
+                // face normal for corners without a normal
+                float e1[3], e2[3], fn[3];
+                for (unsigned int j = 0; j < 3; ++j) {
+                    e1[j] = p[3 + j] - p[j];
+                    e2[j] = p[6 + j] - p[j];
+                }
+                fn[0] = e1[1]*e2[2] - e1[2]*e2[1];
+                fn[1] = e1[2]*e2[0] - e1[0]*e2[2];
+                fn[2] = e1[0]*e2[1] - e1[1]*e2[0];
+                float len = std::sqrt(fn[0]*fn[0] + fn[1]*fn[1] + fn[2]*fn[2]);
+                if (len > 0) { fn[0] /= len; fn[1] /= len; fn[2] /= len; }
+
+                for (unsigned int i = 0; i < 3; ++i) {
+                    int ti = corners[tri[i]*3 + 1];
+                    int ni = corners[tri[i]*3 + 2];
+                    data.verts.insert(data.verts.end(), p + i*3, p + i*3 + 3);
+                    for (unsigned int j = 0; j < 3; ++j)
+                        data.norms.push_back(ni < 0 ? fn[j] : nrm[ni*3 + j]);
+                    data.texcs.push_back(ti < 0 ? 0.0f : tex[ti*2]);
+                    data.texcs.push_back(ti < 0 ? 0.0f : tex[ti*2 + 1]);
+                }
+                data.faceMaterial.push_back(current);
+            }
+        } else if (tag == "mtllib") {
+            ParseMTL(dir + RestOfLine(ls), matNames);
+        } else if (tag == "usemtl") {
+            string name = RestOfLine(ls);
+            current = 0;
+            for (unsigned int i = 0; i < matNames.size(); ++i)
+                if (matNames[i] == name) current = i + 1;
+        }
+    }
+    faces = data.faceMaterial.size();
+    verts = faces ? &data.verts[0] : NULL;
+    norms = faces ? &data.norms[0] : NULL;
+    texcs = faces ? &data.texcs[0] : NULL;
+    faceMaterial = faces ? &data.faceMaterial[0] : NULL;
+}
+
+void CachedOBJResource::ParseMTL(const string& mtl, vector<string>& names) {
+    // recorded before reading, a missing file is recorded as well so
+    // the cache is rebuilt once it appears
+    data.libraries.push_back(mtl);
+    data.libraryTimes.push_back(ModificationTime(mtl));
+    std::ifstream in(mtl.c_str());
+    if (!in) return;
+    string dir = DirectoryOf(mtl);
+    MaterialData* md = NULL;
+    string line, tag;
+    while (std::getline(in, line)) {
+        std::istringstream ls(line);
+        tag.clear();
+        ls >> tag;
+        if (tag == "newmtl") {
+            names.push_back(RestOfLine(ls));
+            data.materials.push_back(MaterialData());
+            md = &data.materials.back();
+        } else if (md == NULL) {
+            continue;
+        } else if (tag == "Ka") {
+            ls >> md->ambient[0] >> md->ambient[1] >> md->ambient[2];
+        } else if (tag == "Kd") {
+            ls >> md->diffuse[0] >> md->diffuse[1] >> md->diffuse[2];
+        } else if (tag == "Ks") {
+            ls >> md->specular[0] >> md->specular[1] >> md->specular[2];
+        } else if (tag == "Ns") {
+            ls >> md->shininess;
+        } else if (tag == "map_Kd") {
+            md->texture = dir + RestOfLine(ls);
+        }
+    }
+}
+
+CachedOBJPlugin::CachedOBJPlugin() {
+    this->AddExtension("obj");
+}
+
+IModelResourcePtr CachedOBJPlugin::CreateResource(string file) {
+    return IModelResourcePtr(new CachedOBJResource(file));
+}
+
+} // NS Resources
+} // NS OpenEngine
@@ -0,0 +1,138 @@
+// OBJ model resource with a binary mesh cache.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OE_CACHED_OBJ_RESOURCE_H_
+#define _OE_CACHED_OBJ_RESOURCE_H_
+
+#include <Resources/IModelResource.h>
+#include <Resources/IResourcePlugin.h>
+
+#include <boost/shared_ptr.hpp>
+#include <string>
+#include <vector>
+
+namespace OpenEngine {
+    namespace Core {
+        class TaskScheduler;
+    }
+    namespace Scene {
+        class ISceneNode;
+    }
+namespace Resources {
+
+class CachedOBJResource;
+typedef boost::shared_ptr<CachedOBJResource> CachedOBJResourcePtr;
+
+/**
+ * OBJ model resource with a binary mesh cache.
+ *
+ * The first time a model is loaded the OBJ (and MTL) text is parsed
+ * and a binary cache is written next to the source file with the
+ * extension ".oemesh". Later loads map the cache into memory and
+ * build the geometry directly from the mapped arrays, as long as the
+ * cache is not older than the source. The cache records the
+ * modification times of the MTL files and is rebuilt when one of them
+ * has changed.
+ *
+ * Loading is split in two steps: Prepare() parses or maps the model
+ * into plain arrays and does not touch any engine state, so it can
+ * run on any thread, while Load() builds the scene node and creates
+ * the textures and must run on the thread owning the resource
+ * managers. PrepareAll() prepares a set of models in parallel, on
+ * threads of its own or on a task scheduler.
+ *
+ * The resulting scene consists of a single GeometryNode. Only
+ * triangulated positions, normals, texture coordinates and the
+ * ambient, diffuse, specular, shininess and diffuse texture material
+ * properties are supported.
+ */
+class CachedOBJResource : public IModelResource {
+public:
+    CachedOBJResource(std::string file);
+    virtual ~CachedOBJResource();
+
+    void Prepare();
+    void Load();
+    void Unload();
+    Scene::ISceneNode* GetSceneNode();
+
+    static void PrepareAll(std::vector<CachedOBJResourcePtr>& models,
+                           unsigned int threads);
+    static void PrepareAll(std::vector<CachedOBJResourcePtr>& models,
+                           Core::TaskScheduler& scheduler);
+
+    /**
+     * Plain material description shared by the parser and the cache.
+     */
+    struct MaterialData {
+        float ambient[4], diffuse[4], specular[4];
+        float shininess;
+        std::string texture;
+        MaterialData();
+    };
+
+    /**
+     * Plain mesh data, three vertices per face.
+     */
+    struct MeshData {
+        std::vector<float> verts, norms, texcs;
+        std::vector<unsigned int> faceMaterial;
+        std::vector<MaterialData> materials;
+        // the MTL files and their modification times when parsed
+        std::vector<std::string> libraries;
+        std::vector<unsigned int> libraryTimes;
+    };
+
+private:
+    std::string file;
+    bool prepared;
+    bool failed;
+    std::string error;
+    Scene::ISceneNode* node;
+
+    // parsed data, or the materials of a mapped cache
+    MeshData data;
+
+    // view of the face arrays, pointing into the data or the mapping
+    unsigned int faces;
+    const float* verts;
+    const float* norms;
+    const float* texcs;
+    const unsigned int* faceMaterial;
+
+    // mapped cache file
+    void* mapping;
+    unsigned long mappingSize;
+    std::vector<char> buffer;
+
+    void Release();
+
+    std::string CacheFile() const;
+    bool CacheIsFresh() const;
+    bool ReadCache();
+    void WriteCache() const;
+    void Parse();
+    void ParseMTL(const std::string& file,
+                  std::vector<std::string>& names);
+};
+
+/**
+ * OBJ plug-in creating cached OBJ resources.
+ * Register it before the ordinary OBJ plug-in to take precedence.
+ */
+class CachedOBJPlugin : public IResourcePlugin<IModelResource> {
+public:
+    CachedOBJPlugin();
+    IModelResourcePtr CreateResource(std::string file);
+};
+
+} // NS Resources
+} // NS OpenEngine
+
+#endif // _OE_CACHED_OBJ_RESOURCE_H_
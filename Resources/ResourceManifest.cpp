@@ -0,0 +1,288 @@
+// Index of the files in the data directories.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Resources/ResourceManifest.h>
+
+#include <Logging/Logger.h>
+
+#include <cstdlib>
+#include <fstream>
+#include <dirent.h>
+#include <sys/stat.h>
+
+namespace OpenEngine {
+namespace Resources {
+
+using Core::ITask;
+using std::map;
+using std::string;
+using std::vector;
+
+// cache file layout, one entry per line with tab separated fields:
+//   oemanifest <version>
+//   R <data directory>            in search order
+//   D <modification time> <directory>
+//   F <name> <path>
+static const char* MANIFEST_MAGIC = "oemanifest";
+static const unsigned int MANIFEST_VERSION = 1;
+
+// files are prefetched in chunks of this size
+static const unsigned int CHUNK = 256 << 10;
+
+static string Join(const string& dir, const string& name) {
+    if (dir.empty() || dir[dir.size() - 1] == '/' || dir[dir.size() - 1] == '\\')
+        return dir + name;
+    return dir + "/" + name;
+}
+
+// Lists one data directory.
+class ResourceManifest::ScanTask : public ITask {
+    const string* root;
+    Index* index;
+public:
+    ScanTask(const string& root, Index& index) : root(&root), index(&index) {}
+    void Run() { Scan(*root, "", *index); }
+};
+
+// Reads a file through the operating system cache and deletes itself.
+class ResourceManifest::PrefetchTask : public ITask {
+    string file;
+public:
+    PrefetchTask(string file) : file(file) {}
+    void Run() {
+        std::ifstream in(file.c_str(), std::ios::binary);
+        vector<char> buffer(CHUNK);
+        while (in.good())
+            in.read(&buffer[0], buffer.size());
+        delete this;
+    }
+};
+
+/**
+ * Create an empty manifest.
+ *
+ * @param scheduler Scheduler to scan and prefetch on.
+ */
+ResourceManifest::ResourceManifest(Core::TaskScheduler& scheduler)
+    : scheduler(scheduler)
+    , built(false) {}
+
+/**
+ * Destroy the manifest, waiting for the files being prefetched.
+ */
+ResourceManifest::~ResourceManifest() {
+    scheduler.Wait(group);
+}
+
+/**
+ * Add a data directory, searched after the ones added before.
+ * The manifest must be built or loaded again to include it.
+ */
+void ResourceManifest::AddDirectory(string dir) {
+    roots.push_back(dir);
+    built = false;
+}
+
+/**
+ * Get the data directories in search order.
+ */
+const vector<string>& ResourceManifest::GetDirectories() const {
+    return roots;
+}
+
+/**
+ * Index the files below the data directories, scanning the
+ * directories in parallel. Returns when all are scanned.
+ */
+void ResourceManifest::Build() {
+    vector<Index> indices(roots.size());
+    vector<ScanTask> tasks;
+    tasks.reserve(roots.size());
+    Core::TaskGroup scans;
+    for (unsigned int i = 0; i < roots.size(); ++i) {
+        tasks.push_back(ScanTask(roots[i], indices[i]));
+        scheduler.Submit(&tasks.back(), &scans);
+    }
+    scheduler.Wait(scans);
+    files.clear();
+    dirs.clear();
+    // inserting keeps the first directory holding a name
+    for (unsigned int i = 0; i < indices.size(); ++i) {
+        files.insert(indices[i].files.begin(), indices[i].files.end());
+        dirs.insert(indices[i].dirs.begin(), indices[i].dirs.end());
+    }
+    built = true;
+    logger.info << "ResourceManifest: indexed " << files.size() << " files in "
+                << dirs.size() << " directories" << logger.end;
+}
+
+/**
+ * Load the manifest from a cache file.
+ *
+ * @param file Cache file written by Save().
+ * @return False if the file is missing or out of date.
+ */
+bool ResourceManifest::Load(string file) {
+    std::ifstream in(file.c_str());
+    string magic;
+    unsigned int version = 0;
+    in >> magic >> version;
+    if (!in.good() || magic != MANIFEST_MAGIC || version != MANIFEST_VERSION)
+        return false;
+    vector<string> cachedRoots;
+    map<string, string> cachedFiles;
+    map<string, long> cachedDirs;
+    string line;
+    std::getline(in, line);
+    while (std::getline(in, line)) {
+        if (line.size() < 2 || line[1] != '\t') return false;
+        string rest = line.substr(2);
+        string::size_type tab = rest.find('\t');
+        if (line[0] == 'R')
+            cachedRoots.push_back(rest);
+        else if (line[0] == 'D' && tab != string::npos) {
+            string dir = rest.substr(tab + 1);
+            long mtime = std::atol(rest.substr(0, tab).c_str());
+            // a changed directory may have gained or lost files
+            if (ModificationTime(dir) != mtime) return false;
+            cachedDirs[dir] = mtime;
+        } else if (line[0] == 'F' && tab != string::npos)
+            cachedFiles[rest.substr(0, tab)] = rest.substr(tab + 1);
+        else
+            return false;
+    }
+    if (cachedRoots != roots) return false;
+    files.swap(cachedFiles);
+    dirs.swap(cachedDirs);
+    built = true;
+    return true;
+}
+
+/**
+ * Save the manifest to a cache file.
+ *
+ * @param file Cache file to write.
+ * @return False if the manifest is not built or the file can not be
+ *         written.
+ */
+bool ResourceManifest::Save(string file) const {
+    if (!built) return false;
+    std::ofstream out(file.c_str(), std::ofstream::out | std::ofstream::trunc);
+    out << MANIFEST_MAGIC << " " << MANIFEST_VERSION << "\n";
+    for (vector<string>::const_iterator itr = roots.begin();
+         itr != roots.end(); ++itr)
+        out << "R\t" << *itr << "\n";
+    for (map<string, long>::const_iterator itr = dirs.begin();
+         itr != dirs.end(); ++itr)
+        out << "D\t" << itr->second << "\t" << itr->first << "\n";
+    for (map<string, string>::const_iterator itr = files.begin();
+         itr != files.end(); ++itr)
+        out << "F\t" << itr->first << "\t" << itr->second << "\n";
+    if (!out.good()) {
+        logger.warning << "ResourceManifest: can not write '" << file << "'"
+                       << logger.end;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Check if the manifest holds the files of the current data
+ * directories.
+ */
+bool ResourceManifest::IsBuilt() const {
+    return built;
+}
+
+/**
+ * Get the number of indexed files.
+ */
+unsigned int ResourceManifest::GetSize() const {
+    return files.size();
+}
+
+/**
+ * Resolve a name relative to the data directories.
+ * Names not in the manifest, and all names while it is not built,
+ * are returned as they are, to be searched by the directory manager.
+ * May be called from any thread once the manifest is built.
+ *
+ * @param name Name relative to a data directory.
+ * @return Path of the file.
+ */
+string ResourceManifest::Resolve(string name) const {
+    if (!built) return name;
+    map<string, string>::const_iterator itr = files.find(name);
+    return (itr == files.end()) ? name : itr->second;
+}
+
+/**
+ * Read files in parallel so they are cached by the operating system
+ * when they are loaded.
+ *
+ * @param names Names relative to the data directories, or paths.
+ * @param wait True to return when all files have been read.
+ * @return Number of files prefetched.
+ */
+unsigned int ResourceManifest::Prefetch(const vector<string>& names, bool wait) {
+    unsigned int count = 0;
+    for (vector<string>::const_iterator itr = names.begin();
+         itr != names.end(); ++itr) {
+        string file = Resolve(*itr);
+        if (ModificationTime(file) < 0) continue;
+        scheduler.Submit(new PrefetchTask(file), &group);
+        count++;
+    }
+    if (wait) WaitPrefetch();
+    return count;
+}
+
+/**
+ * Wait for the files being prefetched.
+ */
+void ResourceManifest::WaitPrefetch() {
+    scheduler.Wait(group);
+}
+
+// List a directory below a data directory recursively. Runs on the
+// scheduler and touches the given index only. Linked directories are
+// not followed, so links can not form cycles.
+void ResourceManifest::Scan(const string& root, const string& rel, Index& index) {
+    string path = Join(root, rel);
+    DIR* dir = opendir(path.c_str());
+    if (dir == NULL) return;
+    index.dirs[path] = ModificationTime(path);
+    vector<string> subdirs;
+    while (struct dirent* entry = readdir(dir)) {
+        string name = entry->d_name;
+        if (name == "." || name == "..") continue;
+        string relname = rel.empty() ? name : rel + "/" + name;
+        string file = Join(root, relname);
+        struct stat st;
+        if (lstat(file.c_str(), &st) != 0) continue;
+        if (S_ISDIR(st.st_mode)) subdirs.push_back(relname);
+        else if (!S_ISLNK(st.st_mode) ||
+                 (stat(file.c_str(), &st) == 0 && !S_ISDIR(st.st_mode)))
+            index.files[relname] = file;
+    }
+    closedir(dir);
+    for (vector<string>::iterator itr = subdirs.begin();
+         itr != subdirs.end(); ++itr)
+        Scan(root, *itr, index);
+}
+
+// Modification time in seconds, -1 if the path does not exist.
+long ResourceManifest::ModificationTime(const string& path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) return -1;
+    return st.st_mtime;
+}
+
+} // NS Resources
+} // NS OpenEngine
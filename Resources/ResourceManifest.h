@@ -0,0 +1,97 @@
+// Index of the files in the data directories.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OE_RESOURCE_MANIFEST_H_
+#define _OE_RESOURCE_MANIFEST_H_
+
+#include <Core/TaskScheduler.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace OpenEngine {
+namespace Resources {
+
+/**
+ * Index of the files in the data directories.
+ *
+ * Looking up a resource through the directory manager probes every
+ * data directory on disk, which is slow with many directories or on
+ * network storage. The manifest lists the files below the data
+ * directories once, scanning the directories in parallel on the task
+ * scheduler, and maps each name relative to a data directory to the
+ * path of the first directory holding it, the file the directory
+ * manager would find.
+ *
+ * The manifest can be saved to a cache file and loaded on the next
+ * run. A cache is used only if it lists the same data directories and
+ * none of the indexed directories has been modified since, otherwise
+ * Load() fails and the manifest must be built again.
+ *
+ * Listed files can be prefetched on the scheduler, reading them so
+ * they are in the operating system cache when loaded.
+ *
+ * @code
+ * ResourceManifest manifest(scheduler);
+ * manifest.AddDirectory("data/");
+ * if (!manifest.Load("data.manifest")) {
+ *     manifest.Build();
+ *     manifest.Save("data.manifest");
+ * }
+ * string file = manifest.Resolve("models/car.obj");
+ * @endcode
+ */
+class ResourceManifest {
+public:
+    ResourceManifest(Core::TaskScheduler& scheduler);
+    virtual ~ResourceManifest();
+
+    void AddDirectory(std::string dir);
+    const std::vector<std::string>& GetDirectories() const;
+
+    void Build();
+    bool Load(std::string file);
+    bool Save(std::string file) const;
+    bool IsBuilt() const;
+    unsigned int GetSize() const;
+
+    std::string Resolve(std::string name) const;
+
+    unsigned int Prefetch(const std::vector<std::string>& names,
+                          bool wait = true);
+    void WaitPrefetch();
+
+private:
+    // files and directories found below one data directory
+    struct Index {
+        std::map<std::string, std::string> files;
+        std::map<std::string, long> dirs;
+    };
+
+    class ScanTask;
+    class PrefetchTask;
+
+    Core::TaskScheduler& scheduler;
+    Core::TaskGroup group;
+    std::vector<std::string> roots;
+    std::map<std::string, std::string> files;
+    // modification times of the indexed directories
+    std::map<std::string, long> dirs;
+    bool built;
+
+    static void Scan(const std::string& root, const std::string& rel,
+                     Index& index);
+    static long ModificationTime(const std::string& path);
+};
+
+} // NS Resources
+} // NS OpenEngine
+
+#endif // _OE_RESOURCE_MANIFEST_H_
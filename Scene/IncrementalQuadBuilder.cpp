@@ -0,0 +1,353 @@
+// Incremental quad tree builder.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Scene/IncrementalQuadBuilder.h>
+
+#include <Core/Thread.h>
+#include <Scene/CollectedGeometryTransformer.h>
+#include <Scene/ISceneNode.h>
+#include <Scene/QuadTransformer.h>
+#include <Scene/SceneNode.h>
+
+#include <set>
+
+namespace OpenEngine {
+namespace Scene {
+
+using namespace Core;
+using Renderers::RenderingEventArg;
+
+/**
+ * Background thread building queued cells.
+ * The thread exits when the queue is empty and is restarted on
+ * demand.
+ */
+class IncrementalQuadBuilder::BuildThread : public Thread {
+    IncrementalQuadBuilder& owner;
+public:
+    BuildThread(IncrementalQuadBuilder& owner) : owner(owner) {}
+    void Run() {
+        Job job(NULL, NULL, NULL, 0);
+        while (owner.NextJob(job)) {
+            if (!owner.Prepare(job)) continue;
+            owner.Build(*job.clone);
+            owner.JobDone(job);
+        }
+    }
+};
+
+/**
+ * Scheduler task building a single queued cell.
+ */
+class IncrementalQuadBuilder::BuildTask : public ITask {
+    IncrementalQuadBuilder& owner;
+public:
+    BuildTask(IncrementalQuadBuilder& owner) : owner(owner) {}
+    void Run() {
+        Job job(NULL, NULL, NULL, 0);
+        if (owner.NextJob(job) && owner.Prepare(job)) {
+            owner.Build(*job.clone);
+            owner.JobDone(job);
+        }
+        delete this;
+    }
+};
+
+/**
+ * Stand-in rendering a source cell until its first tree is built.
+ * Visitors are passed on to the source node, which is not a sub node
+ * and is not deleted with the stand-in.
+ */
+class IncrementalQuadBuilder::SourceNode : public SceneNode {
+    ISceneNode& source;
+public:
+    SourceNode(ISceneNode& source) : source(source) {}
+    void Accept(ISceneNodeVisitor& visitor) {
+        source.Accept(visitor);
+    }
+};
+
+/**
+ * Create a builder.
+ *
+ * @param maxFaces Maximum number of faces in a quad tree leaf.
+ * @param maxSize Maximum side length of a quad tree leaf.
+ */
+IncrementalQuadBuilder::IncrementalQuadBuilder(unsigned int maxFaces,
+                                               float maxSize)
+    : maxFaces(maxFaces)
+    , maxSize(maxSize)
+    , scene(NULL)
+    , root(new SceneNode())
+    , generation(0)
+    , sceneLock(NULL)
+    , thread(NULL)
+    , running(false)
+    , scheduler(NULL) {}
+
+IncrementalQuadBuilder::~IncrementalQuadBuilder() {
+    lock.Lock();
+    for (std::list<Job>::iterator itr = todo.begin();
+         itr != todo.end(); ++itr)
+        delete itr->clone;
+    todo.clear();
+    lock.Unlock();
+    if (scheduler != NULL) scheduler->Wait(tasks);
+    if (thread != NULL) {
+        thread->Wait();
+        delete thread;
+    }
+    for (std::list<Job>::iterator itr = done.begin();
+         itr != done.end(); ++itr)
+        delete itr->clone;
+    // the built cells are owned by the root
+    delete root;
+}
+
+/**
+ * Get the root of the culling structure.
+ * This is the scene to render, it must not be modified.
+ */
+ISceneNode* IncrementalQuadBuilder::GetRoot() {
+    return root;
+}
+
+/**
+ * Set the source scene.
+ * Cells already built for sub nodes that are shared with the previous
+ * scene are kept. New cells are built in the background and rendered
+ * from the source scene until they are ready.
+ *
+ * @param scene Source scene.
+ */
+void IncrementalQuadBuilder::SetScene(ISceneNode& scene) {
+    this->scene = &scene;
+    Swap();
+    Synchronize();
+    Schedule();
+}
+
+/**
+ * Mark a node in the source scene as changed.
+ * The cell containing the node is rebuilt in the background. Marking
+ * the source root itself rebuilds all cells.
+ *
+ * @param node Changed node.
+ */
+void IncrementalQuadBuilder::MarkDirty(ISceneNode& node) {
+    if (scene == NULL) return;
+    if (&node == scene) {
+        for (std::map<ISceneNode*, Cell>::iterator itr = cells.begin();
+             itr != cells.end(); ++itr)
+            itr->second.dirty = true;
+        return;
+    }
+    ISceneNode* cell = &node;
+    while (cell->GetParent() != NULL && cell->GetParent() != scene)
+        cell = cell->GetParent();
+    if (cell->GetParent() == scene)
+        cells[cell].dirty = true;
+}
+
+/**
+ * Build on a task scheduler instead of the builder's own thread.
+ * Must be set before the first asynchronous build.
+ *
+ * @param scheduler Task scheduler, NULL to use the own thread.
+ */
+void IncrementalQuadBuilder::SetScheduler(TaskScheduler* scheduler) {
+    this->scheduler = scheduler;
+}
+
+/**
+ * Clone the cells on the build thread while holding a lock.
+ * The lock must be held by everybody changing the source scene, it
+ * is not needed when the scene only changes on the render thread.
+ * Must be set before the first build.
+ *
+ * @param sceneLock Scene lock, NULL to clone on the render thread.
+ */
+void IncrementalQuadBuilder::SetSceneLock(Mutex* sceneLock) {
+    this->sceneLock = sceneLock;
+}
+
+/**
+ * Number of cells waiting to be built.
+ */
+unsigned int IncrementalQuadBuilder::GetPendingCount() {
+    unsigned int count = 0;
+    for (std::map<ISceneNode*, Cell>::iterator itr = cells.begin();
+         itr != cells.end(); ++itr)
+        if (itr->second.dirty || itr->second.building) count++;
+    return count;
+}
+
+/**
+ * Install finished cells and schedule changed ones.
+ */
+void IncrementalQuadBuilder::Handle(RenderingEventArg arg) {
+    ReapThread();
+    Swap();
+    Synchronize();
+    Schedule();
+}
+
+void IncrementalQuadBuilder::Synchronize() {
+    if (scene == NULL) return;
+    std::set<ISceneNode*> current;
+    for (unsigned int i = 0; i < scene->GetNumberOfNodes(); ++i) {
+        ISceneNode* node = scene->GetNode(i);
+        current.insert(node);
+        // new cells are default constructed as dirty and are rendered
+        // from the source until they are built
+        Cell& cell = cells[node];
+        if (cell.built == NULL) {
+            cell.built = new SourceNode(*node);
+            root->AddNode(cell.built);
+        }
+    }
+    std::map<ISceneNode*, Cell>::iterator itr = cells.begin();
+    while (itr != cells.end()) {
+        if (current.find(itr->first) != current.end()) {
+            ++itr;
+            continue;
+        }
+        // an in flight build of a removed cell is dropped in Swap()
+        root->RemoveNode(itr->second.built);
+        delete itr->second.built;
+        cells.erase(itr++);
+    }
+}
+
+void IncrementalQuadBuilder::Schedule() {
+    bool queued = false;
+    for (std::map<ISceneNode*, Cell>::iterator itr = cells.begin();
+         itr != cells.end(); ++itr) {
+        Cell& cell = itr->second;
+        if (!cell.dirty || cell.building) continue;
+        cell.dirty = false;
+        cell.building = true;
+        cell.generation = ++generation;
+        // without a scene lock the source may change while the build
+        // thread clones it
+        ISceneNode* clone = NULL;
+        if (sceneLock == NULL) {
+            clone = new SceneNode();
+            clone->AddNode(itr->first->Clone());
+        }
+        lock.Lock();
+        todo.push_back(Job(scene, itr->first, clone, cell.generation));
+        lock.Unlock();
+        if (scheduler != NULL)
+            scheduler->Submit(new BuildTask(*this), &tasks);
+        else queued = true;
+    }
+    if (!queued) return;
+    lock.Lock();
+    if (!running) {
+        if (thread != NULL) {
+            thread->Wait();
+            delete thread;
+        }
+        running = true;
+        thread = new BuildThread(*this);
+        thread->Start();
+    }
+    lock.Unlock();
+}
+
+void IncrementalQuadBuilder::Swap() {
+    std::list<Job> finished;
+    lock.Lock();
+    finished.swap(done);
+    lock.Unlock();
+    for (std::list<Job>::iterator itr = finished.begin();
+         itr != finished.end(); ++itr) {
+        std::map<ISceneNode*, Cell>::iterator c = cells.find(itr->source);
+        // the cell was removed, or removed and added again, while
+        // building
+        if (c == cells.end() || c->second.generation != itr->generation) {
+            delete itr->clone;
+            continue;
+        }
+        Cell& cell = c->second;
+        if (itr->clone == NULL) {
+            // the cell left the scene of the job before it was cloned,
+            // it is built again if it is still a cell
+            cell.building = false;
+            cell.dirty = true;
+            continue;
+        }
+        root->RemoveNode(cell.built);
+        delete cell.built;
+        root->AddNode(itr->clone);
+        cell.built = itr->clone;
+        cell.building = false;
+    }
+}
+
+// Clone the source of a job on the build thread, if it was not cloned
+// when queued. The source is only cloned while it is still a cell of
+// the scene, as a node removed from the scene may have been deleted.
+bool IncrementalQuadBuilder::Prepare(Job& job) {
+    if (job.clone != NULL) return true;
+    sceneLock->Lock();
+    for (unsigned int i = 0; i < job.scene->GetNumberOfNodes(); ++i)
+        if (job.scene->GetNode(i) == job.source) {
+            job.clone = new SceneNode();
+            job.clone->AddNode(job.source->Clone());
+            break;
+        }
+    sceneLock->Unlock();
+    if (job.clone != NULL) return true;
+    // hand the job back so the cell is no longer building
+    JobDone(job);
+    return false;
+}
+
+void IncrementalQuadBuilder::Build(ISceneNode& node) {
+    CollectedGeometryTransformer collector;
+    collector.Transform(node);
+    QuadTransformer quad;
+    quad.SetMaxFaceCount(maxFaces);
+    quad.SetMaxQuadSize(maxSize);
+    quad.Transform(node);
+}
+
+bool IncrementalQuadBuilder::NextJob(Job& job) {
+    lock.Lock();
+    if (todo.empty()) {
+        running = false;
+        lock.Unlock();
+        return false;
+    }
+    job = todo.front();
+    todo.pop_front();
+    lock.Unlock();
+    return true;
+}
+
+void IncrementalQuadBuilder::JobDone(Job& job) {
+    lock.Lock();
+    done.push_back(job);
+    lock.Unlock();
+}
+
+void IncrementalQuadBuilder::ReapThread() {
+    lock.Lock();
+    if (thread != NULL && !running) {
+        thread->Wait();
+        delete thread;
+        thread = NULL;
+    }
+    lock.Unlock();
+}
+
+} // NS Scene
+} // NS OpenEngine
@@ -0,0 +1,131 @@
+// Incremental quad tree builder.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OE_INCREMENTAL_QUAD_BUILDER_H_
+#define _OE_INCREMENTAL_QUAD_BUILDER_H_
+
+#include <Core/IListener.h>
+#include <Core/Mutex.h>
+#include <Core/TaskScheduler.h>
+#include <Renderers/IRenderer.h>
+
+#include <list>
+#include <map>
+
+namespace OpenEngine {
+namespace Scene {
+
+class ISceneNode;
+class SceneNode;
+
+/**
+ * Incremental quad tree builder.
+ *
+ * Maintains a culling structure for a source scene without touching
+ * the source scene. Each sub node of the source root is a cell that
+ * is cloned and transformed into its own quad tree, and the cells are
+ * placed under a separate render root that should be given to the
+ * canvas.
+ *
+ * When cells change only they are rebuilt. Rebuilds run on a
+ * background thread on a clone of the cell, and the finished tree is
+ * swapped into the render root on the render thread, so the previous
+ * tree keeps being rendered until the new one is ready. Until the
+ * first tree of a cell is ready the source cell itself is rendered,
+ * without culling. A build is dropped if its cell was removed, or
+ * removed and added again, while it ran.
+ *
+ * With a scene lock set the cells are cloned on the background thread
+ * while holding the lock, otherwise they are cloned on the render
+ * thread when they are queued.
+ *
+ * Sub nodes added to or removed from the source root are detected
+ * automatically on each pre-process. Changes further down a cell,
+ * such as moving a transformation node, must be reported with
+ * MarkDirty() since scene nodes do not signal changes.
+ *
+ * With a task scheduler set the builds run as tasks on the scheduler
+ * instead of on the builder's own thread.
+ *
+ * Attach the builder to the renderer pre-process event.
+ */
+class IncrementalQuadBuilder
+    : public Core::IListener<Renderers::RenderingEventArg> {
+public:
+    IncrementalQuadBuilder(unsigned int maxFaces = 500,
+                           float maxSize = 100.0f);
+    virtual ~IncrementalQuadBuilder();
+
+    ISceneNode* GetRoot();
+
+    void SetScene(ISceneNode& scene);
+    void MarkDirty(ISceneNode& node);
+    void SetScheduler(Core::TaskScheduler* scheduler);
+    void SetSceneLock(Core::Mutex* sceneLock);
+
+    unsigned int GetPendingCount();
+
+    void Handle(Renderers::RenderingEventArg arg);
+
+private:
+    class BuildThread;
+    class BuildTask;
+    class SourceNode;
+
+    struct Cell {
+        ISceneNode* built;   // tree or source stand-in in the render root
+        bool dirty;          // rebuild once the current build is done
+        bool building;       // a build is in flight
+        unsigned int generation; // of the latest build queued
+        Cell() : built(NULL), dirty(true), building(false), generation(0) {}
+    };
+
+    struct Job {
+        ISceneNode* scene;
+        ISceneNode* source;
+        ISceneNode* clone;   // NULL until cloned on the build thread
+        unsigned int generation;
+        Job(ISceneNode* scene, ISceneNode* source, ISceneNode* clone,
+            unsigned int generation)
+            : scene(scene), source(source), clone(clone)
+            , generation(generation) {}
+    };
+
+    unsigned int maxFaces;
+    float maxSize;
+    ISceneNode* scene;
+    SceneNode* root;
+    std::map<ISceneNode*, Cell> cells;
+    unsigned int generation;
+    Core::Mutex* sceneLock;
+
+    // guarded by the lock
+    Core::Mutex lock;
+    std::list<Job> todo;
+    std::list<Job> done;
+    BuildThread* thread;
+    bool running;
+
+    Core::TaskScheduler* scheduler;
+    Core::TaskGroup tasks;
+
+    void Synchronize();
+    void Schedule();
+    void Swap();
+    bool Prepare(Job& job);
+    void Build(ISceneNode& node);
+    bool NextJob(Job& job);
+    void JobDone(Job& job);
+    void ReapThread();
+};
+
+} // NS Scene
+} // NS OpenEngine
+
+#endif // _OE_INCREMENTAL_QUAD_BUILDER_H_
@@ -0,0 +1,299 @@
+// Level of detail node.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Scene/LODNode.h>
+
+#include <Geometry/Face.h>
+#include <Geometry/FaceSet.h>
+#include <Math/Vector.h>
+#include <Scene/GeometryNode.h>
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <set>
+
+namespace OpenEngine {
+namespace Scene {
+
+using namespace Geometry;
+using Math::Vector;
+
+// grid cells along the longest side for the first simplified level,
+// halved for each further level
+static const unsigned int FIRST_CELLS = 64;
+
+namespace {
+
+struct Cell {
+    int x, y, z;
+    bool operator<(const Cell& o) const {
+        if (x != o.x) return x < o.x;
+        if (y != o.y) return y < o.y;
+        return z < o.z;
+    }
+    bool operator==(const Cell& o) const {
+        return x == o.x && y == o.y && z == o.z;
+    }
+};
+
+struct Cluster {
+    Vector<3,float> sum;
+    unsigned int count;
+    Cluster() : sum(0.0f, 0.0f, 0.0f), count(0) {}
+};
+
+// A face by its clusters, in rotation independent order.
+struct Triple {
+    Cell c[3];
+    bool operator<(const Triple& o) const {
+        for (unsigned int i = 0; i < 3; ++i) {
+            if (c[i] < o.c[i]) return true;
+            if (o.c[i] < c[i]) return false;
+        }
+        return false;
+    }
+};
+
+}
+
+/**
+ * Create a level of detail node.
+ * The bounding sphere is used to find the distance to the camera.
+ *
+ * @param center Center of the bounding sphere of the levels.
+ * @param radius Radius of the bounding sphere.
+ */
+LODNode::LODNode(const float center[3], float radius)
+    : radius(radius)
+    , current(0) {
+    std::copy(center, center + 3, this->center);
+}
+
+/**
+ * Destroy the node.
+ * The levels are deleted with the other sub nodes.
+ */
+LODNode::~LODNode() {}
+
+/**
+ * Add a level, coarser than the levels added before it.
+ * The first level added is selected.
+ *
+ * @param level Node of the level.
+ * @param error Largest deviation from level zero in world units.
+ */
+void LODNode::AddLevel(ISceneNode* level, float error) {
+    AddNode(level);
+    errors.push_back(error);
+}
+
+unsigned int LODNode::GetLevelCount() const {
+    return errors.size();
+}
+
+/**
+ * Get the selected level.
+ */
+unsigned int LODNode::GetLevel() const {
+    return current;
+}
+
+/**
+ * Select the level to visit.
+ */
+void LODNode::SetLevel(unsigned int level) {
+    if (level < errors.size()) current = level;
+}
+
+float LODNode::GetError(unsigned int level) const {
+    return errors[level];
+}
+
+/**
+ * Get the node of a level, whether it is selected or not.
+ */
+ISceneNode* LODNode::GetLevelNode(unsigned int level) const {
+    return const_cast<LODNode*>(this)->GetNode(level);
+}
+
+/**
+ * Get the center of the bounding sphere of the levels.
+ */
+const float* LODNode::GetCenter() const {
+    return center;
+}
+
+float LODNode::GetRadius() const {
+    return radius;
+}
+
+/**
+ * Select the level to render by its error on the screen.
+ *
+ * @param modelview Column major model view transformation of the
+ *                  node.
+ * @param pixelScale Pixels per world unit at distance one, half the
+ *                   viewport height times the cotangent of half the
+ *                   vertical field of view.
+ * @param threshold Largest error on the screen in pixels.
+ * @param hysteresis Fraction the threshold is reduced by before a
+ *                   coarser level is selected.
+ * @return The selected level.
+ */
+unsigned int LODNode::Select(const float modelview[16], float pixelScale,
+                             float threshold, float hysteresis) {
+    if (errors.size() < 2) return current;
+    const float* m = modelview;
+    float p[3];
+    for (unsigned int r = 0; r < 3; ++r)
+        p[r] = m[r] * center[0] + m[4 + r] * center[1] +
+               m[8 + r] * center[2] + m[12 + r];
+    float scale = std::sqrt(m[0]*m[0] + m[1]*m[1] + m[2]*m[2]);
+    float distance = std::sqrt(p[0]*p[0] + p[1]*p[1] + p[2]*p[2])
+        - radius * scale;
+    if (distance <= 0.0f) {
+        SetLevel(0);
+        return current;
+    }
+    float pixels = scale * pixelScale / distance;
+
+    unsigned int level = current;
+    while (level > 0 && errors[level] * pixels > threshold)
+        level--;
+    while (level + 1 < errors.size() &&
+           errors[level + 1] * pixels < threshold * (1.0f - hysteresis))
+        level++;
+    SetLevel(level);
+    return current;
+}
+
+/**
+ * Visit the selected level only.
+ */
+void LODNode::VisitSubNodes(ISceneNodeVisitor& visitor) {
+    if (current < errors.size()) GetNode(current)->Accept(visitor);
+}
+
+/**
+ * Clone the node with all its levels, keeping the selected level.
+ */
+ISceneNode* LODNode::Clone() {
+    LODNode* clone = new LODNode(center, radius);
+    for (unsigned int i = 0; i < errors.size(); ++i)
+        clone->AddLevel(GetNode(i)->Clone(), errors[i]);
+    clone->current = current;
+    return clone;
+}
+
+/**
+ * Create a level of detail node for a geometry node.
+ * The geometry node becomes level zero and each further level is
+ * simplified with a grid of half the resolution of the previous one.
+ * Fewer levels are built if a level no longer reduces the faces.
+ *
+ * @param node Full resolution geometry, owned by the new node.
+ * @param levels Number of levels including level zero.
+ * @return The new node.
+ */
+LODNode* LODNode::Create(GeometryNode* node, unsigned int levels) {
+    FaceSet* faces = node->GetFaceSet();
+    Vector<3,float> mn(0.0f, 0.0f, 0.0f), mx(0.0f, 0.0f, 0.0f);
+    bool first = true;
+    if (faces != NULL)
+        for (FaceList::iterator itr = faces->begin();
+             itr != faces->end(); ++itr)
+            for (unsigned int i = 0; i < 3; ++i) {
+                Vector<3,float>& v = (*itr)->vert[i];
+                for (unsigned int k = 0; k < 3; ++k) {
+                    if (first || v[k] < mn[k]) mn[k] = v[k];
+                    if (first || v[k] > mx[k]) mx[k] = v[k];
+                }
+                first = false;
+            }
+    Vector<3,float> ext = mx - mn;
+    float center[3] = { (mn[0] + mx[0]) * 0.5f,
+                        (mn[1] + mx[1]) * 0.5f,
+                        (mn[2] + mx[2]) * 0.5f };
+    LODNode* lod = new LODNode(center, ext.GetLength() * 0.5f);
+    lod->AddLevel(node, 0.0f);
+    if (faces == NULL) return lod;
+
+    float extent = std::max(ext[0], std::max(ext[1], ext[2]));
+    unsigned int previous = faces->Size();
+    unsigned int cells = FIRST_CELLS;
+    for (unsigned int l = 1; l < levels && cells > 0 && extent > 0; ++l) {
+        float cellSize = extent / cells;
+        FaceSet* simple = Simplify(*faces, cellSize);
+        unsigned int count = simple->Size();
+        if (count == 0 || count >= previous) {
+            delete simple;
+            break;
+        }
+        // a vertex moves at most to the far corner of its cell
+        lod->AddLevel(new GeometryNode(simple), cellSize * std::sqrt(3.0f));
+        previous = count;
+        cells /= 2;
+    }
+    return lod;
+}
+
+/**
+ * Simplify faces by vertex clustering.
+ * The vertices are snapped to a grid and replaced by the average of
+ * the vertices in their cell. Faces collapsing to a line or a point
+ * are dropped, as are faces repeating another face. Normals, texture
+ * coordinates and materials are kept from the original faces.
+ *
+ * @param faces Faces to simplify.
+ * @param cellSize Side length of the grid cells.
+ * @return New set of simplified faces.
+ */
+FaceSet* LODNode::Simplify(FaceSet& faces, float cellSize) {
+    std::map<Cell, Cluster> clusters;
+    float inv = 1.0f / cellSize;
+    for (FaceList::iterator itr = faces.begin(); itr != faces.end(); ++itr)
+        for (unsigned int i = 0; i < 3; ++i) {
+            Vector<3,float>& v = (*itr)->vert[i];
+            Cell c = { (int)std::floor(v[0] * inv),
+                       (int)std::floor(v[1] * inv),
+                       (int)std::floor(v[2] * inv) };
+            Cluster& cl = clusters[c];
+            cl.sum += v;
+            cl.count++;
+        }
+
+    FaceSet* simple = new FaceSet();
+    std::set<Triple> seen;
+    for (FaceList::iterator itr = faces.begin(); itr != faces.end(); ++itr) {
+        Triple t;
+        for (unsigned int i = 0; i < 3; ++i) {
+            Vector<3,float>& v = (*itr)->vert[i];
+            Cell c = { (int)std::floor(v[0] * inv),
+                       (int)std::floor(v[1] * inv),
+                       (int)std::floor(v[2] * inv) };
+            t.c[i] = c;
+        }
+        if (t.c[0] == t.c[1] || t.c[1] == t.c[2] || t.c[0] == t.c[2])
+            continue;
+        Triple key = t;
+        std::sort(key.c, key.c + 3);
+        if (!seen.insert(key).second) continue;
+        FacePtr face(new Face(**itr));
+        for (unsigned int i = 0; i < 3; ++i) {
+            Cluster& cl = clusters[t.c[i]];
+            face->vert[i] = cl.sum * (1.0f / cl.count);
+        }
+        simple->Add(face);
+    }
+    return simple;
+}
+
+} // NS Scene
+} // NS OpenEngine
@@ -0,0 +1,78 @@
+// Level of detail node.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OE_LOD_NODE_H_
+#define _OE_LOD_NODE_H_
+
+#include <Scene/SceneNode.h>
+
+#include <vector>
+
+namespace OpenEngine {
+    namespace Geometry {
+        class FaceSet;
+    }
+namespace Scene {
+
+class GeometryNode;
+
+/**
+ * Level of detail node.
+ *
+ * Holds a number of versions of the same geometry, from the full
+ * resolution level zero to the coarsest level, each with the largest
+ * distance in world units its vertices deviate from level zero. The
+ * levels are the sub nodes of the node, in order, but only the
+ * selected level is visited, so visitors see a single level and a
+ * level is selected without changing the sub nodes.
+ *
+ * Select() picks the coarsest level whose error projected on the
+ * screen is below a threshold in pixels. A coarser level is only
+ * picked once its error is below the threshold reduced by the
+ * hysteresis, so levels do not flicker when the error is close to
+ * the threshold.
+ *
+ * Create() builds the levels of a geometry node by vertex
+ * clustering, see Simplify().
+ */
+class LODNode : public SceneNode {
+public:
+    LODNode(const float center[3], float radius);
+    virtual ~LODNode();
+
+    void AddLevel(ISceneNode* level, float error);
+    unsigned int GetLevelCount() const;
+    unsigned int GetLevel() const;
+    void SetLevel(unsigned int level);
+    float GetError(unsigned int level) const;
+    ISceneNode* GetLevelNode(unsigned int level) const;
+    const float* GetCenter() const;
+    float GetRadius() const;
+
+    unsigned int Select(const float modelview[16], float pixelScale,
+                        float threshold, float hysteresis);
+
+    virtual void VisitSubNodes(ISceneNodeVisitor& visitor);
+    virtual ISceneNode* Clone();
+
+    static LODNode* Create(GeometryNode* node, unsigned int levels = 4);
+    static Geometry::FaceSet* Simplify(Geometry::FaceSet& faces,
+                                       float cellSize);
+
+private:
+    float center[3];
+    float radius;
+    unsigned int current;
+    std::vector<float> errors;
+};
+
+} // NS Scene
+} // NS OpenEngine
+
+#endif // _OE_LOD_NODE_H_
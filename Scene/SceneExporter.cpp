@@ -0,0 +1,253 @@
+// Background export of the scene graph with render statistics.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Scene/SceneExporter.h>
+
+#include <Display/IRenderCanvas.h>
+#include <Geometry/FaceSet.h>
+#include <Logging/Logger.h>
+#include <Scene/DirectionalLightNode.h>
+#include <Scene/GeometryNode.h>
+#include <Scene/LODNode.h>
+#include <Scene/MeshNode.h>
+#include <Scene/PointLightNode.h>
+#include <Scene/QuadNode.h>
+#include <Scene/SpotLightNode.h>
+#include <Scene/TransformationNode.h>
+
+#include <fstream>
+
+namespace OpenEngine {
+namespace Scene {
+
+using Core::ITask;
+using std::string;
+using std::vector;
+
+// Writes a snapshot on the task scheduler and deletes it.
+class SceneExporter::WriteTask : public ITask {
+    vector<Record>* records;
+    string base;
+public:
+    WriteTask(vector<Record>* records, string base)
+        : records(records), base(base) {}
+    void Run() {
+        string dotfile = base + ".dot", jsonfile = base + ".json";
+        std::ofstream dot(dotfile.c_str(), std::ofstream::out);
+        if (dot.good()) WriteDot(*records, dot);
+        std::ofstream json(jsonfile.c_str(), std::ofstream::out);
+        if (json.good()) WriteJSON(*records, json);
+        if (!dot.good() || !json.good())
+            logger.error << "SceneExporter: can not write '" << dotfile
+                         << "' and '" << jsonfile << "'" << logger.end;
+        else
+            logger.info << "Saved the scene graph of " << records->size()
+                        << " nodes to '" << dotfile << "' and '"
+                        << jsonfile << "'" << logger.end
+                        << "To create a SVG image run: dot -Tsvg "
+                        << dotfile << " > " << base << ".svg"
+                        << logger.end;
+        delete records;
+        delete this;
+    }
+};
+
+/**
+ * Create an exporter.
+ *
+ * @param scheduler Scheduler to write the files on.
+ */
+SceneExporter::SceneExporter(Core::TaskScheduler& scheduler)
+    : scheduler(scheduler)
+    , requested(false)
+    , recording(false) {}
+
+/**
+ * Destroy the exporter, waiting for the files being written.
+ */
+SceneExporter::~SceneExporter() {
+    scheduler.Wait(group);
+}
+
+/**
+ * Export the scene rendered in the next frame.
+ * May be called from any thread. The files are named by the base
+ * name with the extensions .dot and .json.
+ *
+ * @param base Base name of the files.
+ */
+void SceneExporter::Request(string base) {
+    lock.Lock();
+    requested = true;
+    requestBase = base;
+    lock.Unlock();
+}
+
+/**
+ * Check if the current frame is recorded, in which case the
+ * rendering view reports the nodes it visits.
+ */
+bool SceneExporter::IsRecording() const {
+    return recording;
+}
+
+/**
+ * Number of exports still being written.
+ */
+unsigned int SceneExporter::GetPendingCount() {
+    return group.GetPendingCount();
+}
+
+/**
+ * Record that a node was found visible.
+ */
+void SceneExporter::AddVisible(ISceneNode* node) {
+    stats[node].visible++;
+}
+
+/**
+ * Record that a node was culled.
+ */
+void SceneExporter::AddCulled(ISceneNode* node) {
+    stats[node].culled++;
+}
+
+/**
+ * Record the drawing of a node.
+ *
+ * @param node Drawn node.
+ * @param triangles Triangles drawn.
+ * @param usec Time spent submitting them, zero if deferred.
+ */
+void SceneExporter::AddDraw(ISceneNode* node, unsigned int triangles,
+                            unsigned int usec) {
+    NodeStats& s = stats[node];
+    s.visible++;
+    s.triangles += triangles;
+    s.usec += usec;
+}
+
+/**
+ * Capture the recorded frame and start recording a requested one.
+ */
+void SceneExporter::Handle(Renderers::RenderingEventArg arg) {
+    if (recording) {
+        if (arg.canvas.GetScene() != NULL) Capture(*arg.canvas.GetScene());
+        stats.clear();
+        recording = false;
+    }
+    lock.Lock();
+    if (requested) {
+        recording = true;
+        base = requestBase;
+        requested = false;
+    }
+    lock.Unlock();
+}
+
+// Copy the scene and the statistics into a snapshot in pre-order and
+// hand it to the scheduler.
+void SceneExporter::Capture(ISceneNode& root) {
+    vector<Record>* records = new vector<Record>();
+    vector<std::pair<ISceneNode*, int> > pending;
+    pending.push_back(std::make_pair(&root, -1));
+    while (!pending.empty()) {
+        ISceneNode* node = pending.back().first;
+        int parent = pending.back().second;
+        pending.pop_back();
+        Record r;
+        r.type = GetType(node, r.faces);
+        r.parent = parent;
+        r.depth = (parent < 0) ? 0 : (*records)[parent].depth + 1;
+        r.children = node->GetNumberOfNodes();
+        std::map<ISceneNode*, NodeStats>::iterator itr = stats.find(node);
+        if (itr != stats.end()) r.stats = itr->second;
+        int index = records->size();
+        records->push_back(r);
+        // pushed in reverse so the children are visited in order
+        for (unsigned int i = r.children; i > 0; --i)
+            pending.push_back(std::make_pair(node->GetNode(i - 1), index));
+    }
+    scheduler.Submit(new WriteTask(records, base), &group);
+}
+
+const char* SceneExporter::GetType(ISceneNode* node, unsigned int& faces) {
+    faces = 0;
+    if (GeometryNode* geom = dynamic_cast<GeometryNode*>(node)) {
+        if (geom->GetFaceSet() != NULL) faces = geom->GetFaceSet()->Size();
+        return "GeometryNode";
+    }
+    if (dynamic_cast<TransformationNode*>(node)) return "TransformationNode";
+    if (dynamic_cast<QuadNode*>(node)) return "QuadNode";
+    if (dynamic_cast<LODNode*>(node)) return "LODNode";
+    if (dynamic_cast<MeshNode*>(node)) return "MeshNode";
+    // tested before point lights in case spot lights are ones
+    if (dynamic_cast<SpotLightNode*>(node)) return "SpotLightNode";
+    if (dynamic_cast<PointLightNode*>(node)) return "PointLightNode";
+    if (dynamic_cast<DirectionalLightNode*>(node)) return "DirectionalLightNode";
+    return "SceneNode";
+}
+
+// Culled nodes are filled grey, drawn nodes are labelled with their
+// triangles and time.
+void SceneExporter::WriteDot(const vector<Record>& records, std::ostream& out) {
+    out << "digraph scene {\n"
+        << "  node [shape=box, fontsize=10];\n";
+    for (unsigned int i = 0; i < records.size(); ++i) {
+        const Record& r = records[i];
+        out << "  n" << i << " [label=\"" << r.type;
+        if (r.faces > 0) out << "\\nfaces " << r.faces;
+        if (r.stats.triangles > 0)
+            out << "\\ndrawn " << r.stats.triangles
+                << " in " << r.stats.usec << "us";
+        out << "\"";
+        if (r.stats.culled > 0 && r.stats.visible == 0)
+            out << ", style=filled, fillcolor=grey";
+        out << "];\n";
+        if (r.parent >= 0)
+            out << "  n" << r.parent << " -> n" << i << ";\n";
+    }
+    out << "}\n";
+}
+
+// One node per line, with the totals of the frame first.
+void SceneExporter::WriteJSON(const vector<Record>& records, std::ostream& out) {
+    unsigned int triangles = 0, usec = 0, culled = 0, drawn = 0;
+    for (vector<Record>::const_iterator itr = records.begin();
+         itr != records.end(); ++itr) {
+        triangles += itr->stats.triangles;
+        usec += itr->stats.usec;
+        if (itr->stats.culled > 0 && itr->stats.visible == 0) culled++;
+        if (itr->stats.triangles > 0) drawn++;
+    }
+    out << "{\"totals\":{\"nodes\":" << records.size()
+        << ",\"drawn\":" << drawn
+        << ",\"culled\":" << culled
+        << ",\"triangles\":" << triangles
+        << ",\"usec\":" << usec << "},\n"
+        << "\"nodes\":[\n";
+    for (unsigned int i = 0; i < records.size(); ++i) {
+        const Record& r = records[i];
+        out << "{\"id\":" << i
+            << ",\"parent\":" << r.parent
+            << ",\"depth\":" << r.depth
+            << ",\"type\":\"" << r.type << "\""
+            << ",\"children\":" << r.children
+            << ",\"faces\":" << r.faces
+            << ",\"visible\":" << r.stats.visible
+            << ",\"culled\":" << r.stats.culled
+            << ",\"triangles\":" << r.stats.triangles
+            << ",\"usec\":" << r.stats.usec << "}"
+            << (i + 1 < records.size() ? ",\n" : "\n");
+    }
+    out << "]}\n";
+}
+
+} // NS Scene
+} // NS OpenEngine
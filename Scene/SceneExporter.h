@@ -0,0 +1,104 @@
+// Background export of the scene graph with render statistics.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OE_SCENE_EXPORTER_H_
+#define _OE_SCENE_EXPORTER_H_
+
+#include <Core/IListener.h>
+#include <Core/Mutex.h>
+#include <Core/TaskScheduler.h>
+#include <Renderers/IRenderer.h>
+
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace OpenEngine {
+namespace Scene {
+
+class ISceneNode;
+
+/**
+ * Background export of the scene graph with render statistics.
+ *
+ * An export is requested with Request() and happens over the next
+ * two frames. During the first frame the rendering view records for
+ * each node it visits whether it was culled and the triangles and
+ * time it took to draw. After that frame the rendered scene is
+ * copied into a flat snapshot, a single pass on the rendering thread
+ * without any output, and the snapshot is written on the task
+ * scheduler as a dot graph and as JSON, so neither the traversal nor
+ * the files hold up rendering.
+ *
+ * Draw times are CPU times of submitting the node. Geometry drawn
+ * from a batching draw list is submitted later, sorted by state, and
+ * has no time of its own.
+ *
+ * Attach the exporter to the renderer post-process event.
+ */
+class SceneExporter : public Core::IListener<Renderers::RenderingEventArg> {
+public:
+    /**
+     * Statistics of a node over the recorded frame, times in
+     * microseconds.
+     */
+    struct NodeStats {
+        unsigned int visible, culled;
+        unsigned int triangles;
+        unsigned int usec;
+        NodeStats() : visible(0), culled(0), triangles(0), usec(0) {}
+    };
+
+    SceneExporter(Core::TaskScheduler& scheduler);
+    virtual ~SceneExporter();
+
+    void Request(std::string base = "scene");
+    bool IsRecording() const;
+    unsigned int GetPendingCount();
+
+    void AddVisible(ISceneNode* node);
+    void AddCulled(ISceneNode* node);
+    void AddDraw(ISceneNode* node, unsigned int triangles, unsigned int usec);
+
+    void Handle(Renderers::RenderingEventArg arg);
+
+private:
+    // a node of the snapshot
+    struct Record {
+        const char* type;
+        int parent;
+        unsigned int depth;
+        unsigned int children;
+        unsigned int faces;
+        NodeStats stats;
+    };
+
+    class WriteTask;
+
+    Core::TaskScheduler& scheduler;
+    Core::TaskGroup group;
+    // guards the request, which may come from another thread
+    Core::Mutex lock;
+    bool requested;
+    std::string requestBase;
+    bool recording;
+    std::string base;
+    std::map<ISceneNode*, NodeStats> stats;
+
+    void Capture(ISceneNode& root);
+    static const char* GetType(ISceneNode* node, unsigned int& faces);
+    static void WriteDot(const std::vector<Record>& records, std::ostream& out);
+    static void WriteJSON(const std::vector<Record>& records, std::ostream& out);
+};
+
+} // NS Scene
+} // NS OpenEngine
+
+#endif // _OE_SCENE_EXPORTER_H_
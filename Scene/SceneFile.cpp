@@ -0,0 +1,643 @@
+// Binary scene file.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Scene/SceneFile.h>
+
+#include <Core/Mutex.h>
+#include <Geometry/Face.h>
+#include <Geometry/FaceSet.h>
+#include <Geometry/Material.h>
+#include <Logging/Logger.h>
+#include <Math/Quaternion.h>
+#include <Math/Vector.h>
+#include <Resources/ResourceManager.h>
+#include <Scene/DirectionalLightNode.h>
+#include <Scene/GeometryNode.h>
+#include <Scene/LODNode.h>
+#include <Scene/PointLightNode.h>
+#include <Scene/SceneNode.h>
+#include <Scene/SpotLightNode.h>
+#include <Scene/TransformationNode.h>
+
+#include <boost/weak_ptr.hpp>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <vector>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace OpenEngine {
+namespace Scene {
+
+using namespace Geometry;
+using namespace Math;
+using namespace Resources;
+using Core::Mutex;
+using std::string;
+using std::vector;
+
+// file layout, all values are native endian 32 bit:
+//   magic, version, node count, value count, face count,
+//   material count, string bytes, reserved,
+//   node records[nodes] in depth first order, each followed by its
+//   sub nodes, values[values],
+//   positions[faces*9], normals[faces*9], texcoords[faces*6],
+//   material index[faces], material records[materials],
+//   strings[string bytes] padded to 4 bytes
+static const char SCENE_MAGIC[4] = { 'O', 'E', 'S', 'C' };
+static const unsigned int SCENE_VERSION = 1;
+static const unsigned int HEADER_SIZE = 32;
+static const unsigned int NO_MATERIAL = 0xffffffff;
+
+namespace {
+
+enum NodeType {
+    GROUP,
+    TRANSFORMATION,
+    GEOMETRY,
+    DIRECTIONAL_LIGHT,
+    POINT_LIGHT,
+    SPOT_LIGHT,
+    LOD
+};
+
+// number of values of each node type, a level of detail node has
+// the error of each level in addition
+const unsigned int VALUE_COUNT[] = { 0, 10, 0, 12, 15, 17, 4 };
+
+struct NodeRecord {
+    unsigned int type;
+    unsigned int children;
+    unsigned int faceFirst, faceCount;
+    unsigned int valueFirst, valueCount;
+};
+
+struct MaterialRecord {
+    float ambient[4], diffuse[4], specular[4];
+    float shininess;
+    unsigned int name, length;
+};
+
+struct TextureEntry {
+    boost::weak_ptr<ITexture2D> texr;
+    string file;
+};
+
+}
+
+static Mutex& TextureLock() {
+    static Mutex lock;
+    return lock;
+}
+
+static std::map<ITexture2D*, TextureEntry>& Textures() {
+    static std::map<ITexture2D*, TextureEntry> textures;
+    return textures;
+}
+
+// Flattens a scene into the arrays of a scene file.
+class SceneWriter {
+public:
+    vector<NodeRecord> nodes;
+    vector<float> values;
+    vector<float> verts, norms, texcs;
+    vector<unsigned int> faceMaterial;
+    vector<MaterialRecord> materials;
+    string strings;
+    unsigned int unsupported, untextured, unshaded;
+
+    SceneWriter() : unsupported(0), untextured(0), unshaded(0) {}
+
+    void Add(ISceneNode* node) {
+        unsigned int index = nodes.size();
+        NodeRecord r = { GROUP, node->GetNumberOfNodes(), 0, 0,
+                         (unsigned int)values.size(), 0 };
+        nodes.push_back(r);
+
+        TransformationNode* trans = dynamic_cast<TransformationNode*>(node);
+        GeometryNode* geom = dynamic_cast<GeometryNode*>(node);
+        SpotLightNode* spot = dynamic_cast<SpotLightNode*>(node);
+        PointLightNode* point = dynamic_cast<PointLightNode*>(node);
+        DirectionalLightNode* dir = dynamic_cast<DirectionalLightNode*>(node);
+        LODNode* lod = dynamic_cast<LODNode*>(node);
+        if (trans != NULL) {
+            r.type = TRANSFORMATION;
+            Quaternion<float> q = trans->GetRotation();
+            Push(trans->GetPosition());
+            values.push_back(q.GetReal());
+            Push(q.GetImaginary());
+            Push(trans->GetScale());
+        } else if (geom != NULL) {
+            r.type = GEOMETRY;
+            r.faceFirst = faceMaterial.size();
+            if (geom->GetFaceSet() != NULL) AddFaces(*geom->GetFaceSet());
+            r.faceCount = faceMaterial.size() - r.faceFirst;
+        } else if (spot != NULL) {
+            // tested before point lights in case spot lights are ones
+            r.type = SPOT_LIGHT;
+            Colors(spot);
+            values.push_back(spot->constAtt);
+            values.push_back(spot->linearAtt);
+            values.push_back(spot->quadAtt);
+            values.push_back(spot->cutoff);
+            values.push_back(spot->exponent);
+        } else if (point != NULL) {
+            r.type = POINT_LIGHT;
+            Colors(point);
+            values.push_back(point->constAtt);
+            values.push_back(point->linearAtt);
+            values.push_back(point->quadAtt);
+        } else if (dir != NULL) {
+            r.type = DIRECTIONAL_LIGHT;
+            Colors(dir);
+        } else if (lod != NULL) {
+            // all levels are saved, not just the selected one
+            r.type = LOD;
+            r.children = lod->GetLevelCount();
+            values.insert(values.end(), lod->GetCenter(), lod->GetCenter() + 3);
+            values.push_back(lod->GetRadius());
+            for (unsigned int i = 0; i < lod->GetLevelCount(); ++i)
+                values.push_back(lod->GetError(i));
+        } else if (dynamic_cast<SceneNode*>(node) == NULL)
+            unsupported++;
+        r.valueCount = values.size() - r.valueFirst;
+        nodes[index] = r;
+
+        for (unsigned int i = 0; i < r.children; ++i)
+            Add(lod != NULL ? lod->GetLevelNode(i) : node->GetNode(i));
+    }
+
+private:
+    std::map<Material*, unsigned int> materialIndex;
+
+    template <unsigned int N> void Push(Vector<N,float> v) {
+        for (unsigned int k = 0; k < N; ++k) values.push_back(v[k]);
+    }
+
+    void Colors(LightNode* node) {
+        Push(node->ambient);
+        Push(node->diffuse);
+        Push(node->specular);
+    }
+
+    void AddFaces(FaceSet& faces) {
+        for (FaceList::iterator itr = faces.begin(); itr != faces.end(); ++itr) {
+            FacePtr face = *itr;
+            for (unsigned int i = 0; i < 3; ++i) {
+                for (unsigned int k = 0; k < 3; ++k) {
+                    verts.push_back(face->vert[i][k]);
+                    norms.push_back(face->norm[i][k]);
+                }
+                texcs.push_back(face->texc[i][0]);
+                texcs.push_back(face->texc[i][1]);
+            }
+            faceMaterial.push_back(AddMaterial(face->mat));
+        }
+    }
+
+    unsigned int AddMaterial(MaterialPtr mat) {
+        if (!mat) return NO_MATERIAL;
+        std::map<Material*, unsigned int>::iterator itr =
+            materialIndex.find(mat.get());
+        if (itr != materialIndex.end()) return itr->second;
+
+        MaterialRecord m;
+        Vector<4,float> a = mat->ambient, d = mat->diffuse, s = mat->specular;
+        for (unsigned int k = 0; k < 4; ++k) {
+            m.ambient[k] = a[k];
+            m.diffuse[k] = d[k];
+            m.specular[k] = s[k];
+        }
+        m.shininess = mat->shininess;
+        m.name = m.length = 0;
+        string file;
+        if (mat->texr && SceneFile::GetTextureFile(mat->texr, file)) {
+            m.name = strings.size();
+            m.length = file.size();
+            strings += file;
+        } else if (mat->texr)
+            untextured++;
+        if (mat->shad) unshaded++;
+
+        unsigned int index = materials.size();
+        materials.push_back(m);
+        materialIndex[mat.get()] = index;
+        return index;
+    }
+};
+
+// Builds the nodes of a mapped scene file.
+class SceneReader {
+public:
+    const NodeRecord* nodes;
+    unsigned int nodeCount;
+    const float* values;
+    unsigned int valueCount;
+    const float* verts;
+    const float* norms;
+    const float* texcs;
+    const unsigned int* faceMaterial;
+    unsigned int faceCount;
+    vector<MaterialPtr> materials;
+    unsigned int next;
+
+    // Check the records of a sub tree before anything is built, so a
+    // damaged file is rejected without leaving half a scene behind.
+    bool Check() {
+        if (next >= nodeCount) return false;
+        const NodeRecord& r = nodes[next++];
+        if (r.type > LOD ||
+            r.faceCount > faceCount || r.faceFirst > faceCount - r.faceCount ||
+            r.valueCount > valueCount || r.valueFirst > valueCount - r.valueCount ||
+            r.valueCount < VALUE_COUNT[r.type] ||
+            r.children > nodeCount - next ||
+            (r.type == LOD && r.valueCount < 4 + r.children))
+            return false;
+        for (unsigned int i = 0; i < r.children; ++i)
+            if (!Check()) return false;
+        return true;
+    }
+
+    ISceneNode* Build() {
+        const NodeRecord& r = nodes[next++];
+        const float* v = values + r.valueFirst;
+        ISceneNode* node = NULL;
+        LODNode* lod = NULL;
+        switch (r.type) {
+        case TRANSFORMATION: {
+            TransformationNode* trans = new TransformationNode();
+            trans->SetPosition(Vector<3,float>(v[0], v[1], v[2]));
+            trans->SetRotation(Quaternion<float>(v[3], Vector<3,float>(v[4], v[5], v[6])));
+            trans->SetScale(Vector<3,float>(v[7], v[8], v[9]));
+            node = trans;
+            break;
+        }
+        case GEOMETRY:
+            node = new GeometryNode(BuildFaces(r.faceFirst, r.faceCount));
+            break;
+        case DIRECTIONAL_LIGHT: {
+            DirectionalLightNode* dir = new DirectionalLightNode();
+            Colors(dir, v);
+            node = dir;
+            break;
+        }
+        case POINT_LIGHT: {
+            PointLightNode* point = new PointLightNode();
+            Colors(point, v);
+            point->constAtt = v[12];
+            point->linearAtt = v[13];
+            point->quadAtt = v[14];
+            node = point;
+            break;
+        }
+        case SPOT_LIGHT: {
+            SpotLightNode* spot = new SpotLightNode();
+            Colors(spot, v);
+            spot->constAtt = v[12];
+            spot->linearAtt = v[13];
+            spot->quadAtt = v[14];
+            spot->cutoff = v[15];
+            spot->exponent = v[16];
+            node = spot;
+            break;
+        }
+        case LOD:
+            node = lod = new LODNode(v, v[3]);
+            break;
+        default:
+            node = new SceneNode();
+        }
+        for (unsigned int i = 0; i < r.children; ++i) {
+            if (lod != NULL) lod->AddLevel(Build(), v[4 + i]);
+            else node->AddNode(Build());
+        }
+        return node;
+    }
+
+private:
+    void Colors(LightNode* node, const float* v) {
+        node->ambient = Vector<4,float>(v[0], v[1], v[2], v[3]);
+        node->diffuse = Vector<4,float>(v[4], v[5], v[6], v[7]);
+        node->specular = Vector<4,float>(v[8], v[9], v[10], v[11]);
+    }
+
+    FaceSet* BuildFaces(unsigned int first, unsigned int count) {
+        FaceSet* fs = new FaceSet();
+        for (unsigned int f = first; f < first + count; ++f) {
+            const float* v = verts + f*9;
+            const float* n = norms + f*9;
+            const float* t = texcs + f*6;
+            FacePtr face(new Face(Vector<3,float>(v[0], v[1], v[2]),
+                                  Vector<3,float>(v[3], v[4], v[5]),
+                                  Vector<3,float>(v[6], v[7], v[8]),
+                                  Vector<3,float>(n[0], n[1], n[2]),
+                                  Vector<3,float>(n[3], n[4], n[5]),
+                                  Vector<3,float>(n[6], n[7], n[8])));
+            face->texc[0] = Vector<2,float>(t[0], t[1]);
+            face->texc[1] = Vector<2,float>(t[2], t[3]);
+            face->texc[2] = Vector<2,float>(t[4], t[5]);
+            unsigned int m = faceMaterial[f];
+            if (m < materials.size()) face->mat = materials[m];
+            fs->Add(face);
+        }
+        return fs;
+    }
+};
+
+/**
+ * Save a scene.
+ *
+ * @param root Root of the scene to save.
+ * @param file File to write.
+ * @return True if the file was written.
+ */
+bool SceneFile::Save(ISceneNode& root, string file) {
+    SceneWriter w;
+    w.Add(&root);
+    if (w.unsupported > 0)
+        logger.warning << "SceneFile: " << w.unsupported
+                       << " nodes of unsupported types saved as scene nodes"
+                       << logger.end;
+    if (w.untextured > 0)
+        logger.warning << "SceneFile: " << w.untextured
+                       << " materials saved without their texture, the"
+                       << " texture file is unknown" << logger.end;
+    if (w.unshaded > 0)
+        logger.warning << "SceneFile: " << w.unshaded
+                       << " materials saved without their shader"
+                       << logger.end;
+
+    std::ofstream out(file.c_str(), std::ios::binary | std::ios::trunc);
+    if (!out) {
+        logger.error << "SceneFile: can not open '" << file
+                     << "' for output" << logger.end;
+        return false;
+    }
+    unsigned int faces = w.faceMaterial.size();
+    unsigned int header[8];
+    memcpy(header, SCENE_MAGIC, 4);
+    header[1] = SCENE_VERSION;
+    header[2] = w.nodes.size();
+    header[3] = w.values.size();
+    header[4] = faces;
+    header[5] = w.materials.size();
+    header[6] = w.strings.size();
+    header[7] = 0;
+    out.write((const char*)header, sizeof(header));
+    if (!w.nodes.empty())
+        out.write((const char*)&w.nodes[0], w.nodes.size() * sizeof(NodeRecord));
+    if (!w.values.empty())
+        out.write((const char*)&w.values[0], w.values.size() * 4);
+    if (faces > 0) {
+        out.write((const char*)&w.verts[0], faces*9*4);
+        out.write((const char*)&w.norms[0], faces*9*4);
+        out.write((const char*)&w.texcs[0], faces*6*4);
+        out.write((const char*)&w.faceMaterial[0], faces*4);
+    }
+    if (!w.materials.empty())
+        out.write((const char*)&w.materials[0],
+                  w.materials.size() * sizeof(MaterialRecord));
+    static const char pad[4] = { 0, 0, 0, 0 };
+    unsigned int len = w.strings.size();
+    out.write(w.strings.data(), len);
+    out.write(pad, ((len + 3) & ~3u) - len);
+    if (!out.good()) {
+        out.close();
+        remove(file.c_str());
+        logger.error << "SceneFile: failed writing '" << file << "'"
+                     << logger.end;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Load a scene saved with Save().
+ * The file is mapped into memory and the nodes are built from the
+ * mapped arrays. Textures are created through the resource manager
+ * and loaded as usual by the texture loaders.
+ *
+ * @param file File to load.
+ * @return Root of the new scene, owned by the caller, or NULL if the
+ *         file can not be read.
+ */
+ISceneNode* SceneFile::Load(string file) {
+    const char* base;
+    unsigned long size;
+#ifndef _WIN32
+    void* mapping = NULL;
+    int fd = open(file.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size < (off_t)HEADER_SIZE) {
+        if (fd >= 0) close(fd);
+        logger.error << "SceneFile: can not read '" << file << "'"
+                     << logger.end;
+        return NULL;
+    }
+    size = st.st_size;
+    mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        logger.error << "SceneFile: can not map '" << file << "'"
+                     << logger.end;
+        return NULL;
+    }
+    base = (const char*)mapping;
+#else
+    vector<char> buffer;
+    std::ifstream in(file.c_str(), std::ios::binary);
+    if (in) {
+        in.seekg(0, std::ios::end);
+        size = in.tellg();
+        in.seekg(0, std::ios::beg);
+    }
+    if (!in || size < HEADER_SIZE) {
+        logger.error << "SceneFile: can not read '" << file << "'"
+                     << logger.end;
+        return NULL;
+    }
+    buffer.resize(size);
+    in.read(&buffer[0], size);
+    base = &buffer[0];
+#endif
+
+    const unsigned int* header = (const unsigned int*)base;
+    SceneReader r;
+    r.nodeCount = header[2];
+    r.valueCount = header[3];
+    r.faceCount = header[4];
+    unsigned int matCount = header[5];
+    unsigned int stringBytes = header[6];
+    // in 64 bits so huge counts in a damaged header can not wrap
+    unsigned long long expected = HEADER_SIZE
+        + (unsigned long long)r.nodeCount * sizeof(NodeRecord)
+        + (unsigned long long)r.valueCount * 4
+        + (unsigned long long)r.faceCount * (9 + 9 + 6 + 1) * 4
+        + (unsigned long long)matCount * sizeof(MaterialRecord)
+        + ((stringBytes + 3ull) & ~3ull);
+    ISceneNode* root = NULL;
+    if (memcmp(base, SCENE_MAGIC, 4) == 0 &&
+        header[1] == SCENE_VERSION &&
+        expected <= size) {
+        const char* p = base + HEADER_SIZE;
+        r.nodes = (const NodeRecord*)p;
+        p += r.nodeCount * sizeof(NodeRecord);
+        r.values = (const float*)p;
+        r.verts = r.values + r.valueCount;
+        r.norms = r.verts + r.faceCount*9;
+        r.texcs = r.norms + r.faceCount*9;
+        r.faceMaterial = (const unsigned int*)(r.texcs + r.faceCount*6);
+        const MaterialRecord* mats =
+            (const MaterialRecord*)(r.faceMaterial + r.faceCount);
+        const char* strings = (const char*)(mats + matCount);
+
+        r.next = 0;
+        bool valid = r.Check() && r.next == r.nodeCount;
+        for (unsigned int i = 0; valid && i < matCount; ++i)
+            valid = mats[i].length <= stringBytes &&
+                    mats[i].name <= stringBytes - mats[i].length;
+        if (valid) {
+            for (unsigned int i = 0; i < matCount; ++i) {
+                const MaterialRecord& m = mats[i];
+                MaterialPtr mat(new Material());
+                mat->ambient = Vector<4,float>(m.ambient[0], m.ambient[1],
+                                               m.ambient[2], m.ambient[3]);
+                mat->diffuse = Vector<4,float>(m.diffuse[0], m.diffuse[1],
+                                               m.diffuse[2], m.diffuse[3]);
+                mat->specular = Vector<4,float>(m.specular[0], m.specular[1],
+                                                m.specular[2], m.specular[3]);
+                mat->shininess = m.shininess;
+                if (m.length > 0)
+                    mat->texr = ResourceManager<ITexture2D>::Create(
+                        string(strings + m.name, m.length));
+                r.materials.push_back(mat);
+            }
+            r.next = 0;
+            root = r.Build();
+        }
+    }
+#ifndef _WIN32
+    munmap(mapping, size);
+#endif
+    if (root == NULL)
+        logger.error << "SceneFile: '" << file << "' is not a valid scene file"
+                     << logger.end;
+    return root;
+}
+
+/**
+ * Record the file a texture is created from.
+ * Safe to call from any thread.
+ *
+ * @param texr Texture.
+ * @param file File to reference the texture by in saved scenes.
+ */
+void SceneFile::AddTexture(ITexture2DPtr texr, string file) {
+    Mutex& lock = TextureLock();
+    lock.Lock();
+    TextureEntry& e = Textures()[texr.get()];
+    e.texr = texr;
+    e.file = file;
+    lock.Unlock();
+}
+
+/**
+ * Get the file a texture was created from.
+ *
+ * @param texr Texture.
+ * @param file Set to the file of the texture.
+ * @return True if the file of the texture is known.
+ */
+bool SceneFile::GetTextureFile(ITexture2DPtr texr, string& file) {
+    Mutex& lock = TextureLock();
+    lock.Lock();
+    std::map<ITexture2D*, TextureEntry>& textures = Textures();
+    std::map<ITexture2D*, TextureEntry>::iterator itr = textures.find(texr.get());
+    // the address may belong to a texture released since
+    bool found = itr != textures.end() && itr->second.texr.lock() == texr;
+    if (found) file = itr->second.file;
+    else if (itr != textures.end()) textures.erase(itr);
+    lock.Unlock();
+    return found;
+}
+
+/**
+ * Get the live textures created from a file.
+ * Textures recorded by a name relative to a data directory are found
+ * by any path ending in that name.
+ * Safe to call from any thread.
+ *
+ * @param path Path of the file.
+ * @param textures Textures of the file are added here.
+ */
+void SceneFile::GetTextures(string path, vector<ITexture2DPtr>& textures) {
+    Mutex& lock = TextureLock();
+    lock.Lock();
+    std::map<ITexture2D*, TextureEntry>& entries = Textures();
+    for (std::map<ITexture2D*, TextureEntry>::iterator itr = entries.begin();
+         itr != entries.end(); ) {
+        ITexture2DPtr texr = itr->second.texr.lock();
+        if (!texr) {
+            entries.erase(itr++);
+            continue;
+        }
+        if (IsFile(path, itr->second.file))
+            textures.push_back(texr);
+        ++itr;
+    }
+    lock.Unlock();
+}
+
+/**
+ * Check if a path names a file, given as a path or as a name relative
+ * to a data directory, which matches any path ending in that name.
+ *
+ * @param path Path to check.
+ * @param file File as a path or a relative name.
+ * @return True if the path names the file.
+ */
+bool SceneFile::IsFile(const string& path, const string& file) {
+    if (path == file) return true;
+    return path.size() > file.size() &&
+        path.compare(path.size() - file.size(), file.size(), file) == 0 &&
+        path[path.size() - file.size() - 1] == '/';
+}
+
+/**
+ * Create the plug-in.
+ *
+ * @param images Plug-in creating the textures, owned by this plug-in.
+ */
+SceneTexturePlugin::SceneTexturePlugin(IResourcePlugin<ITexture2D>* images)
+    : images(images) {
+    this->AddExtension("png");
+    this->AddExtension("jpg");
+    this->AddExtension("jpeg");
+    this->AddExtension("tga");
+    this->AddExtension("bmp");
+}
+
+SceneTexturePlugin::~SceneTexturePlugin() {
+    delete images;
+}
+
+ITexture2DPtr SceneTexturePlugin::CreateResource(string file) {
+    ITexture2DPtr texr = images->CreateResource(file);
+    if (texr) SceneFile::AddTexture(texr, file);
+    return texr;
+}
+
+} // NS Scene
+} // NS OpenEngine
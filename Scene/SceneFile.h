@@ -0,0 +1,83 @@
+// Binary scene file.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OE_SCENE_FILE_H_
+#define _OE_SCENE_FILE_H_
+
+#include <Resources/IResourcePlugin.h>
+#include <Resources/ITexture2D.h>
+
+#include <string>
+#include <vector>
+
+namespace OpenEngine {
+namespace Scene {
+
+class ISceneNode;
+
+/**
+ * Binary scene file.
+ *
+ * Saves an assembled scene, with its geometry, materials, lights and
+ * transformations, into a single binary file, and loads it back by
+ * mapping the file into memory and building the nodes directly from
+ * the mapped arrays. Nothing is parsed and no models are loaded, so
+ * a scene assembled from many models at startup loads in the time it
+ * takes to build its faces.
+ *
+ * Textures are referenced by the file they were created from and are
+ * created through the resource manager when the scene is loaded.
+ * Only textures created through a SceneTexturePlugin, or registered
+ * with AddTexture(), have a known file; materials with other
+ * textures are saved without them.
+ *
+ * Scene, transformation, geometry, light and level of detail nodes
+ * are saved. Other nodes are saved as scene nodes keeping their sub
+ * nodes, and shaders are not saved.
+ *
+ * @code
+ * SceneFile::Save(*setup.GetScene(), "level.oescene");
+ * ...
+ * ISceneNode* scene = SceneFile::Load("level.oescene");
+ * if (scene != NULL) setup.SetScene(*scene);
+ * @endcode
+ */
+class SceneFile {
+public:
+    static bool Save(ISceneNode& root, std::string file);
+    static ISceneNode* Load(std::string file);
+
+    static void AddTexture(Resources::ITexture2DPtr texr, std::string file);
+    static bool GetTextureFile(Resources::ITexture2DPtr texr,
+                               std::string& file);
+    static void GetTextures(std::string path,
+                            std::vector<Resources::ITexture2DPtr>& textures);
+    static bool IsFile(const std::string& path, const std::string& file);
+};
+
+/**
+ * Texture plug-in recording the files textures are created from, so
+ * they can be referenced by a SceneFile.
+ * Textures are created by the wrapped plug-in. Register it before
+ * other texture plug-ins to take precedence.
+ */
+class SceneTexturePlugin
+    : public Resources::IResourcePlugin<Resources::ITexture2D> {
+public:
+    SceneTexturePlugin(Resources::IResourcePlugin<Resources::ITexture2D>* images);
+    virtual ~SceneTexturePlugin();
+    Resources::ITexture2DPtr CreateResource(std::string file);
+private:
+    Resources::IResourcePlugin<Resources::ITexture2D>* images;
+};
+
+} // NS Scene
+} // NS OpenEngine
+
+#endif // _OE_SCENE_FILE_H_
@@ -0,0 +1,90 @@
+// Snapshot of scene transformations.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Scene/TransformSnapshot.h>
+
+#include <Scene/ISceneNode.h>
+#include <Scene/ISceneNodeVisitor.h>
+#include <Scene/TransformationNode.h>
+
+#include <algorithm>
+
+namespace OpenEngine {
+namespace Scene {
+
+TransformSnapshot::TransformSnapshot()
+    : back(&buffers[0])
+    , front(&buffers[1])
+    , ready(&buffers[2])
+    , fresh(false) {}
+
+TransformSnapshot::~TransformSnapshot() {}
+
+/**
+ * Capture the transformations of a scene.
+ * Call it from the thread changing the scene, typically on the post
+ * tick event of the threaded engine.
+ *
+ * @param root Scene to capture.
+ */
+void TransformSnapshot::Capture(ISceneNode& root) {
+    class Collector : public ISceneNodeVisitor {
+        std::vector<Entry>& entries;
+    public:
+        Collector(std::vector<Entry>& entries) : entries(entries) {}
+        void VisitTransformationNode(TransformationNode* node) {
+            Entry e;
+            e.node = node;
+            node->GetTransformationMatrix().ToArray(e.m);
+            entries.push_back(e);
+            node->VisitSubNodes(*this);
+        }
+    };
+    back->clear();
+    Collector collector(*back);
+    root.Accept(collector);
+    std::sort(back->begin(), back->end());
+
+    lock.Lock();
+    std::swap(back, ready);
+    fresh = true;
+    lock.Unlock();
+}
+
+/**
+ * Make the newest capture the current snapshot.
+ * Call it from the render thread before traversing the scene.
+ */
+void TransformSnapshot::Acquire() {
+    lock.Lock();
+    if (fresh) {
+        std::swap(front, ready);
+        fresh = false;
+    }
+    lock.Unlock();
+}
+
+/**
+ * Local transformation of a node in the current snapshot.
+ *
+ * @param node Transformation node.
+ * @return Column major matrix, or NULL if the node was added after
+ *         the snapshot was captured.
+ */
+const float* TransformSnapshot::GetTransformation(TransformationNode* node) const {
+    Entry key;
+    key.node = node;
+    Buffer::const_iterator itr =
+        std::lower_bound(front->begin(), front->end(), key);
+    if (itr == front->end() || itr->node != node) return NULL;
+    return itr->m;
+}
+
+} // NS Scene
+} // NS OpenEngine
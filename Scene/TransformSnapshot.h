@@ -0,0 +1,69 @@
+// Snapshot of scene transformations.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OE_TRANSFORM_SNAPSHOT_H_
+#define _OE_TRANSFORM_SNAPSHOT_H_
+
+#include <Core/Mutex.h>
+
+#include <vector>
+
+namespace OpenEngine {
+namespace Scene {
+
+class ISceneNode;
+class TransformationNode;
+
+/**
+ * Snapshot of scene transformations.
+ *
+ * Hands the transformations of a scene from a simulation thread to a
+ * render thread. The simulation captures the local transformation
+ * of every transformation node after each tick, and the renderer
+ * acquires the newest complete capture at the start of each frame
+ * and reads the transformations from it instead of from the nodes.
+ *
+ * Captures are written into a back buffer and handed over through a
+ * third buffer, so neither thread ever waits for the other; the
+ * renderer simply keeps its current snapshot until a newer one has
+ * been published.
+ */
+class TransformSnapshot {
+public:
+    TransformSnapshot();
+    virtual ~TransformSnapshot();
+
+    void Capture(ISceneNode& root);
+    void Acquire();
+    const float* GetTransformation(TransformationNode* node) const;
+
+private:
+    struct Entry {
+        TransformationNode* node;
+        float m[16];
+        bool operator<(const Entry& other) const {
+            return node < other.node;
+        }
+    };
+    typedef std::vector<Entry> Buffer;
+
+    Buffer buffers[3];
+    Buffer* back;    // written by Capture()
+    Buffer* front;   // read by GetTransformation()
+
+    // guards the ready buffer and the fresh flag
+    Core::Mutex lock;
+    Buffer* ready;
+    bool fresh;
+};
+
+} // NS Scene
+} // NS OpenEngine
+
+#endif // _OE_TRANSFORM_SNAPSHOT_H_
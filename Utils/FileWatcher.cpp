@@ -0,0 +1,262 @@
+// Watcher of changed files below a set of directories.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Utils/FileWatcher.h>
+
+#include <Core/Thread.h>
+#include <Logging/Logger.h>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace OpenEngine {
+namespace Utils {
+
+using Core::Mutex;
+using Core::Thread;
+using std::map;
+using std::string;
+using std::vector;
+
+static string Join(const string& dir, const string& name) {
+    if (dir.empty() || dir[dir.size() - 1] == '/') return dir + name;
+    return dir + "/" + name;
+}
+
+// Compares the modification times of the files where inotify is not
+// available.
+class FileWatcher::ScanThread : public Thread {
+    FileWatcher& owner;
+    Mutex lock;
+    bool running;
+    // modification times of the files below each directory
+    map<string, map<string, long> > times;
+public:
+    ScanThread(FileWatcher& owner) : owner(owner), running(true) {}
+    void Stop() {
+        lock.Lock();
+        running = false;
+        lock.Unlock();
+    }
+    bool IsRunning() {
+        lock.Lock();
+        bool r = running;
+        lock.Unlock();
+        return r;
+    }
+    void Run() {
+        while (IsRunning()) {
+            owner.lock.Lock();
+            vector<string> roots = owner.roots;
+            owner.lock.Unlock();
+            vector<string> changed;
+            for (vector<string>::iterator root = roots.begin();
+                 root != roots.end(); ++root) {
+                map<string, long> now;
+                Scan(*root, now);
+                // the first scan of a directory finds its files
+                map<string, map<string, long> >::iterator prev = times.find(*root);
+                if (prev != times.end())
+                    for (map<string, long>::iterator itr = now.begin();
+                         itr != now.end(); ++itr) {
+                        map<string, long>::iterator old = prev->second.find(itr->first);
+                        if (old == prev->second.end() || old->second != itr->second)
+                            changed.push_back(itr->first);
+                    }
+                times[*root].swap(now);
+            }
+            if (!changed.empty()) {
+                owner.lock.Lock();
+                owner.scanned.insert(owner.scanned.end(),
+                                     changed.begin(), changed.end());
+                owner.lock.Unlock();
+            }
+            Thread::Sleep(owner.interval);
+        }
+    }
+};
+
+/**
+ * Create a watcher without directories.
+ *
+ * @param settle Time in microseconds a file must be left alone
+ *               before its change is reported.
+ * @param interval Time in microseconds between comparing the
+ *                 modification times, where inotify is not
+ *                 available.
+ */
+FileWatcher::FileWatcher(unsigned int settle, unsigned int interval)
+    : settle(settle)
+    , interval(interval)
+    , fd(-1)
+    , thread(NULL)
+{
+    timer.Start();
+#ifdef __linux__
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0)
+        logger.warning << "FileWatcher: inotify not available, "
+                       << "comparing modification times" << logger.end;
+#endif
+}
+
+/**
+ * Destroy the watcher.
+ */
+FileWatcher::~FileWatcher() {
+    if (thread != NULL) {
+        thread->Stop();
+        thread->Wait();
+        delete thread;
+    }
+#ifdef __linux__
+    if (fd >= 0) close(fd);
+#endif
+}
+
+/**
+ * Watch the files below a directory, including its sub directories.
+ * Files changing, created or moved into the directories are
+ * reported.
+ */
+void FileWatcher::AddDirectory(string dir) {
+    if (fd >= 0) {
+        Watch(dir);
+        return;
+    }
+    lock.Lock();
+    roots.push_back(dir);
+    bool start = thread == NULL;
+    if (start) thread = new ScanThread(*this);
+    lock.Unlock();
+    if (start) thread->Start();
+}
+
+/**
+ * Get the files changed since the last poll, once they have settled.
+ * Does not block.
+ *
+ * @param changed Paths of the changed files are added here.
+ * @return True if any file changed.
+ */
+bool FileWatcher::Poll(vector<string>& changed) {
+    // ages are measured from the first pending change
+    if (pending.empty()) {
+        timer.Reset();
+        timer.Start();
+    }
+    unsigned int now = timer.GetElapsedTime().AsInt();
+    if (fd >= 0) Read();
+    else {
+        lock.Lock();
+        for (vector<string>::iterator itr = scanned.begin();
+             itr != scanned.end(); ++itr)
+            pending[*itr] = now;
+        scanned.clear();
+        lock.Unlock();
+    }
+    bool any = false;
+    for (map<string, unsigned int>::iterator itr = pending.begin();
+         itr != pending.end(); ) {
+        if (now - itr->second < settle) {
+            ++itr;
+            continue;
+        }
+        changed.push_back(itr->first);
+        pending.erase(itr++);
+        any = true;
+    }
+    return any;
+}
+
+// Watch a directory and its sub directories through inotify.
+void FileWatcher::Watch(const string& dir) {
+#ifdef __linux__
+    int wd = inotify_add_watch(fd, dir.c_str(),
+                               IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+    if (wd < 0) {
+        logger.warning << "FileWatcher: can not watch '" << dir << "'"
+                       << logger.end;
+        return;
+    }
+    watches[wd] = dir;
+    DIR* d = opendir(dir.c_str());
+    if (d == NULL) return;
+    vector<string> subdirs;
+    while (struct dirent* entry = readdir(d)) {
+        string name = entry->d_name;
+        if (name == "." || name == "..") continue;
+        string path = Join(dir, name);
+        struct stat st;
+        if (lstat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode))
+            subdirs.push_back(path);
+    }
+    closedir(d);
+    for (vector<string>::iterator itr = subdirs.begin();
+         itr != subdirs.end(); ++itr)
+        Watch(*itr);
+#endif
+}
+
+// Move the inotify events into the pending changes.
+void FileWatcher::Read() {
+#ifdef __linux__
+    unsigned int now = timer.GetElapsedTime().AsInt();
+    // aligned for the event structures
+    union {
+        struct inotify_event event;
+        char bytes[4096];
+    } buffer;
+    for (;;) {
+        ssize_t n = read(fd, buffer.bytes, sizeof(buffer.bytes));
+        if (n <= 0) break;
+        for (ssize_t i = 0; i < n; ) {
+            struct inotify_event* e = (struct inotify_event*)(buffer.bytes + i);
+            i += sizeof(struct inotify_event) + e->len;
+            map<int, string>::iterator w = watches.find(e->wd);
+            if (w == watches.end() || e->len == 0) continue;
+            string path = Join(w->second, e->name);
+            if (e->mask & IN_ISDIR) {
+                // new directories are watched as well
+                if (e->mask & (IN_CREATE | IN_MOVED_TO)) Watch(path);
+            } else if (e->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+                pending[path] = now;
+        }
+    }
+#endif
+}
+
+// Modification times of the files below a directory, not following
+// linked directories.
+void FileWatcher::Scan(const string& dir, map<string, long>& times) {
+    DIR* d = opendir(dir.c_str());
+    if (d == NULL) return;
+    vector<string> subdirs;
+    while (struct dirent* entry = readdir(d)) {
+        string name = entry->d_name;
+        if (name == "." || name == "..") continue;
+        string path = Join(dir, name);
+        struct stat st;
+        if (lstat(path.c_str(), &st) != 0) continue;
+        if (S_ISDIR(st.st_mode)) subdirs.push_back(path);
+        else if (stat(path.c_str(), &st) == 0 && !S_ISDIR(st.st_mode))
+            times[path] = st.st_mtime;
+    }
+    closedir(d);
+    for (vector<string>::iterator itr = subdirs.begin();
+         itr != subdirs.end(); ++itr)
+        Scan(*itr, times);
+}
+
+} // NS Utils
+} // NS OpenEngine
@@ -0,0 +1,79 @@
+// Watcher of changed files below a set of directories.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OE_FILE_WATCHER_H_
+#define _OE_FILE_WATCHER_H_
+
+#include <Core/Mutex.h>
+#include <Utils/Timer.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace OpenEngine {
+namespace Utils {
+
+/**
+ * Watcher of changed files below a set of directories.
+ *
+ * On Linux the directories are watched through inotify, which is
+ * read without blocking, so Poll() can be called every frame at the
+ * cost of a system call. Elsewhere a thread of the watcher compares
+ * the modification times of the files at an interval.
+ *
+ * Editors tend to write a file in several steps, so a change is
+ * reported only once the file has been left alone for the settle
+ * time, and once for all the writes before.
+ *
+ * @code
+ * FileWatcher watcher;
+ * watcher.AddDirectory("data/");
+ * ...
+ * std::vector<std::string> changed;
+ * if (watcher.Poll(changed)) ...
+ * @endcode
+ */
+class FileWatcher {
+public:
+    FileWatcher(unsigned int settle = 100000, unsigned int interval = 500000);
+    virtual ~FileWatcher();
+
+    void AddDirectory(std::string dir);
+    bool Poll(std::vector<std::string>& changed);
+
+private:
+    class ScanThread;
+
+    unsigned int settle;
+    unsigned int interval;
+    Timer timer;
+    // changed files and the time of their last change
+    std::map<std::string, unsigned int> pending;
+
+    // inotify descriptor and the directory of each watch
+    int fd;
+    std::map<int, std::string> watches;
+
+    // guards the members below, shared with the scan thread
+    Core::Mutex lock;
+    ScanThread* thread;
+    std::vector<std::string> roots;
+    std::vector<std::string> scanned;
+
+    void Watch(const std::string& dir);
+    void Read();
+    static void Scan(const std::string& dir,
+                     std::map<std::string, long>& times);
+};
+
+} // NS Utils
+} // NS OpenEngine
+
+#endif // _OE_FILE_WATCHER_H_
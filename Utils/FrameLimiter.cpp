@@ -0,0 +1,56 @@
+// Frame rate limiter.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Utils/FrameLimiter.h>
+
+#include <Core/Thread.h>
+
+namespace OpenEngine {
+namespace Utils {
+
+using Core::Thread;
+
+/**
+ * Create a frame limiter.
+ *
+ * @param fps Highest number of frames per second, zero for no limit.
+ */
+FrameLimiter::FrameLimiter(unsigned int fps)
+    : fps(fps)
+    , started(false) {}
+
+/**
+ * Set the highest number of frames per second, zero for no limit.
+ */
+void FrameLimiter::SetLimit(unsigned int fps) {
+    this->fps = fps;
+}
+
+unsigned int FrameLimiter::GetLimit() const {
+    return fps;
+}
+
+void FrameLimiter::Handle(Core::ProcessEventArg arg) {
+    if (fps == 0) {
+        started = false;
+        return;
+    }
+    unsigned int period = 1000000 / fps;
+    if (started) {
+        unsigned int elapsed = timer.GetElapsedTime().AsInt();
+        if (elapsed < period) Thread::Sleep(period - elapsed);
+    }
+    // the next frame is timed from the end of the sleep
+    timer.Reset();
+    timer.Start();
+    started = true;
+}
+
+} // NS Utils
+} // NS OpenEngine
@@ -0,0 +1,46 @@
+// Frame rate limiter.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OE_FRAME_LIMITER_H_
+#define _OE_FRAME_LIMITER_H_
+
+#include <Core/IListener.h>
+#include <Core/IEngine.h>
+#include <Utils/Timer.h>
+
+namespace OpenEngine {
+namespace Utils {
+
+/**
+ * Frame rate limiter.
+ *
+ * Sleeps away the rest of each frame that finished before its time,
+ * so a simple scene does not spin the CPU and GPU at hundreds of
+ * frames per second. Attach it to the event driving the frames. A
+ * limit of zero disables the limiter.
+ */
+class FrameLimiter : public Core::IListener<Core::ProcessEventArg> {
+public:
+    FrameLimiter(unsigned int fps = 0);
+
+    void SetLimit(unsigned int fps);
+    unsigned int GetLimit() const;
+
+    void Handle(Core::ProcessEventArg arg);
+
+private:
+    unsigned int fps;
+    Timer timer;
+    bool started;
+};
+
+} // NS Utils
+} // NS OpenEngine
+
+#endif // _OE_FRAME_LIMITER_H_
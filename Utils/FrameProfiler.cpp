@@ -0,0 +1,267 @@
+// Frame time profiler.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Utils/FrameProfiler.h>
+
+#include <Meta/OpenGL.h>
+
+#include <algorithm>
+#include <fstream>
+
+namespace OpenEngine {
+namespace Utils {
+
+using std::string;
+using std::vector;
+using std::map;
+
+void FrameProfiler::Window::Add(unsigned int s) {
+    samples[next] = s;
+    next = (next + 1) % samples.size();
+    if (next == 0) full = true;
+}
+
+/**
+ * Create a disabled profiler.
+ *
+ * @param window Number of samples in the rolling window per phase.
+ */
+FrameProfiler::FrameProfiler(unsigned int window)
+    : window(window == 0 ? 1 : window)
+    , enabled(false)
+    , queryHead(0)
+    , queryTail(0)
+    , gpuInit(false)
+    , gpuSupported(false) {}
+
+FrameProfiler::~FrameProfiler() {
+    for (map<string, Window*>::iterator itr = phases.begin();
+         itr != phases.end(); ++itr)
+        delete itr->second;
+    // the queries are left for the context to clean up since we can
+    // not know if the context still exists.
+}
+
+/**
+ * Enable or disable sampling.
+ */
+void FrameProfiler::Enable(bool enable) {
+    enabled = enable;
+}
+
+bool FrameProfiler::IsEnabled() const {
+    return enabled;
+}
+
+/**
+ * Add a sample to a phase.
+ * Phases are created on their first sample.
+ *
+ * @param phase Phase name.
+ * @param usec Sample in microseconds.
+ */
+void FrameProfiler::AddSample(const string& phase, unsigned int usec) {
+    map<string, Window*>::iterator itr = phases.find(phase);
+    Window* w;
+    if (itr == phases.end()) {
+        w = new Window(window);
+        phases[phase] = w;
+        order.push_back(phase);
+    } else w = itr->second;
+    w->Add(usec);
+}
+
+/**
+ * Get the rolling statistics of a phase.
+ * Unknown phases have zero samples.
+ */
+FrameProfiler::Stats FrameProfiler::GetStats(const string& phase) const {
+    Stats st;
+    map<string, Window*>::const_iterator itr = phases.find(phase);
+    if (itr == phases.end()) return st;
+    const Window& w = *itr->second;
+    unsigned int n = w.full ? w.samples.size() : w.next;
+    if (n == 0) return st;
+    vector<unsigned int> s(w.samples.begin(), w.samples.begin() + n);
+    double sum = 0;
+    st.min = st.max = s[0];
+    for (unsigned int i = 0; i < n; ++i) {
+        sum += s[i];
+        st.min = std::min(st.min, s[i]);
+        st.max = std::max(st.max, s[i]);
+    }
+    st.samples = n;
+    st.avg = sum / n;
+    vector<unsigned int>::iterator p = s.begin() + (n * 99) / 100;
+    std::nth_element(s.begin(), p, s.end());
+    st.p99 = *p;
+    return st;
+}
+
+/**
+ * Names of all sampled phases in the order they were first
+ * sampled.
+ */
+vector<string> FrameProfiler::GetPhases() const {
+    return order;
+}
+
+/**
+ * Discard all samples.
+ */
+void FrameProfiler::Reset() {
+    for (map<string, Window*>::iterator itr = phases.begin();
+         itr != phases.end(); ++itr)
+        delete itr->second;
+    phases.clear();
+    order.clear();
+    counters.clear();
+    counterOrder.clear();
+}
+
+/**
+ * Set a per frame counter, such as the number of culled nodes.
+ * Counters keep their latest value only.
+ *
+ * @param name Counter name.
+ * @param value Value of the current frame.
+ */
+void FrameProfiler::SetCounter(const string& name, unsigned int value) {
+    map<string, unsigned int>::iterator itr = counters.find(name);
+    if (itr == counters.end()) {
+        counters[name] = value;
+        counterOrder.push_back(name);
+    } else itr->second = value;
+}
+
+/**
+ * Get the latest value of a counter, zero if it was never set.
+ */
+unsigned int FrameProfiler::GetCounter(const string& name) const {
+    map<string, unsigned int>::const_iterator itr = counters.find(name);
+    return (itr == counters.end()) ? 0 : itr->second;
+}
+
+/**
+ * Names of all counters in the order they were first set.
+ */
+vector<string> FrameProfiler::GetCounters() const {
+    return counterOrder;
+}
+
+/**
+ * Write the statistics of all phases as comma separated values.
+ * A header line is written first, times are in microseconds.
+ */
+void FrameProfiler::WriteCSV(std::ostream& out) const {
+    out << "phase,samples,min,avg,p99,max" << std::endl;
+    for (vector<string>::const_iterator itr = order.begin();
+         itr != order.end(); ++itr) {
+        Stats st = GetStats(*itr);
+        out << *itr << ","
+            << st.samples << ","
+            << st.min << ","
+            << st.avg << ","
+            << st.p99 << ","
+            << st.max << std::endl;
+    }
+}
+
+/**
+ * Write the statistics of all phases as a JSON object keyed by
+ * phase name, times are in microseconds.
+ */
+void FrameProfiler::WriteJSON(std::ostream& out) const {
+    out << "{" << std::endl;
+    for (vector<string>::const_iterator itr = order.begin();
+         itr != order.end(); ++itr) {
+        Stats st = GetStats(*itr);
+        out << "  \"" << *itr << "\": {"
+            << "\"samples\": " << st.samples << ", "
+            << "\"min\": " << st.min << ", "
+            << "\"avg\": " << st.avg << ", "
+            << "\"p99\": " << st.p99 << ", "
+            << "\"max\": " << st.max << "}"
+            << (itr + 1 == order.end() ? "" : ",") << std::endl;
+    }
+    out << "}" << std::endl;
+}
+
+/**
+ * Dump the statistics to a file.
+ * Files ending in ".json" are written as JSON, all others as CSV.
+ *
+ * @param file File name.
+ * @return True if the file was written.
+ */
+bool FrameProfiler::Dump(const string& file) const {
+    std::ofstream out(file.c_str(), std::ofstream::out);
+    if (!out.good()) return false;
+    if (file.size() >= 5 && file.substr(file.size() - 5) == ".json")
+        WriteJSON(out);
+    else
+        WriteCSV(out);
+    return out.good();
+}
+
+/**
+ * Begin a GPU timer query.
+ * Must be called on the rendering thread.
+ */
+void FrameProfiler::BeginGPU() {
+    if (!gpuInit) {
+        gpuInit = true;
+        gpuSupported = GLEW_EXT_timer_query || GLEW_ARB_timer_query;
+        if (gpuSupported) glGenQueries(QUERIES, queries);
+    }
+    if (!gpuSupported) return;
+    PollGPU();
+    // all queries in flight, skip this frame
+    if ((queryHead + 1) % QUERIES == queryTail) return;
+    glBeginQuery(GL_TIME_ELAPSED_EXT, queries[queryHead]);
+}
+
+/**
+ * End the GPU timer query started by BeginGPU.
+ * The result is collected a few frames later to avoid stalling.
+ */
+void FrameProfiler::EndGPU() {
+    if (!gpuSupported) return;
+    if ((queryHead + 1) % QUERIES == queryTail) return;
+    glEndQuery(GL_TIME_ELAPSED_EXT);
+    queryHead = (queryHead + 1) % QUERIES;
+}
+
+void FrameProfiler::PollGPU() {
+    while (queryTail != queryHead) {
+        GLint available = 0;
+        glGetQueryObjectiv(queries[queryTail],
+                           GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) break;
+        GLuint64EXT ns = 0;
+        glGetQueryObjectui64vEXT(queries[queryTail], GL_QUERY_RESULT, &ns);
+        AddSample("gpu.process", ns / 1000);
+        queryTail = (queryTail + 1) % QUERIES;
+    }
+}
+
+void FrameProfiler::FrameMarker::Handle(Core::ProcessEventArg arg) {
+    if (!prof.IsEnabled()) {
+        started = false;
+        return;
+    }
+    if (started)
+        prof.AddSample("frame", timer.GetElapsedTime().AsInt());
+    timer.Reset();
+    timer.Start();
+    started = true;
+}
+
+} // NS Utils
+} // NS OpenEngine
@@ -0,0 +1,177 @@
+// Frame time profiler.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OE_FRAME_PROFILER_H_
+#define _OE_FRAME_PROFILER_H_
+
+#include <Core/IListener.h>
+#include <Core/IEngine.h>
+#include <Renderers/IRenderer.h>
+#include <Utils/Timer.h>
+
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace OpenEngine {
+namespace Utils {
+
+/**
+ * Frame time profiler.
+ *
+ * The profiler keeps a rolling window of samples for a number of
+ * named phases. Phases are timed on the CPU by wrapping the
+ * listeners of interest in a ProfiledListener, and the scene
+ * rendering is additionally timed on the GPU using timer queries
+ * when the driver supports them.
+ *
+ * A disabled profiler costs a single test per wrapped listener.
+ *
+ * @code
+ * FrameProfiler prof;
+ * renderer.ProcessEvent()
+ *     .Attach(*(new ProfiledListener<RenderingEventArg>(prof, "process", view)));
+ * prof.Enable(true);
+ * ...
+ * prof.WriteCSV(std::cout);
+ * @endcode
+ */
+class FrameProfiler {
+public:
+    /**
+     * Rolling statistics of a phase, all times in microseconds.
+     */
+    struct Stats {
+        unsigned int samples;
+        unsigned int min, max;
+        float avg;
+        unsigned int p99;
+        Stats() : samples(0), min(0), max(0), avg(0), p99(0) {}
+    };
+
+    FrameProfiler(unsigned int window = 300);
+    virtual ~FrameProfiler();
+
+    void Enable(bool enable);
+    bool IsEnabled() const;
+
+    void AddSample(const std::string& phase, unsigned int usec);
+    Stats GetStats(const std::string& phase) const;
+    std::vector<std::string> GetPhases() const;
+    void Reset();
+
+    void SetCounter(const std::string& name, unsigned int value);
+    unsigned int GetCounter(const std::string& name) const;
+    std::vector<std::string> GetCounters() const;
+
+    void WriteCSV(std::ostream& out) const;
+    void WriteJSON(std::ostream& out) const;
+    bool Dump(const std::string& file) const;
+
+    // gpu timing of the scene rendering
+    void BeginGPU();
+    void EndGPU();
+
+    /**
+     * Time between two consecutive engine process events.
+     * Attach this first to the engine process event.
+     */
+    class FrameMarker : public Core::IListener<Core::ProcessEventArg> {
+        FrameProfiler& prof;
+        Timer timer;
+        bool started;
+    public:
+        FrameMarker(FrameProfiler& prof) : prof(prof), started(false) {}
+        void Handle(Core::ProcessEventArg arg);
+    };
+
+private:
+    class Window {
+    public:
+        std::vector<unsigned int> samples;
+        unsigned int next;
+        bool full;
+        Window(unsigned int size) : samples(size, 0), next(0), full(false) {}
+        void Add(unsigned int s);
+    };
+
+    // order of the phases as they were added
+    std::vector<std::string> order;
+    std::map<std::string, Window*> phases;
+    // latest value of each counter, in the order they were first set
+    std::vector<std::string> counterOrder;
+    std::map<std::string, unsigned int> counters;
+    unsigned int window;
+    bool enabled;
+
+    // ring of pending timer queries
+    static const unsigned int QUERIES = 4;
+    unsigned int queries[QUERIES];
+    unsigned int queryHead, queryTail;
+    bool gpuInit, gpuSupported;
+
+    void PollGPU();
+};
+
+/**
+ * Listener decorator timing another listener.
+ * The decorated listener is invoked as usual and the time spent is
+ * recorded in the named phase of the profiler, when enabled.
+ */
+template <class EventArg>
+class ProfiledListener : public Core::IListener<EventArg> {
+    FrameProfiler& prof;
+    std::string phase;
+    Core::IListener<EventArg>& listener;
+public:
+    ProfiledListener(FrameProfiler& prof,
+                     std::string phase,
+                     Core::IListener<EventArg>& listener)
+        : prof(prof), phase(phase), listener(listener) {}
+    void Handle(EventArg arg) {
+        if (!prof.IsEnabled()) {
+            listener.Handle(arg);
+            return;
+        }
+        Timer timer;
+        timer.Start();
+        listener.Handle(arg);
+        prof.AddSample(phase, timer.GetElapsedTime().AsInt());
+    }
+};
+
+/**
+ * Listener decorator timing another rendering listener on the GPU.
+ * Only one GPU timed listener can be active per frame since timer
+ * queries can not be nested.
+ */
+class GPUProfiledListener
+    : public Core::IListener<Renderers::RenderingEventArg> {
+    FrameProfiler& prof;
+    Core::IListener<Renderers::RenderingEventArg>& listener;
+public:
+    GPUProfiledListener(FrameProfiler& prof,
+                        Core::IListener<Renderers::RenderingEventArg>& listener)
+        : prof(prof), listener(listener) {}
+    void Handle(Renderers::RenderingEventArg arg) {
+        if (!prof.IsEnabled()) {
+            listener.Handle(arg);
+            return;
+        }
+        prof.BeginGPU();
+        listener.Handle(arg);
+        prof.EndGPU();
+    }
+};
+
+} // NS Utils
+} // NS OpenEngine
+
+#endif // _OE_FRAME_PROFILER_H_
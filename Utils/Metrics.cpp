@@ -0,0 +1,381 @@
+// Runtime metrics with Prometheus and StatsD export.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Utils/Metrics.h>
+
+#include <Core/Thread.h>
+#include <Logging/Logger.h>
+#include <Utils/Timer.h>
+
+#include <cstring>
+#include <sstream>
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace OpenEngine {
+namespace Utils {
+
+using Core::Mutex;
+using Core::Thread;
+using std::string;
+using std::vector;
+
+// upper bounds of the histogram buckets in microseconds, around the
+// frame times of 120, 60, 30 and 20 Hz
+static const unsigned long BOUNDS[Metrics::BUCKETS] = {
+    2000, 4000, 8333, 16667, 33333, 50000, 100000, 250000
+};
+
+// longest time the export thread waits before checking for work
+static const unsigned int POLL_USEC = 100000;
+
+// statsd lines are sent in datagrams of at most this many bytes
+static const unsigned int DATAGRAM = 1200;
+
+// Serves the HTTP endpoint and pushes to statsd.
+class Metrics::ExportThread : public Thread {
+    Metrics& owner;
+    Mutex lock;
+    bool running;
+public:
+    ExportThread(Metrics& owner) : owner(owner), running(true) {}
+    void Stop() {
+        lock.Lock();
+        running = false;
+        lock.Unlock();
+    }
+    bool IsRunning() {
+        lock.Lock();
+        bool r = running;
+        lock.Unlock();
+        return r;
+    }
+    void Run() {
+        Timer timer;
+        timer.Start();
+        while (IsRunning()) {
+            owner.lock.Lock();
+            int server = owner.server;
+            bool pushing = owner.statsd >= 0;
+            unsigned int interval = owner.interval;
+            owner.lock.Unlock();
+            if (server >= 0) {
+                fd_set fds;
+                FD_ZERO(&fds);
+                FD_SET(server, &fds);
+                struct timeval tv = { 0, POLL_USEC };
+                if (select(server + 1, &fds, NULL, NULL, &tv) > 0) {
+                    int client = accept(server, NULL, NULL);
+                    if (client >= 0) owner.Respond(client);
+                }
+            } else
+                Thread::Sleep(POLL_USEC);
+            if (pushing &&
+                (unsigned int)timer.GetElapsedTime().AsInt() >= interval) {
+                owner.Send();
+                timer.Reset();
+                timer.Start();
+            }
+        }
+    }
+};
+
+Metrics::Block::Block() {
+    for (unsigned int i = 0; i < MAX_METRICS; ++i) {
+        values[i] = 0;
+        for (unsigned int b = 0; b <= BUCKETS; ++b) buckets[i][b] = 0;
+    }
+}
+
+/**
+ * Add an observation to a histogram.
+ *
+ * @param metric Histogram.
+ * @param usec Observed time in microseconds.
+ */
+void Metrics::Block::Observe(unsigned int metric, unsigned long usec) {
+    if (metric >= MAX_METRICS) return;
+    values[metric] += usec;
+    unsigned int b = 0;
+    while (b < BUCKETS && usec > BOUNDS[b]) ++b;
+    buckets[metric][b]++;
+}
+
+/**
+ * Create a set of metrics without any export.
+ */
+Metrics::Metrics()
+    : thread(NULL)
+    , server(-1)
+    , statsd(-1)
+    , interval(1000000) {}
+
+/**
+ * Destroy the metrics, stopping the export.
+ * Blocks must no longer be written.
+ */
+Metrics::~Metrics() {
+    if (thread != NULL) {
+        thread->Stop();
+        thread->Wait();
+        delete thread;
+    }
+    if (server >= 0) close(server);
+    if (statsd >= 0) close(statsd);
+    for (vector<Block*>::iterator itr = blocks.begin();
+         itr != blocks.end(); ++itr)
+        delete *itr;
+}
+
+/**
+ * Define a metric.
+ *
+ * @param name Name in the Prometheus convention, such as
+ *             oe_frames_total.
+ * @param type Type of the metric.
+ * @param help One line description.
+ * @return Index of the metric to write in the blocks.
+ */
+unsigned int Metrics::Define(string name, Type type, string help) {
+    lock.Lock();
+    unsigned int index = metrics.size();
+    if (index < MAX_METRICS) {
+        Metric m;
+        m.name = name;
+        m.help = help;
+        m.type = type;
+        metrics.push_back(m);
+    }
+    lock.Unlock();
+    if (index >= MAX_METRICS)
+        logger.warning << "Metrics: no room for metric " << name
+                       << ", it is not recorded" << logger.end;
+    return index;
+}
+
+/**
+ * Create a block for the calling thread to write metrics in.
+ * The block is owned by the metrics.
+ */
+Metrics::Block& Metrics::CreateBlock() {
+    Block* b = new Block();
+    lock.Lock();
+    blocks.push_back(b);
+    lock.Unlock();
+    return *b;
+}
+
+/**
+ * Write all metrics in the Prometheus text format.
+ */
+void Metrics::Write(std::ostream& out) {
+    vector<unsigned long> values, buckets;
+    Sum(values, buckets);
+    lock.Lock();
+    vector<Metric> defs = metrics;
+    lock.Unlock();
+    for (unsigned int i = 0; i < defs.size(); ++i) {
+        const Metric& m = defs[i];
+        out << "# HELP " << m.name << " " << m.help << "\n";
+        if (m.type != HISTOGRAM) {
+            out << "# TYPE " << m.name
+                << (m.type == COUNTER ? " counter\n" : " gauge\n")
+                << m.name << " " << values[i] << "\n";
+            continue;
+        }
+        out << "# TYPE " << m.name << " histogram\n";
+        unsigned long count = 0;
+        for (unsigned int b = 0; b <= BUCKETS; ++b) {
+            count += buckets[i * (BUCKETS + 1) + b];
+            out << m.name << "_bucket{le=\"";
+            if (b < BUCKETS) out << BOUNDS[b] / 1e6;
+            else out << "+Inf";
+            out << "\"} " << count << "\n";
+        }
+        out << m.name << "_sum " << values[i] / 1e6 << "\n"
+            << m.name << "_count " << count << "\n";
+    }
+}
+
+/**
+ * Serve the metrics over HTTP, in the Prometheus text format on any
+ * path.
+ *
+ * @param port TCP port to listen on.
+ * @return False if the port could not be opened.
+ */
+bool Metrics::Serve(unsigned short port) {
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    int yes = 1;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (s < 0 ||
+        setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) != 0 ||
+        bind(s, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(s, 4) != 0) {
+        logger.warning << "Metrics: can not listen on port " << port
+                       << logger.end;
+        if (s >= 0) close(s);
+        return false;
+    }
+    lock.Lock();
+    if (server >= 0) close(server);
+    server = s;
+    lock.Unlock();
+    Start();
+    return true;
+}
+
+/**
+ * Push the metrics to a StatsD server over UDP.
+ * Counters are sent as the change since the last push, gauges as
+ * their value and histograms as the mean of the observations since
+ * the last push along with their number.
+ *
+ * @param host Name or address of the server.
+ * @param port UDP port of the server.
+ * @param interval Time between pushes in microseconds.
+ * @return False if the host could not be resolved.
+ */
+bool Metrics::SendTo(string host, unsigned short port, unsigned int interval) {
+    std::ostringstream service;
+    service << port;
+    struct addrinfo hints, *info = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    int s = -1;
+    if (getaddrinfo(host.c_str(), service.str().c_str(), &hints, &info) != 0 ||
+        (s = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+        logger.warning << "Metrics: can not send to " << host << ":" << port
+                       << logger.end;
+        if (info != NULL) freeaddrinfo(info);
+        return false;
+    }
+    lock.Lock();
+    if (statsd >= 0) close(statsd);
+    statsd = s;
+    address.assign((unsigned char*)info->ai_addr,
+                   (unsigned char*)info->ai_addr + info->ai_addrlen);
+    this->interval = interval;
+    lock.Unlock();
+    freeaddrinfo(info);
+    Start();
+    return true;
+}
+
+// Add up the blocks, with the buckets of metric i at i * (BUCKETS + 1).
+void Metrics::Sum(vector<unsigned long>& values, vector<unsigned long>& buckets) {
+    values.assign(MAX_METRICS, 0);
+    buckets.assign(MAX_METRICS * (BUCKETS + 1), 0);
+    lock.Lock();
+    for (vector<Block*>::iterator itr = blocks.begin();
+         itr != blocks.end(); ++itr)
+        for (unsigned int i = 0; i < metrics.size(); ++i) {
+            values[i] += (*itr)->values[i];
+            for (unsigned int b = 0; b <= BUCKETS; ++b)
+                buckets[i * (BUCKETS + 1) + b] += (*itr)->buckets[i][b];
+        }
+    lock.Unlock();
+}
+
+void Metrics::Start() {
+    lock.Lock();
+    bool start = thread == NULL;
+    if (start) thread = new ExportThread(*this);
+    lock.Unlock();
+    if (start) thread->Start();
+}
+
+// Answer a request on the export thread. The request is read but not
+// looked at, every path serves the metrics.
+void Metrics::Respond(int client) {
+    struct timeval tv = { 0, POLL_USEC };
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    char request[1024];
+    if (recv(client, request, sizeof(request), 0) <= 0) {
+        close(client);
+        return;
+    }
+    std::ostringstream body;
+    Write(body);
+    string b = body.str();
+    std::ostringstream response;
+    response << "HTTP/1.0 200 OK\r\n"
+             << "Content-Type: text/plain; version=0.0.4\r\n"
+             << "Content-Length: " << b.size() << "\r\n"
+             << "Connection: close\r\n\r\n"
+             << b;
+    string r = response.str();
+    for (size_t done = 0; done < r.size(); ) {
+        ssize_t n = send(client, r.data() + done, r.size() - done, 0);
+        if (n <= 0) break;
+        done += n;
+    }
+    close(client);
+}
+
+// Push the changes since the last push on the export thread.
+void Metrics::Send() {
+    vector<unsigned long> values, buckets;
+    Sum(values, buckets);
+    lock.Lock();
+    vector<Metric> defs = metrics;
+    int s = statsd;
+    vector<unsigned char> to = address;
+    lock.Unlock();
+    sent.resize(MAX_METRICS, 0);
+    sentCounts.resize(MAX_METRICS, 0);
+
+    vector<string> lines;
+    for (unsigned int i = 0; i < defs.size(); ++i) {
+        std::ostringstream line;
+        const Metric& m = defs[i];
+        if (m.type == GAUGE)
+            line << m.name << ":" << values[i] << "|g\n";
+        else if (m.type == COUNTER) {
+            if (values[i] != sent[i])
+                line << m.name << ":" << values[i] - sent[i] << "|c\n";
+        } else {
+            unsigned long count = 0;
+            for (unsigned int b = 0; b <= BUCKETS; ++b)
+                count += buckets[i * (BUCKETS + 1) + b];
+            if (count != sentCounts[i])
+                line << m.name << ":"
+                     << (values[i] - sent[i]) / 1000.0 / (count - sentCounts[i])
+                     << "|ms\n"
+                     << m.name << "_count:" << count - sentCounts[i] << "|c\n";
+            sentCounts[i] = count;
+        }
+        sent[i] = values[i];
+        if (!line.str().empty()) lines.push_back(line.str());
+    }
+
+    string datagram;
+    for (unsigned int i = 0; i <= lines.size(); ++i) {
+        if (!datagram.empty() &&
+            (i == lines.size() || datagram.size() + lines[i].size() > DATAGRAM)) {
+            sendto(s, datagram.data(), datagram.size(), 0,
+                   (const struct sockaddr*)&to[0], to.size());
+            datagram.clear();
+        }
+        if (i < lines.size()) datagram += lines[i];
+    }
+}
+
+} // NS Utils
+} // NS OpenEngine
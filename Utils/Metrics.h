@@ -0,0 +1,118 @@
+// Runtime metrics with Prometheus and StatsD export.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OE_METRICS_H_
+#define _OE_METRICS_H_
+
+#include <Core/Mutex.h>
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace OpenEngine {
+namespace Utils {
+
+/**
+ * Runtime metrics with Prometheus and StatsD export.
+ *
+ * Metrics are defined once by name and written through blocks. Each
+ * thread writing metrics creates a block of its own and writes it
+ * without locks or atomic operations, a store or an add per update,
+ * so the hot path stays cheap. The blocks are added up on the export
+ * thread when metrics are read: counters and gauges are summed, so a
+ * gauge is normally set by one block only, and histograms merge their
+ * buckets.
+ *
+ * The export thread serves the Prometheus text format over HTTP, see
+ * Serve(), and pushes the changes to a StatsD server over UDP at an
+ * interval, see SendTo(). Reading a block while it is written may
+ * see a value one update old, which the next read corrects.
+ *
+ * Histograms observe microseconds and are exported in seconds.
+ *
+ * @code
+ * Metrics metrics;
+ * unsigned int frames = metrics.Define("oe_frames_total", Metrics::COUNTER, "Frames rendered");
+ * Metrics::Block& block = metrics.CreateBlock();
+ * metrics.Serve(9100);
+ * ...
+ * block.Add(frames);
+ * @endcode
+ */
+class Metrics {
+public:
+    enum Type { COUNTER, GAUGE, HISTOGRAM };
+
+    static const unsigned int MAX_METRICS = 64;
+    static const unsigned int BUCKETS = 8;
+
+    /**
+     * Metric values written by a single thread.
+     */
+    class Block {
+    public:
+        void Add(unsigned int metric, unsigned long value = 1) {
+            if (metric < MAX_METRICS) values[metric] += value;
+        }
+        void Set(unsigned int metric, unsigned long value) {
+            if (metric < MAX_METRICS) values[metric] = value;
+        }
+        void Observe(unsigned int metric, unsigned long usec);
+    private:
+        friend class Metrics;
+        Block();
+        // totals of counters, values of gauges, sums of histograms
+        volatile unsigned long values[MAX_METRICS];
+        // counts of the histogram buckets and the overflow bucket
+        volatile unsigned long buckets[MAX_METRICS][BUCKETS + 1];
+    };
+
+    Metrics();
+    virtual ~Metrics();
+
+    unsigned int Define(std::string name, Type type, std::string help);
+    Block& CreateBlock();
+
+    void Write(std::ostream& out);
+    bool Serve(unsigned short port);
+    bool SendTo(std::string host, unsigned short port,
+                unsigned int interval = 1000000);
+
+private:
+    class ExportThread;
+
+    struct Metric {
+        std::string name, help;
+        Type type;
+    };
+
+    // guards the definitions, blocks and sockets
+    Core::Mutex lock;
+    std::vector<Metric> metrics;
+    std::vector<Block*> blocks;
+    ExportThread* thread;
+    int server;
+    int statsd;
+    std::vector<unsigned char> address;
+    unsigned int interval;
+    // totals last sent to statsd
+    std::vector<unsigned long> sent, sentCounts;
+
+    void Sum(std::vector<unsigned long>& values,
+             std::vector<unsigned long>& buckets);
+    void Start();
+    void Respond(int client);
+    void Send();
+};
+
+} // NS Utils
+} // NS OpenEngine
+
+#endif // _OE_METRICS_H_
@@ -0,0 +1,49 @@
+// HUD surface showing frame profiler statistics.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Utils/ProfilerSurface.h>
+#include <Utils/FrameProfiler.h>
+
+#include <cstdio>
+
+namespace OpenEngine {
+namespace Utils {
+
+ProfilerSurface::ProfilerSurface(FrameProfiler& prof,
+                                 unsigned int width,
+                                 unsigned int height)
+    : TextSurface(width, height)
+    , prof(prof) {
+    Redraw();
+}
+
+void ProfilerSurface::DrawLines() {
+    char line[128];
+    sprintf(line, "%-18s %6s %6s %6s", "phase (us)", "min", "avg", "p99");
+    AddLine(line);
+
+    std::vector<std::string> phases = prof.GetPhases();
+    for (std::vector<std::string>::iterator itr = phases.begin();
+         itr != phases.end(); ++itr) {
+        FrameProfiler::Stats st = prof.GetStats(*itr);
+        sprintf(line, "%-18.18s %6u %6u %6u",
+                itr->c_str(), st.min, (unsigned int)st.avg, st.p99);
+        AddLine(line);
+    }
+
+    std::vector<std::string> counters = prof.GetCounters();
+    for (std::vector<std::string>::iterator itr = counters.begin();
+         itr != counters.end(); ++itr) {
+        sprintf(line, "%-18.18s %6u", itr->c_str(), prof.GetCounter(*itr));
+        AddLine(line);
+    }
+}
+
+} // NS Utils
+} // NS OpenEngine
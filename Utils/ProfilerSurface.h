@@ -0,0 +1,42 @@
+// HUD surface showing frame profiler statistics.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OE_PROFILER_SURFACE_H_
+#define _OE_PROFILER_SURFACE_H_
+
+#include <Utils/TextSurface.h>
+
+namespace OpenEngine {
+namespace Utils {
+
+class FrameProfiler;
+
+/**
+ * HUD surface listing the rolling min/avg/p99 of every profiled
+ * phase followed by the latest value of every counter.
+ * Attach the surface to the engine process event, it redraws itself
+ * twice a second.
+ */
+class ProfilerSurface : public TextSurface {
+public:
+    ProfilerSurface(FrameProfiler& prof,
+                    unsigned int width = 256,
+                    unsigned int height = 256);
+
+protected:
+    void DrawLines();
+
+private:
+    FrameProfiler& prof;
+};
+
+} // NS Utils
+} // NS OpenEngine
+
+#endif // _OE_PROFILER_SURFACE_H_
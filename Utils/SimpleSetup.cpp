@@ -10,47 +10,90 @@
 #include <Utils/SimpleSetup.h>
 
 // Core stuff
+#include <Core/Arena.h>
+#include <Core/Exceptions.h>
 #include <Core/Engine.h>
+#include <Core/ThreadedEngine.h>
+#include <Core/TaskScheduler.h>
+#include <Core/ProcessGraph.h>
 #include <Display/Camera.h>
 #include <Display/Frustum.h>
 #include <Display/PerspectiveViewingVolume.h>
 #include <Renderers/TextureLoader.h>
+#include <Renderers/AsyncTextureLoader.h>
+#include <Renderers/OpenGL/CompressedTextureCache.h>
 #include <Resources/ResourceManager.h>
+#include <Resources/ResourceManifest.h>
+#include <Resources/IShaderResource.h>
 #include <Resources/ITexture2D.h>
+#include <Geometry/FaceSet.h>
+#include <Geometry/Material.h>
+#include <Geometry/Mesh.h>
 #include <Scene/DirectionalLightNode.h>
+#include <Scene/GeometryNode.h>
+#include <Scene/ISceneNodeVisitor.h>
+#include <Scene/MeshNode.h>
+#include <Scene/SceneExporter.h>
+#include <Scene/SceneFile.h>
 #include <Scene/SceneNode.h>
+#include <Scene/TransformationNode.h>
+#include <Scene/TransformSnapshot.h>
 
 // Acceleration extension
 #include <Renderers/AcceleratedRenderingView.h>
-#include <Scene/ASDotVisitor.h>
+#include <Scene/IncrementalQuadBuilder.h>
+#include <Scene/LODNode.h>
+#include <Scene/QuadNode.h>
 
 // OpenGL extension
 #include <Renderers/OpenGL/Renderer.h>
 #include <Renderers/OpenGL/RenderingView.h>
 #include <Renderers/OpenGL/ShaderLoader.h>
 #include <Renderers/OpenGL/LightRenderer.h>
+#include <Renderers/OpenGL/ClusteredLightRenderer.h>
+#include <Renderers/OpenGL/DrawList.h>
+#include <Renderers/OpenGL/OcclusionCuller.h>
+#include <Renderers/OpenGL/ProgramCache.h>
+#include <Renderers/OpenGL/ResourceStreamer.h>
+#include <Renderers/OpenGL/UploadRing.h>
+#include <Renderers/OpenGL/DynamicResolution.h>
+#include <Renderers/OpenGL/MultiView.h>
+#include <Meta/OpenGL.h>
 //#include <Resources/GLSLResource.h>
 #include <Resources/OpenGLShader.h>
 
 // SDL extension
+#include <Devices/InputQueue.h>
 #include <Display/SDLEnvironment.h>
+#include <Display/OffscreenEnvironment.h>
 
 #include <Display/RenderCanvas.h>
 #include <Display/OpenGL/TextureCopy.h>
 
 // Resources extensions
 #include <Resources/OBJResource.h>
+#include <Resources/CachedOBJResource.h>
 //#include <Resources/ColladaResource.h>
 
 // Logging
 #include <Logging/Logger.h>
+#include <Logging/AsyncLogger.h>
 #include <Logging/StreamLogger.h>
 #include <Logging/ColorStreamLogger.h>
 
 // HUD
 #include <Display/HUD.h>
+#include <Display/HUDAtlas.h>
 #include <Utils/FPSSurface.h>
 
+// Profiling
+#include <Utils/FrameProfiler.h>
+#include <Utils/FileWatcher.h>
+#include <Utils/FrameLimiter.h>
+#include <Utils/Metrics.h>
+#include <Utils/ProfilerSurface.h>
+#include <Utils/StreamingSurface.h>
+
 namespace OpenEngine {
 namespace Utils {
 
@@ -67,28 +110,555 @@ using namespace Scene;
 class ExtRenderingView
     : public RenderingView
     , public AcceleratedRenderingView {
+    Frustum* frustum;
+    bool culling;
+    unsigned int culled;
+    bool batching;
+    DrawList drawlist;
+    // stack of column major model transformations while batching
+    std::vector<float> stack;
+    TransformSnapshot* snapshot;
+    ResourceStreamer* streamer;
+    OcclusionCuller* occlusion;
+    FrameProfiler* profiler;
+    MultiView* views;
+    bool multi;
+    SceneExporter* exporter;
+    bool lod;
+    float lodThreshold, lodHysteresis;
+    // view transformation and pixels per unit at distance one
+    float view[16];
+    float pixelScale;
 public:
     ExtRenderingView() 
         : RenderingView()
-        , AcceleratedRenderingView() {}
+        , AcceleratedRenderingView()
+        , frustum(NULL)
+        , culling(false)
+        , culled(0)
+        , batching(false)
+        , snapshot(NULL)
+        , streamer(NULL)
+        , occlusion(NULL)
+        , profiler(NULL)
+        , views(NULL)
+        , multi(false)
+        , exporter(NULL)
+        , lod(false)
+        , lodThreshold(1.0f)
+        , lodHysteresis(0.25f)
+        , pixelScale(1.0f) {}
     
     virtual void Handle(RenderingEventArg arg){
         AcceleratedRenderingView::SetViewingVolume(arg.canvas.GetViewingVolume());
+        culled = 0;
+        if (snapshot != NULL) snapshot->Acquire();
+        // with several views the scene is traversed once into the draw
+        // list, which is then submitted for each view
+        multi = views != NULL && views->IsActive();
+        bool wasBatching = batching;
+        if (multi) {
+            views->Begin(*arg.canvas.GetViewingVolume());
+            batching = true;
+        }
+        float eye[3], viewArray[16];
+        if (occlusion != NULL && !multi) {
+            IViewingVolume* volume = arg.canvas.GetViewingVolume();
+            volume->GetPosition().ToArray(eye);
+            volume->GetViewMatrix().ToArray(viewArray);
+            occlusion->Begin(eye);
+        }
+        if (lod) {
+            IViewingVolume* volume = arg.canvas.GetViewingVolume();
+            float proj[16];
+            volume->GetProjectionMatrix().ToArray(proj);
+            volume->GetViewMatrix().ToArray(view);
+            pixelScale = proj[5] * arg.canvas.GetHeight() * 0.5f;
+        }
+        if (batching) {
+            static const float identity[16] =
+                { 1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1 };
+            stack.assign(identity, identity + 16);
+        }
         RenderingView::Handle(arg);
+        if (multi) {
+            for (unsigned int i = 0; i < views->GetViewCount(); ++i) {
+                views->Apply(i);
+                drawlist.Submit();
+            }
+            views->End();
+            drawlist.Discard();
+            batching = wasBatching;
+        } else if (batching) drawlist.Flush();
+        // the queries test against the depth of the finished frame
+        if (occlusion != NULL && !multi) occlusion->End(viewArray);
+        if (profiler != NULL && profiler->IsEnabled()) {
+            profiler->SetCounter("culled.frustum", culled);
+            profiler->SetCounter("culled.occlusion", GetOccludedCount());
+        }
+    }
+
+    // Quad nodes are culled against the frustum, or the frustums of
+    // all views, and, with occlusion culling, against the occlusion
+    // queries of the previous frames here. The queries only hold for
+    // the canvas view, so they are not used with several views. The
+    // sub nodes are rendered by the rendering view traversal.
+    virtual void VisitQuadNode(QuadNode* node) {
+        if (culling && frustum != NULL &&
+            !(multi ? views->IsVisible(node->GetBoundingBox())
+                    : frustum->IsVisible(node->GetBoundingBox()))) {
+            culled++;
+            if (Recording()) exporter->AddCulled(node);
+            return;
+        }
+        if (occlusion != NULL && !multi &&
+            !occlusion->IsVisible(node, node->GetBoundingBox())) {
+            if (Recording()) exporter->AddCulled(node);
+            return;
+        }
+        if (Recording()) exporter->AddVisible(node);
+        node->VisitSubNodes(static_cast<RenderingView&>(*this));
+    }
+
+    // While batching transformations are accumulated on the cpu and
+    // geometry is deferred to the draw list. With a snapshot the
+    // transformations are read from it rather than from the nodes,
+    // which may be changing on the simulation thread.
+    virtual void VisitTransformationNode(TransformationNode* node) {
+        if (!batching && snapshot == NULL) {
+            RenderingView::VisitTransformationNode(node);
+            return;
+        }
+        float m[16], current[16];
+        const float* local =
+            (snapshot != NULL) ? snapshot->GetTransformation(node) : NULL;
+        if (local == NULL) {
+            node->GetTransformationMatrix().ToArray(current);
+            local = current;
+        }
+        if (!batching) {
+            glPushMatrix();
+            glMultMatrixf(local);
+            node->VisitSubNodes(static_cast<RenderingView&>(*this));
+            glPopMatrix();
+            return;
+        }
+        const float* top = &stack[stack.size() - 16];
+        for (unsigned int c = 0; c < 4; ++c)
+            for (unsigned int r = 0; r < 4; ++r) {
+                float sum = 0;
+                for (unsigned int k = 0; k < 4; ++k)
+                    sum += top[k*4 + r] * local[c*4 + k];
+                m[c*4 + r] = sum;
+            }
+        stack.insert(stack.end(), m, m + 16);
+        node->VisitSubNodes(static_cast<RenderingView&>(*this));
+        stack.resize(stack.size() - 16);
+    }
+
+    // Rendered geometry tells the streamer which textures are in use.
+    // While an export is recorded drawn nodes report their triangles
+    // and the time they took, deferred geometry has no time.
+    virtual void VisitGeometryNode(GeometryNode* node) {
+        if (streamer != NULL) streamer->Touch(node);
+        if (Recording()) {
+            unsigned int faces =
+                (node->GetFaceSet() != NULL) ? node->GetFaceSet()->Size() : 0;
+            Timer timer;
+            timer.Start();
+            if (!batching) RenderingView::VisitGeometryNode(node);
+            else drawlist.Add(node->GetFaceSet(), &stack[stack.size() - 16]);
+            exporter->AddDraw(node, faces,
+                              batching ? 0 : timer.GetElapsedTime().AsInt());
+            if (batching) node->VisitSubNodes(static_cast<RenderingView&>(*this));
+            return;
+        }
+        if (!batching) {
+            RenderingView::VisitGeometryNode(node);
+            return;
+        }
+        drawlist.Add(node->GetFaceSet(), &stack[stack.size() - 16]);
+        node->VisitSubNodes(static_cast<RenderingView&>(*this));
+    }
+
+    virtual void VisitMeshNode(MeshNode* node) {
+        if (streamer != NULL) streamer->Touch(node);
+        if (!Recording()) {
+            RenderingView::VisitMeshNode(node);
+            return;
+        }
+        Timer timer;
+        timer.Start();
+        RenderingView::VisitMeshNode(node);
+        exporter->AddDraw(node, 0, timer.GetElapsedTime().AsInt());
+    }
+
+    // Level of detail nodes select their level before the traversal
+    // enters them, from the current model view transformation.
+    virtual void VisitSceneNode(SceneNode* node) {
+        LODNode* lodnode = lod ? dynamic_cast<LODNode*>(node) : NULL;
+        if (lodnode != NULL) {
+            float mv[16];
+            if (batching) {
+                const float* top = &stack[stack.size() - 16];
+                for (unsigned int c = 0; c < 4; ++c)
+                    for (unsigned int r = 0; r < 4; ++r) {
+                        float sum = 0;
+                        for (unsigned int k = 0; k < 4; ++k)
+                            sum += view[k*4 + r] * top[c*4 + k];
+                        mv[c*4 + r] = sum;
+                    }
+            } else
+                glGetFloatv(GL_MODELVIEW_MATRIX, mv);
+            lodnode->Select(mv, pixelScale, lodThreshold, lodHysteresis);
+            if (Recording()) exporter->AddVisible(lodnode);
+        }
+        RenderingView::VisitSceneNode(node);
+    }
+
+    void SetFrustum(Frustum* frustum) { this->frustum = frustum; }
+    void SetCulling(bool enable) { culling = enable; }
+    bool IsCulling() const { return culling; }
+    unsigned int GetCulledCount() const { return culled; }
+    unsigned int GetOccludedCount() const {
+        return (occlusion == NULL) ? 0 : occlusion->GetOccludedCount();
+    }
+    void SetOcclusionCuller(OcclusionCuller* occlusion) {
+        this->occlusion = occlusion;
+    }
+    void SetProfiler(FrameProfiler* profiler) { this->profiler = profiler; }
+    void SetMultiView(MultiView* views) { this->views = views; }
+    void SetExporter(SceneExporter* exporter) { this->exporter = exporter; }
+    bool Recording() const {
+        return exporter != NULL && exporter->IsRecording();
+    }
+    void SetBatching(bool enable) {
+        batching = enable;
+        if (!batching) drawlist.Clear();
+    }
+    DrawList& GetDrawList() { return drawlist; }
+    void SetSnapshot(TransformSnapshot* snapshot) { this->snapshot = snapshot; }
+    void SetStreamer(ResourceStreamer* streamer) { this->streamer = streamer; }
+    void SetLOD(bool enable, float threshold, float hysteresis) {
+        lod = enable;
+        lodThreshold = threshold;
+        lodHysteresis = hysteresis;
+    }
+};
+
+// Captures the scene transformations after each simulation tick.
+// Streaming and reloading change the graph on the render thread under
+// the structure lock, so the capture holds it while walking the
+// graph. It does not take the scene lock, which is held for whole
+// frames.
+class CaptureOnTick
+    : public IListener<Core::ProcessEventArg> {
+    TransformSnapshot& snapshot;
+    ISceneNode*& scene;
+    Core::Mutex& structureLock;
+public:
+    CaptureOnTick(TransformSnapshot& snapshot, ISceneNode*& scene,
+                  Core::Mutex& structureLock)
+        : snapshot(snapshot), scene(scene), structureLock(structureLock) {}
+    void Handle(Core::ProcessEventArg arg) {
+        structureLock.Lock();
+        if (scene != NULL) snapshot.Capture(*scene);
+        structureLock.Unlock();
     }
 };
 
+// Loads the textures of the scene, unless they are streamed.
 class TextureLoadOnInit
     : public IListener<RenderingEventArg> {
-    TextureLoader& tl;
+    AsyncTextureLoader& tl;
+    ResourceStreamer*& streamer;
 public:
-    TextureLoadOnInit(TextureLoader& tl) : tl(tl) { }
+    TextureLoadOnInit(AsyncTextureLoader& tl, ResourceStreamer*& streamer)
+        : tl(tl), streamer(streamer) { }
     void Handle(RenderingEventArg arg) {
-        if (arg.canvas.GetScene() != NULL)
+        if (arg.canvas.GetScene() != NULL && streamer == NULL)
             tl.Load(*arg.canvas.GetScene());
     }
 };
 
+// Rebuilds the culling structure around streamed models.
+class StreamingDirty
+    : public IListener<StreamingEventArg> {
+    SimpleSetup& setup;
+public:
+    StreamingDirty(SimpleSetup& setup) : setup(setup) {}
+    void Handle(StreamingEventArg arg) { setup.MarkSceneDirty(arg.parent); }
+};
+
+// Loads the shaders of a newly set scene on the render thread,
+// through the program cache so linked programs are stored as
+// binaries.
+class ShaderLoadOnPreProcess
+    : public IListener<RenderingEventArg> {
+    SimpleSetup& setup;
+    Renderers::OpenGL::ShaderLoader*& shaderloader;
+    bool& pending;
+public:
+    ShaderLoadOnPreProcess(SimpleSetup& setup,
+                           Renderers::OpenGL::ShaderLoader*& shaderloader,
+                           bool& pending)
+        : setup(setup), shaderloader(shaderloader), pending(pending) {}
+    void Handle(RenderingEventArg arg) {
+        if (!pending || shaderloader == NULL) return;
+        pending = false;
+        Renderers::OpenGL::ProgramCache& cache = setup.GetProgramCache();
+        cache.BeginCapture();
+        shaderloader->Handle(InitializeEventArg());
+        cache.EndCapture();
+    }
+};
+
+// Releases the transient allocations of the previous frame.
+class FrameArenaReset
+    : public IListener<Core::ProcessEventArg> {
+    Arena& arena;
+public:
+    FrameArenaReset(Arena& arena) : arena(arena) {}
+    void Handle(Core::ProcessEventArg arg) { arena.Reset(); }
+};
+
+// Samples the frame and the renderer components into the metrics,
+// on the thread driving the frame.
+class MetricsSampler
+    : public IListener<Core::ProcessEventArg> {
+    Metrics::Block& block;
+    ExtRenderingView*& extview;
+    AsyncTextureLoader*& asyncloader;
+    ResourceStreamer*& streamer;
+    Timer timer;
+    bool started;
+    unsigned int frameTime, frames, drawCalls, culled, occluded;
+    unsigned int loads, failures, latency;
+    unsigned int textureBytes, modelBytes, models, misses, evictions;
+public:
+    MetricsSampler(Metrics& metrics, ExtRenderingView*& extview,
+                   AsyncTextureLoader*& asyncloader, ResourceStreamer*& streamer)
+        : block(metrics.CreateBlock())
+        , extview(extview)
+        , asyncloader(asyncloader)
+        , streamer(streamer)
+        , started(false)
+    {
+        frameTime = metrics.Define("oe_frame_seconds", Metrics::HISTOGRAM,
+                                   "Time between frames.");
+        frames = metrics.Define("oe_frames_total", Metrics::COUNTER,
+                                "Frames rendered.");
+        drawCalls = metrics.Define("oe_draw_calls", Metrics::GAUGE,
+                                   "Batched draw calls in the last frame.");
+        culled = metrics.Define("oe_culled_nodes", Metrics::GAUGE,
+                                "Quad nodes culled by the frustum in the last frame.");
+        occluded = metrics.Define("oe_occluded_nodes", Metrics::GAUGE,
+                                  "Quad nodes culled by occlusion in the last frame.");
+        loads = metrics.Define("oe_texture_loads_total", Metrics::COUNTER,
+                               "Textures uploaded.");
+        failures = metrics.Define("oe_texture_load_failures_total", Metrics::COUNTER,
+                                  "Textures that failed decoding.");
+        latency = metrics.Define("oe_texture_load_latency_microseconds_total",
+                                 Metrics::COUNTER,
+                                 "Time from textures being requested to uploaded.");
+        textureBytes = metrics.Define("oe_resident_texture_bytes", Metrics::GAUGE,
+                                      "Estimated video memory of streamed textures.");
+        modelBytes = metrics.Define("oe_resident_model_bytes", Metrics::GAUGE,
+                                    "Estimated memory of streamed models.");
+        models = metrics.Define("oe_resident_models", Metrics::GAUGE,
+                                "Streamed models loaded.");
+        misses = metrics.Define("oe_stream_misses_total", Metrics::COUNTER,
+                                "Streamed textures used before they were loaded.");
+        evictions = metrics.Define("oe_stream_evictions_total", Metrics::COUNTER,
+                                   "Streamed resources evicted.");
+    }
+    void Handle(Core::ProcessEventArg arg) {
+        if (started)
+            block.Observe(frameTime, timer.GetElapsedTime().AsInt());
+        started = true;
+        timer.Reset();
+        timer.Start();
+        block.Add(frames);
+        if (extview != NULL) {
+            block.Set(drawCalls, extview->GetDrawList().GetDrawCount());
+            block.Set(culled, extview->GetCulledCount());
+            block.Set(occluded, extview->GetOccludedCount());
+        }
+        if (asyncloader != NULL) {
+            AsyncTextureLoader::Stats st = asyncloader->GetStats();
+            block.Set(loads, st.loads);
+            block.Set(failures, st.failures);
+            block.Set(latency, st.latency);
+        }
+        if (streamer != NULL) {
+            ResourceStreamer::Stats st = streamer->GetStats();
+            block.Set(textureBytes, st.textureBytes);
+            block.Set(modelBytes, st.modelBytes);
+            block.Set(models, st.models);
+            block.Set(misses, st.misses);
+            block.Set(evictions, st.evictions);
+        }
+    }
+};
+
+// Collects the shaders used by the materials of a scene.
+class ShaderCollector : public ISceneNodeVisitor {
+public:
+    std::vector<IShaderResourcePtr> shaders;
+    void Add(MaterialPtr mat) {
+        if (!mat || !mat->shad) return;
+        for (unsigned int i = 0; i < shaders.size(); ++i)
+            if (shaders[i] == mat->shad) return;
+        shaders.push_back(mat->shad);
+    }
+    void VisitGeometryNode(GeometryNode* node) {
+        FaceSet* faces = node->GetFaceSet();
+        if (faces != NULL)
+            for (FaceList::iterator itr = faces->begin();
+                 itr != faces->end(); ++itr)
+                Add((*itr)->mat);
+        node->VisitSubNodes(*this);
+    }
+    void VisitMeshNode(MeshNode* node) {
+        Add(node->GetMesh()->GetMaterial());
+        node->VisitSubNodes(*this);
+    }
+};
+
+// Reloads the changed files of the data directories on the render
+// thread, only touching the textures, models and shaders made from
+// them.
+class HotReloader
+    : public IListener<RenderingEventArg> {
+    // a model loaded by SimpleSetup::LoadModel()
+    struct Model {
+        std::string file;
+        IModelResourcePtr model;
+        ISceneNode* parent;
+        ISceneNode* node;
+    };
+    SimpleSetup& setup;
+    FileWatcher watcher;
+    TextureLoader*& textureloader;
+    AsyncTextureLoader*& asyncloader;
+    ResourceStreamer*& streamer;
+    Renderers::OpenGL::ShaderLoader*& shaderloader;
+    ClusteredLightRenderer*& clusteredlights;
+    // held while model nodes are replaced, may be NULL
+    Core::Mutex* structureLock;
+    std::vector<Model> models;
+public:
+    HotReloader(SimpleSetup& setup, TextureLoader*& textureloader,
+                AsyncTextureLoader*& asyncloader, ResourceStreamer*& streamer,
+                Renderers::OpenGL::ShaderLoader*& shaderloader,
+                ClusteredLightRenderer*& clusteredlights,
+                Core::Mutex* structureLock)
+        : setup(setup)
+        , textureloader(textureloader)
+        , asyncloader(asyncloader)
+        , streamer(streamer)
+        , shaderloader(shaderloader)
+        , clusteredlights(clusteredlights)
+        , structureLock(structureLock) {}
+    void AddDirectory(std::string dir) { watcher.AddDirectory(dir); }
+    void AddModel(std::string file, IModelResourcePtr model,
+                  ISceneNode& parent, ISceneNode* node) {
+        Model m;
+        m.file = file;
+        m.model = model;
+        m.parent = &parent;
+        m.node = node;
+        models.push_back(m);
+    }
+    void Handle(RenderingEventArg arg) {
+        std::vector<std::string> changed;
+        if (!watcher.Poll(changed)) return;
+        bool shaders = false;
+        for (std::vector<std::string>::iterator itr = changed.begin();
+             itr != changed.end(); ++itr) {
+            std::string ext = itr->substr(itr->find_last_of('.') + 1);
+            if (ext == "glsl" || ext == "vert" || ext == "frag" || ext == "geom") {
+                shaders = true;
+                continue;
+            }
+            std::vector<ITexture2DPtr> textures;
+            SceneFile::GetTextures(*itr, textures);
+            for (unsigned int i = 0; i < textures.size(); ++i)
+                ReloadTexture(textures[i]);
+            for (unsigned int i = 0; i < models.size(); ++i)
+                if (SceneFile::IsFile(*itr, models[i].file)) ReloadModel(models[i]);
+        }
+        if (shaders && shaderloader != NULL && arg.canvas.GetScene() != NULL)
+            ReloadShaders(*arg.canvas.GetScene());
+    }
+private:
+    // Textures keeping their size are updated in place through the
+    // upload ring, others are reloaded by the texture loader.
+    void ReloadTexture(ITexture2DPtr texr) {
+        unsigned int width = texr->GetWidth(), height = texr->GetHeight();
+        try {
+            texr->Unload();
+            texr->Load();
+        } catch (Exception& e) {
+            logger.warning << "HotReloader: " << e.what() << logger.end;
+            return;
+        }
+        // textures not yet uploaded are loaded when first used
+        if (texr->GetID() == 0) return;
+        if (texr->GetWidth() != width || texr->GetHeight() != height ||
+            !setup.GetUploadRing().Upload(texr))
+            textureloader->Load(texr, TextureLoader::RELOAD_IMMEDIATE);
+    }
+    // The node of the model is replaced under its parent, as the
+    // resource streamer does.
+    void ReloadModel(Model& m) {
+        if (m.node != NULL) {
+            if (structureLock != NULL) structureLock->Lock();
+            m.parent->RemoveNode(m.node);
+            delete m.node;
+            if (structureLock != NULL) structureLock->Unlock();
+            m.node = NULL;
+        }
+        m.model->Unload();
+        try {
+            m.model->Load();
+        } catch (Exception& e) {
+            logger.warning << "HotReloader: " << e.what() << logger.end;
+            setup.MarkSceneDirty(*m.parent);
+            return;
+        }
+        m.node = m.model->GetSceneNode();
+        if (m.node != NULL) {
+            if (structureLock != NULL) structureLock->Lock();
+            m.parent->AddNode(m.node);
+            if (structureLock != NULL) structureLock->Unlock();
+            if (streamer == NULL) asyncloader->Load(*m.node);
+        }
+        setup.MarkSceneDirty(*m.parent);
+        // the new nodes may bring shaders without the light samplers
+        if (clusteredlights != NULL) clusteredlights->InvalidateShaders();
+    }
+    // Shader resources do not tell the files they are built from, so
+    // the shaders of the scene are reloaded through the shader loader.
+    void ReloadShaders(ISceneNode& scene) {
+        ShaderCollector collector;
+        scene.Accept(collector);
+        for (unsigned int i = 0; i < collector.shaders.size(); ++i)
+            collector.shaders[i]->Unload();
+        Renderers::OpenGL::ProgramCache& cache = setup.GetProgramCache();
+        cache.BeginCapture();
+        shaderloader->Handle(InitializeEventArg());
+        cache.EndCapture();
+        // the rebuilt programs have lost the light sampler bindings
+        if (clusteredlights != NULL) clusteredlights->InvalidateShaders();
+    }
+};
+
+template <class E, class L>
+static void DetachListener(void* event, void* listener) {
+    static_cast<E*>(event)->Detach(*static_cast<L*>(listener));
+}
+
 class QuitHandler : public IListener<KeyboardEventArg> {
     IEngine& engine;
 public:
@@ -98,6 +668,16 @@ public:
     }
 };
 
+// Exports the scene when F12 is pressed.
+class ExportHandler : public IListener<KeyboardEventArg> {
+    SceneExporter& exporter;
+public:
+    ExportHandler(SceneExporter& exporter) : exporter(exporter) {}
+    void Handle(KeyboardEventArg arg) {
+        if (arg.type == EVENT_PRESS && arg.sym == KEY_F12) exporter.Request();
+    }
+};
+
 /**
  * Create the simple setup helper.
  * This will create all of the engine components. After this you may
@@ -114,86 +694,360 @@ public:
                              Core::IEngine* eng,
                              Renderers::IRenderer* rend)
     : title(title)
-    , engine(NULL)
-    , env(NULL)
-    , frame(NULL)
-    , canvas(NULL)
-    , renderer(NULL)
-    , mouse(NULL)
-    , keyboard(NULL)
-    , joystick(NULL)
-    , scene(NULL)
-    , camera(NULL)
-    , frustum(NULL)
-    , renderingview(NULL)
-    , textureloader(NULL)
-    , hud(NULL)
 {
+    config.env = env;
+    config.rv = rv;
+    config.engine = eng;
+    config.renderer = rend;
+    Init();
+}
+
+/**
+ * Create the simple setup helper from a configuration.
+ * With a lazy configuration only the logger and the engine are
+ * created here. The remaining subsystems are created on first use:
+ * - the environment, frame and input devices by GetFrame(),
+ *   GetMouse(), GetKeyboard() and GetJoystick(),
+ * - the resource plug-ins, camera, canvas, renderer and texture
+ *   loaders by GetRenderer(), GetCanvas(), GetCamera(),
+ *   GetTextureLoader(), GetHUD() and the Enable methods,
+ * - the default scene by GetScene().
+ * A scene given to SetScene() is applied once the renderer exists.
+ * Creating the renderer creates the environment, the plug-ins and
+ * the scene as well, so a windowed application using a lazy setup
+ * must call one of the renderer getters before starting the engine.
+ *
+ * @code
+ * // Headless tool, only the engine is created.
+ * SimpleSetup::Config config;
+ * config.lazy = true;
+ * SimpleSetup setup("tool", config);
+ * @endcode
+ *
+ * @param title Project title
+ * @param config Setup configuration
+ */
+SimpleSetup::SimpleSetup(std::string title, const Config& config)
+    : title(title)
+    , config(config)
+{
+    Init();
+}
+
+/**
+ * Destroy the setup and everything it created.
+ * The listeners the setup attached are detached first, also from
+ * components given in the configuration, which are left alive.
+ * The components created by the setup are then deleted, as is the
+ * default scene and camera unless the application has replaced
+ * them. Scenes, cameras and other objects given to the setup remain
+ * with the caller.
+ *
+ * The setup must be destroyed after the engine has stopped, and
+ * before the GL context of the frame is gone if the renderer objects
+ * are to release their GL resources.
+ */
+SimpleSetup::~SimpleSetup() {
+    for (std::vector<Binding>::reverse_iterator itr = bindings.rbegin();
+         itr != bindings.rend(); ++itr)
+        itr->detach(itr->event, itr->listener);
+    bindings.clear();
+
+    fpssurface.reset();
+    delete profilersurface;
+    delete streamingsurface;
+    delete hudatlas;
+    delete hud;
+    delete streamer;
+    delete occlusionculler;
+    delete multiview;
+    delete exporter;
+    delete hotreloader;
+    delete manifest;
+    delete inputqueue;
+    delete uploadring;
+    delete quadbuilder;
+    delete shaderloader;
+    delete clusteredlights;
+    delete lightrenderer;
+    delete extview;
+    delete asyncloader;
+    delete textureloader;
+    delete programcache;
+    delete canvas;
+
+    // the frustum node is owned by the frustum, not the scene
+    if (debugging && scene != NULL)
+        scene->RemoveNode(frustum->GetFrustumNode());
+    if (scene == defaultscene) delete defaultscene;
+    delete frustum;
+    delete defaultcamera;
+
+    if (renderer != config.renderer) delete renderer;
+    if (env != config.env) delete env;
+    // waits for the background work of the components deleted above
+    delete processgraph;
+    delete scheduler;
+    delete snapshot;
+    if (engine != config.engine) delete engine;
+    delete profiler;
+    delete metrics;
+
+    // destroys the listeners
+    delete framearena;
+    delete arena;
+
+    Logger::RemoveLogger(stdlog);
+    delete stdlog;
+}
+
+void SimpleSetup::Init() {
+    arena = new Arena();
+    framearena = new Arena();
+    engine = NULL;
+    env = NULL;
+    frame = NULL;
+    canvas = NULL;
+    renderer = NULL;
+    mouse = NULL;
+    keyboard = NULL;
+    joystick = NULL;
+    inputqueue = NULL;
+    scene = NULL;
+    defaultscene = NULL;
+    camera = NULL;
+    defaultcamera = NULL;
+    frustum = NULL;
+    renderingview = NULL;
+    extview = NULL;
+    lightrenderer = NULL;
+    shaderloader = NULL;
+    programcache = NULL;
+    clusteredlights = NULL;
+    lightlistener = NULL;
+    textureloader = NULL;
+    asyncloader = NULL;
+    texturecache = NULL;
+    streamer = NULL;
+    occlusionculler = NULL;
+    uploadring = NULL;
+    hud = NULL;
+    hudatlas = NULL;
+    dynres = NULL;
+    multiview = NULL;
+    exporter = NULL;
+    manifest = NULL;
+    hotreloader = NULL;
+    limiter = NULL;
+    metrics = NULL;
+    quadbuilder = NULL;
+    profiler = NULL;
+    profilersurface = NULL;
+    streamingsurface = NULL;
+    threadedengine = NULL;
+    snapshot = NULL;
+    scheduler = NULL;
+    processgraph = NULL;
+    plugins = false;
+    userscene = false;
+    shaderspending = false;
+    debugging = false;
+
     // create a logger to std out    
-    stdlog = new ColorStreamLogger(&std::cout);
+    if (config.asynclogging) {
+        AsyncLogger* async = new AsyncLogger(new ColorStreamLogger(&std::cout));
+        async->SetRateLimit(config.loglimit);
+        stdlog = async;
+    } else
+        stdlog = new ColorStreamLogger(&std::cout);
     //stdlog = new StreamLogger(&std::cout);
     Logger::AddLogger(stdlog);
+    // opened once added, so a failure is logged
+    if (config.asynclogging && !config.logfile.empty())
+        static_cast<AsyncLogger*>(stdlog)->SetFile(config.logfile, config.logfilesize);
 
     // setup the engine
-    engine = (eng==NULL)?new Engine():eng;
+    if (config.engine != NULL)
+        engine = config.engine;
+    else if (config.threaded)
+        engine = new ThreadedEngine();
+    else
+        engine = new Engine();
+
+    // a threaded engine renders on its own event and the renderer
+    // reads the transformations captured after each tick
+    threadedengine = dynamic_cast<ThreadedEngine*>(engine);
+    if (threadedengine != NULL) {
+        snapshot = new TransformSnapshot();
+        Attach(threadedengine->PostTickEvent(),
+               *arena->New<CaptureOnTick>(*snapshot, scene,
+                                           threadedengine->GetStructureLock()));
+    }
+
+    // the frame arena is reset before anything else runs in a frame
+    Attach(FrameEvent(), *arena->New<FrameArenaReset>(*framearena));
+
+    // the profiler is disabled until EnableDebugging() or
+    // GetProfiler().Enable(true) is called.
+    profiler = new FrameProfiler();
+    Attach(FrameEvent(), *arena->New<FrameProfiler::FrameMarker>(*profiler));
+
+    // the frame limiter is disabled until SetFrameLimit() is called
+    limiter = arena->New<FrameLimiter>();
+    Attach(FrameEvent(), *limiter);
+
+    if (config.lazy) return;
+    InitEnvironment();
+    InitPlugins();
+    InitScene();
+    InitRenderer();
+}
+
+// The event driving the frame, the render event of a threaded
+// engine and the process event otherwise.
+IEvent<ProcessEventArg>& SimpleSetup::FrameEvent() {
+    if (threadedengine != NULL)
+        return threadedengine->RenderEvent();
+    return engine->ProcessEvent();
+}
+
+// Attach a listener and remember it, so it is detached again when
+// the setup is destroyed.
+template <class E, class L>
+void SimpleSetup::Attach(E& event, L& listener) {
+    event.Attach(listener);
+    Binding b = { &event, &listener, &DetachListener<E, L> };
+    bindings.push_back(b);
+}
+
+// Detach a listener attached with Attach().
+template <class E, class L>
+void SimpleSetup::Detach(E& event, L& listener) {
+    event.Detach(listener);
+    for (std::vector<Binding>::iterator itr = bindings.begin();
+         itr != bindings.end(); ++itr)
+        if (itr->event == &event && itr->listener == &listener) {
+            bindings.erase(itr);
+            return;
+        }
+}
+
+void SimpleSetup::InitEnvironment() {
+    if (env != NULL) return;
 
     // setup display and devices
-    this->env = env = (env == NULL) ? new SDLEnvironment(1024,768, 32) : env;
+    if (config.env != NULL)
+        env = config.env;
+    else if (config.offscreen)
+        env = new OffscreenEnvironment(config.width, config.height);
+    else
+        env = new SDLEnvironment(config.width, config.height, 32);
 
     frame    = &env->CreateFrame();
     mouse    = env->GetMouse();
     keyboard = env->GetKeyboard();
     joystick = env->GetJoystick();
-    engine->InitializeEvent().Attach(*env);
-    engine->ProcessEvent().Attach(*env);
-    engine->DeinitializeEvent().Attach(*env);
+    Attach(engine->InitializeEvent(), *env);
+    Attach(FrameEvent(),
+           *arena->New<ProfiledListener<ProcessEventArg> >(*profiler, "engine.process", *env));
+    Attach(engine->DeinitializeEvent(), *env);
 
-    // setup a default viewport and camera
-    camera  = new Camera(*(new PerspectiveViewingVolume()));
-    frustum = new Frustum(*camera);
-    canvas = new RenderCanvas(new TextureCopy());
-    canvas->SetViewingVolume(frustum);
-    
-    //viewport->SetViewingVolume(frustum);
+    /* The environment is resposible for sending these events.
+     * - WILL BE CHANGED IN THE FUTURE
+     */ 
+    // engine->InitializeEvent().Attach(*frame);
+    // engine->ProcessEvent().Attach(*frame);
+    // engine->DeinitializeEvent().Attach(*frame);
+
+    // bind default keys
+    Attach(keyboard->KeyEvent(), *arena->New<QuitHandler>(*engine));
+}
 
-    // add plug-ins
+void SimpleSetup::InitPlugins() {
+    if (plugins) return;
+    plugins = true;
+
+    // add plug-ins, the cached plug-in must precede the OBJ plug-in
+    if (config.modelcache)
+        ResourceManager<IModelResource>::AddPlugin(new CachedOBJPlugin());
     ResourceManager<IModelResource>::AddPlugin(new OBJPlugin());
-    ResourceManager<ITexture2D>::AddPlugin(new SDLImagePlugin());
+    // the compressed texture plug-in or the SDL plug-in, wrapped to
+    // record the texture files for scene files
+    IResourcePlugin<ITexture2D>* images;
+    if (config.texturecompression) {
+        // the plug-in owns the cache, as it stays registered after
+        // the setup is destroyed
+        texturecache = new CompressedTextureCache();
+        images = new CompressedTexturePlugin(texturecache);
+    } else
+        images = new SDLImagePlugin();
+    ResourceManager<ITexture2D>::AddPlugin(new SceneTexturePlugin(images));
     ResourceManager<IShaderResource>::AddPlugin(new GLShaderPlugin());
+}
+
+void SimpleSetup::InitScene() {
+    if (scene != NULL) return;
 
     // populate the default scene
-    scene = new SceneNode();
+    scene = defaultscene = new SceneNode();
     scene->AddNode(new DirectionalLightNode());
+}
+
+void SimpleSetup::InitRenderer() {
+    if (renderer != NULL) return;
+    InitEnvironment();
+    InitPlugins();
+    InitScene();
+
+    // setup a default viewport and camera
+    camera = defaultcamera = new Camera(*arena->New<PerspectiveViewingVolume>());
+    frustum = new Frustum(*camera);
+    canvas = new RenderCanvas(new TextureCopy());
+    canvas->SetViewingVolume(frustum);
+    
+    //viewport->SetViewingVolume(frustum);
 
     // setup the rendering system
     
-    renderer = (rend?rend:new Renderer());
+    renderer = (config.renderer?config.renderer:new Renderer());
     textureloader = new TextureLoader(*renderer);
+    asyncloader = new AsyncTextureLoader(*textureloader);
+    asyncloader->SetCompression(texturecache);
     canvas->SetRenderer(renderer);
     // renderingview = (rv == NULL) ? new RenderingView() : rv;
-    renderingview = (rv == NULL) ? new ExtRenderingView() : rv;
+    if (config.rv == NULL) {
+        extview = new ExtRenderingView();
+        extview->SetFrustum(frustum);
+        extview->SetSnapshot(snapshot);
+        extview->SetProfiler(profiler);
+        renderingview = extview;
+    } else renderingview = config.rv;
     lightrenderer = new LightRenderer();
 
 
-    renderer->PreProcessEvent().Attach(*lightrenderer);
-    renderer->ProcessEvent().Attach(*renderingview);
-    renderer->InitializeEvent().Attach(*renderingview);
+    lightlistener = arena->New<ProfiledListener<RenderingEventArg> >(*profiler, "preprocess.light", *lightrenderer);
+    Attach(renderer->PreProcessEvent(), *lightlistener);
+    // the dynamic resolution is disabled until EnableDynamicResolution()
+    dynres = arena->New<DynamicResolution>(*arena->New<GPUProfiledListener>(*profiler, *renderingview));
+    Attach(renderer->ProcessEvent(),
+           *arena->New<ProfiledListener<RenderingEventArg> >(*profiler, "process.view", *dynres));
+    Attach(renderer->InitializeEvent(), *renderingview);
     canvas->SetScene(scene);
-    renderer->InitializeEvent().Attach(*(new TextureLoadOnInit(*textureloader)));
-    renderer->PreProcessEvent().Attach(*textureloader);
+    Attach(renderer->InitializeEvent(),
+           *arena->New<ProfiledListener<RenderingEventArg> >(*profiler, "initialize.texture",
+            *arena->New<TextureLoadOnInit>(*asyncloader, streamer)));
+    Attach(renderer->PreProcessEvent(),
+           *arena->New<ProfiledListener<RenderingEventArg> >(*profiler, "preprocess.texture", *textureloader));
+    Attach(renderer->PreProcessEvent(),
+           *arena->New<ProfiledListener<RenderingEventArg> >(*profiler, "preprocess.asynctexture", *asyncloader));
+    Attach(renderer->PreProcessEvent(),
+           *arena->New<ProfiledListener<RenderingEventArg> >(*profiler, "preprocess.shaders",
+            *arena->New<ShaderLoadOnPreProcess>(*this, shaderloader, shaderspending)));
 
     frame->SetCanvas(canvas);
 
-    /* The environment is resposible for sending these events.
-     * - WILL BE CHANGED IN THE FUTURE
-     */ 
-    // engine->InitializeEvent().Attach(*frame);
-    // engine->ProcessEvent().Attach(*frame);
-    // engine->DeinitializeEvent().Attach(*frame);
-
-
-    // bind default keys
-    keyboard->KeyEvent().Attach(*(new QuitHandler(*engine)));
+    // a scene given to SetScene() before the renderer existed
+    if (userscene) ApplyScene();
 }
 
 /**
@@ -213,10 +1067,12 @@ IEngine& SimpleSetup::GetEngine() const {
  * @see IFrame
  */
 IFrame& SimpleSetup::GetFrame() const {
+    const_cast<SimpleSetup*>(this)->InitEnvironment();
     return *frame;
 }
 
 IRenderCanvas* SimpleSetup::GetCanvas() const {
+    const_cast<SimpleSetup*>(this)->InitRenderer();
     return canvas;
 }
 
@@ -230,6 +1086,7 @@ IRenderCanvas* SimpleSetup::GetCanvas() const {
  * The renderer itself is not replaceable.
  */
 IRenderer& SimpleSetup::GetRenderer() const {
+    const_cast<SimpleSetup*>(this)->InitRenderer();
     return *renderer;
 }
 
@@ -238,6 +1095,7 @@ IRenderer& SimpleSetup::GetRenderer() const {
  * The mouse structure is not replaceable.
  */
 IMouse& SimpleSetup::GetMouse() const {
+    const_cast<SimpleSetup*>(this)->InitEnvironment();
     return *mouse;
 }
 
@@ -246,6 +1104,7 @@ IMouse& SimpleSetup::GetMouse() const {
  * The keyboard structure is not replaceable.
  */
 IKeyboard& SimpleSetup::GetKeyboard() const {
+    const_cast<SimpleSetup*>(this)->InitEnvironment();
     return *keyboard;
 }
 
@@ -254,9 +1113,42 @@ IKeyboard& SimpleSetup::GetKeyboard() const {
  * The joystick structure is not replaceable.
  */
 IJoystick& SimpleSetup::GetJoystick() const {
+    const_cast<SimpleSetup*>(this)->InitEnvironment();
     return *joystick;
 }
 
+/**
+ * Get the input queue.
+ * The queue receives the events of the mouse, keyboard and joystick
+ * stamped with the time they arrived, to be drained by another
+ * thread, such as the simulation thread of a threaded engine. Its
+ * latest state polls the mouse again right before each frame is
+ * rendered, for the lowest latency from the mouse to the screen.
+ *
+ * @code
+ * InputQueue& input = setup.GetInputQueue();
+ * // on the simulation thread
+ * InputEvent e;
+ * while (input.Pop(e)) ...
+ * // anywhere
+ * if (input.GetState().IsKeyDown(KEY_SPACE)) ...
+ * @endcode
+ */
+InputQueue& SimpleSetup::GetInputQueue() {
+    InitRenderer();
+    if (inputqueue == NULL) {
+        inputqueue = new InputQueue(mouse);
+        Attach(keyboard->KeyEvent(), *inputqueue);
+        Attach(mouse->MouseMovedEvent(), *inputqueue);
+        Attach(mouse->MouseButtonEvent(), *inputqueue);
+        Attach(joystick->JoystickButtonEvent(), *inputqueue);
+        Attach(joystick->JoystickAxisEvent(), *inputqueue);
+        Attach(renderer->PreProcessEvent(),
+               *arena->New<ProfiledListener<RenderingEventArg> >(*profiler, "preprocess.input", *inputqueue));
+    }
+    return *inputqueue;
+}
+
 /**
  * Get the current scene.
  * The default scene consists of a SceneNode with a single
@@ -268,6 +1160,7 @@ IJoystick& SimpleSetup::GetJoystick() const {
  * searched for textures to load.
  */
 ISceneNode* SimpleSetup::GetScene() const {
+    const_cast<SimpleSetup*>(this)->InitScene();
     return scene;
 }
 
@@ -281,16 +1174,74 @@ ISceneNode* SimpleSetup::GetScene() const {
  * up the old scene if needed by using GetScene().
  * When setting a new scene it will automatically be searched for
  * textures to load.
+ * If frustum culling is enabled the culling structure is updated for
+ * the new scene, only sub nodes of the scene root that were not part
+ * of the previous scene are built.
+ * The shader loader of the previous scene is replaced, the shaders of
+ * the new scene are loaded by the renderer before the next frame,
+ * through the program cache (see GetProgramCache()).
  * @param scene New active scene.
  */
 void SimpleSetup::SetScene(ISceneNode& scene) {
     this->scene = &scene;
-    canvas->SetScene(this->scene);
-    textureloader->Load(scene);
+    userscene = true;
+    // a lazy setup applies the scene when the renderer is created
+    if (renderer != NULL) ApplyScene();
+}
+
+void SimpleSetup::ApplyScene() {
+    ISceneNode& scene = *this->scene;
+    if (quadbuilder != NULL) {
+        quadbuilder->SetScene(scene);
+        canvas->SetScene(quadbuilder->GetRoot());
+    } else
+        canvas->SetScene(this->scene);
+    if (streamer == NULL) asyncloader->Load(scene);
+    if (clusteredlights != NULL) clusteredlights->SetScene(&scene);
 
+    // replace the loader of the previous scene, the shaders of the new
+    // scene compile in the pre-process stage where the context is
+    // current, also with the threaded engine
+    delete shaderloader;
     shaderloader = new Renderers::OpenGL::ShaderLoader(*textureloader, scene);
     shaderloader->SetLightRenderer(lightrenderer);
-    engine->InitializeEvent().Attach(*shaderloader);
+    shaderspending = true;
+}
+
+/**
+ * Save the current scene to a binary scene file.
+ * The file holds the geometry, materials, lights and transformations
+ * of the scene and the files of its textures, and loads with
+ * LoadScene() without loading any models, see SceneFile.
+ *
+ * @param file File to write.
+ * @return True if the scene was saved.
+ */
+bool SimpleSetup::SaveScene(std::string file) {
+    return SceneFile::Save(*GetScene(), file);
+}
+
+/**
+ * Load a scene saved with SaveScene() and make it the current scene.
+ * As with SetScene() the new scene is owned by the caller and the
+ * previous scene is left for the caller to clean up.
+ *
+ * @code
+ * ISceneNode* old = setup.GetScene();
+ * if (setup.LoadScene("level.oescene") == NULL) {
+ *     // assemble the scene from its models and save it
+ * } else delete old;
+ * @endcode
+ *
+ * @param file File to load.
+ * @return The loaded scene, or NULL if the file could not be loaded
+ *         in which case the current scene is kept.
+ */
+ISceneNode* SimpleSetup::LoadScene(std::string file) {
+    InitPlugins();
+    ISceneNode* root = SceneFile::Load(FindFile(file));
+    if (root != NULL) SetScene(*root);
+    return root;
 }
 
 /**
@@ -299,6 +1250,7 @@ void SimpleSetup::SetScene(ISceneNode& scene) {
  * z-axis in the negative direction (0,0,-1).
  */
 Camera* SimpleSetup::GetCamera() const {
+    const_cast<SimpleSetup*>(this)->InitRenderer();
     return camera;
 }
 
@@ -307,22 +1259,347 @@ Camera* SimpleSetup::GetCamera() const {
  * Ownership of the camera remains with the caller.
  */
 void SimpleSetup::SetCamera(Camera& volume) {
+    InitRenderer();
     camera = &volume;
     delete frustum;
     frustum = new Frustum(*camera);
     canvas->SetViewingVolume(frustum);    
+    if (extview != NULL) extview->SetFrustum(frustum);
 }
 /**
  * Set a camera by viewing volume.
  * The non-camera class is used to create a *new* camera that wraps
  * the viewing volume. The new camera is created on the heap and the
  * caller is responsible for any needed clean-up of this structure.
+ * As with SetCamera(Camera&) the camera is wrapped in a new frustum.
  *
  * @param volume Volume to wrap in a *new* camera.
  */
 void SimpleSetup::SetCamera(IViewingVolume& volume) {
-    camera = new Camera(volume);
-    canvas->SetViewingVolume(camera);
+    SetCamera(*(new Camera(volume)));
+}
+
+/**
+ * Enable frustum culling in the default rendering view.
+ * The geometry of the current scene, and of any scene later given to
+ * SetScene(), is collected and partitioned into quad trees from the
+ * acceleration structures extension. Quad nodes outside the frustum
+ * of the current camera are skipped during rendering.
+ *
+ * The culling structure is built from a copy of the scene and the
+ * scene itself is left untouched. Each sub node of the scene root is
+ * built separately in the background and only rebuilt when it
+ * changes, see MarkSceneDirty(). Sub nodes are rendered without
+ * culling until they are first built.
+ *
+ * Has no effect if a custom rendering view was given to the
+ * constructor.
+ *
+ * @param maxFaces Maximum number of faces in a quad tree leaf.
+ * @param maxSize Maximum side length of a quad tree leaf.
+ */
+void SimpleSetup::EnableFrustumCulling(unsigned int maxFaces, float maxSize) {
+    InitRenderer();
+    if (extview == NULL) {
+        logger.warning << "Frustum culling requires the default rendering view"
+                       << logger.end;
+        return;
+    }
+    if (quadbuilder != NULL) return;
+    quadbuilder = new IncrementalQuadBuilder(maxFaces, maxSize);
+    quadbuilder->SetScheduler(&GetScheduler());
+    if (threadedengine != NULL)
+        quadbuilder->SetSceneLock(&threadedengine->GetSceneLock());
+    Attach(renderer->PreProcessEvent(), *quadbuilder);
+    extview->SetCulling(true);
+    quadbuilder->SetScene(*scene);
+    canvas->SetScene(quadbuilder->GetRoot());
+}
+
+/**
+ * Light the scene with clustered lighting.
+ * The light renderer is replaced by a ClusteredLightRenderer which
+ * culls the lights against the view frustum and bins the visible
+ * lights into clusters for shaders to sample, so scenes may contain
+ * hundreds of lights. Shaders must include the source of
+ * ClusteredLightRenderer::GetShaderSource() to use the clusters,
+ * other materials are lit by the most important lights only.
+ */
+void SimpleSetup::EnableClusteredLighting() {
+    InitRenderer();
+    if (clusteredlights != NULL) return;
+    clusteredlights = new ClusteredLightRenderer();
+    clusteredlights->SetScene(scene);
+    Detach(renderer->PreProcessEvent(), *lightlistener);
+    lightlistener = arena->New<ProfiledListener<RenderingEventArg> >(*profiler, "preprocess.light", *clusteredlights);
+    Attach(renderer->PreProcessEvent(), *lightlistener);
+}
+
+/**
+ * Render the scene at a resolution adjusted to a GPU time budget.
+ * The scene is rendered offscreen at a scale of the canvas size that
+ * drops when the scene takes more than the budget on the GPU and
+ * recovers when it takes less, and is then stretched into the
+ * canvas. The HUD is drawn on top at native resolution.
+ *
+ * @param budget GPU time of the scene per frame in milliseconds.
+ * @param minScale Lowest scale of the canvas size.
+ */
+void SimpleSetup::EnableDynamicResolution(float budget, float minScale) {
+    InitRenderer();
+    dynres->SetBudget(budget);
+    dynres->SetMinimumScale(minScale);
+    dynres->Enable(true);
+}
+
+/**
+ * Get the scale of the canvas size the scene is currently rendered
+ * at, one unless the dynamic resolution is enabled.
+ */
+float SimpleSetup::GetResolutionScale() const {
+    return (dynres == NULL) ? 1.0f : dynres->GetScale();
+}
+
+/**
+ * Limit the number of frames per second.
+ * Frames finishing early sleep for the rest of their time, which
+ * keeps idle scenes from using all of the CPU and GPU.
+ *
+ * @param fps Highest number of frames per second, zero for no limit.
+ */
+void SimpleSetup::SetFrameLimit(unsigned int fps) {
+    limiter->SetLimit(fps);
+}
+
+/**
+ * Add a view of the scene with a camera of its own.
+ * The views share the canvas, renderer, texture loader, shaders and
+ * scene, and the scene is traversed and culled once for all of them,
+ * see MultiView. Non-geometry nodes drawn by the rendering view
+ * itself, such as mesh nodes, are only drawn in the main view. The
+ * camera looks down the negative z axis from the origin until moved.
+ *
+ * @param x Left edge as a fraction of the canvas width.
+ * @param y Bottom edge as a fraction of the canvas height.
+ * @param width Width as a fraction of the canvas width.
+ * @param height Height as a fraction of the canvas height.
+ * @return Camera of the view, owned by the setup.
+ */
+Camera* SimpleSetup::AddView(float x, float y, float width, float height) {
+    Camera* cam = arena->New<Camera>(*arena->New<PerspectiveViewingVolume>());
+    AddView(*cam, x, y, width, height);
+    return cam;
+}
+
+/**
+ * Add a view of the scene through a viewing volume.
+ * The aspect of the volume should match that of the rectangle.
+ *
+ * @see AddView(float, float, float, float)
+ */
+void SimpleSetup::AddView(IViewingVolume& volume,
+                          float x, float y, float width, float height) {
+    GetViews().AddView(&volume, x, y, width, height);
+}
+
+/**
+ * Set the rectangle of the canvas the main camera renders to, for
+ * instance the left half for split screen. The projection of the
+ * camera is adjusted to the aspect of the rectangle. By default the
+ * main camera covers the canvas.
+ */
+void SimpleSetup::SetMainViewport(float x, float y, float width, float height) {
+    GetViews().SetViewport(0, x, y, width, height);
+}
+
+/**
+ * Render side by side stereo from the main camera.
+ * The left eye is rendered to the left and the right eye to the
+ * right half of the canvas, both from a single traversal of the
+ * scene. Each eye is projected with the aspect of its half, so the
+ * output is full side by side. Added views are removed.
+ *
+ * @param separation Distance between the eyes.
+ */
+void SimpleSetup::EnableStereo(float separation) {
+    MultiView& views = GetViews();
+    views.Clear();
+    views.SetViewport(0, 0, 0, 0.5f, 1);
+    views.SetEyeOffset(0, -separation * 0.5f);
+    views.SetEyeOffset(views.AddView(NULL, 0.5f, 0, 0.5f, 1),
+                       separation * 0.5f);
+}
+
+/**
+ * Remove the added views and stereo, the main camera covers the
+ * canvas again.
+ */
+void SimpleSetup::ClearViews() {
+    if (multiview != NULL) multiview->Clear();
+}
+
+// The views of the default rendering view, created on first use.
+MultiView& SimpleSetup::GetViews() {
+    InitRenderer();
+    if (multiview == NULL) {
+        multiview = new MultiView();
+        if (extview != NULL) extview->SetMultiView(multiview);
+        else logger.warning << "SimpleSetup: views need the default "
+                            << "rendering view" << logger.end;
+    }
+    return *multiview;
+}
+
+/**
+ * Mark a part of the current scene as changed.
+ * Nodes added to or removed from the scene root are detected
+ * automatically, but other changes, such as moving a transformation
+ * node or adding geometry further down the scene, must be reported
+ * for frustum culling to pick them up. The sub tree of the scene
+ * root containing the node is rebuilt in the background and swapped
+ * in when done.
+ *
+ * @param node Changed node in the current scene.
+ */
+void SimpleSetup::MarkSceneDirty(ISceneNode& node) {
+    if (quadbuilder != NULL) quadbuilder->MarkDirty(node);
+}
+
+/**
+ * Enable state sorted batching in the default rendering view.
+ * Instead of rendering geometry in traversal order the visible
+ * geometry is collected into a draw list that is sorted by shader,
+ * texture and material before submission. Faces of a geometry node
+ * sharing a material are merged into one vertex array that is cached
+ * between frames, so each material costs one draw call per geometry
+ * node. Combined with frustum culling, where the geometry of each
+ * quad tree leaf is collected into one node, this gives a draw call
+ * per material per visible leaf.
+ *
+ * A geometry node placed in the scene many times, under different
+ * transformation nodes, is drawn with one instanced call per
+ * material where the driver supports it, see EnableInstancing().
+ *
+ * Geometry is assumed to be static. Mesh nodes and other geometry
+ * types are rendered by the ordinary traversal.
+ *
+ * Has no effect if a custom rendering view was given to the
+ * constructor.
+ *
+ * @param enable True to enable batching.
+ */
+void SimpleSetup::EnableBatching(bool enable) {
+    InitRenderer();
+    if (extview == NULL) {
+        logger.warning << "Batching requires the default rendering view"
+                       << logger.end;
+        return;
+    }
+    extview->GetDrawList().SetProgramCache(&GetProgramCache());
+    extview->SetBatching(enable);
+}
+
+/**
+ * Enable or disable instanced drawing of repeated geometry.
+ * Instancing is part of batching and enabling it enables batching.
+ * The copies of a geometry node are drawn with their transformations
+ * in a per-instance buffer that is only uploaded when they change,
+ * and lit by a built-in shader following the fixed function lights.
+ * Geometry with shaders of its own is drawn one copy at a time.
+ *
+ * @param enable True to enable instancing.
+ */
+void SimpleSetup::EnableInstancing(bool enable) {
+    if (enable) EnableBatching(true);
+    if (extview == NULL) return;
+    extview->GetDrawList().SetInstancing(enable);
+}
+
+/**
+ * Get the number of quad nodes culled in the last frame.
+ */
+unsigned int SimpleSetup::GetCulledCount() const {
+    return (extview == NULL) ? 0 : extview->GetCulledCount();
+}
+
+/**
+ * Enable or disable occlusion culling in the default rendering view.
+ * Quad nodes that passed frustum culling are tested with hardware
+ * occlusion queries against the depth of the previous frames, and
+ * nodes found hidden behind other geometry are skipped. The queries
+ * are read without waiting for them, so a node may appear a frame
+ * late when it comes into view. Occlusion culling works on the quad
+ * tree of frustum culling and enables it.
+ *
+ * The numbers of nodes culled by the frustum and by occlusion are
+ * shown by ShowProfiler() while the profiler is enabled.
+ *
+ * Has no effect if a custom rendering view was given to the
+ * constructor.
+ *
+ * @param enable True to enable occlusion culling.
+ */
+void SimpleSetup::EnableOcclusionCulling(bool enable) {
+    if (enable) EnableFrustumCulling();
+    if (extview == NULL) return;
+    if (enable && occlusionculler == NULL)
+        occlusionculler = new OcclusionCuller();
+    extview->SetOcclusionCuller(enable ? occlusionculler : NULL);
+}
+
+/**
+ * Get the number of quad nodes culled by occlusion in the last
+ * frame.
+ */
+unsigned int SimpleSetup::GetOccludedCount() const {
+    return (extview == NULL) ? 0 : extview->GetOccludedCount();
+}
+
+/**
+ * Enable level of detail selection in the default rendering view.
+ * Each LODNode in the scene selects the coarsest of its levels whose
+ * error on the screen is below the threshold, see CreateLOD() and
+ * LODNode::Select().
+ *
+ * The culling structure of frustum culling is built from the
+ * geometry of the selected levels only, so level of detail nodes
+ * should be placed in scenes rendered without frustum culling.
+ *
+ * Has no effect if a custom rendering view was given to the
+ * constructor.
+ *
+ * @param threshold Largest error on the screen in pixels.
+ * @param hysteresis Fraction the threshold is reduced by before a
+ *                   coarser level is selected.
+ */
+void SimpleSetup::EnableLOD(float threshold, float hysteresis) {
+    InitRenderer();
+    if (extview == NULL) {
+        logger.warning << "Level of detail requires the default rendering view"
+                       << logger.end;
+        return;
+    }
+    extview->SetLOD(true, threshold, hysteresis);
+}
+
+/**
+ * Create simplified levels of detail for a model.
+ * A geometry node is simplified into a LODNode with the node as its
+ * full resolution level, other nodes are returned as they are.
+ *
+ * @code
+ * model->Load();
+ * scene->AddNode(setup.CreateLOD(model->GetSceneNode()));
+ * @endcode
+ *
+ * @param node Model node, owned by the returned node.
+ * @param levels Number of levels including the full resolution.
+ * @return Node to add to the scene in place of the model node.
+ */
+ISceneNode* SimpleSetup::CreateLOD(ISceneNode* node, unsigned int levels) {
+    GeometryNode* geom = dynamic_cast<GeometryNode*>(node);
+    if (geom == NULL) return node;
+    return LODNode::Create(geom, levels);
 }
 
 /**
@@ -333,9 +1610,97 @@ void SimpleSetup::SetCamera(IViewingVolume& volume) {
  * @return Texture loader.
  */
 TextureLoader& SimpleSetup::GetTextureLoader() {
+    InitRenderer();
     return *textureloader;
 }
 
+/**
+ * Load scene textures asynchronously.
+ * Textures found by SetScene() and during renderer initialization
+ * are decoded on worker threads and uploaded on the render thread
+ * during the renderer pre-process phase. At most the budget is spent
+ * uploading per frame so texture streaming will not cause frame
+ * spikes. Until uploaded, geometry renders without its texture.
+ *
+ * Textures loaded directly through GetTextureLoader() are not
+ * affected.
+ *
+ * @param workers Number of decode threads, zero to decode on the
+ *                task scheduler.
+ * @param budget Per frame upload budget in microseconds.
+ */
+void SimpleSetup::EnableAsyncTextureLoading(unsigned int workers,
+                                            unsigned int budget) {
+    InitRenderer();
+    if (workers == 0)
+        asyncloader->SetScheduler(&GetScheduler());
+    else
+        asyncloader->SetWorkerCount(workers);
+    asyncloader->SetUploadBudget(budget);
+    asyncloader->SetAsync(true);
+}
+
+/**
+ * Stream the textures and models of the scene within a memory budget.
+ * Textures are no longer all loaded with the scene but when geometry
+ * using them is rendered, and the least recently used textures are
+ * evicted when the budget is exceeded. Models added to the streamer
+ * with ResourceStreamer::AddModel() are loaded when they come near
+ * the camera inside the view frustum, and evicted the same way.
+ * Texture loading is made asynchronous and the models are prepared
+ * on the task scheduler.
+ *
+ * Has no effect if a custom rendering view was given to the
+ * constructor.
+ *
+ * @param textureBudget Estimated bytes of resident textures.
+ * @param modelBudget Estimated bytes of loaded model geometry.
+ */
+void SimpleSetup::EnableStreaming(unsigned long textureBudget,
+                                  unsigned long modelBudget) {
+    InitRenderer();
+    if (extview == NULL) {
+        logger.warning << "Streaming requires the default rendering view"
+                       << logger.end;
+        return;
+    }
+    if (streamer == NULL) {
+        if (!asyncloader->IsAsync()) EnableAsyncTextureLoading();
+        streamer = new ResourceStreamer(*asyncloader);
+        streamer->SetScheduler(&GetScheduler());
+        if (threadedengine != NULL)
+            streamer->SetStructureLock(&threadedengine->GetStructureLock());
+        Attach(streamer->StreamingEvent(), *arena->New<StreamingDirty>(*this));
+        Attach(renderer->PreProcessEvent(),
+               *arena->New<ProfiledListener<RenderingEventArg> >(*profiler, "preprocess.streaming", *streamer));
+        extview->SetStreamer(streamer);
+    }
+    streamer->SetTextureBudget(textureBudget);
+    streamer->SetModelBudget(modelBudget);
+}
+
+/**
+ * Get the resource streamer, enabling streaming with the default
+ * budgets if it is not enabled.
+ * @see EnableStreaming()
+ */
+ResourceStreamer& SimpleSetup::GetStreamer() {
+    if (streamer == NULL) EnableStreaming();
+    return *streamer;
+}
+
+/**
+ * Show the resident bytes, hits, misses and evictions of the
+ * resource streamer on the HUD.
+ */
+void SimpleSetup::ShowStreaming() {
+    if (streamingsurface != NULL) return;
+    streamingsurface = new StreamingSurface(GetStreamer());
+    Attach(FrameEvent(), *streamingsurface);
+    GetHUDAtlas().Add(streamingsurface->GetTexture(),
+                      HUDAtlas::RIGHT, HUDAtlas::BOTTOM);
+}
+
 /**
  * Add a data directory to the file search path.
  * This path will be searched when loading file resources.
@@ -345,17 +1710,273 @@ TextureLoader& SimpleSetup::GetTextureLoader() {
  */
 void SimpleSetup::AddDataDirectory(string dir) {
     DirectoryManager::AppendPath(dir);
+    GetManifest().AddDirectory(dir);
+    if (hotreloader != NULL) hotreloader->AddDirectory(dir);
+}
+
+/**
+ * Get the manifest of the data directories.
+ * @see BuildManifest()
+ */
+ResourceManifest& SimpleSetup::GetManifest() {
+    if (manifest == NULL) manifest = new ResourceManifest(GetScheduler());
+    return *manifest;
+}
+
+/**
+ * Index the files of the data directories, so files are found
+ * without probing each directory. The directories are scanned in
+ * parallel on the task scheduler, or the index is loaded from the
+ * cache file if it is up to date, and saved to it otherwise.
+ * Call it once all data directories are added, see
+ * AddDataDirectory(). Files are looked up in the manifest by
+ * FindFile(), LoadModels() and LoadScene().
+ *
+ * @param cache Cache file of the manifest, empty for none.
+ */
+void SimpleSetup::BuildManifest(string cache) {
+    if (!cache.empty() && GetManifest().Load(cache)) return;
+    GetManifest().Build();
+    if (!cache.empty()) manifest->Save(cache);
+}
+
+/**
+ * Find a file relative to the data directories in the manifest.
+ * Files not in the manifest, or all files if it is not built, are
+ * returned as they are, to be searched by the directory manager.
+ *
+ * @param file File relative to a data directory.
+ * @return Path of the file.
+ */
+string SimpleSetup::FindFile(string file) {
+    return (manifest == NULL) ? file : manifest->Resolve(file);
+}
+
+/**
+ * Read files in parallel on the task scheduler so they are in the
+ * operating system cache when loaded, typically the models and
+ * textures of the first scene before the engine is started.
+ *
+ * @param files Files relative to the data directories.
+ * @param wait True to return once all files have been read.
+ */
+void SimpleSetup::Prefetch(const std::vector<string>& files, bool wait) {
+    GetManifest().Prefetch(files, wait);
+}
+
+/**
+ * Load a number of models.
+ * With the model cache enabled in the configuration the OBJ files
+ * are parsed, or their caches mapped, in parallel on the task
+ * scheduler before the scene
+ * nodes are built on the calling thread. Other models are loaded one
+ * at a time as usual.
+ *
+ * @param files Model files to load.
+ * @param models Loaded models in the order of the files, empty for
+ *               the files that could not be loaded.
+ */
+void SimpleSetup::LoadModels(const std::vector<std::string>& files,
+                             std::vector<IModelResourcePtr>& models) {
+    InitPlugins();
+    std::vector<CachedOBJResourcePtr> cached;
+    unsigned int first = models.size();
+    for (std::vector<std::string>::const_iterator itr = files.begin();
+         itr != files.end(); ++itr) {
+        IModelResourcePtr model;
+        try {
+            model = ResourceManager<IModelResource>::Create(FindFile(*itr));
+        } catch (Exception& e) {
+            logger.warning << "SimpleSetup: " << e.what() << logger.end;
+        }
+        CachedOBJResourcePtr c =
+            boost::dynamic_pointer_cast<CachedOBJResource>(model);
+        if (c) cached.push_back(c);
+        models.push_back(model);
+    }
+    CachedOBJResource::PrepareAll(cached, GetScheduler());
+    for (unsigned int i = first; i < models.size(); ++i) {
+        if (!models[i]) continue;
+        try {
+            models[i]->Load();
+        } catch (Exception& e) {
+            logger.warning << "SimpleSetup: " << e.what() << logger.end;
+            models[i].reset();
+        }
+    }
+}
+
+/**
+ * Load a model and add it under a parent node.
+ * With hot reloading enabled the node of the model is replaced when
+ * its file changes.
+ *
+ * @param file Model file to load.
+ * @param parent Node to add the model to.
+ * @return Scene node of the model, NULL if it could not be loaded.
+ */
+ISceneNode* SimpleSetup::LoadModel(string file, ISceneNode& parent) {
+    InitPlugins();
+    IModelResourcePtr model;
+    try {
+        model = ResourceManager<IModelResource>::Create(FindFile(file));
+        model->Load();
+    } catch (Exception& e) {
+        logger.warning << "SimpleSetup: " << e.what() << logger.end;
+        return NULL;
+    }
+    ISceneNode* node = model->GetSceneNode();
+    if (node != NULL) parent.AddNode(node);
+    if (hotreloader != NULL)
+        hotreloader->AddModel(FindFile(file), model, parent, node);
+    return node;
+}
+
+/**
+ * Reload textures, models and shaders when their files change in the
+ * data directories, for content iteration without restarting.
+ *
+ * The directories are watched through inotify where available, and
+ * the changes are applied on the render thread before the frame.
+ * Textures are reloaded from file and updated in place through the
+ * upload ring, or by the texture loader if their size changed. Models
+ * loaded with LoadModel() have their node replaced under its parent,
+ * and the culling structure of the parent is rebuilt. A changed
+ * shader source reloads the shaders of the scene through the shader
+ * loader. The rest of the scene is left alone.
+ */
+void SimpleSetup::EnableHotReload() {
+    InitRenderer();
+    if (hotreloader != NULL) return;
+    hotreloader = new HotReloader(*this, textureloader, asyncloader,
+                                  streamer, shaderloader, clusteredlights,
+                                  threadedengine != NULL
+                                  ? &threadedengine->GetStructureLock()
+                                  : NULL);
+    const std::vector<string>& dirs = GetManifest().GetDirectories();
+    for (unsigned int i = 0; i < dirs.size(); ++i)
+        hotreloader->AddDirectory(dirs[i]);
+    Attach(renderer->PreProcessEvent(),
+           *arena->New<ProfiledListener<RenderingEventArg> >(*profiler, "preprocess.hotreload", *hotreloader));
+}
+
+/**
+ * Get the task scheduler.
+ * The scheduler is shared by the setup's own background work, such
+ * as texture decoding, model preparation and culling structure
+ * builds, and may be used by the application as well.
+ *
+ * @return Task scheduler.
+ */
+TaskScheduler& SimpleSetup::GetScheduler() {
+    if (scheduler == NULL)
+        scheduler = new TaskScheduler(config.workers);
+    return *scheduler;
+}
+
+/**
+ * Get the process graph.
+ * Modules added to the graph instead of the engine process event run
+ * in parallel on the task scheduler, respecting the declared
+ * dependencies. The graph itself is attached to the engine process
+ * event the first time it is requested.
+ *
+ * @return Process graph.
+ */
+ProcessGraph& SimpleSetup::GetProcessGraph() {
+    if (processgraph == NULL) {
+        processgraph = new ProcessGraph(GetScheduler());
+        Attach(engine->ProcessEvent(), *processgraph);
+    }
+    return *processgraph;
+}
+
+/**
+ * Get the shader program cache.
+ * Programs built through the cache are stored as driver binaries in
+ * the shader cache directory of the configuration and compiled in the
+ * background where the driver supports it. The cache must be used
+ * with the GL context current, that is from the renderer events.
+ *
+ * @return The program cache of the setup.
+ */
+Renderers::OpenGL::ProgramCache& SimpleSetup::GetProgramCache() {
+    if (programcache == NULL)
+        programcache = new Renderers::OpenGL::ProgramCache(config.shadercache);
+    return *programcache;
+}
+
+/**
+ * Get the frame arena.
+ * Memory allocated in the arena, and objects created in it with
+ * Arena::New(), last for the current frame only: the arena is reset
+ * at the start of every frame event, before any other frame
+ * listener runs. Use it for transient per-frame data such as render
+ * lists built by a rendering view or a HUD surface, which then costs
+ * no heap allocations once the arena has grown to the size of a
+ * frame. The arena is not thread safe and belongs to the thread
+ * running the frame event.
+ *
+ * @return The frame arena of the setup.
+ */
+Arena& SimpleSetup::GetFrameArena() {
+    return *framearena;
+}
+
+/**
+ * Get the upload ring.
+ * The ring is a buffer split into a region per frame in flight, that
+ * dynamic data is written into without waiting for the GPU. Vertex
+ * data written with UploadRing::Write() or UploadRing::Allocate() is
+ * rendered by binding UploadRing::GetBuffer() with the returned
+ * offset, and is valid for the current frame only. The HUD atlas
+ * uploads the changed pixels of its surfaces through the ring.
+ * The ring must be used with the GL context current, that is from
+ * the renderer events.
+ *
+ * @return The upload ring of the setup.
+ */
+UploadRing& SimpleSetup::GetUploadRing() {
+    InitRenderer();
+    if (uploadring == NULL) {
+        uploadring = new UploadRing();
+        Attach(renderer->PreProcessEvent(),
+               *arena->New<ProfiledListener<RenderingEventArg> >(*profiler, "preprocess.upload", *uploadring));
+    }
+    return *uploadring;
 }
 
 HUD& SimpleSetup::GetHUD() {
+    InitRenderer();
     if (hud == NULL){
         // setup hud
         hud = new HUD();
-        renderer->PostProcessEvent().Attach(*hud);
+        Attach(renderer->PostProcessEvent(),
+               *arena->New<ProfiledListener<RenderingEventArg> >(*profiler, "postprocess.hud", *hud));
     }
     return *hud;
 }
 
+/**
+ * Get the HUD atlas.
+ * The FPS, profiler and streaming surfaces of the setup are packed
+ * into the atlas and drawn in one call, uploading only the parts of
+ * them that changed. Add other surfaces that redraw often to the
+ * atlas instead of the HUD.
+ *
+ * @return The HUD atlas of the setup.
+ */
+HUDAtlas& SimpleSetup::GetHUDAtlas() {
+    InitRenderer();
+    if (hudatlas == NULL) {
+        hudatlas = new HUDAtlas();
+        hudatlas->SetUploadRing(&GetUploadRing());
+        Attach(renderer->PostProcessEvent(),
+               *arena->New<ProfiledListener<RenderingEventArg> >(*profiler, "postprocess.hudatlas", *hudatlas));
+    }
+    return *hudatlas;
+}
+
 ILogger* SimpleSetup::GetLogger() const {
     return stdlog;
 }
@@ -364,42 +1985,128 @@ ILogger* SimpleSetup::GetLogger() const {
  * Enable various run-time debugging features.
  * This includes
  * - visualization of the frustum,
- * - export the scene to a dot-graph file (scene.dot)
+ * - export the scene with render statistics (scene.dot and
+ *   scene.json) after the first frame and when F12 is pressed
  * - add FPS to the HUD
+ * - enable the frame profiler and add its statistics to the HUD
  */
 void SimpleSetup::EnableDebugging() {
+    InitRenderer();
+
     // Visualization of the frustum
     frustum->VisualizeClipping(true);
     scene->AddNode(frustum->GetFrustumNode());
+    debugging = true;
 
-    // @todo: this should be on initialize
-    // Output a dot-graph of the scene
-    ofstream dotfile("scene.dot", ofstream::out);
-    if (!dotfile.good()) {
-        logger.error << "Can not open 'scene.dot' for output"
-                     << logger.end;
-    } else {
-        ASDotVisitor dot;
-        dot.Write(*scene, &dotfile);
-        logger.info << "Saved physics graph to 'scene.dot'"
-                    << logger.end
-                    << "To create a SVG image run: "
-                    << "dot -Tsvg scene.dot > scene.svg"
-                    << logger.end;
-    }
+    // Export the scene as rendered in the first frame, and again
+    // whenever F12 is pressed
+    ExportScene("scene");
+    Attach(keyboard->KeyEvent(), *arena->New<ExportHandler>(GetExporter()));
 
     ShowFPS();
+
+    GetProfiler().Enable(true);
+    ShowProfiler();
 }
     
+/**
+ * Export the scene as rendered in the next frame.
+ * The frame records whether each node was culled and the triangles
+ * and time it took to draw, and the rendered scene is written with
+ * these statistics on the task scheduler as a dot graph and as JSON,
+ * so rendering is not held up. See SceneExporter.
+ *
+ * @param base Base name of the files, extended by .dot and .json.
+ */
+void SimpleSetup::ExportScene(std::string base) {
+    GetExporter().Request(base);
+}
+
+// The scene exporter, created on first use.
+SceneExporter& SimpleSetup::GetExporter() {
+    InitRenderer();
+    if (exporter == NULL) {
+        exporter = new SceneExporter(GetScheduler());
+        if (extview != NULL) extview->SetExporter(exporter);
+        Attach(renderer->PostProcessEvent(), *exporter);
+    }
+    return *exporter;
+}
+
 void SimpleSetup::ShowFPS() {
     // Setup fps counter
-    FPSSurfacePtr fps = FPSSurface::Create();
-    GetTextureLoader().Load(fps, TextureLoader::RELOAD_QUEUED);
-    engine->ProcessEvent().Attach(*fps);
-    HUD::Surface* fpshud = GetHUD().CreateSurface(fps);
-    fpshud->SetPosition(HUD::Surface::LEFT, HUD::Surface::TOP);
-        
-        
+    if (fpssurface) return;
+    fpssurface = FPSSurface::Create();
+    Attach(FrameEvent(), *fpssurface);
+    GetHUDAtlas().Add(fpssurface, HUDAtlas::LEFT, HUDAtlas::TOP);
+}
+
+/**
+ * Get the frame profiler.
+ * The profiler times the phases set up by SimpleSetup: the full
+ * frame, the engine process of the environment, the renderer
+ * pre-process listeners (light and texture loading), the rendering
+ * view (both on the CPU and the GPU) and the HUD post-process.
+ * The profiler is disabled by default.
+ *
+ * @code
+ * setup.GetProfiler().Enable(true);
+ * ...
+ * setup.GetProfiler().Dump("profile.csv");
+ * @endcode
+ */
+FrameProfiler& SimpleSetup::GetProfiler() {
+    return *profiler;
+}
+
+/**
+ * Show the frame profiler statistics on the HUD.
+ * This does not enable the profiler.
+ */
+void SimpleSetup::ShowProfiler() {
+    if (profilersurface != NULL) return;
+    profilersurface = new ProfilerSurface(*profiler);
+    Attach(FrameEvent(), *profilersurface);
+    GetHUDAtlas().Add(profilersurface->GetTexture(),
+                      HUDAtlas::RIGHT, HUDAtlas::TOP);
+}
+/**
+ * Get the runtime metrics of the setup.
+ * Once created the frame times, draw calls, culled nodes, texture
+ * loads and resident streamed memory are sampled each frame, and the
+ * application may define metrics of its own, writing them through a
+ * block per thread. See Metrics.
+ */
+Metrics& SimpleSetup::GetMetrics() {
+    if (metrics == NULL) {
+        metrics = new Metrics();
+        Attach(FrameEvent(),
+               *arena->New<MetricsSampler>(*metrics, extview, asyncloader, streamer));
+    }
+    return *metrics;
+}
+
+/**
+ * Serve the metrics over HTTP in the Prometheus text format.
+ * The requests are answered on an export thread, so scraping does
+ * not hold up the frame.
+ *
+ * @param port TCP port to listen on.
+ * @return False if the port could not be opened.
+ */
+bool SimpleSetup::EnableMetrics(unsigned short port) {
+    return GetMetrics().Serve(port);
+}
+
+/**
+ * Push the metrics to a StatsD server over UDP once a second.
+ *
+ * @param host Name or address of the server.
+ * @param port UDP port of the server.
+ * @return False if the host could not be resolved.
+ */
+bool SimpleSetup::SendMetrics(std::string host, unsigned short port) {
+    return GetMetrics().SendTo(host, port);
 }
     
 } // NS Utils
@@ -23,6 +23,8 @@
 #include <Renderers/IRenderingView.h>
 #include <Scene/ISceneNode.h>
 #include <Resources/IModelResource.h>
+#include <Resources/ITexture2D.h>
+#include <boost/shared_ptr.hpp>
 #include <Display/HUD.h>
 
 // include all the classes that depend on serialization
@@ -31,11 +33,16 @@
 
 // other std c++ includes
 #include <string>
+#include <vector>
 
 // forward declarations
 namespace OpenEngine {
     namespace Core {
+        class Arena;
         class Engine;
+        class ThreadedEngine;
+        class TaskScheduler;
+        class ProcessGraph;
     }
     namespace Display {
         class IEnvironment;
@@ -44,24 +51,41 @@ namespace OpenEngine {
         class IViewingVolume;
         class Frustum;
         class HUD;
+        class HUDAtlas;
     }
     namespace Devices {
         class IMouse;
         class IKeyboard;
         class IJoystick;
+        class InputQueue;
     }
     namespace Scene {
         class SceneNode;
+        class IncrementalQuadBuilder;
+        class TransformSnapshot;
+        class SceneExporter;
     }
     namespace Renderers {
         class TextureLoader;
+        class AsyncTextureLoader;
         namespace OpenGL {
             class Renderer;
             class RenderingView;
             class LightRenderer;
             class ShaderLoader;
+            class CompressedTextureCache;
+            class ClusteredLightRenderer;
+            class ProgramCache;
+            class ResourceStreamer;
+            class OcclusionCuller;
+            class UploadRing;
+            class DynamicResolution;
+            class MultiView;
         }
     }
+    namespace Resources {
+        class ResourceManifest;
+    }
     namespace Logging {
         class ILogger;
     }
@@ -70,6 +94,15 @@ namespace OpenEngine {
 namespace OpenEngine {
 namespace Utils {
 
+class FrameProfiler;
+class FPSSurface;
+class ProfilerSurface;
+class StreamingSurface;
+class FrameLimiter;
+class Metrics;
+class ExtRenderingView;
+class HotReloader;
+
 /**
  * The purpose of simple setup is to provide a fairly basic setup of
  * an OpenEngine graphics engine.
@@ -101,11 +134,59 @@ namespace Utils {
 class SimpleSetup {
 public:
 
+    /**
+     * Setup configuration.
+     * The components left NULL are created by the setup. A lazy
+     * setup only creates subsystems when they are first used. An
+     * offscreen setup renders into an OffscreenEnvironment instead
+     * of opening a window, both of the given width and height. With
+     * the model cache OBJ files are loaded through the
+     * CachedOBJResource. With texture compression image textures are
+     * transcoded to DXT through a CompressedTextureCache. A threaded
+     * setup runs the engine process event on a fixed time step
+     * simulation thread and renders on the thread starting the
+     * engine, see Core::ThreadedEngine. Input events are still
+     * delivered on the render thread. The task scheduler is created
+     * with the given number of workers, zero for one per processor.
+     * Shader program binaries are cached in the shader cache
+     * directory, no binaries are stored when it is empty. With
+     * asynchronous logging the log is written on a background thread
+     * by an AsyncLogger, also to the log file when one is given,
+     * rotated at the log file size, and limited to the log limit of
+     * lines per second unless it is zero.
+     */
+    struct Config {
+        Display::IEnvironment* env;
+        Renderers::IRenderingView* rv;
+        Core::IEngine* engine;
+        Renderers::IRenderer* renderer;
+        bool lazy;
+        bool offscreen;
+        unsigned int width, height;
+        bool modelcache;
+        bool texturecompression;
+        bool threaded;
+        unsigned int workers;
+        std::string shadercache;
+        bool asynclogging;
+        std::string logfile;
+        unsigned long logfilesize;
+        unsigned int loglimit;
+        Config()
+            : env(NULL), rv(NULL), engine(NULL), renderer(NULL)
+            , lazy(false), offscreen(false), width(1024), height(768)
+            , modelcache(false), texturecompression(false)
+            , threaded(false), workers(0)
+            , asynclogging(false), logfilesize(10ul << 20), loglimit(0) {}
+    };
+
     SimpleSetup(std::string title, 
                 Display::IEnvironment* env=NULL, 
                 Renderers::IRenderingView* rv=NULL,
                 Core::IEngine* eng=NULL,
                 Renderers::IRenderer* rend=NULL);
+    SimpleSetup(std::string title, const Config& config);
+    virtual ~SimpleSetup();
 
     Core::IEngine& GetEngine() const;
     Display::IFrame& GetFrame() const;
@@ -115,27 +196,85 @@ public:
     Devices::IMouse&    GetMouse() const;
     Devices::IKeyboard& GetKeyboard() const;
     Devices::IJoystick& GetJoystick() const;
+    Devices::InputQueue& GetInputQueue();
 
     Display::HUD& GetHUD();
+    Display::HUDAtlas& GetHUDAtlas();
 
     Logging::ILogger* GetLogger() const;
 
     Scene::ISceneNode* GetScene() const;
     void SetScene(Scene::ISceneNode& scene);
+    bool SaveScene(std::string file);
+    Scene::ISceneNode* LoadScene(std::string file);
 
     Display::Camera* GetCamera() const;
     void SetCamera(Display::Camera& volume);
     void SetCamera(Display::IViewingVolume& volume);
 
+    Display::Camera* AddView(float x, float y, float width, float height);
+    void AddView(Display::IViewingVolume& volume,
+                 float x, float y, float width, float height);
+    void SetMainViewport(float x, float y, float width, float height);
+    void EnableStereo(float separation = 0.065f);
+    void ClearViews();
+
+    void EnableFrustumCulling(unsigned int maxFaces = 500,
+                              float maxSize = 100.0f);
+    void MarkSceneDirty(Scene::ISceneNode& node);
+    void EnableBatching(bool enable = true);
+    void EnableInstancing(bool enable = true);
+    unsigned int GetCulledCount() const;
+    void EnableOcclusionCulling(bool enable = true);
+    unsigned int GetOccludedCount() const;
+    void EnableLOD(float threshold = 1.0f, float hysteresis = 0.25f);
+    Scene::ISceneNode* CreateLOD(Scene::ISceneNode* node,
+                                 unsigned int levels = 4);
+    void EnableClusteredLighting();
+    void EnableDynamicResolution(float budget = 14.0f, float minScale = 0.5f);
+    float GetResolutionScale() const;
+    void SetFrameLimit(unsigned int fps);
 
     Renderers::TextureLoader& GetTextureLoader();
+    void EnableAsyncTextureLoading(unsigned int workers = 0,
+                                   unsigned int budget = 4000);
+
+    void EnableStreaming(unsigned long textureBudget = 256ul << 20,
+                         unsigned long modelBudget = 512ul << 20);
+    Renderers::OpenGL::ResourceStreamer& GetStreamer();
+    void ShowStreaming();
 
     void AddDataDirectory(std::string dir);
+    Resources::ResourceManifest& GetManifest();
+    void BuildManifest(std::string cache = "");
+    std::string FindFile(std::string file);
+    void Prefetch(const std::vector<std::string>& files, bool wait = true);
+
+    void LoadModels(const std::vector<std::string>& files,
+                    std::vector<Resources::IModelResourcePtr>& models);
+    Scene::ISceneNode* LoadModel(std::string file, Scene::ISceneNode& parent);
+    void EnableHotReload();
+
+    Core::TaskScheduler& GetScheduler();
+    Core::ProcessGraph& GetProcessGraph();
+
+    Renderers::OpenGL::ProgramCache& GetProgramCache();
+    Renderers::OpenGL::UploadRing& GetUploadRing();
+
+    Core::Arena& GetFrameArena();
 
     void EnableDebugging();
+    void ExportScene(std::string base = "scene");
     
     void ShowFPS();
 
+    FrameProfiler& GetProfiler();
+    void ShowProfiler();
+
+    Metrics& GetMetrics();
+    bool EnableMetrics(unsigned short port = 9100);
+    bool SendMetrics(std::string host, unsigned short port = 8125);
+
     // What about:
     // - HUD.
     // - Sound.
@@ -151,8 +290,40 @@ public:
     // structure?
 
 private:
+    void Init();
+    void InitEnvironment();
+    void InitPlugins();
+    void InitScene();
+    void InitRenderer();
+    void ApplyScene();
+    Renderers::OpenGL::MultiView& GetViews();
+    Scene::SceneExporter& GetExporter();
+    Core::IEvent<Core::ProcessEventArg>& FrameEvent();
+
+    // a listener attached by the setup, detached on destruction
+    struct Binding {
+        void* event;
+        void* listener;
+        void (*detach)(void* event, void* listener);
+    };
+    template <class E, class L> void Attach(E& event, L& listener);
+    template <class E, class L> void Detach(E& event, L& listener);
+
     std::string title;
+    Config config;
+    bool plugins;
+    bool userscene;
+    // the shaders of the scene are loaded before the next frame
+    bool shaderspending;
+    bool debugging;
+    Core::Arena* arena;
+    Core::Arena* framearena;
+    std::vector<Binding> bindings;
     Core::IEngine* engine;
+    Core::ThreadedEngine* threadedengine;
+    Scene::TransformSnapshot* snapshot;
+    Core::TaskScheduler* scheduler;
+    Core::ProcessGraph* processgraph;
     Display::IEnvironment* env;
     Display::IFrame* frame;
     Display::IRenderCanvas* canvas;
@@ -161,15 +332,42 @@ private:
     Devices::IMouse* mouse;
     Devices::IKeyboard* keyboard;
     Devices::IJoystick* joystick;
+    Devices::InputQueue* inputqueue;
     Scene::ISceneNode* scene;
+    Scene::ISceneNode* defaultscene;
     Display::Camera* camera;
+    Display::Camera* defaultcamera;
     Display::Frustum* frustum;
     Renderers::IRenderingView* renderingview;
+    ExtRenderingView* extview;
     Renderers::OpenGL::LightRenderer* lightrenderer;
     Renderers::OpenGL::ShaderLoader* shaderloader;
+    Renderers::OpenGL::ProgramCache* programcache;
+    Renderers::OpenGL::ClusteredLightRenderer* clusteredlights;
+    Core::IListener<Renderers::RenderingEventArg>* lightlistener;
     Renderers::TextureLoader* textureloader;
+    Renderers::AsyncTextureLoader* asyncloader;
+    // owned by the compressed texture plug-in
+    Renderers::OpenGL::CompressedTextureCache* texturecache;
+    Renderers::OpenGL::ResourceStreamer* streamer;
+    Renderers::OpenGL::OcclusionCuller* occlusionculler;
+    Renderers::OpenGL::UploadRing* uploadring;
     Display::HUD* hud;
+    Display::HUDAtlas* hudatlas;
+    Renderers::OpenGL::DynamicResolution* dynres;
+    Renderers::OpenGL::MultiView* multiview;
+    Scene::SceneExporter* exporter;
+    Resources::ResourceManifest* manifest;
+    HotReloader* hotreloader;
+    Scene::IncrementalQuadBuilder* quadbuilder;
     Logging::ILogger* stdlog;
+    FrameProfiler* profiler;
+    FrameLimiter* limiter;
+    Metrics* metrics;
+    // held here, the HUD atlas only keeps weak references
+    boost::shared_ptr<FPSSurface> fpssurface;
+    ProfilerSurface* profilersurface;
+    StreamingSurface* streamingsurface;
 };
 
 } // NS Utils
@@ -0,0 +1,43 @@
+// HUD surface showing resource streaming statistics.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Utils/StreamingSurface.h>
+#include <Renderers/OpenGL/ResourceStreamer.h>
+
+#include <cstdio>
+
+namespace OpenEngine {
+namespace Utils {
+
+using Renderers::OpenGL::ResourceStreamer;
+
+StreamingSurface::StreamingSurface(ResourceStreamer& streamer,
+                                   unsigned int width,
+                                   unsigned int height)
+    : TextSurface(width, height)
+    , streamer(streamer) {
+    Redraw();
+}
+
+void StreamingSurface::DrawLines() {
+    ResourceStreamer::Stats st = streamer.GetStats();
+    char line[128];
+    sprintf(line, "textures %5u %8.1f MB", st.textures,
+            st.textureBytes / 1048576.0);
+    AddLine(line);
+    sprintf(line, "models   %5u %8.1f MB", st.models,
+            st.modelBytes / 1048576.0);
+    AddLine(line);
+    sprintf(line, "hits %u misses %u evictions %u",
+            st.hits, st.misses, st.evictions);
+    AddLine(line);
+}
+
+} // NS Utils
+} // NS OpenEngine
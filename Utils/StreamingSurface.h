@@ -0,0 +1,45 @@
+// HUD surface showing resource streaming statistics.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OE_STREAMING_SURFACE_H_
+#define _OE_STREAMING_SURFACE_H_
+
+#include <Utils/TextSurface.h>
+
+namespace OpenEngine {
+    namespace Renderers {
+        namespace OpenGL {
+            class ResourceStreamer;
+        }
+    }
+namespace Utils {
+
+/**
+ * HUD surface showing the resident bytes, hits, misses and
+ * evictions of a resource streamer.
+ * Attach the surface to the engine process event, it redraws itself
+ * twice a second.
+ */
+class StreamingSurface : public TextSurface {
+public:
+    StreamingSurface(Renderers::OpenGL::ResourceStreamer& streamer,
+                     unsigned int width = 256,
+                     unsigned int height = 64);
+
+protected:
+    void DrawLines();
+
+private:
+    Renderers::OpenGL::ResourceStreamer& streamer;
+};
+
+} // NS Utils
+} // NS OpenEngine
+
+#endif // _OE_STREAMING_SURFACE_H_
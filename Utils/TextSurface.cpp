@@ -0,0 +1,78 @@
+// HUD surface showing lines of monospaced text.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Utils/TextSurface.h>
+
+namespace OpenEngine {
+namespace Utils {
+
+using namespace Resources;
+
+TextSurface::TextSurface(unsigned int width, unsigned int height)
+    : surface(CairoResource::Create(width, height))
+    , y(0.0) {
+    surface->Load();
+    timer.Start();
+}
+
+TextSurface::~TextSurface() {}
+
+/**
+ * Get the texture to place on the HUD.
+ * Add it to a HUDAtlas, every redraw signals the changed event of the
+ * texture and the atlas uploads the changed tiles on its next draw.
+ */
+ITexture2DPtr TextSurface::GetTexture() {
+    return surface;
+}
+
+void TextSurface::Handle(Core::ProcessEventArg arg) {
+    if (timer.GetElapsedTime().AsInt() < 500000) return;
+    timer.Reset();
+    timer.Start();
+    Redraw();
+}
+
+/**
+ * Add a line below the previous one. Only valid from DrawLines().
+ *
+ * @param line Text of the line.
+ */
+void TextSurface::AddLine(const std::string& line) {
+    cairo_t* cr = surface->GetContext();
+    cairo_move_to(cr, 4.0, y);
+    cairo_show_text(cr, line.c_str());
+    y += 13.0;
+}
+
+/**
+ * Clear the surface and draw the lines of the sub class.
+ */
+void TextSurface::Redraw() {
+    cairo_t* cr = surface->GetContext();
+
+    // clear to a translucent background
+    cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+    cairo_set_source_rgba(cr, 0.0, 0.0, 0.0, 0.5);
+    cairo_paint(cr);
+    cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+
+    cairo_select_font_face(cr, "monospace",
+                           CAIRO_FONT_SLANT_NORMAL,
+                           CAIRO_FONT_WEIGHT_NORMAL);
+    cairo_set_font_size(cr, 11.0);
+    cairo_set_source_rgba(cr, 1.0, 1.0, 1.0, 1.0);
+
+    y = 14.0;
+    DrawLines();
+    surface->RebindTexture();
+}
+
+} // NS Utils
+} // NS OpenEngine
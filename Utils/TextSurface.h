@@ -0,0 +1,56 @@
+// HUD surface showing lines of monospaced text.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OE_TEXT_SURFACE_H_
+#define _OE_TEXT_SURFACE_H_
+
+#include <Core/IListener.h>
+#include <Core/IEngine.h>
+#include <Resources/CairoResource.h>
+#include <Utils/Timer.h>
+
+#include <string>
+
+namespace OpenEngine {
+namespace Utils {
+
+/**
+ * HUD surface drawing lines of monospaced text on a translucent
+ * background. Sub classes write their lines with AddLine() from
+ * DrawLines(), and call Redraw() once constructed.
+ * Attach the surface to the engine process event, it redraws itself
+ * twice a second.
+ */
+class TextSurface
+    : public Core::IListener<Core::ProcessEventArg> {
+public:
+    TextSurface(unsigned int width, unsigned int height);
+    virtual ~TextSurface();
+
+    Resources::ITexture2DPtr GetTexture();
+
+    void Handle(Core::ProcessEventArg arg);
+
+protected:
+    virtual void DrawLines() = 0;
+
+    void AddLine(const std::string& line);
+    void Redraw();
+
+private:
+    Resources::CairoResourcePtr surface;
+    Timer timer;
+    // baseline of the next line while redrawing
+    double y;
+};
+
+} // NS Utils
+} // NS OpenEngine
+
+#endif // _OE_TEXT_SURFACE_H_